@@ -33,7 +33,7 @@ create_test_sourcelist(Tests
 					   ${test_names})
 					   
 add_executable(UnitTests UnitTests.cpp ${cpp_tests} ${test_scripts})
-target_link_libraries(UnitTests lua_interface selene_core)
+target_link_libraries(UnitTests fdfd lua_interface selene_core)
 target_link_libraries(UnitTests ${LUA_LIBRARIES})
 
 foreach(test ${test_names})
@@ -28,4 +28,12 @@ for i=1,10 do
 	ml:superstrate(const_material(1.0))
 	ml:output(output)
 	ml:add_layer(hn,"mat_lib/Al_Rakic.lua")
-end
\ No newline at end of file
+end
+
+ml=MODE("multilayer_tmm")
+ml:compute_map(0,80,81)
+ml:spectrum(400e-9,1000e-9,601)
+ml:substrate(const_material(1.5))
+ml:superstrate(const_material(1.0))
+ml:output("ml_map")
+ml:add_layer(50e-9,"mat_lib/Au_400n_1000n_Vial.lua")
\ No newline at end of file
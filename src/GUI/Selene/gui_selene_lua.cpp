@@ -797,6 +797,8 @@ void SeleneFrame::save_project(wxFileName const &fname_)
                 if(object->sens_ray_obj_intersection) file<<",\"obj_intersection\"";
                 if(object->sens_ray_obj_direction) file<<",\"obj_direction\"";
                 if(object->sens_ray_obj_face) file<<",\"obj_face\"";
+                if(object->sens_ascii) file<<",\"ascii\"";
+                if(object->sens_reduce) file<<",\"reduce\"";
                 
                 file<<")\n";
             }
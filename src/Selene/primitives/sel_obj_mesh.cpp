@@ -27,7 +27,7 @@ namespace Sel::Primitives
                std::vector<Sel::SelFace> &F_arr_,
                std::vector<std::string> &face_name_arr_)
         :Primitive(bbox_, F_arr_, face_name_arr_),
-         scaled_mesh(false), scaling_factor(1.0), has_octree(false)
+         scaled_mesh(false), scaling_factor(1.0), has_bvh(false)
     {
     }
     
@@ -77,7 +77,7 @@ namespace Sel::Primitives
             
             int N_inter_1=0;
             
-            if(!has_octree)
+            if(!has_bvh)
             {
                 N_inter_1=ray_N_inter(V_arr,F_arr,i,O, V);
                 //            int N_inter_2=ray_N_inter(V_arr,F_arr,i,O,-V);
@@ -85,18 +85,19 @@ namespace Sel::Primitives
             else
             {
                 SelRay ray;
-                std::list<int> flist;
                 
                 ray.set_dir(V);
                 ray.set_start(O);
                 
-                octree.ray_check(ray,flist);
-                N_inter_1=ray_N_inter_list(V_arr,F_arr,flist,i,O,V);
+                double t_max=std::numeric_limits<double>::infinity();
                 
-                if(N_inter_1==2)
+                face_bvh.traverse(ray,t_max,[&](int k,double &t_max_)
                 {
+                    double t,u,v;
                     
-                }
+                    if(k!=static_cast<int>(i) && ray_inter_face(V_arr,F_arr[k],O,V,t,u,v) && t>=0)
+                        N_inter_1++;
+                });
             }
             
             if(N_inter_1%2!=0) F_arr[i].norm=-F_arr[i].norm;
@@ -148,13 +149,39 @@ namespace Sel::Primitives
         bbox.ym-=0.05*spany; bbox.yp+=0.05*spany;
         bbox.zm-=0.05*spanz; bbox.zp+=0.05*spanz;
         
+        has_bvh=false;
+        face_bvh.clear();
+        
         if(NFc>12)
         {
-            has_octree=true;
-            octree.clear_tree();
-            octree.set_params(8,bbox.xm,bbox.xp,bbox.ym,bbox.yp,bbox.zm,bbox.zp);
-            octree.generate_tree(V_arr,F_arr);
+            std::vector<BoundingBox> face_boxes(NFc);
+            
+            for(int i=0;i<NFc;i++)
+            {
+                Vector3 const &A=V_arr[F_arr[i].V1].loc;
+                Vector3 const &B=V_arr[F_arr[i].V2].loc;
+                Vector3 const &C=V_arr[F_arr[i].V3].loc;
+                
+                BoundingBox &box=face_boxes[i];
+                
+                box.xm=std::min({A.x,B.x,C.x}); box.xp=std::max({A.x,B.x,C.x});
+                box.ym=std::min({A.y,B.y,C.y}); box.yp=std::max({A.y,B.y,C.y});
+                box.zm=std::min({A.z,B.z,C.z}); box.zp=std::max({A.z,B.z,C.z});
+                
+                // Flat faces get a thickness so that the slab tests stay robust
+                
+                double pad=1e-9*std::max({box.span_x(),box.span_y(),box.span_z()});
+                
+                box.xm-=pad; box.xp+=pad;
+                box.ym-=pad; box.yp+=pad;
+                box.zm-=pad; box.zp+=pad;
+            }
+            
+            has_bvh=true;
+            face_bvh.build(face_boxes,4);
         }
+        
+        build_face_packs();
     }
     
     
@@ -242,7 +269,7 @@ namespace Sel::Primitives
             int face_hit=-1;
             double t_intersec,u,v;
             
-            if(!has_octree)
+            if(!has_bvh)
             {
                 ray_inter(V_arr,F_arr,face_last_intersect,
                           ray.start,ray.dir,
@@ -250,10 +277,34 @@ namespace Sel::Primitives
             }
             else
             {
-                octree.ray_check(ray,octree_buffer);
-                ray_inter_vector(V_arr,F_arr,octree_buffer,face_last_intersect,
-                                 ray.start,ray.dir,
-                                 face_hit,t_intersec,u,v);
+                // Closest hit, the traversal stops at the nodes beyond it
+                
+                t_intersec=1e100;
+                
+                face_bvh.traverse_leaves(ray,t_intersec,[&](int n,double &t_max)
+                {
+                    double t[4],u_[4],v_[4];
+                    
+                    for(int p=node_packs[n];p<node_packs[n+1];p++)
+                    {
+                        FacePack const &pack=face_packs[p];
+                        
+                        face_pack_intersect(pack,ray.start,ray.dir,face_last_intersect,t,u_,v_);
+                        
+                        for(int l=0;l<4;l++)
+                        {
+                            int k=pack.face[l];
+                            
+                            if(t[l]<t_max || (t[l]==t_max && k<face_hit))
+                            {
+                                face_hit=k;
+                                t_max=t[l];
+                                u=u_[l];
+                                v=v_[l];
+                            }
+                        }
+                    }
+                });
             }
             
             if(face_hit>-1)
@@ -275,18 +326,35 @@ namespace Sel::Primitives
         }
         else
         {
+            // Scratch buffer per thread as meshes are shared between the render workers
+            
+            thread_local std::vector<RayFaceIntersect> face_intersect_buffer;
+            
             face_intersect_buffer.clear();
             
-            if(!has_octree)
+            if(!has_bvh)
             {
                 ray_inter(V_arr,F_arr,face_last_intersect,
                           ray.start,ray.dir,face_intersect_buffer);
             }
             else
             {
-                octree.ray_check(ray,octree_buffer);
-                ray_inter_vector(V_arr,F_arr,octree_buffer,face_last_intersect,
-                                 ray.start,ray.dir,face_intersect_buffer);
+                double t_max=std::numeric_limits<double>::infinity();
+                
+                face_bvh.traverse_leaves(ray,t_max,[&](int n,double &t_max_)
+                {
+                    double t[4],u[4],v[4];
+                    
+                    for(int p=node_packs[n];p<node_packs[n+1];p++)
+                    {
+                        FacePack const &pack=face_packs[p];
+                        
+                        face_pack_intersect(pack,ray.start,ray.dir,face_last_intersect,t,u,v);
+                        
+                        for(int l=0;l<4;l++) if(t[l]<t_max_)
+                            face_intersect_buffer.push_back(RayFaceIntersect(pack.face[l],t[l],u[l],v[l]));
+                    }
+                });
             }
             
             for(unsigned int i=0;i<face_intersect_buffer.size();i++)
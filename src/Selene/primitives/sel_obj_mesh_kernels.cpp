@@ -0,0 +1,177 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+#include <selene_primitives.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SEL_MESH_KERNEL_DISPATCH
+    #define SEL_MESH_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+    #define SEL_MESH_KERNEL_INLINE inline
+#endif
+
+namespace Sel::Primitives
+{
+    // Moller-Trumbore test of one ray against the four lanes of a pack.
+    // The operations are the ones of ray_inter_face, in the same order, so
+    // that the packed and scalar paths give bitwise identical results.
+    // Lanes that miss get an infinite t.
+    
+    SEL_MESH_KERNEL_INLINE void face_pack_kernel_body(FacePack const &pack,Vector3 const &O,Vector3 const &D,int face_skip,
+                                                      double *t_out,double *u_out,double *v_out)
+    {
+        for(int l=0;l<4;l++)
+        {
+            double T_x=O.x-pack.v1_x[l];
+            double T_y=O.y-pack.v1_y[l];
+            double T_z=O.z-pack.v1_z[l];
+            
+            double P_x=D.y*pack.e2_z[l]-D.z*pack.e2_y[l];
+            double P_y=D.z*pack.e2_x[l]-D.x*pack.e2_z[l];
+            double P_z=D.x*pack.e2_y[l]-D.y*pack.e2_x[l];
+            
+            double Q_x=T_y*pack.e1_z[l]-T_z*pack.e1_y[l];
+            double Q_y=T_z*pack.e1_x[l]-T_x*pack.e1_z[l];
+            double Q_z=T_x*pack.e1_y[l]-T_y*pack.e1_x[l];
+            
+            double det=P_x*pack.e1_x[l]+P_y*pack.e1_y[l]+P_z*pack.e1_z[l];
+            double invdet=1.0/det;
+            
+            double u=(P_x*T_x+P_y*T_y+P_z*T_z)*invdet;
+            double v=(Q_x*D.x+Q_y*D.y+Q_z*D.z)*invdet;
+            double t=(Q_x*pack.e2_x[l]+Q_y*pack.e2_y[l]+Q_z*pack.e2_z[l])*invdet;
+            
+            bool hit=   u>=0 && u<=1.0 && v>=0 && u+v<=1.0 && t>=0
+                     && pack.face[l]>=0 && pack.face[l]!=face_skip;
+            
+            t_out[l]=hit ? t : std::numeric_limits<double>::infinity();
+            u_out[l]=u;
+            v_out[l]=v;
+        }
+    }
+    
+    void face_pack_kernel_generic(FacePack const &pack,Vector3 const &O,Vector3 const &D,int face_skip,
+                                  double *t,double *u,double *v)
+    {
+        face_pack_kernel_body(pack,O,D,face_skip,t,u,v);
+    }
+    
+    #ifdef SEL_MESH_KERNEL_DISPATCH
+    __attribute__((target("avx2")))
+    void face_pack_kernel_avx2(FacePack const &pack,Vector3 const &O,Vector3 const &D,int face_skip,
+                               double *t,double *u,double *v)
+    {
+        face_pack_kernel_body(pack,O,D,face_skip,t,u,v);
+    }
+    #endif
+    
+    typedef void (*FacePackKernel)(FacePack const&,Vector3 const&,Vector3 const&,int,double*,double*,double*);
+    
+    struct FacePackDispatch
+    {
+        FacePackKernel kernel;
+        std::string isa;
+        
+        FacePackDispatch()
+            :kernel(&face_pack_kernel_generic), isa("generic")
+        {
+            #ifdef SEL_MESH_KERNEL_DISPATCH
+            __builtin_cpu_init();
+            
+            if(__builtin_cpu_supports("avx2"))
+            {
+                kernel=&face_pack_kernel_avx2;
+                isa="avx2";
+            }
+            #endif
+        }
+    };
+    
+    FacePackDispatch const& face_pack_dispatch()
+    {
+        static FacePackDispatch dispatch;
+        
+        return dispatch;
+    }
+    
+    void face_pack_intersect(FacePack const &pack,Vector3 const &O,Vector3 const &D,int face_skip,
+                             double t[4],double u[4],double v[4])
+    {
+        static FacePackKernel const kernel=face_pack_dispatch().kernel;
+        
+        kernel(pack,O,D,face_skip,t,u,v);
+    }
+    
+    std::string face_pack_isa()
+    {
+        return face_pack_dispatch().isa;
+    }
+    
+    //##########
+    //   Mesh
+    //##########
+    
+    void Mesh::build_face_packs()
+    {
+        face_packs.clear();
+        node_packs.clear();
+        
+        if(!has_bvh) return;
+        
+        std::size_t Nnodes=face_bvh.nodes.size();
+        
+        node_packs.resize(Nnodes+1,0);
+        
+        for(std::size_t n=0;n<Nnodes;n++)
+        {
+            BVH::Node const &node=face_bvh.nodes[n];
+            
+            node_packs[n]=face_packs.size();
+            
+            for(int i=0;i<node.count;i+=4)
+            {
+                FacePack pack;
+                
+                for(int l=0;l<4;l++)
+                {
+                    if(i+l<node.count)
+                    {
+                        int k=face_bvh.prim_ID[node.start+i+l];
+                        
+                        Vector3 const &V1=V_arr[F_arr[k].V1].loc;
+                        Vector3 E1=V_arr[F_arr[k].V2].loc-V1;
+                        Vector3 E2=V_arr[F_arr[k].V3].loc-V1;
+                        
+                        pack.v1_x[l]=V1.x; pack.v1_y[l]=V1.y; pack.v1_z[l]=V1.z;
+                        pack.e1_x[l]=E1.x; pack.e1_y[l]=E1.y; pack.e1_z[l]=E1.z;
+                        pack.e2_x[l]=E2.x; pack.e2_y[l]=E2.y; pack.e2_z[l]=E2.z;
+                        pack.face[l]=k;
+                    }
+                    else
+                    {
+                        pack.v1_x[l]=pack.v1_y[l]=pack.v1_z[l]=0;
+                        pack.e1_x[l]=pack.e1_y[l]=pack.e1_z[l]=0;
+                        pack.e2_x[l]=pack.e2_y[l]=pack.e2_z[l]=0;
+                        pack.face[l]=-1;
+                    }
+                }
+                
+                face_packs.push_back(pack);
+            }
+        }
+        
+        node_packs[Nnodes]=face_packs.size();
+    }
+}
@@ -25,6 +25,8 @@ RayCounter::RayCounter()
      computation_type(RC_COUNTING),
      spectral_mode(SP_FULL),
      empty_sensor(false),
+     binary_sensor(false),
+     reduction(nullptr),
      has_lambda(false),
      has_source(false),
      has_path(false),
@@ -36,6 +38,8 @@ RayCounter::RayCounter()
 
 double RayCounter::compute_angular_spread()
 {
+    if(reduction!=nullptr) return reduction->angular_spread();
+    
     double x_avg=0,
            y_avg=0,
            z_avg=0,
@@ -77,12 +81,16 @@ double RayCounter::compute_angular_spread()
 
 double RayCounter::compute_hit_count()
 {
+    if(reduction!=nullptr) return reduction->N_hits;
+    
     return obj_inter.size();
 }
 
 
 double RayCounter::compute_spatial_spread()
 {
+    if(reduction!=nullptr) return reduction->spatial_spread();
+    
     double x_avg=0,
            y_avg=0,
            z_avg=0,
@@ -121,9 +129,16 @@ double RayCounter::compute_spatial_spread()
     return std::sqrt(x_stddev)+std::sqrt(y_stddev)+std::sqrt(z_stddev);
 }
 
+std::vector<std::string> const& RayCounter::get_header() const
+{
+    if(binary_sensor) return sensor_file.get_header();
+    else return loader.header;
+}
+
 void RayCounter::initialize()
 {
-    if(loader.file_ok==false)
+    if(   ( binary_sensor && !sensor_file.is_open())
+       || (!binary_sensor && !loader.file_ok))
     {
         empty_sensor=true;
         return;
@@ -131,7 +146,7 @@ void RayCounter::initialize()
     
     // Power unit
     
-    std::string sensor_values=loader.header[1];
+    std::string sensor_values=get_header()[1];
     
     std::vector<std::string> sv_split;
     split_string(sv_split,sensor_values);
@@ -141,7 +156,7 @@ void RayCounter::initialize()
     
     // Sensor type
     
-    std::string sensor_content_linear=loader.header[2];
+    std::string sensor_content_linear=get_header()[2];
     
     std::vector<std::string> sensor_content;
     split_string(sensor_content,sensor_content_linear);
@@ -237,7 +252,7 @@ void RayCounter::initialize()
     
     // Loading
     
-    int Nl=loader.Nl;
+    int Nl=binary_sensor ? sensor_file.get_N_rows() : loader.Nl;
     
     if(has_lambda) lambda.resize(Nl);
     if(has_source) source.resize(Nl);
@@ -250,11 +265,37 @@ void RayCounter::initialize()
     obj_dir.resize(Nl);
     face.resize(Nl);
     
-    std::vector<double> data;
-    
     lambda_max=0;
     lambda_min=std::numeric_limits<double>::max();
     
+    if(binary_sensor)
+    {
+        if(has_lambda)
+        {
+            sensor_file.read_column("wavelength",lambda);
+            
+            for(int i=0;i<Nl;i++)
+            {
+                lambda_min=std::min(lambda_min,lambda[i]);
+                lambda_max=std::max(lambda_max,lambda[i]);
+            }
+        }
+        
+        if(has_source) sensor_file.read_column("source",source);
+        if(has_path) sensor_file.read_column("path",path);
+        if(has_generation) sensor_file.read_column("generation",generation);
+        if(has_phase) sensor_file.read_column("phase",phase);
+        if(has_polarization) sensor_file.read_column("obj_polarization",obj_polarization);
+        
+        sensor_file.read_column("obj_intersection",obj_inter);
+        sensor_file.read_column("obj_direction",obj_dir);
+        sensor_file.read_column("obj_face",face);
+        
+        return;
+    }
+    
+    std::vector<double> data;
+    
     for(int i=0;i<Nl;i++)
     {
         loader.load_seq(data);
@@ -290,11 +331,52 @@ void RayCounter::set_sensor(Sel::Object *object_)
 {
     object=object_;
     sensor_fname=object->get_sensor_file_path();
-    loader.initialize(sensor_fname.generic_string());
+    
+    if(object->sens_reduce)
+    {
+        // The hits were reduced during the render, the bins are copied from there
+        
+        reduction=&object->sb_reduction;
+        
+        ray_unit=reduction->power_unit;
+        N_faces=reduction->spatial_bins.size();
+        
+        Nu=reduction->Nu;
+        Nv=reduction->Nv;
+        
+        bins.resize(N_faces);
+        Du.resize(N_faces);
+        Dv.resize(N_faces);
+        
+        for(int i=0;i<N_faces;i++)
+        {
+            Du[i]=1.0/Nu[i];
+            Dv[i]=1.0/Nv[i];
+            
+            bins[i].init(Nu[i],Nv[i]);
+        }
+        
+        empty_sensor=reduction->N_hits==0;
+        
+        return;
+    }
+    
+    reduction=nullptr;
+    open_sensor_file();
     
     initialize();
 }
 
+void RayCounter::open_sensor_file()
+{
+    sensor_file.close();
+    
+    binary_sensor=SensorFile::is_binary(sensor_fname);
+    
+    if(binary_sensor) sensor_file.open(sensor_fname);
+    else loader.initialize(sensor_fname.generic_string());
+}
+
 void RayCounter::set_sensor(std::filesystem::path const &sensor_file)
 {
     sensor_fname=sensor_file;
@@ -307,9 +389,9 @@ void RayCounter::set_sensor(std::filesystem::path const &sensor_file)
     
     // Reading the object geometry from the sensor file
     
-    loader.initialize(sensor_fname.generic_string());
+    open_sensor_file();
     
-    std::string object_header=loader.header[0];
+    std::string object_header=get_header()[0];
     chk_var(object_header);
     
     std::vector<std::string> header_split;
@@ -361,6 +443,12 @@ void RayCounter::reallocate()
 
 void RayCounter::update()
 {
+    if(reduction!=nullptr)
+    {
+        update_from_reduction();
+        return;
+    }
+    
     reallocate();
     
     for(int i=0;i<N_faces;i++)
@@ -397,25 +485,19 @@ void RayCounter::update()
 
 void RayCounter::update_from_file()
 {
+    if(reduction!=nullptr)
+    {
+        update_from_reduction();
+        return;
+    }
+    
     reallocate();
     
     for(int i=0;i<N_faces;i++)
         bins[i]=0;
     
-    int Nl=loader.Nl;
-    
-    std::vector<double> data;
-    
-    for(int i=0;i<Nl;i++)
+    auto add_hit=[&](double x,double y,double z,int face)
     {
-        loader.load_seq(data);
-        
-        double x=data[obj_inter_column+0];
-        double y=data[obj_inter_column+1];
-        double z=data[obj_inter_column+2];
-        
-        int face=data[face_column];
-        
         double u,v;
         
         object->xyz_to_uv(u,v,face,x,y,z);
@@ -429,6 +511,68 @@ void RayCounter::update_from_file()
         {
             fbins(m,n)++;
         }
+    };
+    
+    // Binary files are binned straight from the mapped blocks
+    
+    if(binary_sensor)
+    {
+        for(std::size_t b=0;b<sensor_file.get_N_blocks();b++)
+        {
+            std::size_t Nr=sensor_file.get_block_rows(b);
+            
+            char const *inter=sensor_file.get_column("obj_intersection",b);
+            char const *face=sensor_file.get_column("obj_face",b);
+            
+            if(inter==nullptr || face==nullptr) return;
+            
+            for(std::size_t i=0;i<Nr;i++)
+            {
+                add_hit(SensorFile::get_value<double>(inter,i),
+                        SensorFile::get_value<double>(inter,Nr+i),
+                        SensorFile::get_value<double>(inter,2*Nr+i),
+                        SensorFile::get_value<std::int32_t>(face,i));
+            }
+        }
+        
+        return;
+    }
+    
+    std::vector<double> data;
+    
+    for(int i=0;i<loader.Nl;i++)
+    {
+        loader.load_seq(data);
+        
+        add_hit(data[obj_inter_column+0],
+                data[obj_inter_column+1],
+                data[obj_inter_column+2],
+                data[face_column]);
+    }
+}
+    
+
+// The reduced bins have a fixed resolution and no spectral filtering
+
+void RayCounter::update_from_reduction()
+{
+    double unit=1.0;
+    if(computation_type==RC_POWER) unit=ray_unit;
+    
+    for(int i=0;i<N_faces;i++)
+    {
+        Nu[i]=reduction->Nu[i];
+        Nv[i]=reduction->Nv[i];
+    }
+    
+    reallocate();
+    
+    for(int i=0;i<N_faces;i++)
+    {
+        Grid2<double> const &rbins=reduction->spatial_bins[i];
+        
+        for(int m=0;m<Nu[i];m++) for(int n=0;n<Nv[i];n++)
+            bins[i](m,n)=unit*rbins(m,n);
     }
 }
     
@@ -0,0 +1,270 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene_primitives.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace Sel
+{
+
+void bbox_expand(BoundingBox &box,BoundingBox const &b)
+{
+    box.xm=std::min(box.xm,b.xm); box.xp=std::max(box.xp,b.xp);
+    box.ym=std::min(box.ym,b.ym); box.yp=std::max(box.yp,b.yp);
+    box.zm=std::min(box.zm,b.zm); box.zp=std::max(box.zp,b.zp);
+}
+
+double bbox_half_area(BoundingBox const &box)
+{
+    double dx=box.span_x();
+    double dy=box.span_y();
+    double dz=box.span_z();
+    
+    return dx*dy+dy*dz+dz*dx;
+}
+
+BoundingBox bbox_empty()
+{
+    double inf=std::numeric_limits<double>::infinity();
+    
+    BoundingBox box;
+    
+    box.xm=box.ym=box.zm=inf;
+    box.xp=box.yp=box.zp=-inf;
+    
+    return box;
+}
+
+//#########
+//   BVH
+//#########
+
+void BVH::build(std::vector<BoundingBox> const &boxes,int leaf_size)
+{
+    clear();
+    
+    int N=boxes.size();
+    if(N==0) return;
+    
+    std::vector<Vector3> centers(N);
+    prim_ID.resize(N);
+    
+    for(int i=0;i<N;i++)
+    {
+        prim_ID[i]=i;
+        centers[i]=Vector3(0.5*(boxes[i].xm+boxes[i].xp),
+                           0.5*(boxes[i].ym+boxes[i].yp),
+                           0.5*(boxes[i].zm+boxes[i].zp));
+    }
+    
+    nodes.reserve(2*N/std::max(1,leaf_size)+1);
+    
+    build_node(boxes,centers,0,N,std::max(1,leaf_size),0);
+}
+
+/*
+ * Binned SAH split along the axis of largest centroid extent, with a unit
+ * cost for a traversal step and for a primitive test. Falls back to a median
+ * split when every centroid lands in the same bin, and stops splitting past
+ * a depth the traversal stack can hold.
+ */
+
+int BVH::build_node(std::vector<BoundingBox> const &boxes,
+                    std::vector<Vector3> const &centers,
+                    int start,int end,int leaf_size,int depth)
+{
+    int n=nodes.size();
+    nodes.emplace_back();
+    
+    int i;
+    int N=end-start;
+    
+    BoundingBox box=bbox_empty(),cbox=bbox_empty();
+    
+    for(i=start;i<end;i++)
+    {
+        int p=prim_ID[i];
+        Vector3 const &C=centers[p];
+        
+        bbox_expand(box,boxes[p]);
+        
+        cbox.xm=std::min(cbox.xm,C.x); cbox.xp=std::max(cbox.xp,C.x);
+        cbox.ym=std::min(cbox.ym,C.y); cbox.yp=std::max(cbox.yp,C.y);
+        cbox.zm=std::min(cbox.zm,C.z); cbox.zp=std::max(cbox.zp,C.z);
+    }
+    
+    nodes[n].box=box;
+    
+    auto make_leaf=[&]()
+    {
+        nodes[n].start=start;
+        nodes[n].count=N;
+        return n;
+    };
+    
+    if(N<=leaf_size || depth>=48) return make_leaf();
+    
+    int axis=0;
+    double c_min=cbox.xm,c_span=cbox.span_x();
+    
+    if(cbox.span_y()>c_span) { axis=1; c_min=cbox.ym; c_span=cbox.span_y(); }
+    if(cbox.span_z()>c_span) { axis=2; c_min=cbox.zm; c_span=cbox.span_z(); }
+    
+    if(c_span<=0) return make_leaf();
+    
+    auto coord=[&](int p)
+    {
+        if(axis==0) return centers[p].x;
+        else if(axis==1) return centers[p].y;
+        return centers[p].z;
+    };
+    
+    // Binning
+    
+    int const Nbins=16;
+    
+    BoundingBox bin_box[Nbins];
+    int bin_count[Nbins];
+    
+    for(i=0;i<Nbins;i++) { bin_box[i]=bbox_empty(); bin_count[i]=0; }
+    
+    auto bin_of=[&](int p)
+    {
+        int b=static_cast<int>(Nbins*(coord(p)-c_min)/c_span);
+        return std::clamp(b,0,Nbins-1);
+    };
+    
+    for(i=start;i<end;i++)
+    {
+        int p=prim_ID[i];
+        int b=bin_of(p);
+        
+        bin_count[b]++;
+        bbox_expand(bin_box[b],boxes[p]);
+    }
+    
+    // Sweeps
+    
+    double area_r[Nbins];
+    int count_r[Nbins];
+    
+    BoundingBox acc=bbox_empty();
+    int acc_count=0;
+    
+    for(i=Nbins-1;i>0;i--)
+    {
+        bbox_expand(acc,bin_box[i]);
+        acc_count+=bin_count[i];
+        
+        area_r[i]=acc_count>0 ? bbox_half_area(acc) : 0;
+        count_r[i]=acc_count;
+    }
+    
+    acc=bbox_empty();
+    acc_count=0;
+    
+    int best_split=-1;
+    double best_cost=std::numeric_limits<double>::max();
+    
+    for(i=1;i<Nbins;i++)
+    {
+        bbox_expand(acc,bin_box[i-1]);
+        acc_count+=bin_count[i-1];
+        
+        if(acc_count==0 || count_r[i]==0) continue;
+        
+        double cost=bbox_half_area(acc)*acc_count+area_r[i]*count_r[i];
+        
+        if(cost<best_cost)
+        {
+            best_cost=cost;
+            best_split=i;
+        }
+    }
+    
+    int mid;
+    
+    if(best_split<0)
+    {
+        mid=start+N/2;
+        
+        std::nth_element(prim_ID.begin()+start,prim_ID.begin()+mid,prim_ID.begin()+end,
+                         [&](int a,int b) { return coord(a)<coord(b); });
+    }
+    else
+    {
+        double area=bbox_half_area(box);
+        
+        if(area>0 && N<=4*leaf_size && 1.0+best_cost/area>=N) return make_leaf();
+        
+        mid=std::partition(prim_ID.begin()+start,prim_ID.begin()+end,
+                           [&](int p) { return bin_of(p)<best_split; })-prim_ID.begin();
+    }
+    
+    build_node(boxes,centers,start,mid,leaf_size,depth+1);
+    
+    int right=build_node(boxes,centers,mid,end,leaf_size,depth+1);
+    
+    nodes[n].right=right;
+    
+    return n;
+}
+
+void BVH::clear()
+{
+    nodes.clear();
+    prim_ID.clear();
+}
+
+bool BVH::empty() const { return nodes.empty(); }
+
+/*
+ * Slab test. An axis giving a NaN, for a ray lying on a slab plane, is
+ * ignored, so that the test stays conservative.
+ */
+
+bool BVH::intersect_box(BoundingBox const &box,SelRay const &ray,double t_max,double &t_entry)
+{
+    double t_near=-std::numeric_limits<double>::infinity();
+    double t_far=t_max;
+    
+    double t1=(box.xm-ray.start.x)*ray.inv_dir.x;
+    double t2=(box.xp-ray.start.x)*ray.inv_dir.x;
+    
+    if(t1>t2) std::swap(t1,t2);
+    if(t1>t_near) t_near=t1;
+    if(t2<t_far) t_far=t2;
+    
+    t1=(box.ym-ray.start.y)*ray.inv_dir.y;
+    t2=(box.yp-ray.start.y)*ray.inv_dir.y;
+    
+    if(t1>t2) std::swap(t1,t2);
+    if(t1>t_near) t_near=t1;
+    if(t2<t_far) t_far=t2;
+    
+    t1=(box.zm-ray.start.z)*ray.inv_dir.z;
+    t2=(box.zp-ray.start.z)*ray.inv_dir.z;
+    
+    if(t1>t2) std::swap(t1,t2);
+    if(t1>t_near) t_near=t1;
+    if(t2<t_far) t_far=t2;
+    
+    t_entry=t_near;
+    
+    return t_near<=t_far && t_far>0;
+}
+
+}
@@ -20,6 +20,157 @@ extern std::ofstream plog;
 namespace Sel
 {
 
+//####################
+//     IRF_Table
+//####################
+
+IRF_Table::IRF_Table()
+    :mat_1(nullptr), mat_2(nullptr),
+     reversed(false)
+{
+}
+
+void irf_table_locate(std::vector<double> const &x,double val,std::size_t &i,std::size_t &i1,double &u)
+{
+    if(x.size()==1)
+    {
+        i=i1=0;
+        u=0;
+        return;
+    }
+    
+    i=std::upper_bound(x.begin()+1,x.end()-1,val)-x.begin()-1;
+    i1=i+1;
+    
+    u=(val-x[i])/(x[i1]-x[i]);
+    u=std::clamp(u,0.0,1.0);
+}
+
+bool IRF_Table::lookup(double thi,double lambda_,bool is_TE,double &R,double &T) const
+{
+    if(lambda_<lambda.front() || lambda_>lambda.back()) return false;
+    
+    std::size_t i,i1,j,j1;
+    double u,v;
+    
+    irf_table_locate(th,thi,i,i1,u);
+    irf_table_locate(lambda,lambda_,j,j1,v);
+    
+    std::size_t Nth=th.size();
+    
+    int k=is_TE ? 0 : 2;
+    
+    std::array<double,4> const &A=values[j*Nth+i];
+    std::array<double,4> const &B=values[j*Nth+i1];
+    std::array<double,4> const &C=values[j1*Nth+i1];
+    std::array<double,4> const &D=values[j1*Nth+i];
+    
+    R=interpolate_bilinear(A[k],B[k],C[k],D[k],u,v);
+    T=interpolate_bilinear(A[k+1],B[k+1],C[k+1],D[k+1],u,v);
+    
+    return true;
+}
+
+std::size_t IRF_Table::size() const
+{
+    return values.size();
+}
+
+/*
+ * One bisection pass along an axis of a table. An interval is split at its
+ * midpoint if the samples there deviate from the linear interpolation by more
+ * than tol along a row of the other axis. Active intervals are checked along
+ * every row, the others only along the rows added since their last check.
+ * x_inner tells whether the axis is the contiguous one in the values layout.
+ * Returns the number of split intervals.
+ */
+
+template<typename Sampler>
+std::size_t irf_table_refine(std::vector<double> &x,std::vector<char> &active,std::vector<char> &x_added,
+                             std::vector<char> const &y_added,bool x_inner,
+                             std::vector<std::array<double,4>> &values,
+                             double tol,double dx_min,Sampler const &sample)
+{
+    std::size_t i,j,k;
+    std::size_t Nx=x.size();
+    std::size_t Ny=y_added.size();
+    
+    auto index=[&](std::size_t ix,std::size_t iy,std::size_t Nx_) -> std::size_t
+    {
+        return x_inner ? iy*Nx_+ix : ix*Ny+iy;
+    };
+    
+    std::vector<std::vector<std::array<double,4>>> mid_values(Nx-1);
+    std::vector<char> computed(Ny);
+    std::size_t N_split=0;
+    
+    for(i=0;i+1<Nx;i++)
+    {
+        if(x[i+1]-x[i]<2.0*dx_min) continue;
+        
+        double xm=0.5*(x[i]+x[i+1]);
+        
+        std::vector<std::array<double,4>> row(Ny);
+        bool split=false;
+        
+        for(j=0;j<Ny;j++)
+        {
+            computed[j]=active[i] || y_added[j];
+            if(!computed[j]) continue;
+            
+            sample(xm,j,row[j]);
+            
+            std::array<double,4> const &a=values[index(i,j,Nx)];
+            std::array<double,4> const &b=values[index(i+1,j,Nx)];
+            
+            for(k=0;k<4;k++)
+                if(std::abs(0.5*(a[k]+b[k])-row[j][k])>tol) split=true;
+        }
+        
+        if(split)
+        {
+            for(j=0;j<Ny;j++) if(!computed[j]) sample(xm,j,row[j]);
+            
+            mid_values[i]=std::move(row);
+            N_split++;
+        }
+    }
+    
+    // Rebuild with the midpoints as nodes, only the new intervals stay active
+    
+    std::size_t Nx_new=Nx+N_split;
+    
+    std::vector<double> x_new(Nx_new);
+    std::vector<std::array<double,4>> values_new(Nx_new*Ny);
+    
+    active.assign(Nx_new-1,false);
+    x_added.assign(Nx_new,false);
+    
+    std::size_t n=0;
+    
+    for(i=0;i<Nx;i++)
+    {
+        x_new[n]=x[i];
+        for(j=0;j<Ny;j++) values_new[index(n,j,Nx_new)]=values[index(i,j,Nx)];
+        n++;
+        
+        if(i+1<Nx && !mid_values[i].empty())
+        {
+            x_new[n]=0.5*(x[i]+x[i+1]);
+            for(j=0;j<Ny;j++) values_new[index(n,j,Nx_new)]=mid_values[i][j];
+            
+            active[n-1]=active[n]=true;
+            x_added[n]=true;
+            n++;
+        }
+    }
+    
+    x=std::move(x_new);
+    values=std::move(values_new);
+    
+    return N_split;
+}
+
 //####################
 //      IRF
 //####################
@@ -27,6 +178,7 @@ namespace Sel
 IRF::IRF()
     :type(IRF_Type::NONE),
      scatt_ref(0),
+     bake_tolerance(1e-4),
      splitting_factor(0),
      Nl(0), Nth(0)
 {
@@ -51,6 +203,8 @@ IRF::IRF(IRF const &irf)
      ml_model(irf.ml_model),
      ml_heights(irf.ml_heights),
      ml_materials(irf.ml_materials),
+     bake_tolerance(irf.bake_tolerance),
+     baked(irf.baked),
      splitting_factor(irf.splitting_factor),
      Nl(irf.Nl), Nth(irf.Nth)
 {
@@ -75,12 +229,125 @@ IRF::IRF(IRF const &irf)
     g3_tra=irf.g3_tra;
 }
 
+/*
+ * Tabulates the response between mat_1, on the incidence side, and mat_2 over
+ * [0,Pi/2]x[lambda_min,lambda_max]. The table is dropped if it would need more
+ * than 2^20 samples to reach the tolerance, the hits then keep the exact path.
+ */
+
+void IRF::bake(Material *mat_1,Material *mat_2,bool reversed,double lambda_min,double lambda_max)
+{
+    if(bake_tolerance<=0 || !can_bake()) return;
+    if(find_table(mat_1,mat_2,reversed)!=nullptr) return;
+    
+    bool spectral=true;
+    
+    if(type==IRF_Type::MULTILAYER)
+    {
+        if(mat_1==nullptr || mat_2==nullptr) return;
+    }
+    else
+    {
+        // Tabulated responses, independent of the media and of the wavelength
+        // Their table has a single wavelength node at 0
+        
+        mat_1=mat_2=nullptr;
+        reversed=false;
+        spectral=false;
+        lambda_min=lambda_max=0;
+        
+        if(!baked.empty()) return;
+    }
+    
+    if(lambda_max<=lambda_min) spectral=false;
+    
+    IRF_Table table;
+    
+    table.mat_1=mat_1;
+    table.mat_2=mat_2;
+    table.reversed=reversed;
+    
+    std::size_t i,j,N=16;
+    std::size_t N_samples=0,N_samples_max=1<<20;
+    
+    table.th.resize(N+1);
+    for(i=0;i<=N;i++) table.th[i]=i*Pi/2.0/N;
+    
+    if(spectral)
+    {
+        table.lambda.resize(N+1);
+        for(j=0;j<=N;j++) table.lambda[j]=lambda_min+j*(lambda_max-lambda_min)/N;
+    }
+    else table.lambda.resize(1,lambda_min);
+    
+    auto sample_point=[&](double thi,double lambda,std::array<double,4> &V)
+    {
+        double n1=1.0,n2=1.0;
+        
+        if(mat_1!=nullptr)
+        {
+            double w=m_to_rad_Hz(lambda);
+            
+            n1=mat_1->get_n(w).real();
+            n2=mat_2->get_n(w).real();
+        }
+        
+        get_power(thi,lambda,n1,n2,reversed,V[0],V[1],V[2],V[3]);
+        N_samples++;
+    };
+    
+    table.values.resize(table.th.size()*table.lambda.size());
+    
+    for(j=0;j<table.lambda.size();j++)
+        for(i=0;i<table.th.size();i++)
+            sample_point(table.th[i],table.lambda[j],table.values[j*table.th.size()+i]);
+    
+    double tol=0.5*bake_tolerance;
+    
+    auto sample_th=[&](double thi,std::size_t j,std::array<double,4> &V) { sample_point(thi,table.lambda[j],V); };
+    auto sample_lambda=[&](double lambda,std::size_t i,std::array<double,4> &V) { sample_point(table.th[i],lambda,V); };
+    
+    std::vector<char> th_active(table.th.size()-1,true),th_added(table.th.size(),false);
+    std::vector<char> lambda_active(table.lambda.size()-1,true),lambda_added(table.lambda.size(),false);
+    
+    while(N_samples<=N_samples_max)
+    {
+        std::size_t N_split=irf_table_refine(table.th,th_active,th_added,lambda_added,true,
+                                             table.values,tol,1e-9,sample_th);
+        
+        if(spectral)
+            N_split+=irf_table_refine(table.lambda,lambda_active,lambda_added,th_added,false,
+                                      table.values,tol,1e-9*(lambda_max-lambda_min),sample_lambda);
+        
+        if(N_split==0) break;
+    }
+    
+    if(N_samples>N_samples_max)
+    {
+        Plog::print(LogType::WARNING, "IRF ", name, " could not be baked to the ", bake_tolerance,
+                    " tolerance, using the exact response\n");
+        return;
+    }
+    
+    baked.push_back(std::move(table));
+}
+
 void IRF::bootstrap()
 {
     if(type==IRF_Type::MULTILAYER)
         ml_model.set_N_layers(ml_heights.size());
 }
 
+bool IRF::can_bake() const
+{
+    return type==IRF_Type::MULTILAYER || type==IRF_Type::SNELL_FILE;
+}
+
+void IRF::clear_bake()
+{
+    baked.clear();
+}
+
 void IRF::compute_snell_reflection(Vector3 &out_dir,Vector3 const &in_dir,
                                    Vector3 const &Fnorm,double n_scal)
 {
@@ -133,10 +400,76 @@ bool IRF::determine_polarization(Vector3 &S_vec,Vector3 const &Fnorm,
     else return false;
 }
 
+IRF_Table const* IRF::find_table(Material const *mat_1,Material const *mat_2,bool reversed) const
+{
+    if(type!=IRF_Type::MULTILAYER)
+    {
+        if(baked.empty()) return nullptr;
+        return &baked[0];
+    }
+    
+    for(IRF_Table const &table : baked)
+        if(table.mat_1==mat_1 && table.mat_2==mat_2 && table.reversed==reversed)
+            return &table;
+    
+    return nullptr;
+}
+
+/*
+ * Exact reflectance and transmittance at the incidence angle thi, reversed
+ * stands for a ray coming from the bottom of the stack
+ */
+
+void IRF::get_power(double thi,double lambda,double n1,double n2,bool reversed,
+                    double &R_TE,double &T_TE,double &R_TM,double &T_TM)
+{
+    if(type==IRF_Type::MULTILAYER)
+    {
+        // Per-thread copy of the model, the render workers share the IRF
+        
+        thread_local Multilayer_TMM_UD ml_local;
+        
+        std::size_t Nl=ml_heights.size();
+        
+        if(ml_local.N_layers!=static_cast<int>(Nl)) ml_local.set_N_layers(Nl);
+        
+        ml_local.set_lambda(lambda);
+        ml_local.set_environment(n1,n2);
+        
+        if(!reversed)
+        {
+            for(std::size_t i=0;i<Nl;i++)
+                ml_local.set_layer(i,ml_heights[i],ml_materials[i]->get_n(m_to_rad_Hz(lambda)));
+        }
+        else
+        {
+            for(std::size_t i=0;i<Nl;i++)
+                ml_local.set_layer(Nl-1-i,ml_heights[i],ml_materials[i]->get_n(m_to_rad_Hz(lambda)));
+        }
+        
+        ml_local.set_angle(thi);
+        
+        double A_TE,A_TM;
+        ml_local.compute_power(R_TE,T_TE,A_TE,R_TM,T_TM,A_TM);
+    }
+    else if(type==IRF_Type::SNELL_FILE)
+    {
+        int k=0;
+        double u=0;
+        
+        ang_th_data.vector_locate_linear(thi,k,u);
+        
+        R_TE=R_TM=ref_data.lin_interp(k,u);
+        T_TE=T_TM=tra_data.lin_interp(k,u);
+    }
+    else R_TE=T_TE=R_TM=T_TM=0;
+}
+
 bool IRF::get_response(Vector3 &out_dir,Vector3 &out_polar,
                        Vector3 const &in_dir,Vector3 const &in_polar,
                        Vector3 const &Fnorm,Vector3 const &Ftangent,
-                       double lambda,double n1,double n2)
+                       double lambda,double n1,double n2,
+                       Material const *n1_mat,Material const *n2_mat)
 {
     double n_scal=scalar_prod(in_dir,Fnorm);
     bool is_near_normal=near_normal(n_scal);
@@ -149,7 +482,7 @@ bool IRF::get_response(Vector3 &out_dir,Vector3 &out_polar,
     bool is_TE=determine_polarization(S_vec,Fnorm,in_dir,in_polar,is_near_normal);
     
          if(type==IRF_Type::FRESNEL) ray_abs=get_response_fresnel(out_dir,in_dir,Fnorm,n_scal,lambda,n1,n2,is_TE,is_near_normal);
-    else if(type==IRF_Type::MULTILAYER) ray_abs=get_response_multilayer(out_dir,in_dir,Fnorm,n_scal,lambda,n1,n2,is_TE,is_near_normal);
+    else if(type==IRF_Type::MULTILAYER) ray_abs=get_response_multilayer(out_dir,in_dir,Fnorm,n_scal,lambda,n1,n2,is_TE,is_near_normal,n1_mat,n2_mat);
     else if(type==IRF_Type::PERF_ABS)
     {
         return true;
@@ -327,46 +660,36 @@ bool IRF::get_response_grating(Vector3 const &in_dir,Vector3 &out_dir,
 bool IRF::get_response_multilayer(Vector3 &out_dir,Vector3 const &in_dir,
                                   Vector3 const &Fnorm,double n_scal,
                                   double lambda,double n1,double n2,
-                                  bool is_TE,bool is_near_normal)
+                                  bool is_TE,bool is_near_normal,
+                                  Material const *n1_mat,Material const *n2_mat)
 {
-    // Multilayer setup
-    
-    ml_model.set_lambda(lambda);
-    ml_model.set_environment(n1,n2);
-    
-    std::size_t Nl=ml_heights.size();
-    
-    if(n_scal<=0)
-    {
-        for(std::size_t i=0;i<Nl;i++)
-            ml_model.set_layer(i,ml_heights[i],ml_materials[i]->get_n(m_to_rad_Hz(lambda)));
-    }
-    else
-    {
-        for(std::size_t i=0;i<Nl;i++)
-            ml_model.set_layer(Nl-1-i,ml_heights[i],ml_materials[i]->get_n(m_to_rad_Hz(lambda)));
-    }
-    
     double cos_thi=std::abs(n_scal);
     double thi=std::acos(cos_thi);
     
-    ml_model.set_angle(thi);
-    
-    // Powers
+    bool reversed=n_scal>0;
     
-    double R_TE,R_TM,T_TE,T_TM,A_TE,A_TM;
-    ml_model.compute_power(R_TE,T_TE,A_TE,R_TM,T_TM,A_TM);
+    // Powers, from the baked table when there is one for these media
     
-//    double R=0.5*(R_TE+R_TM);
-//    double T=0.5*(T_TE+T_TM);
+    double R,T;
     
-    double R=R_TM;
-    double T=T_TM;
+    IRF_Table const *table=find_table(n1_mat,n2_mat,reversed);
     
-    if(is_TE)
+    if(table==nullptr || !table->lookup(thi,lambda,is_TE,R,T))
     {
-        R=R_TE;
-        T=T_TE;
+        double R_TE,R_TM,T_TE,T_TM;
+        get_power(thi,lambda,n1,n2,reversed,R_TE,T_TE,R_TM,T_TM);
+        
+//        double R=0.5*(R_TE+R_TM);
+//        double T=0.5*(T_TE+T_TM);
+        
+        R=R_TM;
+        T=T_TM;
+        
+        if(is_TE)
+        {
+            R=R_TE;
+            T=T_TE;
+        }
     }
     
     // Child
@@ -511,13 +834,20 @@ bool IRF::get_response_snell_file(Vector3 const &in_dir,Vector3 &out_dir,
     //double thr=std::asin(n1/n2*sin(thi));
     //double cos_thr=std::cos(thr);
     
-    int k=0;
-    double u=0;
+    double r,t;
     
-    ang_th_data.vector_locate_linear(thi,k,u);
+    IRF_Table const *table=find_table(nullptr,nullptr,false);
     
-    double r=ref_data.lin_interp(k,u);
-    double t=tra_data.lin_interp(k,u);
+    if(table==nullptr || !table->lookup(thi,0,true,r,t))
+    {
+        int k=0;
+        double u=0;
+        
+        ang_th_data.vector_locate_linear(thi,k,u);
+        
+        r=ref_data.lin_interp(k,u);
+        t=tra_data.lin_interp(k,u);
+    }
     
     double p=randp();
     
@@ -633,6 +963,9 @@ void IRF::operator = (IRF const &irf)
     ml_heights=irf.ml_heights;
     ml_materials=irf.ml_materials;
     
+    bake_tolerance=irf.bake_tolerance;
+    baked=irf.baked;
+    
     splitting_factor=irf.splitting_factor;
     
     Nl=irf.Nl;
@@ -654,6 +987,11 @@ void IRF::operator = (IRF const &irf)
     g3_tra=irf.g3_tra;
 }
 
+void IRF::set_bake_tolerance(double tolerance)
+{
+    bake_tolerance=tolerance;
+}
+
 void IRF::set_type(IRF_Type type_)
 {
     type=type_;
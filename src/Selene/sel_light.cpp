@@ -14,9 +14,72 @@ limitations under the License.*/
 
 #include <selene.h>
 
+#include <algorithm>
+
 namespace Sel
 {
 
+namespace
+{
+    // Sobol dimension of each emission parameter
+    
+    enum
+    {
+        DIM_LAMBDA=0,
+        DIM_POS_1,
+        DIM_POS_2,
+        DIM_POS_3,
+        DIM_DIR_1,
+        DIM_DIR_2,
+        DIM_POLAR,
+        DIM_APERTURE
+    };
+    
+    // Point uniformly distributed in the unit disk, u and v in [0,1[
+    
+    void disk_sample(double u,double v,double &y,double &z)
+    {
+        double r=std::sqrt(u);
+        double phi=2.0*Pi*v;
+        
+        y=r*std::cos(phi);
+        z=r*std::sin(phi);
+    }
+    
+    // Point uniformly distributed in the unit ball
+    
+    Vector3 ball_sample(double u,double v,double w)
+    {
+        double r=std::cbrt(u);
+        double c=1.0-2.0*v;
+        double s=std::sqrt(std::max(0.0,1.0-c*c));
+        double phi=2.0*Pi*w;
+        
+        return Vector3(r*c,r*s*std::cos(phi),r*s*std::sin(phi));
+    }
+    
+    // Direction in the cap of axis A and of cosine cos_max, uniform in solid angle
+    
+    Vector3 cap_sample(double u,double v,double cos_max,
+                       Vector3 const &A,Vector3 const &e1,Vector3 const &e2)
+    {
+        double c=1.0-u*(1.0-cos_max);
+        double s=std::sqrt(std::max(0.0,1.0-c*c));
+        double phi=2.0*Pi*v;
+        
+        return c*A+s*std::cos(phi)*e1+s*std::sin(phi)*e2;
+    }
+    
+    void orthonormal_basis(Vector3 const &A,Vector3 &e1,Vector3 &e2)
+    {
+        if(std::abs(A.x)<0.9) e1=crossprod(A,unit_vec_x);
+        else e1=crossprod(A,unit_vec_y);
+        
+        e1.normalize();
+        e2=crossprod(A,e1);
+    }
+}
+
 Light::Light()
     :spectrum_type(SPECTRUM_MONO),
      extent(EXTENT_POINT),
@@ -30,6 +93,19 @@ Light::Light()
      spectrum_shape(SPECTRUM_FLAT),
      lambda_min(370e-9), lambda_max(850e-9),
      planck_temperature(5500),
+     sampling_qmc(false),
+     aperture_set(false),
+     aperture_active(false),
+     aperture_center(0,0,0),
+     aperture_radius(0),
+     aperture_cos(1.0),
+     aperture_fraction(1.0),
+     aperture_p_max(0),
+     aperture_quad_type(-1),
+     aperture_quad_cone(0),
+     aperture_quad_cos(1.0),
+     aperture_quad_axis(0,0,0),
+     aperture_quad_fraction(0),
      power(1.0),
      extent_x(0),
      extent_y(0),
@@ -49,19 +125,136 @@ void Light::bootstrap()
     for(std::size_t i=0;i<polymono_weight.size();i++)
         polymono_weight_sum+=polymono_weight[i];
     
+    bootstrap_spectrum();
+    bootstrap_aperture();
+}
+
+/*
+ * Draws a direction of the aperture cone with the emission density restricted
+ * to the cone: uniform candidates accepted with a probability proportional to
+ * the density. The acceptance test takes its own Sobol dimension and a
+ * rejected candidate skips its index of the sequence, so the accepted rays
+ * keep low discrepancy points in every dimension.
+ */
+
+Vector3 Light::aperture_direction()
+{
+    while(true)
+    {
+        Vector3 local_dir=cap_sample(sample(DIM_DIR_1),sample(DIM_DIR_2),aperture_cos,
+                                     aperture_axis,aperture_e1,aperture_e2);
+        
+        if(type==SRC_POINT || sample(DIM_APERTURE)*aperture_p_max<emission_density(local_dir))
+            return local_dir;
+        
+        NRays_sent++;
+    }
+}
+
+/*
+ * Finds the cone of directions from which the rays can reach the aperture
+ * sphere, whatever their starting point in the extent of the light. The
+ * directions are drawn in that cone by aperture_direction, and every ray then
+ * carries the same weight, the fraction of the power emitted in the cone.
+ */
+
+void Light::bootstrap_aperture()
+{
+    aperture_active=false;
+    aperture_fraction=1.0;
+    
+    if(!aperture_set) return;
+    
+    if(type!=SRC_POINT && type!=SRC_CONE && type!=SRC_LAMBERTIAN)
+    {
+        Plog::print(LogType::WARNING, "Light ", name, ": the aperture only applies to point, cone and lambertian sources, ignored\n");
+        return;
+    }
+    
+    Vector3 axis=to_local(aperture_center-loc);
+    
+    double D=axis.norm();
+    double R=aperture_radius+extent_radius();
+    
+    if(D<=R)
+    {
+        Plog::print(LogType::WARNING, "Light ", name, " is within its aperture, ignored\n");
+        return;
+    }
+    
+    aperture_axis=axis/D;
+    aperture_cos=std::sqrt(1.0-R*R/(D*D));
+    
+    orthonormal_basis(aperture_axis,aperture_e1,aperture_e2);
+    
+    if(type==SRC_POINT)
+    {
+        aperture_p_max=1.0/(4.0*Pi);
+        aperture_fraction=(1.0-aperture_cos)/2.0;
+    }
+    else
+    {
+        if(type==SRC_CONE) aperture_p_max=1.0/(2.0*Pi*(1.0-std::cos(cone_angle/2.0)));
+        else
+        {
+            double th_axis=std::acos(std::clamp(aperture_axis.x,-1.0,1.0));
+            double th_min=std::max(0.0,th_axis-std::acos(aperture_cos));
+            
+            aperture_p_max=std::max(0.0,std::cos(th_min))/Pi;
+        }
+        
+        // Midpoint quadrature of the emission density over the cap
+        
+        if(aperture_quad_type!=type || aperture_quad_cone!=cone_angle ||
+           aperture_quad_cos!=aperture_cos || (aperture_quad_axis-aperture_axis).norm()>0)
+        {
+            int N=1024;
+            double sum=0;
+            
+            for(int i=0;i<N;i++) for(int j=0;j<N;j++)
+                sum+=emission_density(cap_sample((i+0.5)/N,(j+0.5)/N,aperture_cos,
+                                                 aperture_axis,aperture_e1,aperture_e2));
+            
+            aperture_quad_type=type;
+            aperture_quad_cone=cone_angle;
+            aperture_quad_cos=aperture_cos;
+            aperture_quad_axis=aperture_axis;
+            aperture_quad_fraction=sum*2.0*Pi*(1.0-aperture_cos)/(N*N);
+        }
+        
+        aperture_fraction=aperture_quad_fraction;
+    }
+    
+    if(aperture_fraction<=0 || aperture_p_max<=0)
+    {
+        Plog::print(LogType::WARNING, "Light ", name, ": the aperture is out of the emission cone, ignored\n");
+        aperture_fraction=1.0;
+        return;
+    }
+    
+    aperture_active=true;
+}
+
+void Light::bootstrap_spectrum()
+{
+    spectrum_cdf_x.clear();
+    spectrum_cdf_y.clear();
+    spectrum_cdf.clear();
+    
     if(spectrum_type==SPECTRUM_POLY)
     {
         if(spectrum_shape==SPECTRUM_PLANCK)
         {
-            double lambda_planck_max=h_planck*c_light/(4.965114231744276*k_boltzmann*planck_temperature);
+            int N=1024;
             
-            chk_var(lambda_planck_max);
+            spectrum_cdf_x.resize(N);
+            spectrum_cdf_y.resize(N);
             
-            if(lambda_max<=lambda_planck_max)
-                planck_max=planck_distribution_wavelength(lambda_max,planck_temperature);
-            else if(lambda_min>=lambda_planck_max)
-                planck_max=planck_distribution_wavelength(lambda_min,planck_temperature);
-            else planck_max=planck_distribution_wavelength(lambda_planck_max,planck_temperature);
+            for(int i=0;i<N;i++)
+            {
+                spectrum_cdf_x[i]=lambda_min+(lambda_max-lambda_min)*i/(N-1.0);
+                spectrum_cdf_y[i]=planck_distribution_wavelength(spectrum_cdf_x[i],planck_temperature);
+            }
         }
         else if(spectrum_shape==SPECTRUM_FILE)
         {
@@ -71,87 +264,131 @@ void Light::bootstrap()
             spf_x=data[0];
             spf_y=data[1];
             
-            lambda_min=spf_x[0];
-            lambda_max=spf_x[0];
-            file_max=spf_y[0];
+            std::vector<std::size_t> order(spf_x.size());
+            for(std::size_t i=0;i<order.size();i++) order[i]=i;
+            
+            std::sort(order.begin(),order.end(),[&](std::size_t a,std::size_t b) { return spf_x[a]<spf_x[b]; });
             
-            for(std::size_t i=0;i<spf_y.size();i++)
+            for(std::size_t i : order)
             {
-                lambda_min=std::min(lambda_min,spf_x[i]);
-                lambda_max=std::max(lambda_max,spf_x[i]);
-                file_max=std::max(file_max,spf_y[i]);
+                spectrum_cdf_x.push_back(spf_x[i]);
+                spectrum_cdf_y.push_back(std::max(0.0,spf_y[i]));
             }
+            
+            lambda_min=spectrum_cdf_x.front();
+            lambda_max=spectrum_cdf_x.back();
+        }
+        else return;
+        
+        std::size_t N=spectrum_cdf_x.size();
+        
+        spectrum_cdf.resize(N,0);
+        
+        for(std::size_t i=1;i<N;i++)
+            spectrum_cdf[i]=spectrum_cdf[i-1]+0.5*(spectrum_cdf_y[i-1]+spectrum_cdf_y[i])
+                                             *(spectrum_cdf_x[i]-spectrum_cdf_x[i-1]);
+        
+        if(N<2 || spectrum_cdf.back()<=0)
+        {
+            Plog::print(LogType::FATAL, "Empty spectrum for the light ", name, "\nAborting...\n");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    else if(spectrum_type==SPECTRUM_POLYMONO)
+    {
+        spectrum_cdf.resize(polymono_weight.size());
+        
+        double sum=0;
+        
+        for(std::size_t i=0;i<polymono_weight.size();i++)
+        {
+            sum+=polymono_weight[i];
+            spectrum_cdf[i]=sum;
         }
     }
 }
 
-double Light::compute_wavelength()
+// Inverse of the cumulative spectral distribution, u in [0,1[
+
+double Light::compute_wavelength(double u)
 {
          if(spectrum_type==SPECTRUM_MONO) return lambda_mono;
     else if(spectrum_type==SPECTRUM_POLY)
     {
-        if(spectrum_shape==SPECTRUM_FLAT) return randp(lambda_min,lambda_max);
-        else if(spectrum_shape==SPECTRUM_PLANCK)
+        if(spectrum_shape==SPECTRUM_FLAT) return lambda_min+u*(lambda_max-lambda_min);
+        else
         {
-            double prob=randp();
-            double lambda=randp(lambda_min,lambda_max);
+            // Linear density on the segment, the quadratic is solved in its
+            // cancellation free form
             
-            double run=true;
+            double target=u*spectrum_cdf.back();
             
-            while(run)
-            {
-                if(prob<=planck_distribution_wavelength(lambda,planck_temperature)/planck_max)
-                {
-                    run=false;
-                    return lambda;
-                }
-                else
-                {
-                    prob=randp();
-                    lambda=randp(lambda_min,lambda_max);
-                }
-            }
-        }
-        else if(spectrum_shape==SPECTRUM_FILE)
-        {
-            double prob=randp();
-            double lambda=randp(lambda_min,lambda_max);
+            std::size_t i=std::upper_bound(spectrum_cdf.begin(),spectrum_cdf.end(),target)-spectrum_cdf.begin();
+            i=std::clamp<std::size_t>(i,1,spectrum_cdf.size()-1);
             
-            double run=true;
+            double h=spectrum_cdf_x[i]-spectrum_cdf_x[i-1];
             
-            while(run)
-            {
-                if(prob<=vector_interp_linear(spf_x,spf_y,lambda,false)/file_max)
-                {
-                    run=false;
-                    return lambda;
-                }
-                else
-                {
-                    prob=randp();
-                    lambda=randp(lambda_min,lambda_max);
-                }
-            }
+            // Repeated wavelengths in a spectrum file give steps
+            
+            if(h<=0) return spectrum_cdf_x[i];
+            
+            double y0=spectrum_cdf_y[i-1];
+            double k=(spectrum_cdf_y[i]-y0)/h;
+            double A=target-spectrum_cdf[i-1];
+            
+            double den=y0+std::sqrt(std::max(0.0,y0*y0+2.0*k*A));
+            double t=den>0 ? 2.0*A/den : 0;
+            
+            return spectrum_cdf_x[i-1]+std::clamp(t,0.0,h);
         }
     }
     else if(spectrum_type==SPECTRUM_POLYMONO)
     {
-        double p=randp(polymono_weight_sum);
+        std::size_t i=std::upper_bound(spectrum_cdf.begin(),spectrum_cdf.end(),u*polymono_weight_sum)-spectrum_cdf.begin();
         
-        int i=0;
-        
-        while(p-polymono_weight[i]>=0)
-        {
-            p-=polymono_weight[i];
-            i++;
-        }
-        
-        return polymono_lambda[i];
+        return polymono_lambda[std::min(i,polymono_lambda.size()-1)];
     }
     
     return lambda_min;
 }
 
+void Light::clear_aperture()
+{
+    aperture_set=false;
+}
+
+// Directional density of the emission, per steradian
+
+double Light::emission_density(Vector3 const &local_dir) const
+{
+    switch(type)
+    {
+        case SRC_POINT: return 1.0/(4.0*Pi);
+        case SRC_CONE:
+            if(local_dir.x>=std::cos(cone_angle/2.0))
+                return 1.0/(2.0*Pi*(1.0-std::cos(cone_angle/2.0)));
+            return 0;
+        case SRC_LAMBERTIAN: return std::max(0.0,local_dir.x)/Pi;
+    }
+    
+    return 0;
+}
+
+// Radius of the sphere bounding the extent
+
+double Light::extent_radius() const
+{
+    switch(extent)
+    {
+        case EXTENT_CIRCLE:
+        case EXTENT_SPHERE: return extent_d/2.0;
+        case EXTENT_ELLIPSE: return std::max(extent_y,extent_z)/2.0;
+        case EXTENT_ELLIPSOID: return std::max({extent_x,extent_y,extent_z})/2.0;
+        case EXTENT_RECTANGLE: return std::sqrt(extent_y*extent_y+extent_z*extent_z)/2.0;
+    }
+    
+    return 0;
+}
 
 Vector3 Light::get_anchor(int anchor)
 {
@@ -210,14 +447,25 @@ std::string Light::get_anchor_script_name(int anchor)
     return anchor_name;
 }
 
-double Light::get_power() { return power; }
+double Light::get_power() { return power*aperture_fraction; }
+
+/*
+ * Every emission parameter is drawn by inversion of its distribution from a
+ * single number of [0,1[, taken in its own Sobol dimension when the light
+ * uses low discrepancy sampling.
+ */
 
 void Light::get_ray(SelRay &ray)
 {
     Vector3 local_dir,local_pol;
     
+    // The aperture may skip indices of the sequence, its direction is drawn
+    // before the other parameters
+    
+    if(aperture_active) local_dir=aperture_direction();
+    
     ray.start=loc;
-    ray.lambda=compute_wavelength();
+    ray.lambda=compute_wavelength(sample(DIM_LAMBDA));
     
     double x=0,y=0,z=0;
     double ex2=extent_x/2.0;
@@ -228,56 +476,40 @@ void Light::get_ray(SelRay &ray)
     switch(extent)
     {
         case EXTENT_CIRCLE:
-            y=randp(-er,er);
-            z=randp(-er,er);
-            
-            while(y*y+z*z>=er*er)
-            {
-                y=randp(-er,er);
-                z=randp(-er,er);
-            }
+            disk_sample(sample(DIM_POS_1),sample(DIM_POS_2),y,z);
+            y*=er;
+            z*=er;
             break;
             
         case EXTENT_ELLIPSE:
-            y=randp(-ey2,ey2);
-            z=randp(-ez2,ez2);
-            
-            while(y*y/(ey2*ey2)+z*z/(ez2*ez2)>=1.0)
-            {
-                y=randp(-ey2,ey2);
-                z=randp(-ez2,ez2);
-            }
+            disk_sample(sample(DIM_POS_1),sample(DIM_POS_2),y,z);
+            y*=ey2;
+            z*=ez2;
             break;
             
         case EXTENT_ELLIPSOID:
-            x=randp(-ex2,ex2);
-            y=randp(-ey2,ey2);
-            z=randp(-ez2,ez2);
+        {
+            Vector3 P=ball_sample(sample(DIM_POS_1),sample(DIM_POS_2),sample(DIM_POS_3));
             
-            while(x*x/(ex2*ex2)+y*y/(ey2*ey2)+z*z/(ez2*ez2)>=1.0)
-            {
-                x=randp(-ex2,ex2);
-                y=randp(-ey2,ey2);
-                z=randp(-ez2,ez2);
-            }
+            x=ex2*P.x;
+            y=ey2*P.y;
+            z=ez2*P.z;
+        }
             break;
             
         case EXTENT_RECTANGLE:
-            y=randp(-ey2,ey2);
-            z=randp(-ez2,ez2);
+            y=ey2*(2.0*sample(DIM_POS_1)-1.0);
+            z=ez2*(2.0*sample(DIM_POS_2)-1.0);
             break;
             
         case EXTENT_SPHERE:
-            x=randp(-er,er);
-            y=randp(-er,er);
-            z=randp(-er,er);
+        {
+            Vector3 P=ball_sample(sample(DIM_POS_1),sample(DIM_POS_2),sample(DIM_POS_3));
             
-            while(x*x+y*y+z*z>=er*er)
-            {
-                x=randp(-er,er);
-                y=randp(-er,er);
-                z=randp(-er,er);
-            }
+            x=er*P.x;
+            y=er*P.y;
+            z=er*P.z;
+        }
             break;
     }
     
@@ -287,58 +519,50 @@ void Light::get_ray(SelRay &ray)
     
     bool forced_polarization=false;
     
-         if(type==SRC_POINT) local_dir.rand_sph();
+    if(aperture_active)
+    {
+        // Already drawn
+    }
+    else if(type==SRC_POINT)
+    {
+        local_dir=cap_sample(sample(DIM_DIR_1),sample(DIM_DIR_2),-1.0,
+                             unit_vec_x,unit_vec_y,unit_vec_z);
+    }
     else if(type==SRC_POINT_PLANAR)
     {
-        double th=randp(2.0*Pi);
+        double th=2.0*Pi*sample(DIM_DIR_1);
         
         local_dir=std::cos(th)*unit_vec_y+
                   std::sin(th)*unit_vec_z;
     }
     else if(type==SRC_CONE)
     {
-        bool check=true;
-        double th,phi;
-        
-        double boundary=std::sin(cone_angle/2.0);
-        
-        while(check)
-        {
-            th=randp(cone_angle/2.0);
-            phi=randp(2.0*Pi);
-            
-            if(randp(boundary)<std::sin(th)) check=false;
-        }
-        
-        local_dir=std::cos(th)*unit_vec_x+
-                  std::cos(phi)*std::sin(th)*unit_vec_y+
-                  std::sin(phi)*std::sin(th)*unit_vec_z;
+        local_dir=cap_sample(sample(DIM_DIR_1),sample(DIM_DIR_2),std::cos(cone_angle/2.0),
+                             unit_vec_x,unit_vec_y,unit_vec_z);
     }
     else if(type==SRC_GAUSSIAN_BEAM)
     {
+        // Gaussian profiles of the waist position and of the direction,
+        // truncated at three times their widths
+        
         double w0=ray.lambda/(Pi*beam_numerical_aperture);
+        double NA=beam_numerical_aperture;
         
-        double w2=w0*w0;
-        double NA2=beam_numerical_aperture*beam_numerical_aperture;
+        double r_max=3.0*w0;
+        double v_max=std::min(3.0*NA,1.0);
         
-        double y,z,vy,vz;
+        double r=w0*std::sqrt(-std::log(1.0-sample(DIM_POS_1)*(1.0-std::exp(-r_max*r_max/(w0*w0)))));
+        double v=NA*std::sqrt(-std::log(1.0-sample(DIM_DIR_1)*(1.0-std::exp(-v_max*v_max/(NA*NA)))));
         
-        bool check=true;
+        double phi_r=2.0*Pi*sample(DIM_POS_2);
+        double phi_v=2.0*Pi*sample(DIM_DIR_2);
         
-        while(check)
-        {
-            y=3.0*w0*randp(-1.0,1.0);
-            z=3.0*w0*randp(-1.0,1.0);
-            vy=3.0*beam_numerical_aperture*randp(-1.0,1.0);
-            vz=3.0*beam_numerical_aperture*randp(-1.0,1.0);
-            
-            double p=randp();
-            
-            if(   p<std::exp(-(y*y+z*z)/w2-(vy*vy+vz*vz)/NA2)
-               && vy*vy+vz*vz<1.0) check=false;
-        }
+        double y=r*std::cos(phi_r);
+        double z=r*std::sin(phi_r);
+        double vy=v*std::cos(phi_v);
+        double vz=v*std::sin(phi_v);
         
-        double vx=sqrt(1.0-vy*vy-vz*vz);
+        double vx=std::sqrt(std::max(0.0,1.0-vy*vy-vz*vz));
         double t=-beam_waist_distance/vx;
         
         y=y+t*vy;
@@ -351,15 +575,13 @@ void Light::get_ray(SelRay &ray)
     }
     else if(type==SRC_LAMBERTIAN)
     {
-        bool c=true;
+        // cos(theta) is the square root of a uniform number
         
-        while(c)
-        {
-            local_dir.rand_sph();
-            local_dir.x=std::abs(local_dir.x);
-
-            if(randp(0.0,1.0)<local_dir.x) c=false; // ld.x is the cosine of theta (elevation angle)
-        }
+        double c=std::sqrt(sample(DIM_DIR_1));
+        double s=std::sqrt(std::max(0.0,1.0-c*c));
+        double phi=2.0*Pi*sample(DIM_DIR_2);
+        
+        local_dir(c,s*std::cos(phi),s*std::sin(phi));
     }
     else if(type==SRC_PERFECT_BEAM)
     {
@@ -400,8 +622,12 @@ void Light::get_ray(SelRay &ray)
         }
         else if(polar_type==POLAR_UNSET)
         {
-            local_pol.rand_sph();
-            local_pol=local_pol-local_dir*scalar_prod(local_pol,local_dir);
+            Vector3 e1,e2;
+            orthonormal_basis(local_dir,e1,e2);
+            
+            double phi=2.0*Pi*sample(DIM_POLAR);
+            
+            local_pol=std::cos(phi)*e1+std::sin(phi)*e2;
         }
     }
     
@@ -420,8 +646,28 @@ void Light::get_ray(SelRay &ray)
 
 void Light::reset_ray_counter() { NRays_sent=0; }
 
+// Number in [0,1[ for the emission parameter of Sobol dimension dim
+
+double Light::sample(int dim)
+{
+    if(sampling_qmc) return qmc.sample(NRays_sent,dim);
+    
+    return randp();
+}
+
+void Light::set_aperture(Vector3 const &center,double radius)
+{
+    aperture_set=true;
+    aperture_center=center;
+    aperture_radius=radius;
+}
+
 void Light::set_power(double power_) { power=power_; }
 
+void Light::set_sampling_qmc(bool qmc_) { sampling_qmc=qmc_; }
+
+void Light::set_sampling_seed(std::uint64_t seed) { qmc.seed(seed); }
+
 void Light::set_spectrum_file(std::string const &fname)
 {
     spectrum_file=fname;
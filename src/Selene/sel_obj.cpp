@@ -14,8 +14,13 @@ limitations under the License.*/
 
 #include <selene.h>
 #include <mesh_tools.h>
+#include <profiler.h>
 #include <ray_intersect.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
 extern std::ofstream plog;
 
 namespace Sel
@@ -110,7 +115,15 @@ Object::Object()
      sens_ray_obj_intersection(false),
      sens_ray_obj_direction(false),
      sens_ray_obj_polar(false),
-     sens_ray_obj_face(false)
+     sens_ray_obj_face(false),
+     sens_ascii(false),
+     sens_reduce(false),
+     sb_Nmax(0),
+     sb_Ncurr(0),
+     sb_Ntot(0),
+     sb_reduction_slot(-1),
+     sb_noise_slot(-1),
+     sb_power_offset(0)
 {
     type=OBJ_UNSET;
     build_variables_map();
@@ -167,74 +180,130 @@ void Object::build_variables_map()
 }
 
 
-void Object::bootstrap(std::filesystem::path const &output_directory,double ray_power,int max_ray_bounces)
+// Fixed width in practice, so that the sensor files can be updated in place
+
+std::string sensor_power_string(double ray_power)
+{
+    char buf[32];
+    std::snprintf(buf,32,"%.16e",ray_power);
+    
+    return buf;
+}
+
+void Object::bootstrap(std::filesystem::path const &output_directory,double ray_power,int max_ray_bounces,bool resume)
 {
     consolidate_position();
     
-    if(sensor_type!=Sensor::NONE)
+    if(sensor_type!=Sensor::NONE && sens_reduce)
+    {
+        // Only the reductions are kept, nothing is recorded per hit
+        
+        sb_fname=output_directory / (name+"_sensor_reduction.txt");
+        
+        if(sb_file.is_open()) sb_file.close();
+        sb_writer.close();
+        cleanup_done=false;
+        
+        if(!resume)
+        {
+            SensorReduction layout;
+            
+            layout.power_unit=ray_power;
+            layout.Nu.resize(NFc);
+            layout.Nv.resize(NFc);
+            
+            for(int i=0;i<NFc;i++) default_N_uv(layout.Nu[i],layout.Nv[i],i);
+            
+            sb_reduction.reset_like(layout);
+        }
+    }
+    else if(sensor_type!=Sensor::NONE)
     {
         sb_fname=output_directory / (name+"_ray_sensor");
         
         if(sb_file.is_open()) sb_file.close();
+        sb_writer.close();
         cleanup_done=false;
         
-        sb_file.open(sb_fname,std::ios::out|std::ios::trunc|std::ios::binary);
+        std::stringstream header;
         
-        sb_Ncurr=sb_Ntot=0;
+        sb_Ncurr=0;
+        if(!resume) sb_Ntot=0;
         
         sb_Nmax=0;
         
         switch(type)
         {
             case OBJ_BOOLEAN:
-                sb_file<<"boolean "; break;
+                header<<"boolean "; break;
             case OBJ_BOX:
-                sb_file<<"box "<<box.get_lx()<<" "<<box.get_ly()<<" "<<box.get_lz(); break;
+                header<<"box "<<box.get_lx()<<" "<<box.get_ly()<<" "<<box.get_lz(); break;
             case OBJ_VOL_CONE:
-                sb_file<<"cone "; break;
+                header<<"cone "; break;
             case OBJ_CONIC:
-                sb_file<<"conic_section "<<conic.R_factor<<" "<<conic.K_factor<<" "<<conic.in_radius<<" "<<conic.out_radius; break;
+                header<<"conic_section "<<conic.R_factor<<" "<<conic.K_factor<<" "<<conic.in_radius<<" "<<conic.out_radius; break;
             case OBJ_VOL_CYLINDER:
-                sb_file<<"cylinder "<<cylinder.length<<" "<<cylinder.radius<<" "<<cylinder.cut_factor; break;
+                header<<"cylinder "<<cylinder.length<<" "<<cylinder.radius<<" "<<cylinder.cut_factor; break;
             case OBJ_DISK:
-                sb_file<<"disk "<<disk.radius<<" "<<disk.in_radius; break;
+                header<<"disk "<<disk.radius<<" "<<disk.in_radius; break;
             case OBJ_LENS:
-                sb_file<<"lens "<<lens.thickness<<" "<<lens.max_outer_radius<<" "<<lens.radius_front<<" "<<lens.radius_back; break;
+                header<<"lens "<<lens.thickness<<" "<<lens.max_outer_radius<<" "<<lens.radius_front<<" "<<lens.radius_back; break;
             case OBJ_MESH:
-                sb_file<<"mesh "<<mesh.get_mesh_path().generic_string(); break;
+                header<<"mesh "<<mesh.get_mesh_path().generic_string(); break;
             case OBJ_RECTANGLE:
-                sb_file<<"rectangle "<<rectangle.get_ly()<<" "<<rectangle.get_lz(); break;
+                header<<"rectangle "<<rectangle.get_ly()<<" "<<rectangle.get_lz(); break;
             case OBJ_PARABOLA:
-                sb_file<<"parabola "<<parabola.focal<<" "<<parabola.inner_radius<<" "<<parabola.length; break;
+                header<<"parabola "<<parabola.focal<<" "<<parabola.inner_radius<<" "<<parabola.length; break;
             case OBJ_SPHERE:
-                sb_file<<"sphere "<<sphere.get_radius()<<" "<<sphere.get_cut_factor(); break;
+                header<<"sphere "<<sphere.get_radius()<<" "<<sphere.get_cut_factor(); break;
             case OBJ_SPHERE_PATCH:
-                sb_file<<"spherical_patch "<<sphere_patch.get_radius()<<" "<<sphere_patch.get_cut_factor(); break;
+                header<<"spherical_patch "<<sphere_patch.get_radius()<<" "<<sphere_patch.get_cut_factor(); break;
+        }
+        
+        header<<"\n";
+        header<<loc.x<<" "<<loc.y<<" "<<loc.z<<" "
+              <<local_x.x<<" "<<local_x.y<<" "<<local_x.z<<" "
+              <<local_y.x<<" "<<local_y.y<<" "<<local_y.z<<" "
+              <<local_z.x<<" "<<local_z.y<<" "<<local_z.z<<" "
+              <<bbox.xm<<" "<<bbox.xp<<" "
+              <<bbox.ym<<" "<<bbox.yp<<" "
+              <<bbox.zm<<" "<<bbox.zp<<" ";
+        
+        std::streamoff power_offset=header.tellp();
+        header<<sensor_power_string(ray_power)<<"\n";
+        
+        if(sens_wavelength) { sb_Nmax+=sizeof(double); header<<"wavelength "; }
+        if(sens_source) { sb_Nmax+=sizeof(int); header<<"source "; }
+        if(sens_path) { sb_Nmax+=sizeof(int); header<<"path "; }
+        if(sens_generation) { sb_Nmax+=sizeof(int); header<<"generation "; }
+        if(sens_length) { sb_Nmax+=sizeof(double); header<<"length "; }
+        if(sens_phase) { sb_Nmax+=sizeof(double); header<<"phase "; }
+        if(sens_ray_world_intersection) { sb_Nmax+=3*sizeof(double); header<<"world_intersection "; }
+        if(sens_ray_world_direction) { sb_Nmax+=3*sizeof(double); header<<"world_direction "; }
+        if(sens_ray_world_polar) { sb_Nmax+=3*sizeof(double); header<<"world_polarization "; }
+        if(sens_ray_obj_intersection) { sb_Nmax+=3*sizeof(double); header<<"obj_intersection "; }
+        if(sens_ray_obj_direction) { sb_Nmax+=3*sizeof(double); header<<"obj_direction "; }
+        if(sens_ray_obj_polar) { sb_Nmax+=3*sizeof(double); header<<"obj_polarization "; }
+        if(sens_ray_obj_face) { sb_Nmax+=sizeof(int); header<<"obj_face "; }
+        
+        // A resumed render appends to the previous file, header included
+        
+        if(sens_ascii)
+        {
+            if(resume) sb_file.open(sb_fname,std::ios::out|std::ios::app|std::ios::binary);
+            else
+            {
+                sb_file.open(sb_fname,std::ios::out|std::ios::trunc|std::ios::binary);
+                sb_file<<header.str();
+            }
         }
+        else sb_writer.open(sb_fname,header.str(),resume);
         
-        sb_file<<"\n";
-        sb_file<<loc.x<<" "<<loc.y<<" "<<loc.z<<" "
-               <<local_x.x<<" "<<local_x.y<<" "<<local_x.z<<" "
-               <<local_y.x<<" "<<local_y.y<<" "<<local_y.z<<" "
-               <<local_z.x<<" "<<local_z.y<<" "<<local_z.z<<" "
-               <<bbox.xm<<" "<<bbox.xp<<" "
-               <<bbox.ym<<" "<<bbox.yp<<" "
-               <<bbox.zm<<" "<<bbox.zp<<" "
-               <<ray_power<<"\n";
-        
-        if(sens_wavelength) { sb_Nmax+=sizeof(double); sb_file<<"wavelength "; }
-        if(sens_source) { sb_Nmax+=sizeof(int); sb_file<<"source "; }
-        if(sens_path) { sb_Nmax+=sizeof(int); sb_file<<"path "; }
-        if(sens_generation) { sb_Nmax+=sizeof(int); sb_file<<"generation "; }
-        if(sens_length) { sb_Nmax+=sizeof(double); sb_file<<"length "; }
-        if(sens_phase) { sb_Nmax+=sizeof(double); sb_file<<"phase "; }
-        if(sens_ray_world_intersection) { sb_Nmax+=3*sizeof(double); sb_file<<"world_intersection "; }
-        if(sens_ray_world_direction) { sb_Nmax+=3*sizeof(double); sb_file<<"world_direction "; }
-        if(sens_ray_world_polar) { sb_Nmax+=3*sizeof(double); sb_file<<"world_polarization "; }
-        if(sens_ray_obj_intersection) { sb_Nmax+=3*sizeof(double); sb_file<<"obj_intersection "; }
-        if(sens_ray_obj_direction) { sb_Nmax+=3*sizeof(double); sb_file<<"obj_direction "; }
-        if(sens_ray_obj_polar) { sb_Nmax+=3*sizeof(double); sb_file<<"obj_polarization "; }
-        if(sens_ray_obj_face) { sb_Nmax+=sizeof(int); sb_file<<"obj_face "; }
+        if(!resume)
+        {
+            sb_power_offset=power_offset;
+            if(!sens_ascii) sb_power_offset+=8+sizeof(std::uint32_t);
+        }
         
         sb_Nmax=static_cast<int>(150e6/sb_Nmax);
         
@@ -261,9 +330,27 @@ void Object::cleanup()
 {
     if(sensor_type!=Sensor::NONE)
     {
-        sens_buffer_dump();
-        
-        sb_file.close();
+        if(sens_reduce)
+        {
+            ProfileZone zone("sensor_dump");
+            sb_reduction.write(sb_fname);
+        }
+        else
+        {
+            sens_buffer_dump();
+            
+            if(sens_ascii)
+            {
+                sb_file.close();
+                
+                if(sb_file.fail())
+                {
+                    Plog::print(LogType::FATAL, "Could not write the sensor file ", sb_fname, "\nAborting...\n");
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+            else sb_writer.close();
+        }
     }
     
     cleanup_done=true;
@@ -553,6 +640,62 @@ void Object::intersect(SelRay const &base_ray,std::vector<RayInter> &interlist,i
     }
 }
 
+// Box of the object in the frame it is placed in, that is the box of its
+// corners once moved by loc and the local axes
+
+BoundingBox frame_bbox(BoundingBox const &box,Frame const &frame)
+{
+    BoundingBox out=bbox_empty();
+    
+    for(int i=0;i<8;i++)
+    {
+        double x=(i&1) ? box.xp : box.xm;
+        double y=(i&2) ? box.yp : box.ym;
+        double z=(i&4) ? box.zp : box.zm;
+        
+        Vector3 V=frame.loc+x*frame.local_x+y*frame.local_y+z*frame.local_z;
+        
+        BoundingBox corner;
+        corner.xm=corner.xp=V.x;
+        corner.ym=corner.yp=V.y;
+        corner.zm=corner.zp=V.z;
+        
+        bbox_expand(out,corner);
+    }
+    
+    return out;
+}
+
+// Booleans have no box of their own, their operands are placed in the frame
+// of the boolean object
+
+BoundingBox Object::get_local_bbox()
+{
+    if(type!=OBJ_BOOLEAN) return bbox;
+    
+    BoundingBox out=frame_bbox(bool_obj_1->get_local_bbox(),*bool_obj_1);
+    
+    if(boolean_type!=Boolean_Type::EXCLUDE)
+        bbox_expand(out,frame_bbox(bool_obj_2->get_local_bbox(),*bool_obj_2));
+    
+    return out;
+}
+
+BoundingBox Object::get_world_bbox()
+{
+    BoundingBox out=frame_bbox(get_local_bbox(),*this);
+    
+    // Padding so that rays grazing a flat object are never rejected
+    
+    double pad=1e-9*std::max({out.span_x(),out.span_y(),out.span_z()})+1e-15;
+    
+    out.xm-=pad; out.xp+=pad;
+    out.ym-=pad; out.yp+=pad;
+    out.zm-=pad; out.zp+=pad;
+    
+    return out;
+}
+
 bool Object::intersect_boundaries_box(SelRay const &ray)
 {
     if(type!=OBJ_BOOLEAN)
@@ -590,7 +733,7 @@ bool Object::intersect_boundaries_box(SelRay const &ray)
     }
 }
 
-void Object::process_intersection(RayPath &path)
+void Object::process_intersection(RayPath &path,std::vector<SensorHit> &hits,ProfileCounter &irf_counter)
 {
     SelRay &ray=path.ray;
     RayInter &inter=path.intersection;
@@ -611,7 +754,15 @@ void Object::process_intersection(RayPath &path)
     
     if(sensor_type!=Sensor::NONE)
     {
-        sens_buffer_add(ray,next_start,next_start_obj,face_inter);
+        SensorHit hit;
+        
+        hit.object=this;
+        hit.face=face_inter;
+        hit.ray=ray;
+        hit.world_intersection=next_start;
+        hit.obj_intersection=next_start_obj;
+        
+        hits.push_back(hit);
         
         if(sensor_type==Sensor::ABS)
         {
@@ -664,10 +815,15 @@ void Object::process_intersection(RayPath &path)
     if(randp()>beer_lambert_factor) abs_ray=true;
     else
     {
+        irf_counter.start();
+        
         abs_ray=irf->get_response(dir_out,polar_out,
                                   local_dir,local_polar,
                                   Fnorm,Ftang,
-                                  lambda,n1.real(),n2.real());
+                                  lambda,n1.real(),n2.real(),
+                                  n1_mat,n2_mat);
+        
+        irf_counter.stop();
     
         // Reflected or transmitted determination
         
@@ -723,6 +879,12 @@ void Object::sens_buffer_add(SelRay &ray,
                              Vector3 const &obj_intersection,
                              int hit_face)
 {
+    if(sens_reduce)
+    {
+        sens_reduction_add(sb_reduction,ray,obj_intersection,hit_face);
+        return;
+    }
+    
     SelRay local_ray;
     to_local_ray(local_ray,ray);
     
@@ -750,8 +912,84 @@ void Object::sens_buffer_add(SelRay &ray,
 
 void Object::sens_buffer_dump()
 {
+    ProfileZone zone("sensor_dump");
+    
     int i;
     
+    if(!sens_ascii)
+    {
+        // Columnar block, handed over to the writer thread
+        
+        std::size_t Nr=std::min(sb_Nmax,sb_Ncurr);
+        
+        std::size_t Nbytes=0;
+        
+        if(sens_wavelength) Nbytes+=sizeof(double);
+        if(sens_source) Nbytes+=sizeof(std::int32_t);
+        if(sens_path) Nbytes+=sizeof(std::int32_t);
+        if(sens_generation) Nbytes+=sizeof(std::int32_t);
+        if(sens_length) Nbytes+=sizeof(double);
+        if(sens_phase) Nbytes+=sizeof(double);
+        if(sens_ray_world_intersection) Nbytes+=3*sizeof(double);
+        if(sens_ray_world_direction) Nbytes+=3*sizeof(double);
+        if(sens_ray_world_polar) Nbytes+=3*sizeof(double);
+        if(sens_ray_obj_intersection) Nbytes+=3*sizeof(double);
+        if(sens_ray_obj_direction) Nbytes+=3*sizeof(double);
+        if(sens_ray_obj_polar) Nbytes+=3*sizeof(double);
+        if(sens_ray_obj_face) Nbytes+=sizeof(std::int32_t);
+        
+        sb_block.resize(sizeof(std::uint64_t)+Nr*Nbytes);
+        
+        char *ptr=sb_block.data();
+        
+        std::uint64_t Nr_64=Nr;
+        std::memcpy(ptr,&Nr_64,sizeof(std::uint64_t));
+        ptr+=sizeof(std::uint64_t);
+        
+        auto add_int=[&](std::vector<int> const &data)
+        {
+            for(std::size_t j=0;j<Nr;j++)
+            {
+                std::int32_t value=data[j];
+                std::memcpy(ptr,&value,sizeof(std::int32_t));
+                ptr+=sizeof(std::int32_t);
+            }
+        };
+        
+        auto add_double=[&](std::vector<double> const &data)
+        {
+            std::memcpy(ptr,data.data(),Nr*sizeof(double));
+            ptr+=Nr*sizeof(double);
+        };
+        
+        auto add_vector=[&](std::vector<Vector3> const &data)
+        {
+            for(std::size_t j=0;j<Nr;j++) { std::memcpy(ptr,&data[j].x,sizeof(double)); ptr+=sizeof(double); }
+            for(std::size_t j=0;j<Nr;j++) { std::memcpy(ptr,&data[j].y,sizeof(double)); ptr+=sizeof(double); }
+            for(std::size_t j=0;j<Nr;j++) { std::memcpy(ptr,&data[j].z,sizeof(double)); ptr+=sizeof(double); }
+        };
+        
+        if(sens_wavelength) add_double(sb_lambda);
+        if(sens_source) add_int(sb_source);
+        if(sens_path) add_int(sb_path);
+        if(sens_generation) add_int(sb_generation);
+        if(sens_length) add_double(sb_opl);
+        if(sens_phase) add_double(sb_phase);
+        if(sens_ray_world_intersection) add_vector(sb_world_i);
+        if(sens_ray_world_direction) add_vector(sb_world_d);
+        if(sens_ray_world_polar) add_vector(sb_world_polar);
+        if(sens_ray_obj_intersection) add_vector(sb_obj_i);
+        if(sens_ray_obj_direction) add_vector(sb_obj_d);
+        if(sens_ray_obj_polar) add_vector(sb_obj_polar);
+        if(sens_ray_obj_face) add_int(sb_face);
+        
+        if(Nr>0) sb_writer.push(sb_block);
+        
+        sb_Ncurr=0;
+        
+        return;
+    }
+    
     std::stringstream strm;
     
     for(i=0;i<std::min(sb_Nmax,sb_Ncurr);i++)
@@ -777,6 +1015,20 @@ void Object::sens_buffer_dump()
     sb_Ncurr=0;
 }
 
+void Object::sens_reduction_add(SensorReduction &reduction,
+                                SelRay const &ray,
+                                Vector3 const &obj_intersection,
+                                int hit_face)
+{
+    SelRay local_ray;
+    to_local_ray(local_ray,ray);
+    
+    double u=0,v=0;
+    xyz_to_uv(u,v,hit_face,obj_intersection.x,obj_intersection.y,obj_intersection.z);
+    
+    reduction.add(hit_face,u,v,obj_intersection,local_ray.dir,ray.lambda);
+}
+
 void Object::set_default_in_irf(IRF *irf)
 {
     if(type==OBJ_BOOLEAN)
@@ -903,6 +1155,44 @@ void Object::set_sens_transp()
     sensor_type=Sensor::TRANSP;
 }
 
+/*
+ * Updates the unit ray power of the sensor outputs once the render is over,
+ * for renders whose final ray count was not known at bootstrap
+ */
+
+void Object::set_sensor_ray_power(double ray_power)
+{
+    if(sensor_type==Sensor::NONE) return;
+    
+    if(sens_reduce)
+    {
+        sb_reduction.power_unit=ray_power;
+        sb_reduction.write(sb_fname);
+        
+        return;
+    }
+    
+    std::string power=sensor_power_string(ray_power);
+    
+    std::fstream file(sb_fname,std::ios::in|std::ios::out|std::ios::binary);
+    
+    std::string current(power.size(),' ');
+    char next=0;
+    
+    file.seekg(sb_power_offset);
+    file.read(current.data(),current.size());
+    file.get(next);
+    
+    if(!file || next!='\n' || current.find('\n')!=std::string::npos)
+    {
+        Plog::print(LogType::WARNING, "Could not update the ray power of ", sb_fname, "\n");
+        return;
+    }
+    
+    file.seekp(sb_power_offset);
+    file.write(power.data(),power.size());
+}
+
 
 void Object::to_local_ray(SelRay &ray,SelRay const &base_ray)
 {
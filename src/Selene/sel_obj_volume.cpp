@@ -51,9 +51,9 @@ void Object::intersect_boolean(SelRay const &ray,std::vector<RayInter> &interlis
     bool in_obj_1=false,in_obj_2=false;
     
     // Getting all the intersections of both object
+    // Local buffers, booleans can be nested and are traced by several threads
     
-    bool_buffer_1.clear();
-    bool_buffer_2.clear();
+    std::vector<RayInter> bool_buffer_1,bool_buffer_2;
     
     if(face_last_intersect>=bool_obj_1->NFc)
     {
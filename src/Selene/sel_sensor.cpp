@@ -0,0 +1,786 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <logger.h>
+#include <selene.h>
+#include <string_tools.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace Sel
+{
+
+char const sensor_file_magic[8]={'S','E','L','S','E','N','S','1'};
+
+//##################
+//   SensorWriter
+//##################
+
+SensorWriter::SensorWriter()
+    :closing(false),
+     failed(false),
+     worker(nullptr)
+{
+}
+
+SensorWriter::~SensorWriter()
+{
+    close();
+}
+
+void SensorWriter::close()
+{
+    if(worker!=nullptr)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            closing=true;
+        }
+        
+        queue_cv.notify_all();
+        
+        worker->join();
+        delete worker;
+        worker=nullptr;
+    }
+    
+    if(file.is_open())
+    {
+        file.close();
+        
+        if(failed || file.fail())
+        {
+            Plog::print(LogType::FATAL, "Could not write the sensor file ", fname, "\nAborting...\n");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+bool SensorWriter::is_open() const
+{
+    return worker!=nullptr;
+}
+
+void SensorWriter::open(std::filesystem::path const &fname_,std::string const &header,bool append)
+{
+    close();
+    
+    fname=fname_;
+    failed=false;
+    
+    if(append) file.open(fname,std::ios::out|std::ios::app|std::ios::binary);
+    else file.open(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    if(!file.is_open())
+    {
+        Plog::print(LogType::FATAL, "Could not open the sensor file ", fname, "\nAborting...\n");
+        std::exit(EXIT_FAILURE);
+    }
+    
+    if(!append)
+    {
+        std::uint32_t header_size=header.size();
+        
+        file.write(sensor_file_magic,8);
+        file.write(reinterpret_cast<char const*>(&header_size),sizeof(std::uint32_t));
+        file.write(header.data(),header.size());
+        
+        if(!file)
+        {
+            Plog::print(LogType::FATAL, "Could not write the header of the sensor file ", fname, "\nAborting...\n");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    
+    closing=false;
+    queue.clear();
+    
+    worker=new std::thread(&SensorWriter::run,this);
+}
+
+void SensorWriter::push(std::vector<char> &block)
+{
+    if(worker==nullptr) return;
+    
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    
+    // At most two blocks in flight, the tracing waits for the disk beyond that
+    queue_cv.wait(lock,[&]{ return queue.size()<2; });
+    
+    queue.emplace_back();
+    queue.back().swap(block);
+    
+    lock.unlock();
+    queue_cv.notify_all();
+}
+
+void SensorWriter::run()
+{
+    std::vector<char> block;
+    
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            
+            queue_cv.wait(lock,[&]{ return closing || !queue.empty(); });
+            
+            if(queue.empty()) return;
+            
+            block.swap(queue.front());
+            queue.pop_front();
+        }
+        
+        queue_cv.notify_all();
+        
+        // Once a write failed, the file is truncated and the rest is dropped
+        
+        if(!failed)
+        {
+            file.write(block.data(),block.size());
+            
+            if(!file)
+            {
+                failed=true;
+                Plog::print(LogType::WARNING, "Writing to the sensor file ", fname,
+                            " failed, the following hits are lost\n");
+            }
+        }
+        
+        block.clear();
+    }
+}
+
+//################
+//   SensorFile
+//################
+
+SensorFile::SensorFile()
+    :N_rows(0)
+{
+}
+
+void SensorFile::close()
+{
+    map.close();
+    
+    N_rows=0;
+    header.clear();
+    columns.clear();
+    blocks_offset.clear();
+    blocks_rows.clear();
+}
+
+char const* SensorFile::column_data(int column,std::size_t block) const
+{
+    char const *ptr=map.data()+blocks_offset[block];
+    std::size_t Nr=blocks_rows[block];
+    
+    for(int i=0;i<column;i++)
+    {
+        std::size_t Nbytes=column_is_integer(columns[i]) ? sizeof(std::int32_t) : sizeof(double);
+        ptr+=Nbytes*column_components(columns[i])*Nr;
+    }
+    
+    return ptr;
+}
+
+int SensorFile::column_components(std::string const &name)
+{
+    if(   name=="world_intersection" || name=="world_direction" || name=="world_polarization"
+       || name=="obj_intersection" || name=="obj_direction" || name=="obj_polarization") return 3;
+    
+    return 1;
+}
+
+bool SensorFile::column_is_integer(std::string const &name)
+{
+    return name=="source" || name=="path" || name=="generation" || name=="obj_face";
+}
+
+void SensorFile::export_ascii(std::filesystem::path const &fname) const
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    for(std::size_t i=0;i<header.size();i++)
+    {
+        file<<header[i];
+        if(i+1<header.size()) file<<"\n";
+    }
+    
+    std::stringstream strm;
+    
+    for(std::size_t b=0;b<blocks_rows.size();b++)
+    {
+        std::size_t Nr=blocks_rows[b];
+        
+        std::vector<char const*> data(columns.size());
+        for(std::size_t c=0;c<columns.size();c++) data[c]=column_data(c,b);
+        
+        for(std::size_t r=0;r<Nr;r++)
+        {
+            strm<<"\n";
+            
+            for(std::size_t c=0;c<columns.size();c++)
+            {
+                int Ncomp=column_components(columns[c]);
+                
+                for(int k=0;k<Ncomp;k++)
+                {
+                    if(column_is_integer(columns[c]))
+                    {
+                        std::int32_t value;
+                        std::memcpy(&value,data[c]+(k*Nr+r)*sizeof(std::int32_t),sizeof(std::int32_t));
+                        strm<<value<<" ";
+                    }
+                    else
+                    {
+                        double value;
+                        std::memcpy(&value,data[c]+(k*Nr+r)*sizeof(double),sizeof(double));
+                        strm<<value<<" ";
+                    }
+                }
+            }
+        }
+        
+        file<<strm.str();
+        strm.str("");
+    }
+}
+
+int SensorFile::find_column(std::string const &name) const
+{
+    for(std::size_t i=0;i<columns.size();i++)
+        if(columns[i]==name) return i;
+    
+    return -1;
+}
+
+std::size_t SensorFile::get_block_rows(std::size_t block) const { return blocks_rows[block]; }
+
+// First value of a column in a block, nullptr if the column is not recorded
+
+char const* SensorFile::get_column(std::string const &name,std::size_t block) const
+{
+    int column=find_column(name);
+    
+    if(column<0) return nullptr;
+    
+    return column_data(column,block);
+}
+
+std::vector<std::string> const& SensorFile::get_header() const { return header; }
+
+std::size_t SensorFile::get_N_blocks() const { return blocks_rows.size(); }
+
+std::size_t SensorFile::get_N_rows() const { return N_rows; }
+
+bool SensorFile::has_column(std::string const &name) const
+{
+    return find_column(name)>=0;
+}
+
+bool SensorFile::is_binary(std::filesystem::path const &fname)
+{
+    std::ifstream file(fname,std::ios::in|std::ios::binary);
+    
+    char magic[8];
+    file.read(magic,8);
+    
+    return file.gcount()==8 && std::memcmp(magic,sensor_file_magic,8)==0;
+}
+
+bool SensorFile::is_open() const
+{
+    return map.is_open();
+}
+
+bool SensorFile::open(std::filesystem::path const &fname)
+{
+    close();
+    
+    if(!map.open(fname)) return false;
+    
+    char const *data=map.data();
+    std::size_t Nbytes=map.size();
+    
+    std::uint32_t header_size;
+    
+    if(   Nbytes<8+sizeof(std::uint32_t)
+       || std::memcmp(data,sensor_file_magic,8)!=0)
+    {
+        close();
+        return false;
+    }
+    
+    std::memcpy(&header_size,data+8,sizeof(std::uint32_t));
+    
+    std::size_t offset=8+sizeof(std::uint32_t);
+    
+    if(offset+header_size>Nbytes)
+    {
+        close();
+        return false;
+    }
+    
+    std::string header_text(data+offset,header_size);
+    offset+=header_size;
+    
+    // The header lines are kept verbatim for the ASCII export
+    
+    std::stringstream header_strm(header_text);
+    std::string line;
+    
+    while(std::getline(header_strm,line)) header.push_back(line);
+    
+    if(header.size()<3)
+    {
+        close();
+        return false;
+    }
+    
+    split_string(columns,header[2]);
+    
+    std::size_t row_size=0;
+    
+    for(std::string const &name : columns)
+    {
+        std::size_t Nbytes_value=column_is_integer(name) ? sizeof(std::int32_t) : sizeof(double);
+        row_size+=Nbytes_value*column_components(name);
+    }
+    
+    // Block index, a truncated last block is ignored
+    
+    while(offset+sizeof(std::uint64_t)<=Nbytes)
+    {
+        std::uint64_t Nr;
+        std::memcpy(&Nr,data+offset,sizeof(std::uint64_t));
+        offset+=sizeof(std::uint64_t);
+        
+        if(offset+Nr*row_size>Nbytes) break;
+        
+        blocks_offset.push_back(offset);
+        blocks_rows.push_back(Nr);
+        
+        offset+=Nr*row_size;
+        N_rows+=Nr;
+    }
+    
+    return true;
+}
+
+void SensorFile::read_column(std::string const &name,std::vector<double> &data) const
+{
+    int column=find_column(name);
+    
+    data.resize(N_rows);
+    if(column<0) return;
+    
+    std::size_t r=0;
+    
+    for(std::size_t b=0;b<blocks_rows.size();b++)
+    {
+        char const *ptr=column_data(column,b);
+        std::size_t Nr=blocks_rows[b];
+        
+        if(column_is_integer(name))
+        {
+            for(std::size_t i=0;i<Nr;i++)
+            {
+                std::int32_t value;
+                std::memcpy(&value,ptr+i*sizeof(std::int32_t),sizeof(std::int32_t));
+                data[r+i]=value;
+            }
+        }
+        else std::memcpy(data.data()+r,ptr,Nr*sizeof(double));
+        
+        r+=Nr;
+    }
+}
+
+void SensorFile::read_column(std::string const &name,std::vector<int> &data) const
+{
+    int column=find_column(name);
+    
+    data.resize(N_rows);
+    if(column<0) return;
+    
+    std::size_t r=0;
+    
+    for(std::size_t b=0;b<blocks_rows.size();b++)
+    {
+        char const *ptr=column_data(column,b);
+        std::size_t Nr=blocks_rows[b];
+        
+        for(std::size_t i=0;i<Nr;i++)
+        {
+            if(column_is_integer(name))
+            {
+                std::int32_t value;
+                std::memcpy(&value,ptr+i*sizeof(std::int32_t),sizeof(std::int32_t));
+                data[r+i]=value;
+            }
+            else
+            {
+                double value;
+                std::memcpy(&value,ptr+i*sizeof(double),sizeof(double));
+                data[r+i]=value;
+            }
+        }
+        
+        r+=Nr;
+    }
+}
+
+void SensorFile::read_column(std::string const &name,std::vector<Vector3> &data) const
+{
+    int column=find_column(name);
+    
+    data.resize(N_rows);
+    if(column<0 || column_components(name)!=3) return;
+    
+    std::size_t r=0;
+    
+    for(std::size_t b=0;b<blocks_rows.size();b++)
+    {
+        char const *ptr=column_data(column,b);
+        std::size_t Nr=blocks_rows[b];
+        
+        for(std::size_t i=0;i<Nr;i++)
+        {
+            std::memcpy(&data[r+i].x,ptr+(0*Nr+i)*sizeof(double),sizeof(double));
+            std::memcpy(&data[r+i].y,ptr+(1*Nr+i)*sizeof(double),sizeof(double));
+            std::memcpy(&data[r+i].z,ptr+(2*Nr+i)*sizeof(double),sizeof(double));
+        }
+        
+        r+=Nr;
+    }
+}
+
+//#################
+//   SensorNoise
+//#################
+
+SensorNoise::SensorNoise()
+    :N_batches(0), sum_n(0), sum_n2(0)
+{
+}
+
+void SensorNoise::add_batch(std::vector<double> const &counts,double n)
+{
+    if(n<=0) return;
+    
+    N_batches+=1.0;
+    sum_n+=n;
+    sum_n2+=n*n;
+    
+    for(std::size_t i=0;i<counts.size();i++)
+    {
+        double const &c=counts[i];
+        
+        sum_c[i]+=c;
+        sum_c2[i]+=c*c;
+        sum_cn[i]+=c*n;
+    }
+}
+
+int SensorNoise::bin(int face,double u,double v) const
+{
+    if(face<0 || face>=static_cast<int>(Nu.size())) return -1;
+    
+    // Same bin widths as RayCounter
+    
+    double Du=1.0/Nu[face];
+    double Dv=1.0/Nv[face];
+    
+    int m=u/Du;
+    int n=v/Dv;
+    
+    if(m<0 || m>=Nu[face] || n<0 || n>=Nv[face]) return -1;
+    
+    return face_offset[face]+m+Nu[face]*n;
+}
+
+/*
+ * Ratio estimator of the hits per ray family of every bin, with the variance
+ * of the batch means. The error is the largest relative standard deviation
+ * over the bins holding at least threshold times the hits of the fullest one.
+ */
+
+double SensorNoise::relative_error(double threshold) const
+{
+    if(N_batches<16) return std::numeric_limits<double>::infinity();
+    
+    double c_max=0;
+    for(double const &c : sum_c) c_max=std::max(c_max,c);
+    
+    if(c_max<=0) return std::numeric_limits<double>::infinity();
+    
+    double n_mean=sum_n/N_batches;
+    double error=0;
+    
+    for(std::size_t i=0;i<sum_c.size();i++)
+    {
+        if(sum_c[i]<=0 || sum_c[i]<threshold*c_max) continue;
+        
+        double mu=sum_c[i]/sum_n;
+        double var=(sum_c2[i]-2.0*mu*sum_cn[i]+mu*mu*sum_n2)/(N_batches*(N_batches-1.0)*n_mean*n_mean);
+        
+        error=std::max(error,std::sqrt(std::max(var,0.0))/mu);
+    }
+    
+    return error;
+}
+
+/*
+ * Bins on the default uv grid of the sensor faces, or on a N_uv x N_uv grid if
+ * N_uv>0, the default grids can be too fine to converge in a reasonable time
+ */
+
+void SensorNoise::set_layout(Object *sensor,int N_uv)
+{
+    int NFc=sensor->get_N_faces();
+    
+    Nu.resize(NFc);
+    Nv.resize(NFc);
+    face_offset.resize(NFc);
+    
+    int N=0;
+    
+    for(int i=0;i<NFc;i++)
+    {
+        if(N_uv>0) Nu[i]=Nv[i]=N_uv;
+        else sensor->default_N_uv(Nu[i],Nv[i],i);
+        
+        face_offset[i]=N;
+        N+=Nu[i]*Nv[i];
+    }
+    
+    N_batches=sum_n=sum_n2=0;
+    
+    sum_c.assign(N,0);
+    sum_c2.assign(N,0);
+    sum_cn.assign(N,0);
+}
+
+std::size_t SensorNoise::size() const
+{
+    return sum_c.size();
+}
+
+//#####################
+//   SensorReduction
+//#####################
+
+SensorReduction::SensorReduction()
+    :N_hits(0), power_unit(1.0),
+     N_theta(90), N_phi(180),
+     N_lambda(100), lambda_min(0), lambda_max(0)
+{
+    clear();
+}
+
+void SensorReduction::add(int face,double u,double v,Vector3 const &obj_inter,Vector3 const &obj_dir,double lambda)
+{
+    N_hits+=1.0;
+    
+    double inter[3]={obj_inter.x,obj_inter.y,obj_inter.z};
+    double dir[3]={obj_dir.x,obj_dir.y,obj_dir.z};
+    
+    for(int k=0;k<3;k++)
+    {
+        double delta=inter[k]-inter_mean[k];
+        inter_mean[k]+=delta/N_hits;
+        inter_M2[k]+=delta*(inter[k]-inter_mean[k]);
+        
+        delta=dir[k]-dir_mean[k];
+        dir_mean[k]+=delta/N_hits;
+        dir_M2[k]+=delta*(dir[k]-dir_mean[k]);
+    }
+    
+    // Spatial
+    
+    if(face>=0 && face<static_cast<int>(spatial_bins.size()))
+    {
+        // Same bin widths as RayCounter
+        
+        double Du=1.0/Nu[face];
+        double Dv=1.0/Nv[face];
+        
+        int m=u/Du;
+        int n=v/Dv;
+        
+        if(m>=0 && m<Nu[face] && n>=0 && n<Nv[face]) spatial_bins[face](m,n)+=1.0;
+    }
+    
+    // Angular, polar angle from the local z axis and azimuth
+    
+    double theta=std::acos(std::clamp(obj_dir.z,-1.0,1.0));
+    double phi=std::atan2(obj_dir.y,obj_dir.x)+Pi;
+    
+    int m=std::min(static_cast<int>(theta/Pi*N_theta),N_theta-1);
+    int n=std::min(static_cast<int>(phi/(2.0*Pi)*N_phi),N_phi-1);
+    
+    if(m>=0 && n>=0) angular_bins(m,n)+=1.0;
+    
+    // Spectral
+    
+    if(lambda_max>lambda_min)
+    {
+        int l=(lambda-lambda_min)/(lambda_max-lambda_min)*N_lambda;
+        
+        if(lambda==lambda_max) l=N_lambda-1;
+        if(l>=0 && l<N_lambda) spectral_bins[l]+=1.0;
+    }
+    else if(N_lambda>0) spectral_bins[0]+=1.0;
+}
+
+double SensorReduction::angular_spread() const
+{
+    if(N_hits==0) return 0;
+    
+    return std::sqrt(dir_M2[0]/N_hits)+std::sqrt(dir_M2[1]/N_hits)+std::sqrt(dir_M2[2]/N_hits);
+}
+
+void SensorReduction::clear()
+{
+    N_hits=0;
+    
+    for(int k=0;k<3;k++)
+        inter_mean[k]=inter_M2[k]=dir_mean[k]=dir_M2[k]=0;
+    
+    for(Grid2<double> &bins : spatial_bins) bins=0;
+    
+    angular_bins.init(N_theta,N_phi,0);
+    spectral_bins.assign(N_lambda,0);
+}
+
+void SensorReduction::merge(SensorReduction const &reduction)
+{
+    double Na=N_hits;
+    double Nb=reduction.N_hits;
+    
+    if(Nb==0) return;
+    
+    double N=Na+Nb;
+    
+    for(int k=0;k<3;k++)
+    {
+        double delta=reduction.inter_mean[k]-inter_mean[k];
+        inter_mean[k]+=delta*Nb/N;
+        inter_M2[k]+=reduction.inter_M2[k]+delta*delta*Na*Nb/N;
+        
+        delta=reduction.dir_mean[k]-dir_mean[k];
+        dir_mean[k]+=delta*Nb/N;
+        dir_M2[k]+=reduction.dir_M2[k]+delta*delta*Na*Nb/N;
+    }
+    
+    N_hits=N;
+    
+    for(std::size_t f=0;f<spatial_bins.size();f++)
+    {
+        Grid2<double> &bins=spatial_bins[f];
+        Grid2<double> const &bins_b=reduction.spatial_bins[f];
+        
+        for(int i=0;i<bins.L1();i++) for(int j=0;j<bins.L2();j++)
+            bins(i,j)+=bins_b(i,j);
+    }
+    
+    for(int i=0;i<N_theta;i++) for(int j=0;j<N_phi;j++)
+        angular_bins(i,j)+=reduction.angular_bins(i,j);
+    
+    for(int l=0;l<N_lambda;l++) spectral_bins[l]+=reduction.spectral_bins[l];
+}
+
+void SensorReduction::reset_like(SensorReduction const &reduction)
+{
+    if(   Nu!=reduction.Nu || Nv!=reduction.Nv
+       || N_theta!=reduction.N_theta || N_phi!=reduction.N_phi
+       || N_lambda!=reduction.N_lambda)
+    {
+        Nu=reduction.Nu;
+        Nv=reduction.Nv;
+        
+        spatial_bins.resize(Nu.size());
+        for(std::size_t f=0;f<Nu.size();f++) spatial_bins[f].init(Nu[f],Nv[f],0);
+        
+        N_theta=reduction.N_theta;
+        N_phi=reduction.N_phi;
+        N_lambda=reduction.N_lambda;
+    }
+    
+    power_unit=reduction.power_unit;
+    lambda_min=reduction.lambda_min;
+    lambda_max=reduction.lambda_max;
+    
+    clear();
+}
+
+void SensorReduction::set_spectral_range(double lambda_min_,double lambda_max_)
+{
+    lambda_min=lambda_min_;
+    lambda_max=lambda_max_;
+}
+
+double SensorReduction::spatial_spread() const
+{
+    if(N_hits==0) return 0;
+    
+    return std::sqrt(inter_M2[0]/N_hits)+std::sqrt(inter_M2[1]/N_hits)+std::sqrt(inter_M2[2]/N_hits);
+}
+
+void SensorReduction::write(std::filesystem::path const &fname) const
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    file<<"hits "<<N_hits<<"\n";
+    file<<"power_unit "<<power_unit<<"\n";
+    
+    file<<"intersection_mean "<<inter_mean[0]<<" "<<inter_mean[1]<<" "<<inter_mean[2]<<"\n";
+    file<<"direction_mean "<<dir_mean[0]<<" "<<dir_mean[1]<<" "<<dir_mean[2]<<"\n";
+    
+    double N=std::max(N_hits,1.0);
+    
+    file<<"intersection_variance "<<inter_M2[0]/N<<" "<<inter_M2[1]/N<<" "<<inter_M2[2]/N<<"\n";
+    file<<"direction_variance "<<dir_M2[0]/N<<" "<<dir_M2[1]/N<<" "<<dir_M2[2]/N<<"\n";
+    
+    for(std::size_t f=0;f<spatial_bins.size();f++)
+    {
+        file<<"face "<<f<<" "<<Nu[f]<<" "<<Nv[f]<<"\n";
+        
+        for(int j=0;j<Nv[f];j++)
+        {
+            for(int i=0;i<Nu[f];i++) file<<spatial_bins[f](i,j)<<" ";
+            file<<"\n";
+        }
+    }
+    
+    file<<"angular "<<N_theta<<" "<<N_phi<<"\n";
+    
+    for(int i=0;i<N_theta;i++)
+    {
+        for(int j=0;j<N_phi;j++) file<<angular_bins(i,j)<<" ";
+        file<<"\n";
+    }
+    
+    file<<"spectral "<<N_lambda<<" "<<lambda_min<<" "<<lambda_max<<"\n";
+    
+    for(int l=0;l<N_lambda;l++) file<<spectral_bins[l]<<" ";
+    file<<"\n";
+}
+
+}
@@ -12,12 +12,18 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
+#include <limits>
 #include <list>
+#include <set>
 
 #include <filehdl.h>
 #include <selene.h>
 #include <mesh_tools.h>
+#include <profiler.h>
+#include <thread_utils.h>
 
 namespace Sel
 {
@@ -79,9 +85,16 @@ Selene::Selene()
     :Nobj(0),
      Nlight(0),
      render_number(0),
+     N_threads(0),
+     render_seed(0),
+     total_power(0),
+     ray_power(0),
      Nr_bounces(200),
      Nr_disp(1000),
      Nr_tot(10000),
+     Nr_units(0),
+     noise_threshold(0.1),
+     disp_cache_tolerance(1e-6),
      fetch_family(0),
      N_fetched_families(0),
      ray_family_counter(0),
@@ -116,6 +129,18 @@ void Selene::add_light(Light *src)
     Nlight+=1;
 }
 
+void Selene::add_noise_sensor(Object *obj,int N_uv)
+{
+    auto it=std::find(noise_sensors.begin(),noise_sensors.end(),obj);
+    
+    if(it!=noise_sensors.end()) noise_N_uv[it-noise_sensors.begin()]=N_uv;
+    else
+    {
+        noise_sensors.push_back(obj);
+        noise_N_uv.push_back(N_uv);
+    }
+}
+
 void Selene::add_object(Object *obj)
 {
     obj->obj_ID=Nobj;
@@ -183,89 +208,235 @@ void Selene::fetch_ray_lost(SelRay const &ray)
     }
 }
 
+void RenderBatch::clear()
+{
+    trace_calls=0;
+    
+    jobs.clear();
+    hits.clear();
+    fetch_rays.clear();
+    fetch_lost.clear();
+}
+
+/*
+ * Largest relative noise over the noise sensors, infinite until every one of
+ * them holds enough batches to estimate it
+ */
+
+double Selene::get_noise() const
+{
+    double error=0;
+    
+    for(SensorNoise const &sensor_noise : noise)
+        error=std::max(error,sensor_noise.relative_error(noise_threshold));
+    
+    return error;
+}
+
+bool Selene::get_spectral_range(double &lambda_min,double &lambda_max) const
+{
+    lambda_min=std::numeric_limits<double>::max();
+    lambda_max=0;
+    
+    for(int i=0;i<Nlight;i++)
+    {
+        Light const &light=*light_arr[i];
+        
+        if(light.spectrum_type==SPECTRUM_MONO)
+        {
+            lambda_min=std::min(lambda_min,light.lambda_mono);
+            lambda_max=std::max(lambda_max,light.lambda_mono);
+        }
+        else if(light.spectrum_type==SPECTRUM_POLY)
+        {
+            lambda_min=std::min(lambda_min,light.lambda_min);
+            lambda_max=std::max(lambda_max,light.lambda_max);
+        }
+        else if(light.spectrum_type==SPECTRUM_POLYMONO)
+        {
+            for(double lambda : light.polymono_lambda)
+            {
+                lambda_min=std::min(lambda_min,lambda);
+                lambda_max=std::max(lambda_max,lambda);
+            }
+        }
+    }
+    
+    return lambda_max>=lambda_min;
+}
+
+void Selene::merge_batch(RenderBatch &batch)
+{
+    for(SensorHit &hit : batch.hits)
+        hit.object->sens_buffer_add(hit.ray,hit.world_intersection,hit.obj_intersection,hit.face);
+    
+    for(std::size_t k=0;k<reduction_sensors.size();k++)
+        reduction_sensors[k]->sb_reduction.merge(batch.reductions[k]);
+    
+    for(std::size_t k=0;k<noise.size();k++)
+        noise[k].add_batch(batch.noise_counts[k],batch.jobs.size());
+    
+    unsigned int last_family=std::numeric_limits<unsigned int>::max();
+    
+    for(std::size_t i=0;i<batch.fetch_rays.size();i++)
+    {
+        SelRay const &ray=batch.fetch_rays[i];
+        
+        if(ray.family!=last_family)
+        {
+            light_N_fetched[ray.source_ID]++;
+            last_family=ray.family;
+        }
+        
+        if(batch.fetch_lost[i]) fetch_ray_lost(ray);
+        else fetch_ray(ray);
+    }
+    
+    trace_calls+=batch.trace_calls;
+}
+
 void Selene::render()
 {
     Timer timer;
     
     timer.tic();
     
+    if(Nlight==0) return;
+    
+    render_begin(false);
+    render_pass(Nr_tot);
+    render_end(false);
+        
+    timer.toc();
+    
+    chk_var(timer()/trace_calls);
+}
+
+/*
+ * Sets the lights, the objects and the caches up. A resumed render keeps the
+ * random streams, the ray counts, the fetcher and the sensors of the previous
+ * one, the sensor files are appended to.
+ */
+
+void Selene::render_begin(bool resume)
+{
+    ProfileZone zone("selene_setup");
+    
+    int i;
+    
     trace_calls=0;
     
-    if(Nlight==0) return;
+    if(resume && light_N_rays_total.size()!=static_cast<std::size_t>(Nlight))
+    {
+        Plog::print(LogType::FATAL, "No previous Selene render to resume\nAborting...\n");
+        std::exit(EXIT_FAILURE);
+    }
     
     if(!output_directory.empty())
         std::filesystem::create_directories(output_directory);
     
-    int i;
-    
     // Lights initialization
     
     for(i=0;i<Nlight;i++) light_arr[i]->bootstrap();
     
     // - Powers renomalization
     
-    double total_power=0;
+    total_power=0;
     for(i=0;i<Nlight;i++) total_power+=light_arr[i]->get_power();
     
-    ray_power=total_power/Nr_tot;
-    
-    int run_Nr_tot=0;
+    if(!resume)
+    {
+        ray_power=total_power/Nr_tot;
+        Nr_units=0;
+        
+        light_N_rays_total.assign(Nlight,0);
+    }
     
-    light_N_rays.resize(Nlight);
     light_Nr_disp.resize(Nlight);
     for(i=0;i<Nlight;i++)
-    {
-        light_N_rays[i]=std::max(static_cast<int>(light_arr[i]->get_power()/ray_power),1);
-        run_Nr_tot+=light_N_rays[i];
-        
         light_Nr_disp[i]=std::floor(Nr_disp*light_arr[i]->get_power()/total_power);
-    }
     
     // Objects initialization
     
     for(i=0;i<Nobj;i++)
-        obj_arr[i]->bootstrap(output_directory,ray_power,Nr_bounces);
+        obj_arr[i]->bootstrap(output_directory,ray_power,Nr_bounces,resume);
     
-    // Rendering
+    set_dispersion_caches(true);
+    set_irf_tables(true);
+    update_scene_bvh();
     
-    Nr_cast=0;
-    reset_fetcher();
-    for(i=0;i<Nlight;i++) light_arr[i]->reset_ray_counter();
+    // Reduction only sensors, accumulated per batch on the workers
     
-    RayPath ray_path;
+    reduction_sensors.clear();
     
-    ray_path=request_job();
-    Nr_cast++;
+    double lambda_min,lambda_max;
+    if(!get_spectral_range(lambda_min,lambda_max)) lambda_min=lambda_max=0;
     
-    while(ray_path.complete==false && Nr_cast<=run_Nr_tot)
+    for(i=0;i<Nobj;i++)
     {
-        request_raytrace(ray_path);
+        Object *obj=obj_arr[i];
         
-        RayInter &inter=ray_path.intersection;
-        
-//        if(inter.does_intersect==true)
-        if(ray_path.does_intersect==true)
-        {
-            obj_arr[inter.object]->process_intersection(ray_path);
-            fetch_ray(ray_path.ray);
-        }
-        else
+        if(obj->sensor_type!=Sensor::NONE && obj->sens_reduce)
         {
-            if(ray_path.ray.generation!=0) fetch_ray_lost(ray_path.ray);
-            ray_path.complete=true;
+            if(!resume) obj->sb_reduction.set_spectral_range(lambda_min,lambda_max);
+            obj->sb_reduction_slot=reduction_sensors.size();
+            
+            reduction_sensors.push_back(obj);
         }
+    }
+    
+    // Noise estimates
+    
+    for(i=0;i<Nobj;i++) obj_arr[i]->sb_noise_slot=-1;
+    
+    if(!resume) noise.resize(noise_sensors.size());
+    
+    for(std::size_t k=0;k<noise_sensors.size();k++)
+    {
+        noise_sensors[k]->sb_noise_slot=k;
+        if(!resume) noise[k].set_layout(noise_sensors[k],noise_N_uv[k]);
+    }
+    
+    if(!resume)
+    {
+        reset_fetcher();
+        for(i=0;i<Nlight;i++) light_arr[i]->reset_ray_counter();
         
-        ray_path.ray.generation++;
+        light_N_fetched.assign(Nlight,0);
+        render_seed=randi();
+        render_seed=(render_seed<<32)|randi();
         
-        if(ray_path.complete==true)
-        {
-            ray_path=request_job();
-            Nr_cast++;
-        }
+        for(i=0;i<Nlight;i++)
+            light_arr[i]->set_sampling_seed(render_seed+(i+1)*0x9E3779B97F4A7C15ull);
     }
+}
+
+void Selene::render_end(bool resume)
+{
+    ProfileZone zone("selene_output");
+    
+    int i;
+    
+    // The unit ray power follows the total number of rays of the render,
+    // the sensors are updated if it changed since their initialization
+    
+    double sensor_ray_power=ray_power;
+    ray_power=total_power/Nr_units;
     
     for(i=0;i<Nobj;i++) obj_arr[i]->cleanup();
     
+    if(ray_power!=sensor_ray_power)
+    {
+        for(i=0;i<Nobj;i++) obj_arr[i]->set_sensor_ray_power(ray_power);
+    }
+    
+    set_dispersion_caches(false);
+    set_irf_tables(false);
+    
+    // A resumed render replaces the outputs of the one it extends
+    
+    if(resume && render_number>0) render_number--;
+    
      std::ofstream file(output_directory / ("selene_fetcher_" + std::to_string(render_number) + ".txt"),
                         std::ios::out|std::ios::trunc);
     
@@ -289,7 +460,10 @@ void Selene::render()
     
     file.open(output_directory / ("selene_render_"+std::to_string(render_number)),
               std::ios::out|std::ios::trunc);
-              
+    
+    int run_Nr_tot=0;
+    for(int i=0;i<Nlight;i++) run_Nr_tot+=light_N_rays_total[i];
+    
     file<<"total_rays("<<run_Nr_tot<<")\n\n";
     
     for(int i=0;i<Nlight;i++)
@@ -297,19 +471,271 @@ void Selene::render()
     file<<"\n";
     
     for(int i=0;i<Nlight;i++)
-        file<<"source_N_rays("<<std::to_string(i)<<","<<std::to_string(light_N_rays[i])<<")\n";
+        file<<"source_N_rays("<<std::to_string(i)<<","<<std::to_string(light_N_rays_total[i])<<")\n";
     file<<"\n";
     
     file<<"unit_ray_power("<<ray_power<<")\n";
     
     render_number++;
     chk_var(trace_calls);
+}
+
+/*
+ * Traces Nr_pass rays, split between the lights according to their power.
+ * The ray families are numbered after the ones of the previous passes.
+ * Each light is brought to its share of all the rays cast so far and draws its
+ * random streams from its own family count, so it traces the same families
+ * however the render is split in passes. With several lights a resumed render
+ * records the same hits as a single one, but the sensor rows are grouped by pass.
+ */
+
+void Selene::render_pass(unsigned int Nr_pass)
+{
+    ProfileZone zone("selene_pass");
+    
+    // The jobs are generated here and the batches may be traced here too,
+    // which reseeds the generator of the calling thread
+    
+    RandpStateGuard randp_guard;
+    
+    int i;
+    
+    double total_ray_power=total_power/(Nr_units+Nr_pass);
+    
+    light_N_rays.resize(Nlight);
+    for(i=0;i<Nlight;i++)
+    {
+        int light_N_target=std::max(static_cast<int>(light_arr[i]->get_power()/total_ray_power),1);
+        light_N_rays[i]=std::max(light_N_target-light_N_rays_total[i],0);
+    }
+    
+    // Rendering
+    // Ray families are generated in order and traced by batches on the workers.
+    // Every bounce draws from its own random stream, keyed by the light, the
+    // family and the bounce, and the batches are merged back in family order,
+    // so that the sensors and the fetcher do not depend on the number of threads.
+    
+    Nr_cast=0;
+    
+    int Nthr=N_threads>0 ? N_threads : max_threads_number();
+    
+    unsigned int batch_size=256;
+    std::vector<RenderBatch> batches(4*Nthr);
+    
+    bool rays_left=true;
+    
+    while(rays_left)
+    {
+        int Nb=0;
         
+        for(RenderBatch &batch : batches)
+        {
+            batch.clear();
+            batch.reductions.resize(reduction_sensors.size());
+            batch.noise_counts.resize(noise.size());
+            
+            for(std::size_t k=0;k<reduction_sensors.size();k++)
+                batch.reductions[k].reset_like(reduction_sensors[k]->sb_reduction);
+            
+            for(std::size_t k=0;k<noise.size();k++)
+                batch.noise_counts[k].assign(noise[k].size(),0);
+            
+            while(batch.jobs.size()<batch_size)
+            {
+                RayPath ray_path=request_job();
+                Nr_cast++;
+                
+                if(ray_path.complete) { rays_left=false; break; }
+                
+                batch.jobs.push_back(ray_path);
+            }
+            
+            if(!batch.jobs.empty()) Nb++;
+            if(!rays_left) break;
+        }
+        
+        parallel_for(Nb,[&](int b) { trace_batch(batches[b]); },Nthr);
+        
+        ProfileZone zone_merge("merge");
+        for(int b=0;b<Nb;b++) merge_batch(batches[b]);
+    }
+    
+    for(i=0;i<Nlight;i++) light_N_rays_total[i]+=light_N_rays[i];
+    
+    Nr_units+=Nr_pass;
+}
+
+/*
+ * Traces passes of N_rays_total rays until the relative noise of the noise
+ * sensors is below target_error or Nr_max rays were cast, 0 removes the limit.
+ */
+
+void Selene::render_progressive(double target_error,unsigned int Nr_max,bool resume)
+{
+    Timer timer;
+    
+    timer.tic();
+    
+    if(Nlight==0) return;
+    
+    if(noise_sensors.empty() && Nr_max==0)
+    {
+        Plog::print(LogType::FATAL, "Progressive Selene render without noise sensor nor ray limit\nAborting...\n");
+        std::exit(EXIT_FAILURE);
+    }
+    
+    render_begin(resume);
+    
+    while(true)
+    {
+        unsigned int Nr_pass=Nr_tot;
+        
+        if(Nr_max>0)
+        {
+            if(Nr_units>=Nr_max) break;
+            Nr_pass=std::min(Nr_pass,Nr_max-Nr_units);
+        }
+        
+        render_pass(Nr_pass);
+        
+        double error=get_noise();
+        
+        Plog::print(Nr_units, " rays, relative noise ", error, "\n");
+        
+        if(!noise_sensors.empty() && error<=target_error) break;
+    }
+    
+    render_end(resume);
+    
     timer.toc();
     
     chk_var(timer()/trace_calls);
 }
 
+void Selene::render_resume(unsigned int Nr_add)
+{
+    if(light_N_rays_total.size()!=static_cast<std::size_t>(Nlight))
+    {
+        Plog::print(LogType::FATAL, "No previous Selene render to resume\nAborting...\n");
+        std::exit(EXIT_FAILURE);
+    }
+    
+    render_progressive(-1,Nr_units+Nr_add,true);
+}
+
+/*
+ * Tabulates the dispersion of every material a ray can meet over the band
+ * covered by the lights, so that the per-hit index lookups become table reads.
+ * Materials that already carry a cache keep it, refreshed if their model was
+ * edited. The caches created here are dropped after the render as the materials
+ * may be edited between two renders. A zero tolerance disables them.
+ */
+
+void Selene::set_dispersion_caches(bool enable)
+{
+    int i;
+    std::set<Material*> mats;
+    
+    for(i=0;i<Nlight;i++)
+        if(light_arr[i]->amb_mat!=nullptr) mats.insert(light_arr[i]->amb_mat);
+    
+    std::vector<Object*> objs(obj_arr.begin(),obj_arr.end());
+    
+    for(std::size_t n=0;n<objs.size();n++)
+    {
+        Object *obj=objs[n];
+        
+        if(obj->type==OBJ_BOOLEAN)
+        {
+            objs.push_back(obj->bool_obj_1);
+            objs.push_back(obj->bool_obj_2);
+        }
+        
+        for(SelFace const &face : obj->F_arr)
+        {
+            if(face.up_mat!=nullptr) mats.insert(face.up_mat);
+            if(face.down_mat!=nullptr) mats.insert(face.down_mat);
+            
+            for(IRF *irf : {face.up_irf,face.down_irf})
+            {
+                if(irf!=nullptr && irf->type==IRF_Type::MULTILAYER)
+                    for(Material *mat : irf->ml_materials) mats.insert(mat);
+            }
+        }
+    }
+    
+    if(!enable)
+    {
+        for(Material *mat : disp_cache_mats) mat->clear_dispersion_cache();
+        disp_cache_mats.clear();
+        
+        return;
+    }
+    
+    for(Material *mat : mats) mat->refresh_dispersion_cache();
+    
+    if(disp_cache_tolerance<=0) return;
+    
+    double lambda_min,lambda_max;
+    
+    if(!get_spectral_range(lambda_min,lambda_max)) return;
+    
+    for(Material *mat : mats)
+    {
+        if(!mat->is_const() && mat->disp_cache==nullptr)
+        {
+            mat->set_dispersion_cache(lambda_min,lambda_max,disp_cache_tolerance);
+            disp_cache_mats.push_back(mat);
+        }
+    }
+    
+    if(!disp_cache_mats.empty())
+        Plog::print("Dispersion tables for ", disp_cache_mats.size(), " materials, relative tolerance ",
+                    disp_cache_tolerance, "\n");
+}
+
+/*
+ * Bakes the R/T tables of the IRFs for every pair of media they separate, over
+ * the band covered by the lights. They are dropped after the render like the
+ * dispersion caches.
+ */
+
+void Selene::set_irf_tables(bool enable)
+{
+    ProfileZone zone("irf_tables");
+    
+    double lambda_min=0,lambda_max=0;
+    
+    if(enable && !get_spectral_range(lambda_min,lambda_max)) return;
+    
+    std::vector<Object*> objs(obj_arr.begin(),obj_arr.end());
+    
+    for(std::size_t n=0;n<objs.size();n++)
+    {
+        Object *obj=objs[n];
+        
+        if(obj->type==OBJ_BOOLEAN)
+        {
+            objs.push_back(obj->bool_obj_1);
+            objs.push_back(obj->bool_obj_2);
+        }
+        
+        for(SelFace const &face : obj->F_arr)
+        {
+            if(!enable)
+            {
+                if(face.up_irf!=nullptr) face.up_irf->clear_bake();
+                if(face.down_irf!=nullptr) face.down_irf->clear_bake();
+            }
+            else
+            {
+                if(face.up_irf!=nullptr) face.up_irf->bake(face.up_mat,face.down_mat,false,lambda_min,lambda_max);
+                if(face.down_irf!=nullptr) face.down_irf->bake(face.down_mat,face.up_mat,true,lambda_min,lambda_max);
+            }
+        }
+    }
+}
+
 void Selene::render(int Nr_disp_,int Nr_tot_)
 {
     Nr_disp=Nr_disp_;
@@ -331,6 +757,10 @@ RayPath Selene::request_job()
         
         if(Nr_cast<sum)
         {
+            job_out.stream=light_N_rays_total[i]+Nr_cast-(sum-light_N_rays[i]);
+            
+            seedp_stream(render_seed,i,job_out.stream,0);
+            
             light_arr[i]->get_ray(job_out.ray);
             
             job_out.ray.source_ID=i;
@@ -340,8 +770,14 @@ RayPath Selene::request_job()
         }
     }
     
-    job_out.ray.family=ray_family_counter;
-    ray_family_counter++;
+    // The family numbers order the fetcher, they have to stay
+    // contiguous over the passes of a resumed render
+    
+    if(!job_out.complete)
+    {
+        job_out.ray.family=ray_family_counter;
+        ray_family_counter++;
+    }
     
     return job_out;
 }
@@ -350,6 +786,11 @@ void Selene::request_raytrace(RayPath &ray_path)
 {
     trace_calls++;
     
+    request_raytrace(ray_path,intersection_buffer);
+}
+
+void Selene::request_raytrace(RayPath &ray_path,std::vector<RayInter> &intersection_buffer)
+{
     int i;
     
     intersection_buffer.clear();
@@ -357,6 +798,39 @@ void Selene::request_raytrace(RayPath &ray_path)
     int const &obj_last_intersection_f=ray_path.obj_last_intersection_f;
     int const &face_last_intersect=ray_path.face_last_intersect;
     
+    if(!scene_bvh.empty())
+    {
+        // Nearest object first, equal distances resolved by object index as
+        // in the linear scan
+        
+        double t_min=1e100;
+        
+        ray_path.does_intersect=false;
+        
+        scene_bvh.traverse(ray_path.ray,t_min,[&](int obj,double &t_max)
+        {
+            intersection_buffer.clear();
+            
+            if(obj==obj_last_intersection_f)
+                obj_arr[obj]->intersect(ray_path.ray,intersection_buffer,face_last_intersect);
+            else
+                obj_arr[obj]->intersect(ray_path.ray,intersection_buffer);
+            
+            for(RayInter const &itmp : intersection_buffer)
+            {
+                if(   itmp.t<t_max
+                   || (itmp.t==t_max && ray_path.does_intersect && itmp.object<ray_path.intersection.object))
+                {
+                    t_max=itmp.t;
+                    ray_path.does_intersect=true;
+                    ray_path.intersection=itmp;
+                }
+            }
+        });
+        
+        return;
+    }
+    
     if(obj_last_intersection_f>=0)
     {
         for(i=0;i<obj_last_intersection_f;i++)
@@ -393,6 +867,110 @@ void Selene::request_raytrace(RayPath &ray_path)
     }
 }
 
+/*
+ * Traces every ray family of the batch. The sensor hits and the rays that may
+ * end up in the fetcher are kept in the batch until it is merged: the fetcher
+ * only keeps the first Nr_disp+2 families of each source, so any family past
+ * that quota, within the batch or from the already merged ones, is skipped.
+ */
+
+void Selene::trace_batch(RenderBatch &batch)
+{
+    ProfileZone zone("trace");
+    ProfileCounter irf_counter("irf");
+    
+    std::vector<RayInter> buffer;
+    std::vector<unsigned int> N_fetched(light_N_fetched);
+    
+    for(RayPath &ray_path : batch.jobs)
+    {
+        unsigned int source=ray_path.ray.source_ID;
+        
+        bool fetched=false;
+        bool fetchable=true;
+        
+        while(ray_path.complete==false)
+        {
+            request_raytrace(ray_path,buffer);
+            batch.trace_calls++;
+            
+            RayInter &inter=ray_path.intersection;
+            
+            bool fetch=false,lost=false;
+            
+            if(ray_path.does_intersect==true)
+            {
+                seedp_stream(render_seed,source,ray_path.stream,ray_path.ray.generation+1);
+                
+                obj_arr[inter.object]->process_intersection(ray_path,batch.hits,irf_counter);
+                fetch=true;
+            }
+            else
+            {
+                if(ray_path.ray.generation!=0) fetch=lost=true;
+                ray_path.complete=true;
+            }
+            
+            if(fetch && !fetched)
+            {
+                fetchable=N_fetched[source]<light_Nr_disp[source]+2;
+                if(fetchable) N_fetched[source]++;
+                fetched=true;
+            }
+            
+            if(fetch && fetchable)
+            {
+                batch.fetch_rays.push_back(ray_path.ray);
+                batch.fetch_lost.push_back(lost);
+            }
+            
+            ray_path.ray.generation++;
+        }
+    }
+    
+    // Noise sensors bins
+    
+    if(!noise.empty())
+    {
+        for(SensorHit const &hit : batch.hits)
+        {
+            int slot=hit.object->sb_noise_slot;
+            if(slot<0) continue;
+            
+            double u=0,v=0;
+            hit.object->xyz_to_uv(u,v,hit.face,hit.obj_intersection.x,hit.obj_intersection.y,hit.obj_intersection.z);
+            
+            int bin=noise[slot].bin(hit.face,u,v);
+            if(bin>=0) batch.noise_counts[slot][bin]+=1.0;
+        }
+    }
+    
+    // Hits on the reduction only sensors are reduced here, in family order
+    
+    if(!reduction_sensors.empty())
+    {
+        std::size_t N_kept=0;
+        
+        for(std::size_t i=0;i<batch.hits.size();i++)
+        {
+            SensorHit &hit=batch.hits[i];
+            
+            if(hit.object->sens_reduce && hit.object->sb_reduction_slot>=0)
+            {
+                hit.object->sens_reduction_add(batch.reductions[hit.object->sb_reduction_slot],
+                                               hit.ray,hit.obj_intersection,hit.face);
+            }
+            else
+            {
+                if(N_kept!=i) batch.hits[N_kept]=hit;
+                N_kept++;
+            }
+        }
+        
+        batch.hits.resize(N_kept);
+    }
+}
+
 void Selene::reset_fetcher()
 {
     gen_ftc.clear();
@@ -409,9 +987,50 @@ void Selene::reset_fetcher()
     fetched_source=0;
 }
 
+/*
+ * World space hierarchy over the object boxes, only worth it past a few
+ * objects. It is rebuilt when a box changed since the last render, that is
+ * when an object was moved or edited.
+ */
+
+void Selene::update_scene_bvh()
+{
+    if(Nobj<8)
+    {
+        scene_bvh.clear();
+        scene_bvh_boxes.clear();
+        return;
+    }
+    
+    std::vector<BoundingBox> boxes(Nobj);
+    
+    for(int i=0;i<Nobj;i++)
+        boxes[i]=obj_arr[i]->get_world_bbox();
+    
+    bool moved=scene_bvh.empty() || boxes.size()!=scene_bvh_boxes.size();
+    
+    for(std::size_t i=0;i<boxes.size() && !moved;i++)
+    {
+        BoundingBox const &A=boxes[i];
+        BoundingBox const &B=scene_bvh_boxes[i];
+        
+        moved=   A.xm!=B.xm || A.xp!=B.xp
+              || A.ym!=B.ym || A.yp!=B.yp
+              || A.zm!=B.zm || A.zp!=B.zp;
+    }
+    
+    if(!moved) return;
+    
+    scene_bvh_boxes=boxes;
+    scene_bvh.build(boxes,1);
+}
+
+void Selene::set_dispersion_tolerance(double tolerance) { disp_cache_tolerance=tolerance; }
 void Selene::set_max_ray_bounces(int N) { Nr_bounces=N; }
 void Selene::set_N_rays_disp(int Nr_disp_) { Nr_disp=Nr_disp_; }
 void Selene::set_N_rays_total(int Nr_tot_) { Nr_tot=Nr_tot_; }
+void Selene::set_N_threads(int N_threads_) { N_threads=N_threads_; }
+void Selene::set_noise_threshold(double threshold) { noise_threshold=threshold; }
 
 void Selene::set_output_directory(std::filesystem::path const &output_directory_)
 {
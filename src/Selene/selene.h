@@ -15,12 +15,18 @@ limitations under the License.*/
 #ifndef SELENE_H
 #define SELENE_H
 
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <list>
+#include <mutex>
+#include <thread>
 
 #include <filehdl.h>
 #include <mathUT.h>
 #include <math_optim.h>
 #include <phys_tools.h>
+#include <profiler.h>
 #include <selene_mesh.h>
 #include <selene_primitives.h>
 #include <selene_rays.h>
@@ -256,11 +262,39 @@ class Light: public Frame
         
         int spectrum_shape;
         double lambda_min,lambda_max;
-        double planck_temperature,planck_max;
+        double planck_temperature;
         std::string spectrum_file;
-        double file_max;
         std::vector<double> spf_x,spf_y;
         
+        // Piecewise linear spectral density and its cumulative integral,
+        // inverted to draw the wavelengths
+        
+        std::vector<double> spectrum_cdf_x,spectrum_cdf_y,spectrum_cdf;
+        
+        // Sampling: low discrepancy points instead of pseudo-random numbers,
+        // one Sobol dimension per emission parameter
+        
+        bool sampling_qmc;
+        Sobol qmc;
+        
+        // Importance sampling: only the directions that can reach a sphere
+        // given in world coordinates are emitted, the power is scaled by
+        // the fraction of the emission they carry
+        
+        bool aperture_set,aperture_active;
+        Vector3 aperture_center;
+        double aperture_radius;
+        Vector3 aperture_axis,aperture_e1,aperture_e2;
+        double aperture_cos,aperture_fraction,aperture_p_max;
+        
+        // Emission fraction of the last cap, the quadrature is only redone
+        // when the type, the cone or the cap change
+        
+        int aperture_quad_type;
+        double aperture_quad_cone,aperture_quad_cos;
+        Vector3 aperture_quad_axis;
+        double aperture_quad_fraction;
+        
         //
         
         double power;
@@ -277,8 +311,9 @@ class Light: public Frame
         Light();
         
         void bootstrap();
+        void clear_aperture();
         Vector3 compute_polarization(Vector3 const &local_ray_dir);
-        double compute_wavelength();
+        double compute_wavelength(double u);
         Vector3 get_anchor(int anchor);                 // switch
         std::string get_anchor_name(int anchor);        // switch
         std::string get_anchor_script_name(int anchor); // switch
@@ -287,14 +322,166 @@ class Light: public Frame
         void get_ray(SelRay &ray);
         void load_spectrum_file(std::string const &fname);
         void reset_ray_counter();
+        void set_aperture(Vector3 const &center,double radius);
         void set_power(double power);
+        void set_sampling_qmc(bool qmc);
+        void set_sampling_seed(std::uint64_t seed);
         void set_spectrum_file(std::string const &fname);
         void set_spectrum_flat(double lambda_min,double lambda_max);
         void set_spectrum_planck(double lambda_min,double lambda_max,double T);
         void set_spectrum_type(int type);
         void set_type(int type);
+        
+    private:
+        Vector3 aperture_direction();
+        void bootstrap_aperture();
+        void bootstrap_spectrum();
+        double emission_density(Vector3 const &local_dir) const;
+        double extent_radius() const;
+        double sample(int dim);
 };
 
+// Binary sensor files: a magic number, the text header of the ASCII format,
+// then blocks of hits. Each block holds its row count followed by one
+// contiguous array per column, the vector columns being split in x, y and z
+// arrays. Integer columns are 32 bits, values are in native byte order.
+
+extern char const sensor_file_magic[8];
+
+// Background writer, the blocks are written in the order they are pushed.
+// A failed write drops the following blocks, close() then aborts
+
+class SensorWriter
+{
+    public:
+        SensorWriter();
+        SensorWriter(SensorWriter const&)=delete;
+        ~SensorWriter();
+        
+        void close();
+        bool is_open() const;
+        void open(std::filesystem::path const &fname,std::string const &header,bool append=false);
+        void push(std::vector<char> &block);
+        
+        void operator = (SensorWriter const&)=delete;
+        
+    private:
+        bool closing,failed;
+        std::filesystem::path fname;
+        std::ofstream file;
+        std::thread *worker;
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        std::deque<std::vector<char>> queue;
+        
+        void run();
+};
+
+// Memory mapped binary sensor file. The columns are either read block by
+// block in place, through get_column and get_value, or copied out by read_column
+
+class SensorFile
+{
+    public:
+        SensorFile();
+        
+        void close();
+        void export_ascii(std::filesystem::path const &fname) const;
+        std::size_t get_block_rows(std::size_t block) const;
+        char const* get_column(std::string const &name,std::size_t block) const;
+        std::vector<std::string> const& get_header() const;
+        std::size_t get_N_blocks() const;
+        std::size_t get_N_rows() const;
+        bool has_column(std::string const &name) const;
+        bool is_open() const;
+        bool open(std::filesystem::path const &fname);
+        void read_column(std::string const &name,std::vector<double> &data) const;
+        void read_column(std::string const &name,std::vector<int> &data) const;
+        void read_column(std::string const &name,std::vector<Vector3> &data) const;
+        
+        static int column_components(std::string const &name);
+        static bool column_is_integer(std::string const &name);
+        static bool is_binary(std::filesystem::path const &fname);
+        
+        // Value i of a column block, component k of vector columns being at k*Nr+i
+        template<typename T>
+        static T get_value(char const *column,std::size_t i)
+        {
+            T value;
+            std::memcpy(&value,column+i*sizeof(T),sizeof(T));
+            return value;
+        }
+        
+    private:
+        MappedFile map;
+        std::size_t N_rows;
+        std::vector<std::string> header,columns;
+        std::vector<std::size_t> blocks_offset,blocks_rows;
+        
+        char const* column_data(int column,std::size_t block) const;
+        int find_column(std::string const &name) const;
+};
+
+// Running reductions of the hits of a sensor, kept instead of the hits
+// themselves when the sensor is in reduction mode: spatial bins per face,
+// angular bins of the local direction, spectral bins, and the moments of the
+// local intersections and directions. The moments are updated with Welford's
+// scheme and merged with Chan's, so partial reductions can be combined.
+
+class SensorReduction
+{
+    public:
+        double N_hits,power_unit;
+        double inter_mean[3],inter_M2[3],
+               dir_mean[3],dir_M2[3];
+        
+        std::vector<int> Nu,Nv;
+        std::vector<Grid2<double>> spatial_bins;
+        
+        int N_theta,N_phi;
+        Grid2<double> angular_bins;
+        
+        int N_lambda;
+        double lambda_min,lambda_max;
+        std::vector<double> spectral_bins;
+        
+        SensorReduction();
+        
+        void add(int face,double u,double v,Vector3 const &obj_inter,Vector3 const &obj_dir,double lambda);
+        double angular_spread() const;
+        void clear();
+        void merge(SensorReduction const &reduction);
+        void reset_like(SensorReduction const &reduction);
+        void set_spectral_range(double lambda_min,double lambda_max);
+        double spatial_spread() const;
+        void write(std::filesystem::path const &fname) const;
+};
+
+class Object;
+
+// Batch means estimate of the noise of a sensor. The hits are binned per face
+// on the default uv grid of the object and every render batch gives one sample
+// of the bin counts.
+
+class SensorNoise
+{
+    public:
+        std::vector<int> Nu,Nv,face_offset;
+        
+        double N_batches,sum_n,sum_n2;
+        std::vector<double> sum_c,sum_c2,sum_cn;
+        
+        SensorNoise();
+        
+        void add_batch(std::vector<double> const &counts,double n);
+        int bin(int face,double u,double v) const;
+        double relative_error(double threshold) const;
+        void set_layout(Object *sensor,int N_uv=0);
+        std::size_t size() const;
+};
+
+class SensorHit;
+
 class Object: public Frame
 {
     public:
@@ -313,7 +500,7 @@ class Object: public Frame
         ~Object();
         
         void build_variables_map();
-        void bootstrap(std::filesystem::path const &output_directory,double ray_power,int max_ray_bounces);   // switch
+        void bootstrap(std::filesystem::path const &output_directory,double ray_power,int max_ray_bounces,bool resume=false);   // switch
         void cleanup();
         bool contains(double x,double y,double z);
         void default_N_uv(int &Nu,int &Nv,int face);   // switch
@@ -332,9 +519,11 @@ class Object: public Frame
         //int get_N_faces_groups();
         std::filesystem::path get_sensor_file_path() const;
         std::string get_type_name();                    // switch
+        BoundingBox get_local_bbox();
+        BoundingBox get_world_bbox();
         void intersect(SelRay const &ray,std::vector<RayInter> &inter_list,int face_last_intersect=-1,bool first_forward=true); //switch
         bool intersect_boundaries_box(SelRay const &ray);
-        void process_intersection(RayPath &path);
+        void process_intersection(RayPath &path,std::vector<SensorHit> &hits,ProfileCounter &irf_counter);
         //void propagate_faces_group(int index);
         void save_mesh_to_obj(std::string const &fname);
         double* reference_variable(std::string const &variable_name);
@@ -345,6 +534,7 @@ class Object: public Frame
         void set_default_out_mat(Material *mat);
         void set_sens_abs();
         void set_sens_none();
+        void set_sensor_ray_power(double ray_power);
         void set_sens_transp();
         void to_local_ray(SelRay &ray,SelRay const &base_ray);
         void update_geometry();                         // switch
@@ -356,7 +546,6 @@ class Object: public Frame
         Boolean_Type boolean_type;
         Object* bool_obj_1;
         Object* bool_obj_2;
-        std::vector<RayInter> bool_buffer_1,bool_buffer_2;
         
         void intersect_boolean(SelRay const &ray,std::vector<RayInter> &interlist,int face_last_intersect,bool first_forward);
         Vector3 normal_boolean(RayInter inter);
@@ -477,7 +666,9 @@ class Object: public Frame
              sens_ray_obj_intersection,
              sens_ray_obj_direction,
              sens_ray_obj_polar,
-             sens_ray_obj_face;
+             sens_ray_obj_face,
+             sens_ascii,
+             sens_reduce;
         
         int sb_Nmax,sb_Ncurr,sb_Ntot;
         std::filesystem::path sb_fname;
@@ -486,12 +677,50 @@ class Object: public Frame
         std::vector<Vector3> sb_world_i,sb_world_d,sb_world_polar,
                              sb_obj_i,sb_obj_d,sb_obj_polar;
         std::ofstream sb_file;
+        SensorWriter sb_writer;
+        std::vector<char> sb_block;
+        SensorReduction sb_reduction;
+        int sb_reduction_slot;
+        int sb_noise_slot;
+        std::streamoff sb_power_offset;
         
         void sens_buffer_add(SelRay &ray,
                              Vector3 const &world_intersection,
                              Vector3 const &obj_intersection,
                              int face_hit);
         void sens_buffer_dump();
+        void sens_reduction_add(SensorReduction &reduction,
+                                SelRay const &ray,
+                                Vector3 const &obj_intersection,
+                                int face_hit);
+};
+
+// Sensor hit recorded by a render worker, written to the sensor buffer of
+// the object when the batches are merged back in ray family order
+
+class SensorHit
+{
+    public:
+        Object *object;
+        int face;
+        SelRay ray;
+        Vector3 world_intersection,obj_intersection;
+};
+
+// Contiguous range of ray families traced by a single worker
+
+class RenderBatch
+{
+    public:
+        unsigned int trace_calls;
+        std::vector<RayPath> jobs;
+        std::vector<SensorHit> hits;
+        std::vector<SelRay> fetch_rays;
+        std::vector<bool> fetch_lost;
+        std::vector<SensorReduction> reductions;
+        std::vector<std::vector<double>> noise_counts;
+        
+        void clear();
 };
 
 
@@ -518,8 +747,10 @@ class RayCounter
         double lambda_min,lambda_max;
         
         // Data
-        bool empty_sensor;
+        bool empty_sensor,binary_sensor;
         AsciiDataLoader loader;
+        SensorFile sensor_file;
+        SensorReduction const *reduction;
         std::filesystem::path sensor_fname;
         
         double ray_unit;
@@ -559,8 +790,11 @@ class RayCounter
         void update_from_file();
     
     private:
+        std::vector<std::string> const& get_header() const;
         void initialize();
+        void open_sensor_file();
         void reallocate();
+        void update_from_reduction();
 };
 
 
@@ -590,23 +824,48 @@ class Selene
         int Nobj;
         int Nlight;
         int render_number;
+        int N_threads;
+        std::uint64_t render_seed;
         std::vector<Object*> obj_arr;
         std::vector<Light*> light_arr;
         
-        double ray_power;
-        std::vector<int> light_N_rays;
+        double total_power,ray_power;
+        std::vector<int> light_N_rays,light_N_rays_total;
         
         std::vector<RayInter> intersection_buffer;
         
+        BVH scene_bvh;
+        std::vector<BoundingBox> scene_bvh_boxes;
+        
         unsigned int Nr_bounces;
         unsigned int Nr_disp;
         unsigned int Nr_tot;
+        unsigned int Nr_units;
         unsigned int Nr_cast;
         unsigned int trace_calls;
         
-        std::vector<unsigned int> light_Nr_disp;
+        std::vector<unsigned int> light_Nr_disp,light_N_fetched;
+        std::vector<Object*> reduction_sensors;
+        
+        double noise_threshold;
+        std::vector<Object*> noise_sensors;
+        std::vector<int> noise_N_uv;
+        std::vector<SensorNoise> noise;
+        
+        double disp_cache_tolerance;
+        std::vector<Material*> disp_cache_mats;
         
+        bool get_spectral_range(double &lambda_min,double &lambda_max) const;
+        void merge_batch(RenderBatch &batch);
+        void render_begin(bool resume);
+        void render_end(bool resume);
+        void render_pass(unsigned int Nr_pass);
         RayPath request_job();
+        void request_raytrace(RayPath &ray_path,std::vector<RayInter> &buffer);
+        void set_dispersion_caches(bool enable);
+        void set_irf_tables(bool enable);
+        void trace_batch(RenderBatch &batch);
+        void update_scene_bvh();
         
         std::filesystem::path output_directory;
     public:
@@ -626,16 +885,23 @@ class Selene
         std::vector<bool> lost_ftc;
         
         void add_light(Light *src);
+        void add_noise_sensor(Object *obj,int N_uv=0);
         void add_object(Object *obj);
         void fetch_ray(SelRay const &ray);
         void fetch_ray_lost(SelRay const &ray);
+        double get_noise() const;
         void render();
         void render(int Nr_disp,int Nr_tot);
+        void render_progressive(double target_error,unsigned int Nr_max=0,bool resume=false);
+        void render_resume(unsigned int Nr_add);
         void request_raytrace(RayPath &ray_path);
         void reset_fetcher();
+        void set_dispersion_tolerance(double tolerance);
         void set_max_ray_bounces(int Nr_bounces);
         void set_N_rays_disp(int Nr_disp);
         void set_N_rays_total(int Nr_tot);
+        void set_N_threads(int N_threads);
+        void set_noise_threshold(double threshold);
         void set_output_directory(std::filesystem::path const &output_directory);
 };
 
@@ -15,6 +15,8 @@ limitations under the License.*/
 #ifndef SELENE_MESH_H
 #define SELENE_MESH_H
 
+#include <array>
+
 #include <index_utils.h>
 #include <mathUT.h>
 #include <material.h>
@@ -68,6 +70,25 @@ class smp_order
         double probability;
 };
 
+class IRF_Table
+{
+    // Reflectance and transmittance of an IRF between two given media, over
+    // the incidence angle and the wavelength, for both polarizations
+    // Each axis is bisected until the linear interpolation error along it is
+    // below half the IRF bake tolerance at every interval midpoint
+    public:
+        Material *mat_1,*mat_2;
+        bool reversed;
+        
+        std::vector<double> th,lambda;
+        std::vector<std::array<double,4>> values; // R_TE, T_TE, R_TM, T_TM at [j*Nth+i]
+        
+        IRF_Table();
+        
+        bool lookup(double thi,double lambda,bool is_TE,double &R,double &T) const;
+        std::size_t size() const;
+};
+
 class IRF
 {
     public:
@@ -102,6 +123,11 @@ class IRF
         std::vector<double> ml_heights;
         std::vector<Material*> ml_materials;
         
+        // Baked responses, 0 disables them
+        
+        double bake_tolerance;
+        std::vector<IRF_Table> baked;
+        
         // Splitter
         
         double splitting_factor;
@@ -119,7 +145,10 @@ class IRF
         IRF();
         IRF(IRF const &irf);
         
+        void bake(Material *mat_1,Material *mat_2,bool reversed,double lambda_min,double lambda_max);
         [[deprecated]] void bootstrap();
+        bool can_bake() const;
+        void clear_bake();
         void compute_snell_reflection(Vector3 &out_dir,Vector3 const &in_dir,
                                       Vector3 const &Fnorm,double n_scal);
         void compute_snell_refration(Vector3 &out_dir,Vector3 const &in_dir,
@@ -128,11 +157,14 @@ class IRF
         bool determine_polarization(Vector3 &S_vec,Vector3 const &Fnorm,
                                     Vector3 const &in_dir,Vector3 const &in_polar,
                                     bool is_near_normal);
-        
+        IRF_Table const* find_table(Material const *mat_1,Material const *mat_2,bool reversed) const;
+        void get_power(double thi,double lambda,double n1,double n2,bool reversed,
+                       double &R_TE,double &T_TE,double &R_TM,double &T_TM);
         bool get_response(Vector3 &out_dir,Vector3 &out_polar,
                           Vector3 const &in_dir,Vector3 const &in_polar,
                           Vector3 const &Fnorm,Vector3 const &Ftangent,
-                          double lambda,double n1,double n2);
+                          double lambda,double n1,double n2,
+                          Material const *n1_mat=nullptr,Material const *n2_mat=nullptr);
         bool get_response_fresnel(Vector3 &out_dir,Vector3 const &in_dir,
                                   Vector3 const &Fnorm,double n_scal,
                                   double lambda,double n1,double n2,
@@ -143,7 +175,8 @@ class IRF
         bool get_response_multilayer(Vector3 &out_dir,Vector3 const &in_dir,
                                      Vector3 const &Fnorm,double n_scal,
                                      double lambda,double n1,double n2,
-                                     bool is_TE,bool is_near_normal);
+                                     bool is_TE,bool is_near_normal,
+                                     Material const *n1_mat,Material const *n2_mat);
         bool get_response_perf_antiref(Vector3 const &in_dir,Vector3 &out_dir,
                                        Vector3 const &Fnorm,double lambda,double n1,double n2);
         bool get_response_snell_scatt_file(Vector3 const &in_dir,Vector3 &out_dir,
@@ -156,6 +189,7 @@ class IRF
         bool near_normal(double n_scal);
         void operator = (IRF const &IRF);
         
+        void set_bake_tolerance(double tolerance);
         void set_type(IRF_Type type);
         void set_type_grating(std::string ref_fname,std::string tra_fname);
         void set_type_fresnel();
@@ -37,6 +37,122 @@ namespace Sel
         double span_z() const { return zp-zm; }
     };
     
+    void bbox_expand(BoundingBox &box,BoundingBox const &b);
+    double bbox_half_area(BoundingBox const &box);
+    BoundingBox bbox_empty();
+    
+    /*
+     * Flattened bounding volume hierarchy over a set of axis aligned boxes,
+     * built with a binned surface area heuristic. The nodes are stored depth
+     * first, the left child of a node directly follows it and the right child
+     * is referenced by index. Leaves reference a range of prim_ID.
+     */
+    
+    class BVH
+    {
+        public:
+            struct Node
+            {
+                BoundingBox box;
+                int start=0;
+                int count=0;
+                int right=0;
+            };
+            
+            std::vector<Node> nodes;
+            std::vector<int> prim_ID;
+            
+            void build(std::vector<BoundingBox> const &boxes,int leaf_size=4);
+            void clear();
+            bool empty() const;
+            static bool intersect_box(BoundingBox const &box,SelRay const &ray,double t_max,double &t_entry);
+            
+            // Visits the leaves along the ray, nearest first, and skips the
+            // nodes that start farther than t_max. The test function is
+            // called as test(prim_index,t_max) and lowers t_max on a hit.
+            
+            template<typename TFunc>
+            void traverse(SelRay const &ray,double &t_max,TFunc &&test) const
+            {
+                traverse_leaves(ray,t_max,[&](int n,double &t_max_)
+                {
+                    Node const &node=nodes[n];
+                    
+                    for(int i=node.start;i<node.start+node.count;i++)
+                        test(prim_ID[i],t_max_);
+                });
+            }
+            
+            // Same as traverse, but the test function gets the leaf node index
+            
+            template<typename TFunc>
+            void traverse_leaves(SelRay const &ray,double &t_max,TFunc &&test) const
+            {
+                if(nodes.empty()) return;
+                
+                double t_entry;
+                if(!intersect_box(nodes[0].box,ray,t_max,t_entry)) return;
+                
+                int stack[64];
+                double stack_t[64];
+                int Nstack=0;
+                
+                int n=0;
+                
+                while(true)
+                {
+                    Node const &node=nodes[n];
+                    
+                    if(node.count>0) test(n,t_max);
+                    else
+                    {
+                        double t_l,t_r;
+                        
+                        bool hit_l=intersect_box(nodes[n+1].box,ray,t_max,t_l);
+                        bool hit_r=intersect_box(nodes[node.right].box,ray,t_max,t_r);
+                        
+                        if(hit_l && hit_r)
+                        {
+                            int near=n+1,far=node.right;
+                            if(t_r<t_l) { std::swap(near,far); std::swap(t_l,t_r); }
+                            
+                            stack[Nstack]=far;
+                            stack_t[Nstack]=t_r;
+                            Nstack++;
+                            
+                            n=near;
+                            continue;
+                        }
+                        else if(hit_l) { n=n+1; continue; }
+                        else if(hit_r) { n=node.right; continue; }
+                    }
+                    
+                    // Next node from the stack, unless a closer hit was found since
+                    
+                    bool found=false;
+                    
+                    while(Nstack>0)
+                    {
+                        Nstack--;
+                        
+                        if(stack_t[Nstack]<=t_max)
+                        {
+                            n=stack[Nstack];
+                            found=true;
+                            break;
+                        }
+                    }
+                    
+                    if(!found) return;
+                }
+            }
+            
+        private:
+            int build_node(std::vector<BoundingBox> const &boxes,
+                           std::vector<Vector3> const &centers,
+                           int start,int end,int leaf_size,int depth);
+    };
+    
     int nearest_2np1(double val);
 }
 
@@ -240,6 +356,21 @@ namespace Sel::Primitives
                     cylinder_direction;
     };
 
+    // Four mesh faces in a structure of arrays layout, for the vectorized
+    // intersection kernels. Unused lanes have a face index of -1.
+    
+    struct FacePack
+    {
+        double v1_x[4],v1_y[4],v1_z[4];
+        double e1_x[4],e1_y[4],e1_z[4];
+        double e2_x[4],e2_y[4],e2_z[4];
+        int face[4];
+    };
+    
+    void face_pack_intersect(FacePack const &pack,Vector3 const &O,Vector3 const &D,int face_skip,
+                             double t[4],double u[4],double v[4]);
+    std::string face_pack_isa();
+    
     class Mesh: public Primitive
     {
         public:
@@ -292,10 +423,12 @@ namespace Sel::Primitives
             std::vector<Sel::Vertex> V_arr;
             std::filesystem::path mesh_fname;
 
-            bool has_octree;
-            FOctree octree;
-            std::vector<int> octree_buffer;
-            std::vector<RayFaceIntersect> face_intersect_buffer;
+            bool has_bvh;
+            BVH face_bvh;
+            std::vector<FacePack> face_packs;
+            std::vector<int> node_packs;
+            
+            void build_face_packs();
     };
 
     class Parabola: public Primitive
@@ -130,7 +130,8 @@ namespace Sel
     RayPath::RayPath()
         :complete(false),
          does_intersect(false),
-         face_last_intersect(-1), obj_last_intersection_f(-1)
+         face_last_intersect(-1), obj_last_intersection_f(-1),
+         stream(0)
     {
     }
 
@@ -139,6 +140,7 @@ namespace Sel
          does_intersect(path.does_intersect),
          face_last_intersect(path.face_last_intersect),
          obj_last_intersection_f(path.obj_last_intersection_f),
+         stream(path.stream),
          ray(path.ray),
          intersection(path.intersection)
     {
@@ -150,6 +152,7 @@ namespace Sel
         does_intersect=path.does_intersect;
         face_last_intersect=path.face_last_intersect;
         obj_last_intersection_f=path.obj_last_intersection_f;
+        stream=path.stream;
         ray=path.ray;
         intersection=path.intersection;
     }
@@ -62,6 +62,7 @@ namespace Sel
             bool complete;
             bool does_intersect;
             int face_last_intersect,obj_last_intersection_f;
+            unsigned int stream; // family index within its light
 
             SelRay ray;
             RayInter intersection;
@@ -31,13 +31,18 @@ limitations under the License.*/
 #include <lua_sources.h>
 #include <lua_structure.h>
 #include <mathUT.h>
+#include <profiler.h>
+#include <thread_utils.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <filesystem>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #ifdef QUENCHING_MODULE
     #include <quenching.h>
@@ -50,7 +55,7 @@ int gen_complex_material(lua_State* L);
 extern const Imdouble Im;
 extern std::ofstream plog;
 
-static bool test_failure=false;
+static std::atomic<bool> test_failure(false);
 
 using std::cos;
 using std::sin;
@@ -78,6 +83,14 @@ int mode_choice(lua_State *L)
     
     base_mode *p_mode=nullptr;
     
+    // Inside a job, the outputs go to its directory by default, see run_jobs()
+    
+    std::string job_directory;
+    
+    lua_getglobal(L,"job_directory");
+    if(lua_isstring(L,-1)) job_directory=lua_tostring(L,-1);
+    lua_pop(L,1);
+    
     if(mode=="fdtd" ||
        mode=="fdtd_lab" ||
        mode=="fdtd_normal" ||
@@ -98,6 +111,8 @@ int mode_choice(lua_State *L)
 //        else if(mode=="fdtd_planar_guided_2D_ext") fdtd.type="planar_guided_2D_ext";
         else if(mode=="fdtd_single_particle") fdtd.type=FDTD_Mode::FDTD_SINGLE_PARTICLE;
         
+        if(!job_directory.empty()) fdtd.set_prefix(job_directory);
+        
         p_mode=&fdtd;
     }
     else if(mode=="fdfd")
@@ -106,6 +121,8 @@ int mode_choice(lua_State *L)
         
         if(mode=="fdfd") p_fdfd->type=FDFD_Mode::FDFD;
         
+        if(!job_directory.empty()) p_fdfd->set_prefix(job_directory);
+        
         p_mode=p_fdfd;
     }
     else if(mode=="fd_modes") p_mode=lua_allocate_metapointer<FDMS_Mode>(L,"metatable_fd_modes");
@@ -120,7 +137,14 @@ int mode_choice(lua_State *L)
     else if(mode=="multilayer_tmm") p_mode=lua_allocate_metapointer<Multilayer_TMM_mode>(L,"metatable_multilayer_tmm");
     else if(mode=="pause") p_mode=new Pause_mode;
     else if(mode=="quit") p_mode=new Quit_mode;
-    else if(mode=="selene") p_mode=lua_allocate_metapointer<Selene_Mode>(L,"metatable_selene");
+    else if(mode=="selene")
+    {
+        Selene_Mode *p_selene=lua_allocate_metapointer<Selene_Mode>(L,"metatable_selene");
+        
+        if(!job_directory.empty()) p_selene->set_output_directory(job_directory);
+        
+        p_mode=p_selene;
+    }
     else if(mode=="sleep") p_mode=new Sleep_mode;
     #ifdef PRIV_MODE
     else if(mode=="testlab") p_mode=new Testlab_mode;
@@ -135,76 +159,276 @@ int mode_choice(lua_State *L)
     return 1;
 }
 
-#ifndef GUI_ON
-    int main(int n_args,char **argv)
-#else
-    int mode_lua()
-#endif
+//##########
+//   Jobs
+//##########
+
+/*
+ * Argument of a job, copied out of the calling state since the job runs in
+ * its own one. Numbers, strings, booleans and tables of those.
+ */
+
+class Job_Value
 {
-    PathManager::initialize();
-    plog.open(PathManager::to_temporary_path("log.txt"),std::ios::out|std::ios::trunc);
-    Plog::init(PathManager::to_temporary_path("log.txt"));
-    
-    std::string script_fname="script.lua";
-    
-    #ifdef GUI_ON
-    int n_args=0;
-    char **argv=nullptr;
-    #endif
-    
-    if(n_args>1)
-    {
-        std::vector<std::string> args(n_args);
-        for(int i=0;i<n_args;i++) args[i]=argv[i];
+    public:
+        int type;
+        bool boolean,is_integer;
+        lua_Integer integer;
+        double number;
+        std::string str;
+        std::vector<Job_Value> keys,values;
         
-        int curr_arg=1;
+        Job_Value()
+            :type(LUA_TNIL), boolean(false), is_integer(false), integer(0), number(0)
+        {
+        }
         
-        while(curr_arg<n_args)
+        bool pull(lua_State *L,int index,int depth=0)
         {
-            if(args[curr_arg]=="-f") // Specified file
+            index=lua_absindex(L,index);
+            type=lua_type(L,index);
+            
+            if(type==LUA_TNUMBER)
             {
-                if(curr_arg+1<n_args) { curr_arg++; script_fname=args[curr_arg]; }
-                else
+                is_integer=lua_isinteger(L,index);
+                
+                if(is_integer) integer=lua_tointeger(L,index);
+                else number=lua_tonumber(L,index);
+            }
+            else if(type==LUA_TBOOLEAN) boolean=lua_toboolean(L,index);
+            else if(type==LUA_TSTRING)
+            {
+                std::size_t N=0;
+                char const *str_c=lua_tolstring(L,index,&N);
+                
+                str.assign(str_c,N);
+            }
+            else if(type==LUA_TTABLE)
+            {
+                if(depth>=32) return false;
+                
+                lua_pushnil(L);
+                
+                while(lua_next(L,index)!=0)
                 {
-                    Plog::print(LogType::FATAL, "Missing file argument for '-f'.\n");
-                    Plog::print(LogType::FATAL, "Try '", args[0], " --help' for more information.\n");
-                    std::exit(EXIT_FAILURE);
+                    keys.emplace_back();
+                    values.emplace_back();
+                    
+                    if(!keys.back().pull(L,-2,depth+1) || !values.back().pull(L,-1,depth+1))
+                    {
+                        lua_pop(L,2);
+                        return false;
+                    }
+                    
+                    lua_pop(L,1);
                 }
             }
-            else if(args[curr_arg]=="-h" || args[curr_arg]=="--help") // Help requested
+            else if(type!=LUA_TNIL) return false;
+            
+            return true;
+        }
+        
+        void push(lua_State *L) const
+        {
+            if(type==LUA_TNUMBER)
             {
-                Plog::print("Usage: ", args[0], " [-f SCRIPT_NAME]\n");
-                Plog::print("If SCRIPT_NAME is not specified, Aether will attempt to run a file named 'script.lua' in the current working directory.\n");
-                std::exit(EXIT_SUCCESS);
+                if(is_integer) lua_pushinteger(L,integer);
+                else lua_pushnumber(L,number);
             }
-            else // Unrecognized argument
+            else if(type==LUA_TBOOLEAN) lua_pushboolean(L,boolean);
+            else if(type==LUA_TSTRING) lua_pushlstring(L,str.data(),str.size());
+            else if(type==LUA_TTABLE)
             {
-                Plog::print(LogType::FATAL, "Invalid option '", args[curr_arg], "'.\n");
-                Plog::print(LogType::FATAL, "Try '", args[0], " --help' for more information.");
-                std::exit(EXIT_FAILURE);
+                lua_createtable(L,0,keys.size());
+                
+                for(std::size_t i=0;i<keys.size();i++)
+                {
+                    keys[i].push(L);
+                    values[i].push(L);
+                    lua_settable(L,-3);
+                }
             }
-            curr_arg++;
+            else lua_pushnil(L);
         }
+};
+
+class Script_Job
+{
+    public:
+        std::string chunk; // precompiled job function
+        std::vector<Job_Value> args;
+};
+
+// Fresh state with the whole scripting interface
+
+class Script_State
+{
+    public:
+        lua_State *L;
+        
+        Sel::IRF fresnel_IRF,
+                 perfect_abs_IRF,
+                 perfect_antiref_IRF,
+                 perfect_mirror_IRF;
+        
+        Script_State(std::filesystem::path *caller_path,
+                     int job_index=0,std::filesystem::path const &job_directory="");
+        Script_State(Script_State const&)=delete;
+        ~Script_State();
+        
+        void operator = (Script_State const&)=delete;
+};
+
+static std::vector<Script_Job> jobs_queue;
+
+int job_chunk_writer(lua_State *L,void const *p,std::size_t size,void *chunk)
+{
+    static_cast<std::string*>(chunk)->append(static_cast<char const*>(p),size);
+    
+    return 0;
+}
+
+/*
+ * Queues a function and its arguments for run_jobs(). The function is
+ * precompiled and runs in another state, so it cannot use the locals of the
+ * script, only the globals of the interface and its arguments.
+ */
+
+int add_job(lua_State *L)
+{
+    if(lua_type(L,1)!=LUA_TFUNCTION || lua_iscfunction(L,1))
+    {
+        Plog::print(LogType::FATAL, "add_job expects a Lua function as first argument\n");
+        std::exit(EXIT_FAILURE);
     }
     
-    std::filesystem::path script_fname_path=script_fname;
+    char const *upvalue=nullptr;
     
-    if(!std::filesystem::is_regular_file(script_fname_path))
+    for(int n=1;(upvalue=lua_getupvalue(L,1,n))!=nullptr;n++)
     {
-        Plog::print(LogType::FATAL,
-                    script_fname_path.generic_string(),
-                    " is not a file or could not be located at ",
-                    std::filesystem::absolute(script_fname_path).generic_string(),
-                    "\nAborting...\n");
-        std::exit(EXIT_FAILURE);
+        lua_pop(L,1);
+        
+        if(std::string(upvalue)!="_ENV")
+        {
+            Plog::print(LogType::FATAL, "The job function uses the local '", upvalue, "', pass it as an argument of add_job instead\n");
+            std::exit(EXIT_FAILURE);
+        }
     }
     
-    script_fname_path=script_fname_path.parent_path();
+    Script_Job job;
+    
+    lua_pushvalue(L,1);
+    lua_dump(L,job_chunk_writer,&job.chunk,0);
+    lua_pop(L,1);
+    
+    for(int i=2;i<=lua_gettop(L);i++)
+    {
+        job.args.emplace_back();
+        
+        if(!job.args.back().pull(L,i))
+        {
+            Plog::print(LogType::FATAL, "Argument ", i-1, " of add_job is not a number, a string, a boolean or a table of those\n");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    
+    jobs_queue.push_back(std::move(job));
+    
+    lua_pushinteger(L,jobs_queue.size());
+    
+    return 1;
+}
+
+int lua_ignore_job(lua_State *L)
+{
+    Plog::print(LogType::WARNING, "Jobs cannot be queued from within a job, ignored\n");
+    
+    return 0;
+}
+
+/*
+ * Runs the queued jobs side by side, each in its own state with the globals
+ * job_index and job_directory, the latter being created as jobs/job_<index>/
+ * next to the script. The FD and Selene modes created in a job write there
+ * unless given another prefix or output directory. The optional argument is
+ * the number of jobs running at once, by default as many as the threads,
+ * which are then shared between them. Returns the number of jobs that failed.
+ * Only the Lua errors of a job are caught: the fatal errors of the modes still
+ * end the whole program, along with the other jobs.
+ */
+
+int run_jobs(lua_State *L)
+{
+    std::vector<Script_Job> jobs=std::move(jobs_queue);
+    jobs_queue.clear();
+    
+    int N_jobs=jobs.size();
+    
+    if(N_jobs==0)
+    {
+        lua_pushinteger(L,0);
+        return 1;
+    }
+    
+    int N_budget=max_threads_number();
+    int N_parallel=std::min(N_jobs,N_budget);
+    
+    if(lua_gettop(L)>0) N_parallel=std::clamp(static_cast<int>(lua_tointeger(L,1)),1,N_jobs);
     
-    lua_State *L=luaL_newstate();
+    int N_job_threads=std::max(1,N_budget/N_parallel);
+    
+    lua_getglobal(L,"lua_caller_path");
+    std::filesystem::path caller_path=*static_cast<std::filesystem::path*>(lua_touserdata(L,-1));
+    lua_pop(L,1);
+    
+    Plog::print("Running ", N_jobs, " jobs, ", N_parallel, " at once with ", N_job_threads, " threads each\n");
+    
+    std::atomic<int> N_failed(0);
+    
+    parallel_for(N_jobs,[&](int n)
+    {
+        set_thread_budget(N_job_threads);
+        
+        std::filesystem::path directory=caller_path/"jobs"/("job_"+std::to_string(n+1));
+        directory+="/";
+        
+        std::error_code ec;
+        std::filesystem::create_directories(directory,ec);
+        
+        Script_State state(&caller_path,n+1,directory);
+        Script_Job const &job=jobs[n];
+        
+        bool failed=luaL_loadbuffer(state.L,job.chunk.data(),job.chunk.size(),"job")!=LUA_OK;
+        
+        if(!failed)
+        {
+            for(Job_Value const &arg : job.args) arg.push(state.L);
+            
+            failed=docall(state.L,job.args.size(),0)!=LUA_OK;
+        }
+        
+        if(failed)
+        {
+            Plog::print(LogType::WARNING, "Job ", n+1, " failed: ", lua_tostring(state.L,-1), "\n");
+            N_failed++;
+        }
+        else Plog::print("Job ", n+1, " done\n");
+        
+        set_thread_budget(0);
+    },N_parallel);
+    
+    lua_pushinteger(L,N_failed.load());
+    
+    return 1;
+}
+
+Script_State::Script_State(std::filesystem::path *caller_path,
+                           int job_index,std::filesystem::path const &job_directory)
+{
+    L=luaL_newstate();
     luaL_openlibs(L);
     
-    lua_pushlightuserdata(L,reinterpret_cast<void*>(&script_fname_path));
+    lua_pushlightuserdata(L,reinterpret_cast<void*>(caller_path));
     lua_setglobal(L,"lua_caller_path");
     
     lua_register(L,"MODE",mode_choice);
@@ -223,6 +447,25 @@ int mode_choice(lua_State *L)
     lua_register(L,"trapz",lua_tools::lua_adaptive_trapeze_integral);
     
     lua_register(L,"fail_test",lua_fail_test);
+    
+    // Jobs, see run_jobs()
+    
+    if(job_index>0)
+    {
+        lua_register(L,"add_job",lua_ignore_job);
+        lua_register(L,"run_jobs",lua_ignore_job);
+        
+        lua_pushinteger(L,job_index);
+        lua_setglobal(L,"job_index");
+        
+        lua_pushstring(L,job_directory.generic_string().c_str());
+        lua_setglobal(L,"job_directory");
+    }
+    else
+    {
+        lua_register(L,"add_job",add_job);
+        lua_register(L,"run_jobs",run_jobs);
+    }
         
     //###############
     
@@ -253,6 +496,7 @@ int mode_choice(lua_State *L)
     metatable_add_func(L,"solver",FDFD_mode_set_solver);
     metatable_add_func(L,"spectrum",FDFD_mode_set_spectrum);
     metatable_add_func(L,"structure",FD_mode_set_structure);
+    lua_wrapper<12,FDFD_Mode,int>::bind(L,"subpixel",&FDFD_Mode::set_subpixel);
     
     create_obj_metatable(L,"metatable_fd_modes");
     
@@ -332,11 +576,6 @@ int mode_choice(lua_State *L)
     //   Selene
     //############
     
-    Sel::IRF fresnel_IRF,
-             perfect_abs_IRF,
-             perfect_antiref_IRF,
-             perfect_mirror_IRF;
-    
     fresnel_IRF.set_type_fresnel();
     perfect_abs_IRF.set_type(Sel::IRF_Type::PERF_ABS);
     perfect_antiref_IRF.set_type(Sel::IRF_Type::PERF_ANTIREF);
@@ -366,6 +605,95 @@ int mode_choice(lua_State *L)
     //#########################
     
     LuaUI::create_optimization_metatable(L);
+}
+
+Script_State::~Script_State()
+{
+    lua_close(L);
+}
+
+#ifndef GUI_ON
+    int main(int n_args,char **argv)
+#else
+    int mode_lua()
+#endif
+{
+    PathManager::initialize();
+    plog.open(PathManager::to_temporary_path("log.txt"),std::ios::out|std::ios::trunc);
+    Plog::init(PathManager::to_temporary_path("log.txt"));
+    
+    std::string script_fname="script.lua";
+    std::filesystem::path profile_fname;
+    
+    #ifdef GUI_ON
+    int n_args=0;
+    char **argv=nullptr;
+    #endif
+    
+    if(n_args>1)
+    {
+        std::vector<std::string> args(n_args);
+        for(int i=0;i<n_args;i++) args[i]=argv[i];
+        
+        int curr_arg=1;
+        
+        while(curr_arg<n_args)
+        {
+            if(args[curr_arg]=="-f") // Specified file
+            {
+                if(curr_arg+1<n_args) { curr_arg++; script_fname=args[curr_arg]; }
+                else
+                {
+                    Plog::print(LogType::FATAL, "Missing file argument for '-f'.\n");
+                    Plog::print(LogType::FATAL, "Try '", args[0], " --help' for more information.\n");
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+            else if(args[curr_arg]=="-p" || args[curr_arg]=="--profile") // Timings summary
+            {
+                if(curr_arg+1<n_args) { curr_arg++; profile_fname=args[curr_arg]; }
+                else
+                {
+                    Plog::print(LogType::FATAL, "Missing file argument for '", args[curr_arg], "'.\n");
+                    Plog::print(LogType::FATAL, "Try '", args[0], " --help' for more information.\n");
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+            else if(args[curr_arg]=="-h" || args[curr_arg]=="--help") // Help requested
+            {
+                Plog::print("Usage: ", args[0], " [-f SCRIPT_NAME] [-p PROFILE_NAME]\n");
+                Plog::print("If SCRIPT_NAME is not specified, Aether will attempt to run a file named 'script.lua' in the current working directory.\n");
+                Plog::print("If PROFILE_NAME is specified, the time spent in the solvers is written there in JSON.\n");
+                std::exit(EXIT_SUCCESS);
+            }
+            else // Unrecognized argument
+            {
+                Plog::print(LogType::FATAL, "Invalid option '", args[curr_arg], "'.\n");
+                Plog::print(LogType::FATAL, "Try '", args[0], " --help' for more information.");
+                std::exit(EXIT_FAILURE);
+            }
+            curr_arg++;
+        }
+    }
+    
+    std::filesystem::path script_fname_path=script_fname;
+    
+    if(!std::filesystem::is_regular_file(script_fname_path))
+    {
+        Plog::print(LogType::FATAL,
+                    script_fname_path.generic_string(),
+                    " is not a file or could not be located at ",
+                    std::filesystem::absolute(script_fname_path).generic_string(),
+                    "\nAborting...\n");
+        std::exit(EXIT_FAILURE);
+    }
+    
+    script_fname_path=script_fname_path.parent_path();
+    
+    if(!profile_fname.empty()) Profiler::enable();
+    
+    Script_State state(&script_fname_path);
+    lua_State *L=state.L;
     
     //
     
@@ -377,9 +705,13 @@ int mode_choice(lua_State *L)
         #endif
     }
     
-    lua_close(L);
+    if(!profile_fname.empty())
+    {
+        Profiler::disable();
+        Profiler::write_json(profile_fname);
+    }
     
-    Plog::print("test_failure: ", test_failure, "\n");
+    Plog::print("test_failure: ", test_failure.load(), "\n");
     
     if(test_failure) return 1;
     else return 0;
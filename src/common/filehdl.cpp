@@ -17,6 +17,10 @@ limitations under the License.*/
 #include <string_tools.h>
 
 #ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
 #include <userenv.h>
 #include <Processthreadsapi.h>
 #endif
@@ -26,6 +30,8 @@ limitations under the License.*/
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h> 
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 #include <algorithm>
@@ -247,6 +253,101 @@ void AsciiDataLoader::load_seq(std::vector<double> &data)
     buffer_position++;
 }
 
+//#####################
+//   MappedFile
+//#####################
+
+MappedFile::MappedFile()
+    :ptr(nullptr), Nbytes(0)
+{
+    #ifdef _WIN32
+    file_handle=map_handle=nullptr;
+    #endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+    #ifdef _WIN32
+    if(ptr!=nullptr) UnmapViewOfFile(ptr);
+    if(map_handle!=nullptr) CloseHandle(map_handle);
+    if(file_handle!=nullptr) CloseHandle(file_handle);
+    
+    file_handle=map_handle=nullptr;
+    #endif
+    
+    #ifdef UNIX_PLATFORM
+    if(ptr!=nullptr) munmap(const_cast<char*>(ptr),Nbytes);
+    #endif
+    
+    ptr=nullptr;
+    Nbytes=0;
+}
+
+char const* MappedFile::data() const { return ptr; }
+
+bool MappedFile::is_open() const { return ptr!=nullptr; }
+
+bool MappedFile::open(std::filesystem::path const &fname)
+{
+    close();
+    
+    std::error_code error;
+    std::uintmax_t file_size=std::filesystem::file_size(fname,error);
+    
+    // Empty files cannot be mapped
+    if(error || file_size==0) return false;
+    
+    #ifdef _WIN32
+    file_handle=CreateFileW(fname.wstring().c_str(),GENERIC_READ,FILE_SHARE_READ,NULL,
+                            OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+    
+    if(file_handle==INVALID_HANDLE_VALUE)
+    {
+        file_handle=nullptr;
+        return false;
+    }
+    
+    map_handle=CreateFileMappingW(file_handle,NULL,PAGE_READONLY,0,0,NULL);
+    
+    if(map_handle==nullptr)
+    {
+        close();
+        return false;
+    }
+    
+    ptr=static_cast<char const*>(MapViewOfFile(map_handle,FILE_MAP_READ,0,0,0));
+    
+    if(ptr==nullptr)
+    {
+        close();
+        return false;
+    }
+    #endif
+    
+    #ifdef UNIX_PLATFORM
+    int fd=::open(fname.c_str(),O_RDONLY);
+    if(fd<0) return false;
+    
+    void *map=mmap(nullptr,file_size,PROT_READ,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    
+    if(map==MAP_FAILED) return false;
+    
+    ptr=static_cast<char const*>(map);
+    #endif
+    
+    Nbytes=file_size;
+    
+    return ptr!=nullptr;
+}
+
+std::size_t MappedFile::size() const { return Nbytes; }
+
 //#####################
 //   PathManager
 //#####################
@@ -43,6 +43,31 @@ class AsciiDataLoader
         void initialize(std::string const &fname,double limit=50e6);
 };
 
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+    public:
+        MappedFile();
+        MappedFile(MappedFile const&)=delete;
+        ~MappedFile();
+        
+        void close();
+        char const* data() const;
+        bool is_open() const;
+        bool open(std::filesystem::path const &fname);
+        std::size_t size() const;
+        
+        void operator = (MappedFile const&)=delete;
+    
+    private:
+        char const *ptr;
+        std::size_t Nbytes;
+        
+        #ifdef _WIN32
+        void *file_handle,*map_handle;
+        #endif
+};
+
 class PathManager
 {
     private:
@@ -18,8 +18,10 @@ limitations under the License.*/
 #include <logger.h>
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <vector>
 
 //#define D_BCHECK
 //#define GRID_INIT_CHECK
@@ -850,12 +852,16 @@ class Grid3
         
         void operator = (Grid3<T> const&G)
         {
-            if(N1!=G.N1 && N2!=G.N2 && N3!=G.N3)
+            if(NT!=G.NT)
             {
                 delete[] data;
                 data=new T[G.NT];
             }
             
+            N1=G.N1; N2=G.N2; N3=G.N3;
+            N12=G.N12; N13=G.N13; N23=G.N23;
+            NT=G.NT;
+            
             for(int i=0;i<NT;i++) data[i]=G.data[i];
         }
         
@@ -878,6 +884,194 @@ class Grid3
         }
 };
 
+// Material index grid, stored with the narrowest unsigned type that holds
+// every index written so far. Structures rarely use more than a few
+// materials, so the update loops read one byte per cell instead of four.
+// The storage is widened on the fly when an index doesn't fit anymore.
+
+class IndexGrid3
+{
+    private:
+        int N1,N2,N3;
+        int N12,NT;
+        int width;
+        
+        std::vector<std::uint8_t> data_8;
+        std::vector<std::uint16_t> data_16;
+        std::vector<std::uint32_t> data_32;
+        
+        void widen(unsigned int value)
+        {
+            if(value<=0xffff && width<2)
+            {
+                data_16.assign(data_8.begin(),data_8.end());
+                
+                std::vector<std::uint8_t>().swap(data_8);
+                width=2;
+            }
+            else if(value>0xffff)
+            {
+                if(width==1) data_32.assign(data_8.begin(),data_8.end());
+                else data_32.assign(data_16.begin(),data_16.end());
+                
+                std::vector<std::uint8_t>().swap(data_8);
+                std::vector<std::uint16_t>().swap(data_16);
+                width=4;
+            }
+        }
+        
+    public:
+        class Reference
+        {
+            private:
+                IndexGrid3 &grid;
+                int n;
+                
+            public:
+                Reference(IndexGrid3 &grid_,int n_)
+                    :grid(grid_), n(n_)
+                {
+                }
+                
+                operator unsigned int () const { return grid.get(n); }
+                
+                Reference& operator = (unsigned int value)
+                {
+                    grid.set(n,value);
+                    return *this;
+                }
+                
+                Reference& operator = (Reference const &R)
+                {
+                    grid.set(n,R.grid.get(R.n));
+                    return *this;
+                }
+        };
+        
+        IndexGrid3()
+            :N1(0), N2(0), N3(0),
+             N12(0), NT(0),
+             width(1)
+        {
+        }
+        
+        void bound_check(int ind1,int ind2,int ind3) const
+        {
+            if(ind1<0 || ind1>=N1
+               || ind2<0 || ind2>=N2
+               || ind3<0 || ind3>=N3)
+            {
+                Plog::print("IG3 Error, out of bounds: ", "\n"
+                         , ind1, " ", N1, "\n"
+                         , ind2, " ", N2, "\n"
+                         , ind3, " ", N3, "\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        
+        unsigned int get(int n) const
+        {
+            switch(width)
+            {
+                case 1: return data_8[n];
+                case 2: return data_16[n];
+                default: return data_32[n];
+            }
+        }
+        
+        void init(int in1,int in2,int in3,unsigned int value=0)
+        {
+            N1=in1;
+            N2=in2;
+            N3=in3;
+            
+            N12=N1*N2;
+            NT=N1*N2*N3;
+            
+            std::vector<std::uint8_t>().swap(data_8);
+            std::vector<std::uint16_t>().swap(data_16);
+            std::vector<std::uint32_t>().swap(data_32);
+            
+            if(value<=0xff)
+            {
+                width=1;
+                data_8.assign(NT,value);
+            }
+            else if(value<=0xffff)
+            {
+                width=2;
+                data_16.assign(NT,value);
+            }
+            else
+            {
+                width=4;
+                data_32.assign(NT,value);
+            }
+        }
+        
+        int L1() const { return N1; }
+        int L2() const { return N2; }
+        int L3() const { return N3; }
+        
+        unsigned int max() const
+        {
+            unsigned int R=0;
+            for(int i=0;i<NT;i++) R=std::max(R,get(i));
+            return R;
+        }
+        
+        double mem_size() const
+        {
+            return static_cast<double>(NT)*width;
+        }
+        
+        int bytes_per_index() const { return width; }
+        
+        // Calls f with a typed pointer to the raw indices, so that hot loops
+        // are instantiated once per width instead of switching on every read
+        
+        template<typename F>
+        void visit(F &&f) const
+        {
+            switch(width)
+            {
+                case 1: f(data_8.data()); break;
+                case 2: f(data_16.data()); break;
+                default: f(data_32.data());
+            }
+        }
+        
+        void set(int n,unsigned int value)
+        {
+            if((width==1 && value>0xff) || (width==2 && value>0xffff)) widen(value);
+            
+            switch(width)
+            {
+                case 1: data_8[n]=value; break;
+                case 2: data_16[n]=value; break;
+                default: data_32[n]=value;
+            }
+        }
+        
+        Reference operator() (int ind1,int ind2,int ind3)
+        {
+            #ifdef D_BCHECK
+                bound_check(ind1,ind2,ind3);
+            #endif
+            
+            return Reference(*this,ind1+ind2*N1+ind3*N12);
+        }
+        
+        unsigned int operator() (int ind1,int ind2,int ind3) const
+        {
+            #ifdef D_BCHECK
+                bound_check(ind1,ind2,ind3);
+            #endif
+            
+            return get(ind1+ind2*N1+ind3*N12);
+        }
+};
+
 //#########################
 // CRITICAL: DO NOT TOUCH
 //#########################
@@ -19,6 +19,7 @@ limitations under the License.*/
 //##########
 
 std::ofstream Plog::p_file;
+std::mutex Plog::p_mutex;
 
 void Plog::init(std::filesystem::path const &file_path)
 {
@@ -18,6 +18,7 @@ limitations under the License.*/
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 
 enum class LogType
 {
@@ -30,6 +31,8 @@ class Plog
     public:
         static void flush()
         {
+            std::unique_lock lock(p_mutex);
+            
             std::cout<<std::flush;
             p_file<<std::flush;
         }
@@ -39,6 +42,8 @@ class Plog
         template<typename... T>
         static void print(T const &... args)
         {
+            std::unique_lock lock(p_mutex);
+            
             (std::cout<<...<<args);
             (p_file<<...<<args);
         }
@@ -46,6 +51,8 @@ class Plog
         template<typename... T>
         static void print(LogType log_type, T const &... args)
         {
+            std::unique_lock lock(p_mutex);
+            
             if(log_type==LogType::FATAL)
             {
                 std::cout<<"! ";
@@ -66,6 +73,7 @@ class Plog
         
     private:
         static std::ofstream p_file;
+        static std::mutex p_mutex; // messages of concurrent jobs stay whole
         
 };
 
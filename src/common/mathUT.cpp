@@ -43,9 +43,203 @@ double exp_dec(double x)
 //}
 
 
-std::mt19937 mte(std::time(0));
-//std::mt19937 mte(1986);
-std::normal_distribution<> rdn_gen(0,1);
+//###############
+//    Philox
+//###############
+
+Philox::Philox(std::uint64_t seed_)
+{
+    seed(seed_);
+}
+
+void Philox::block(std::uint32_t const ctr_in[4],std::uint32_t const key_in[2],std::uint32_t out_[4])
+{
+    std::uint32_t c[4]={ctr_in[0],ctr_in[1],ctr_in[2],ctr_in[3]};
+    std::uint32_t k[2]={key_in[0],key_in[1]};
+    
+    for(int r=0;r<10;r++)
+    {
+        std::uint64_t p0=std::uint64_t(0xD2511F53)*c[0];
+        std::uint64_t p1=std::uint64_t(0xCD9E8D57)*c[2];
+        
+        std::uint32_t hi0=p0>>32,lo0=static_cast<std::uint32_t>(p0);
+        std::uint32_t hi1=p1>>32,lo1=static_cast<std::uint32_t>(p1);
+        
+        c[0]=hi1^c[1]^k[0];
+        c[1]=lo1;
+        c[2]=hi0^c[3]^k[1];
+        c[3]=lo0;
+        
+        k[0]+=0x9E3779B9;
+        k[1]+=0xBB67AE85;
+    }
+    
+    for(int i=0;i<4;i++) out_[i]=c[i];
+}
+
+Philox::result_type Philox::operator () ()
+{
+    if(Nout==4)
+    {
+        block(ctr,key,out);
+        ctr[0]++;
+        Nout=0;
+    }
+    
+    return out[Nout++];
+}
+
+void Philox::seed(std::uint64_t seed_)
+{
+    key[0]=static_cast<std::uint32_t>(seed_);
+    key[1]=static_cast<std::uint32_t>(seed_>>32);
+    
+    set_stream(0,0,0);
+}
+
+// The first counter word numbers the output blocks, the other three select
+// the stream
+
+void Philox::set_stream(std::uint32_t a,std::uint32_t b,std::uint32_t c)
+{
+    ctr[0]=0;
+    ctr[1]=a;
+    ctr[2]=b;
+    ctr[3]=c;
+    
+    Nout=4;
+}
+
+//###############
+//     Sobol
+//###############
+
+// Joe and Kuo direction numbers: degree s, coefficients a and initial m_k
+// of the primitive polynomial of each dimension after the first one
+
+namespace
+{
+    struct SobolPolynomial
+    {
+        int s,a;
+        std::uint32_t m[6];
+    };
+    
+    SobolPolynomial const sobol_polynomials[Sobol::max_dimensions-1]=
+    {
+        {1, 0,{1}},
+        {2, 1,{1,3}},
+        {3, 1,{1,3,1}},
+        {3, 2,{1,1,1}},
+        {4, 1,{1,1,3,3}},
+        {4, 4,{1,3,5,13}},
+        {5, 2,{1,1,5,5,17}},
+        {5, 4,{1,1,5,5,5}},
+        {5, 7,{1,1,7,11,19}},
+        {5,11,{1,1,5,1,1}},
+        {5,13,{1,1,1,3,11}},
+        {5,14,{1,3,5,5,31}},
+        {6, 1,{1,3,3,9,7,49}},
+        {6,13,{1,1,1,15,21,21}},
+        {6,16,{1,3,1,13,27,49}}
+    };
+    
+    struct SobolDirections
+    {
+        std::uint32_t V[Sobol::max_dimensions][32];
+        
+        SobolDirections()
+        {
+            for(int k=0;k<32;k++) V[0][k]=std::uint32_t(1)<<(31-k);
+            
+            for(int d=1;d<Sobol::max_dimensions;d++)
+            {
+                SobolPolynomial const &P=sobol_polynomials[d-1];
+                
+                for(int k=0;k<32;k++)
+                {
+                    if(k<P.s) V[d][k]=P.m[k]<<(31-k);
+                    else
+                    {
+                        V[d][k]=V[d][k-P.s]^(V[d][k-P.s]>>P.s);
+                        
+                        for(int j=1;j<P.s;j++)
+                            if((P.a>>(P.s-1-j))&1) V[d][k]^=V[d][k-j];
+                    }
+                }
+            }
+        }
+    };
+    
+    SobolDirections const sobol_directions;
+    
+    std::uint32_t reverse_bits(std::uint32_t x)
+    {
+        x=((x>>1)&0x55555555)|((x&0x55555555)<<1);
+        x=((x>>2)&0x33333333)|((x&0x33333333)<<2);
+        x=((x>>4)&0x0F0F0F0F)|((x&0x0F0F0F0F)<<4);
+        x=((x>>8)&0x00FF00FF)|((x&0x00FF00FF)<<8);
+        
+        return (x>>16)|(x<<16);
+    }
+    
+    // Laine-Karras style hash, every bit only depends on the lower ones so
+    // that applied to the reversed bits it is a nested uniform scrambling
+    
+    std::uint32_t owen_hash(std::uint32_t x,std::uint32_t seed)
+    {
+        x+=seed;
+        x^=x*0x6c50b47c;
+        x^=x*0xb82f1e52;
+        x^=x*0xc7afe638;
+        x^=x*0x8d22f6e6;
+        
+        return x;
+    }
+}
+
+Sobol::Sobol(std::uint64_t seed_)
+{
+    seed(seed_);
+}
+
+double Sobol::sample(std::uint32_t index,int dim) const
+{
+    if(dim<0 || dim>=max_dimensions) return randp();
+    
+    std::uint32_t x=reverse_bits(sample_bits(index,dim));
+    x=reverse_bits(owen_hash(x,scramble_seed[dim]));
+    
+    return (x+0.5)/4294967296.0;
+}
+
+std::uint32_t Sobol::sample_bits(std::uint32_t index,int dim)
+{
+    std::uint32_t x=0;
+    
+    for(int k=0;index!=0;k++,index>>=1)
+        if(index&1) x^=sobol_directions.V[dim][k];
+    
+    return x;
+}
+
+void Sobol::seed(std::uint64_t seed_)
+{
+    std::uint32_t key[2]={static_cast<std::uint32_t>(seed_),
+                          static_cast<std::uint32_t>(seed_>>32)};
+    
+    for(int d=0;d<max_dimensions;d+=4)
+    {
+        std::uint32_t ctr[4]={static_cast<std::uint32_t>(d),0x536f626f,0,0};
+        Philox::block(ctr,key,scramble_seed+d);
+    }
+}
+
+// One generator per thread: randp() is called concurrently by the Selene
+// workers, which select their own stream through seedp_stream()
+
+thread_local Philox mte(std::time(0)+std::hash<std::thread::id>()(std::this_thread::get_id()));
+thread_local std::normal_distribution<> rdn_gen(0,1);
 
 unsigned long int randi()
 {
@@ -75,6 +269,25 @@ double randp_norm(double mean,double std_dev)
 void seedp(int i)
 {
     mte.seed(i);
+    rdn_gen.reset();
+}
+
+void seedp_stream(std::uint64_t seed,unsigned int a,unsigned int b,unsigned int c)
+{
+    mte.seed(seed);
+    mte.set_stream(a,b,c);
+    rdn_gen.reset();
+}
+
+RandpStateGuard::RandpStateGuard()
+    :gen(mte), norm_gen(rdn_gen)
+{
+}
+
+RandpStateGuard::~RandpStateGuard()
+{
+    mte=gen;
+    rdn_gen=norm_gen;
 }
 
 //###############
@@ -20,6 +20,7 @@ limitations under the License.*/
 #include <complex>
 #include <cstdlib>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <numbers>
 #include <random>
@@ -44,12 +45,76 @@ double factorial_frac(int,int);
 typedef std::complex<double> Imdouble;
 typedef std::complex<long double> Imdouble_l;
 
+// Counter-based generator (Philox4x32-10): every block of output is a pure
+// function of the key and of the counter, so that independent and
+// reproducible streams are selected by setting the counter words instead
+// of advancing a shared state
+
+class Philox
+{
+    private:
+        int Nout;
+        std::uint32_t key[2],ctr[4],out[4];
+        
+    public:
+        typedef std::uint32_t result_type;
+        
+        Philox(std::uint64_t seed=0);
+        
+        static void block(std::uint32_t const ctr[4],std::uint32_t const key[2],std::uint32_t out[4]);
+        void seed(std::uint64_t seed);
+        void set_stream(std::uint32_t a,std::uint32_t b,std::uint32_t c);
+        
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return 0xffffffff; }
+        
+        result_type operator () ();
+};
+
+// Owen scrambled Sobol sequence: the points are Sobol points whose bits are
+// shuffled by a hash seeded per dimension, which keeps their stratification
+// while decorrelating the dimensions and the renders
+
+class Sobol
+{
+    private:
+        std::uint32_t scramble_seed[16];
+        
+    public:
+        static constexpr int max_dimensions=16;
+        
+        Sobol(std::uint64_t seed=0);
+        
+        double sample(std::uint32_t index,int dim) const;
+        void seed(std::uint64_t seed);
+        
+        static std::uint32_t sample_bits(std::uint32_t index,int dim);
+};
+
 unsigned long int randi();
 double randp(double A=1);
 double randp(double A,std::mt19937 &gen);
 double randp(double A,double B);
 double randp_norm(double mean,double std_dev);
 void seedp(int i);
+void seedp_stream(std::uint64_t seed,unsigned int a,unsigned int b,unsigned int c);
+
+// Saves the generator of the calling thread and restores it at destruction,
+// around code that selects its own streams through seedp_stream()
+
+class RandpStateGuard
+{
+    private:
+        Philox gen;
+        std::normal_distribution<> norm_gen;
+        
+    public:
+        RandpStateGuard();
+        ~RandpStateGuard();
+        
+        RandpStateGuard(RandpStateGuard const&)=delete;
+        void operator = (RandpStateGuard const&)=delete;
+};
 
 class AngleRad
 {
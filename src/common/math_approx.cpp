@@ -15,11 +15,14 @@ limitations under the License.*/
 #include <logger.h>
 #include <math_approx.h>
 
+#include <algorithm>
+
 Cspline::Cspline()
     :Np(0),
      end_mode(CSPLINE_NATURAL),
      offset_x(0), offset_y(0),
-     scale_x(1.0), scale_y(1.0)
+     scale_x(1.0), scale_y(1.0),
+     uniform(false)
 {
 }
 
@@ -30,6 +33,7 @@ Cspline::Cspline(Cspline const &spline)
      offset_y(spline.offset_y),
      scale_x(spline.scale_x),
      scale_y(spline.scale_y),
+     uniform(spline.uniform),
      xp(spline.xp),
      yp(spline.yp)
 {
@@ -41,6 +45,7 @@ Cspline::Cspline(Cspline const &spline)
 Cspline::Cspline(std::vector<double> const &xp_,std::vector<double> const &yp_,int end_mode_)
     :Np(xp_.size()),
      end_mode(end_mode_),
+     uniform(false),
      xp(xp_),
      yp(yp_),
      coeffs(4,Np-1,0)
@@ -53,6 +58,13 @@ void Cspline::calc_coeffs()
     reorder();
     rescale();
     
+    // Uniform sampling check, for the direct segment lookup
+    
+    uniform=(Np>2);
+    
+    for(int l=0;l<Np && uniform;l++)
+        if(std::abs(xp[l]-l/(Np-1.0))>1e-9) uniform=false;
+    
     int i,j;
     int Ns=Np-1;
     int Ns3=3*Ns;
@@ -152,29 +164,33 @@ void Cspline::calc_coeffs()
 
 double Cspline::eval(double const &x_) const
 {
-    int i;
-    
     double x=(x_-offset_x)/scale_x;
     
-    double seg_ind=0;
+    return eval_segment(x,segment(x));
+}
+
+/*
+ * Evaluation over an array of points, the segment search starting from
+ * the previous one so that sorted queries walk the segments once
+ */
+
+void Cspline::eval(std::vector<double> const &x_,std::vector<double> &y) const
+{
+    y.resize(x_.size());
     
-    //find which segment to consider    
-    if(x>=xp[0] && x<=xp[Np-1])
-    {
-        for(i=0;i<Np-1;i++)
-        {
-            if(x>=xp[i] && x<=xp[i+1])
-            {
-                seg_ind=i;
-                break;
-            }
-        }
-    }
-    else if(x<xp[0]) seg_ind=0;
-    else if(x>xp[Np-1]) seg_ind=Np-2;
+    int i=0;
     
-    i=seg_ind;
+    for(std::size_t n=0;n<x_.size();n++)
+    {
+        double x=(x_[n]-offset_x)/scale_x;
         
+        i=segment(x,i);
+        y[n]=eval_segment(x,i);
+    }
+}
+
+double Cspline::eval_segment(double x,int i) const
+{
     double xd=x-xp[i];
     
     double out=((coeffs(0,i)*xd+coeffs(1,i))*xd+coeffs(2,i))*xd+coeffs(3,i);
@@ -248,6 +264,8 @@ void Cspline::operator = (Cspline const &spline)
     scale_x=spline.scale_x;
     scale_y=spline.scale_y;
     
+    uniform=spline.uniform;
+    
     xp=spline.xp;
     yp=spline.yp;
     coeffs.init(spline.coeffs.L1(),spline.coeffs.L2());
@@ -272,6 +290,36 @@ bool Cspline::operator == (Cspline const &spline) const
     return true;
 }
 
+// Segment i such that xp[i]<x<=xp[i+1], the first one for x==xp[0],
+// the end ones outside of the data range
+
+int Cspline::segment(double x) const
+{
+    if(!(x>xp[0])) return 0;
+    if(x>=xp[Np-1]) return Np-2;
+    
+    if(uniform) return segment(x,static_cast<int>(x*(Np-1)));
+    
+    int i=std::lower_bound(xp.begin(),xp.end(),x)-xp.begin();
+    
+    return std::max(i-1,0);
+}
+
+// Local search from a guess
+
+int Cspline::segment(double x,int i) const
+{
+    if(!(x>xp[0])) return 0;
+    if(x>=xp[Np-1]) return Np-2;
+    
+    i=std::clamp(i,0,Np-2);
+    
+    while(i>0 && xp[i]>=x) i--;
+    while(i<Np-2 && xp[i+1]<x) i++;
+    
+    return i;
+}
+
 void Cspline::reorder()
 {
     if(xp.size()>1 && xp[1]<xp[0])
@@ -160,12 +160,16 @@ class Cspline
         int Np,end_mode;
         double offset_x,offset_y;
         double scale_x,scale_y;
+        bool uniform;
         std::vector<double> xp,yp;
         Grid2<double> coeffs;
         
         void calc_coeffs();
+        double eval_segment(double x,int i) const;
         void reorder();
         void rescale();
+        int segment(double x) const;
+        int segment(double x,int i) const;
         
     public:
         Cspline();
@@ -173,6 +177,7 @@ class Cspline
         Cspline(std::vector<double> const &x,std::vector<double> const &y,int end_mode=CSPLINE_NATURAL);
         
         double eval(double const &x) const;
+        void eval(std::vector<double> const &x,std::vector<double> &y) const;
         std::size_t get_N() const;
         double get_x_base(std::size_t const &i) const;
         double get_y_base(std::size_t const &i) const;
@@ -0,0 +1,304 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <profiler.h>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+class ProfileNode
+{
+    public:
+        std::string name;
+        int parent;
+        std::vector<int> children;
+        long long calls;
+        double time;
+        
+        ProfileNode(std::string_view name_,int parent_)
+            :name(name_), parent(parent_), calls(0), time(0)
+        {
+        }
+};
+
+// Zones tree of a thread, the mutex only guards against a concurrent summary
+
+class ProfileThread
+{
+    public:
+        int ID;
+        bool in_use;
+        int current;
+        std::mutex mutex;
+        std::vector<ProfileNode> nodes;
+        std::vector<int> roots;
+        
+        ProfileThread(int ID_)
+            :ID(ID_), in_use(true), current(-1)
+        {
+        }
+        
+        int child(std::string_view name)
+        {
+            std::vector<int> &siblings=(current<0) ? roots : nodes[current].children;
+            
+            for(int n : siblings) if(nodes[n].name==name) return n;
+            
+            nodes.emplace_back(name,current);
+            
+            // siblings may have been invalidated by the reallocation
+            
+            int n=nodes.size()-1;
+            
+            if(current<0) roots.push_back(n);
+            else nodes[current].children.push_back(n);
+            
+            return n;
+        }
+};
+
+namespace
+{
+    std::mutex threads_mutex;
+    std::vector<std::unique_ptr<ProfileThread>> threads;
+    std::chrono::steady_clock::time_point profile_start=std::chrono::steady_clock::now();
+    
+    // The trees of the finished threads are handed over to the next ones,
+    // so that the workers spawned at each pass do not pile up
+    
+    class ThreadSlot
+    {
+        public:
+            ProfileThread *thread;
+            
+            ThreadSlot()
+                :thread(nullptr)
+            {
+                std::unique_lock<std::mutex> lock(threads_mutex);
+                
+                for(std::unique_ptr<ProfileThread> &thr : threads)
+                {
+                    if(!thr->in_use)
+                    {
+                        thread=thr.get();
+                        thread->in_use=true;
+                        return;
+                    }
+                }
+                
+                threads.push_back(std::make_unique<ProfileThread>(threads.size()));
+                thread=threads.back().get();
+            }
+            
+            ~ThreadSlot()
+            {
+                std::unique_lock<std::mutex> lock(threads_mutex);
+                
+                thread->current=-1;
+                thread->in_use=false;
+            }
+    };
+    
+    ProfileThread* local_thread()
+    {
+        thread_local ThreadSlot slot;
+        
+        return slot.thread;
+    }
+    
+    void json_string(std::ostream &strm,std::string const &str)
+    {
+        strm<<"\"";
+        
+        for(char c : str)
+        {
+                 if(c=='"' || c=='\\') strm<<"\\"<<c;
+            else if(static_cast<unsigned char>(c)<0x20) strm<<" ";
+            else strm<<c;
+        }
+        
+        strm<<"\"";
+    }
+    
+    void json_zones(std::ostream &strm,ProfileThread const &thread,
+                    std::vector<int> const &zones,std::string const &indent)
+    {
+        bool first=true;
+        
+        strm<<"[";
+        
+        for(int n : zones)
+        {
+            ProfileNode const &node=thread.nodes[n];
+            
+            if(node.calls==0) continue;
+            
+            double children_time=0;
+            for(int k : node.children) children_time+=thread.nodes[k].time;
+            
+            if(!first) strm<<",";
+            first=false;
+            
+            strm<<"\n"<<indent<<"{\"name\": ";
+            json_string(strm,node.name);
+            strm<<", \"calls\": "<<node.calls
+                <<", \"total\": "<<node.time
+                <<", \"self\": "<<std::max(node.time-children_time,0.0)
+                <<", \"children\": ";
+            
+            json_zones(strm,thread,node.children,indent+"    ");
+            
+            strm<<"}";
+        }
+        
+        if(!first) strm<<"\n"<<indent.substr(4);
+        strm<<"]";
+    }
+}
+
+//##############
+//   Profiler
+//##############
+
+std::atomic<bool> Profiler::active(false);
+
+void Profiler::disable()
+{
+    active=false;
+}
+
+void Profiler::enable()
+{
+    reset();
+    active=true;
+}
+
+// Clears the timings, the trees are kept since zones may still be open
+
+void Profiler::reset()
+{
+    std::unique_lock<std::mutex> lock(threads_mutex);
+    
+    for(std::unique_ptr<ProfileThread> &thread : threads)
+    {
+        std::unique_lock<std::mutex> thread_lock(thread->mutex);
+        
+        for(ProfileNode &node : thread->nodes)
+        {
+            node.calls=0;
+            node.time=0;
+        }
+    }
+    
+    profile_start=std::chrono::steady_clock::now();
+}
+
+/*
+ * Times in seconds, the self time of a zone excludes its children. Zones still
+ * open are not counted yet.
+ */
+
+std::string Profiler::summary_json()
+{
+    std::unique_lock<std::mutex> lock(threads_mutex);
+    
+    std::stringstream strm;
+    
+    std::chrono::duration<double> wall_time=std::chrono::steady_clock::now()-profile_start;
+    
+    strm<<"{\n    \"wall_time\": "<<wall_time.count()<<",\n    \"threads\": [";
+    
+    bool first=true;
+    
+    for(std::unique_ptr<ProfileThread> &thread : threads)
+    {
+        std::unique_lock<std::mutex> thread_lock(thread->mutex);
+        
+        bool empty=true;
+        for(ProfileNode const &node : thread->nodes) if(node.calls>0) empty=false;
+        
+        if(empty) continue;
+        
+        if(!first) strm<<",";
+        first=false;
+        
+        strm<<"\n        {\n            \"thread\": "<<thread->ID<<",\n            \"zones\": ";
+        json_zones(strm,*thread,thread->roots,"                ");
+        strm<<"\n        }";
+    }
+    
+    if(!first) strm<<"\n    ";
+    strm<<"]\n}\n";
+    
+    return strm.str();
+}
+
+void Profiler::write_json(std::filesystem::path const &fname)
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc);
+    
+    file<<summary_json();
+}
+
+//####################
+//   ProfileCounter
+//####################
+
+void ProfileCounter::commit()
+{
+    ProfileThread *thread=local_thread();
+    
+    std::unique_lock<std::mutex> lock(thread->mutex);
+    
+    ProfileNode &node=thread->nodes[thread->child(name)];
+    
+    node.calls+=calls;
+    node.time+=std::chrono::duration<double>(time).count();
+}
+
+//#################
+//   ProfileZone
+//#################
+
+void ProfileZone::close()
+{
+    std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now();
+    
+    std::unique_lock<std::mutex> lock(thread->mutex);
+    
+    ProfileNode &zone=thread->nodes[node];
+    
+    zone.calls++;
+    zone.time+=std::chrono::duration<double>(end-start).count();
+    
+    thread->current=zone.parent;
+    thread=nullptr;
+}
+
+void ProfileZone::open(std::string_view name)
+{
+    thread=local_thread();
+    
+    {
+        std::unique_lock<std::mutex> lock(thread->mutex);
+        
+        node=thread->child(name);
+        thread->current=node;
+    }
+    
+    start=std::chrono::steady_clock::now();
+}
@@ -0,0 +1,115 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+/*
+ * Hierarchical timing of the solvers. Zones are scoped and nest on the thread
+ * that opens them, every thread filling its own tree. The profiler is off by
+ * default and a zone then only checks the flag.
+ */
+
+class ProfileThread;
+
+class Profiler
+{
+    public:
+        static void disable();
+        static void enable();
+        static bool enabled() { return active.load(std::memory_order_relaxed); }
+        static void reset();
+        static std::string summary_json();
+        static void write_json(std::filesystem::path const &fname);
+        
+    private:
+        static std::atomic<bool> active;
+};
+
+// Zones have to be closed in the reverse order they were opened
+
+class ProfileZone
+{
+    public:
+        explicit ProfileZone(std::string_view name)
+            :thread(nullptr), node(0)
+        {
+            if(Profiler::enabled()) open(name);
+        }
+        
+        ProfileZone(ProfileZone const&)=delete;
+        
+        ~ProfileZone() { stop(); }
+        
+        void stop() { if(thread!=nullptr) close(); }
+        
+        void operator = (ProfileZone const&)=delete;
+        
+    private:
+        ProfileThread *thread;
+        int node;
+        std::chrono::steady_clock::time_point start;
+        
+        void close();
+        void open(std::string_view name);
+};
+
+/*
+ * Section run many times within a zone, like a call per ray intersection.
+ * The runs are summed locally and recorded at destruction as one child of the
+ * zone open on the thread, so that each run only reads the clock.
+ */
+
+class ProfileCounter
+{
+    public:
+        explicit ProfileCounter(std::string_view name_)
+            :active(Profiler::enabled()), name(name_), calls(0), time(0)
+        {
+        }
+        
+        ProfileCounter(ProfileCounter const&)=delete;
+        
+        ~ProfileCounter() { if(calls>0) commit(); }
+        
+        void start() { if(active) start_time=std::chrono::steady_clock::now(); }
+        
+        void stop()
+        {
+            if(active)
+            {
+                time+=std::chrono::steady_clock::now()-start_time;
+                calls++;
+            }
+        }
+        
+        void operator = (ProfileCounter const&)=delete;
+        
+    private:
+        bool active;
+        std::string name;
+        long long calls;
+        std::chrono::steady_clock::duration time;
+        std::chrono::steady_clock::time_point start_time;
+        
+        void commit();
+};
+
+#endif // PROFILER_H_INCLUDED
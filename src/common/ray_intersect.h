@@ -115,6 +115,40 @@ int ray_N_inter(Grid1<V> const &V_arr,Grid1<F> const &F_arr,
     return N_inter;
 }*/
 
+//Single face test shared by the loops below, t is left unchecked
+template<class V,class F>
+bool ray_inter_face(std::vector<V> const &V_arr,F const &face,
+                    Vector3 const &O,Vector3 const& D,double &t,double &u,double &v)
+{
+    Vector3 E1,E2,P,Q,T;
+    double det,invdet;
+    
+    E1=V_arr[face.V2].loc-V_arr[face.V1].loc;
+    E2=V_arr[face.V3].loc-V_arr[face.V1].loc;
+    T=O-V_arr[face.V1].loc;
+    
+    P.crossprod(D,E2);
+    Q.crossprod(T,E1);
+    
+    det=scalar_prod(P,E1);
+    invdet=1.0/det;
+    
+    u=scalar_prod(P,T)*invdet;
+    
+    if(u>=0 && u<=1.0)
+    {
+        v=scalar_prod(Q,D)*invdet;
+        
+        if(v>=0 && u+v<=1.0)
+        {
+            t=scalar_prod(Q,E2)*invdet;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
 //Ray intersection using Mller & Trumbore's algorithm
 // "Fast, Minimum Storage Ray/Triangle Intersection"
 template<class V,class F>
@@ -126,39 +160,13 @@ int ray_N_inter(std::vector<V> const &V_arr,std::vector<F> const &F_arr,
     
     int Nt=F_arr.size();
     
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t,u,v;
     
     for(k=0;k<Nt;k++)
     {
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
-            {
-                v=scalar_prod(Q,D)*invdet;
-                
-                if(v>=0 && u+v<=1.0)
-                {
-                    if(scalar_prod(Q,E2)*invdet>=0) N_inter+=1;
-                }
-            }
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0) N_inter+=1;
         }
     }
     
@@ -239,9 +247,7 @@ int ray_N_inter_list(std::vector<V> const &V_arr,std::vector<F> const &F_arr,std
     int k;
     int N_inter=0;
     
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t,u,v;
     
     std::list<int> hit_list;
     std::list<int>::const_iterator iterator,hit_iterator;
@@ -252,45 +258,21 @@ int ray_N_inter_list(std::vector<V> const &V_arr,std::vector<F> const &F_arr,std
         
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0)
             {
-                v=scalar_prod(Q,D)*invdet;
+                bool already_hit=false;
                 
-                if(v>=0 && u+v<=1.0)
-                {
-                    if(scalar_prod(Q,E2)*invdet>=0)
+                for(hit_iterator=hit_list.begin();hit_iterator!=hit_list.end();hit_iterator++)
+                    if(k==*hit_iterator)
                     {
-                        bool already_hit=false;
-                        
-                        for(hit_iterator=hit_list.begin();hit_iterator!=hit_list.end();hit_iterator++)
-                            if(k==*hit_iterator)
-                            {
-                                already_hit=true;
-                                break;
-                            }
-                        
-                        if(!already_hit)
-                        {
-                            N_inter+=1;
-                            hit_list.push_back(k);
-                        }
+                        already_hit=true;
+                        break;
                     }
+                
+                if(!already_hit)
+                {
+                    N_inter+=1;
+                    hit_list.push_back(k);
                 }
             }
         }
@@ -310,48 +292,18 @@ void ray_inter(std::vector<V> const &V_arr,std::vector<F> const &F_arr,int face_
     
     int Nt=F_arr.size();
     
-    double t=0;
-    
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t=0,u,v;
     
     for(k=0;k<Nt;k++)
     {
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0 && t<t_intersec)
             {
-                v=scalar_prod(Q,D)*invdet;
-                
-                if(v>=0 && u+v<=1.0)
-                {
-                    t=scalar_prod(Q,E2)*invdet;
-                    
-                    if(t>=0 && t<t_intersec)
-                    {
-                        ftarget=k;
-                        t_intersec=t;
-                        uo=u;
-                        vo=v;
-                    }
-                }
+                ftarget=k;
+                t_intersec=t;
+                uo=u;
+                vo=v;
             }
         }
     }
@@ -365,45 +317,15 @@ void ray_inter(std::vector<V> const &V_arr,std::vector<F> const &F_arr,int face_
     
     int Nt=F_arr.size();
     
-    double t=0;
-    
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t=0,u,v;
     
     for(k=0;k<Nt;k++)
     {
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0)
             {
-                v=scalar_prod(Q,D)*invdet;
-                
-                if(v>=0 && u+v<=1.0)
-                {
-                    t=scalar_prod(Q,E2)*invdet;
-                    
-                    if(t>=0)
-                    {
-                        ray_face_intersect.push_back(RayFaceIntersect(k,t,u,v));
-                    }
-                }
+                ray_face_intersect.push_back(RayFaceIntersect(k,t,u,v));
             }
         }
     }
@@ -482,11 +404,7 @@ void ray_inter_list(std::vector<V> const &V_arr,std::vector<F> const &F_arr,std:
     ftarget=-1;
     t_intersec=1e100;
     
-    double t=0;
-    
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t=0,u,v;
     
     std::list<int>::const_iterator iterator;
     
@@ -496,38 +414,12 @@ void ray_inter_list(std::vector<V> const &V_arr,std::vector<F> const &F_arr,std:
         
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0 && t<t_intersec)
             {
-                v=scalar_prod(Q,D)*invdet;
-                
-                if(v>=0 && u+v<=1.0)
-                {
-                    t=scalar_prod(Q,E2)*invdet;
-                    
-                    if(t>=0 && t<t_intersec)
-                    {
-                        ftarget=k;
-                        t_intersec=t;
-                        uo=u;
-                        vo=v;
-                    }
-                }
+                ftarget=k;
+                t_intersec=t;
+                uo=u;
+                vo=v;
             }
         }
     }
@@ -544,11 +436,7 @@ void ray_inter_vector(std::vector<V> const &V_arr,std::vector<F> const &F_arr,st
     ftarget=-1;
     t_intersec=1e100;
     
-    double t=0;
-    
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t=0,u,v;
     
     std::vector<int>::const_iterator iterator;
     
@@ -558,38 +446,12 @@ void ray_inter_vector(std::vector<V> const &V_arr,std::vector<F> const &F_arr,st
         
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0 && t<t_intersec)
             {
-                v=scalar_prod(Q,D)*invdet;
-                
-                if(v>=0 && u+v<=1.0)
-                {
-                    t=scalar_prod(Q,E2)*invdet;
-                    
-                    if(t>=0 && t<t_intersec)
-                    {
-                        ftarget=k;
-                        t_intersec=t;
-                        uo=u;
-                        vo=v;
-                    }
-                }
+                ftarget=k;
+                t_intersec=t;
+                uo=u;
+                vo=v;
             }
         }
     }
@@ -603,11 +465,7 @@ void ray_inter_vector(std::vector<V> const &V_arr,std::vector<F> const &F_arr,st
 {
     int k;
     
-    double t=0;
-    
-    Vector3 E1,E2,P,Q,T;
-    double det,u,v;
-    double invdet;
+    double t=0,u,v;
     
     std::vector<int>::const_iterator iterator;
     
@@ -617,35 +475,9 @@ void ray_inter_vector(std::vector<V> const &V_arr,std::vector<F> const &F_arr,st
         
         if(k!=face_last_intersect)
         {
-            int const &V1=F_arr[k].V1;
-            int const &V2=F_arr[k].V2;
-            int const &V3=F_arr[k].V3;
-            
-            E1=V_arr[V2].loc-V_arr[V1].loc;
-            E2=V_arr[V3].loc-V_arr[V1].loc;
-            T=O-V_arr[V1].loc;
-            
-            P.crossprod(D,E2);
-            Q.crossprod(T,E1);
-            
-            det=scalar_prod(P,E1);
-            invdet=1.0/det;
-            
-            u=scalar_prod(P,T)*invdet;
-            
-            if(u>=0 && u<=1.0)
+            if(ray_inter_face(V_arr,F_arr[k],O,D,t,u,v) && t>=0)
             {
-                v=scalar_prod(Q,D)*invdet;
-                
-                if(v>=0 && u+v<=1.0)
-                {
-                    t=scalar_prod(Q,E2)*invdet;
-                    
-                    if(t>=0)
-                    {
-                        ray_face_intersect.push_back(RayFaceIntersect(k,t,u,v));
-                    }
-                }
+                ray_face_intersect.push_back(RayFaceIntersect(k,t,u,v));
             }
         }
     }
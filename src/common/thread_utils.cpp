@@ -322,11 +322,28 @@ void ThreadsPool::resize_pool(int Nthr_)
 
 //
 
+namespace
+{
+    thread_local int thread_budget=0;
+}
+
 int max_threads_number()
 {
     #ifndef MAX_NTHR
-        return std::thread::hardware_concurrency();
+        int Nthr=std::thread::hardware_concurrency();
     #else
-        return std::min(std::thread::hardware_concurrency(),static_cast<unsigned int>(MAX_NTHR));
+        int Nthr=std::min(std::thread::hardware_concurrency(),static_cast<unsigned int>(MAX_NTHR));
     #endif
+    
+    if(thread_budget>0) Nthr=std::min(Nthr,thread_budget);
+    
+    return std::max(Nthr,1);
+}
+
+// Caps max_threads_number() on the calling thread, for computations run side
+// by side, 0 to remove the cap
+
+void set_thread_budget(int Nthr)
+{
+    thread_budget=Nthr;
 }
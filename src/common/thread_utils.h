@@ -15,6 +15,8 @@ limitations under the License.*/
 #ifndef THREAD_UTILS_H
 #define THREAD_UTILS_H
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -204,5 +206,42 @@ class ThreadsPool
 };
 
 int max_threads_number();
+void set_thread_budget(int Nthr);
+
+// Runs f(t) for t in [0,Nthr[, one thread each, on the calling thread if Nthr<=1
+
+template<typename F>
+void run_threads(int Nthr,F const &f)
+{
+    if(Nthr<=1)
+    {
+        f(0);
+        return;
+    }
+    
+    std::vector<std::thread*> tsk(Nthr);
+    
+    for(int t=0;t<Nthr;t++) tsk[t]=new std::thread([&f,t]() { f(t); });
+    
+    for(int t=0;t<Nthr;t++)
+    {
+        tsk[t]->join();
+        delete tsk[t];
+    }
+}
+
+// Runs f(n) for n in [0,N[ on up to Nthr threads, the n handed out one at a time
+
+template<typename F>
+void parallel_for(int N,F const &f,int Nthr=max_threads_number())
+{
+    std::atomic<int> next_n(0);
+    
+    run_threads(std::max(1,std::min(Nthr,N)),[&](int t)
+    {
+        int n;
+        while((n=next_n++)<N) f(n);
+    });
+}
 
 #endif // THREAD_UTILS_H
@@ -26,7 +26,8 @@ FDFD::FDFD(double Dx_,double Dy_,double Dz_)
      F(6*Nxyz),
      D_mat(6*Nxyz,6*Nxyz),
      M_mat(6*Nxyz,6*Nxyz),
-     solver_type(SOLVE_LU)
+     solver_type(SOLVE_LU),
+     solver_memory(0)
 {
     Dx=Dx_;
     Dy=Dy_;
@@ -338,6 +339,16 @@ void FDFD::set_injection_plane_z(int k)
     inj_zp=k;
 }
 
+void FDFD::set_slice_scratch(std::filesystem::path const &path)
+{
+    slc_scratch=path;
+}
+
+void FDFD::set_solver_type(int solver_type_)
+{
+    solver_type=solver_type_;
+}
+
 int FDFD::slc_Ex(int i,int j) { return index(i,j,0,0); }
 int FDFD::slc_Ey(int i,int j) { return index(i,j,0,1); }
 int FDFD::slc_Ez(int i,int j) { return index(i,j,0,2); }
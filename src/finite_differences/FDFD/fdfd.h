@@ -21,6 +21,7 @@ limitations under the License.*/
 #include <material.h>
 #include <phys_tools.h>
 
+#include <Eigen/Dense>
 #include <Eigen/SparseCore>
 #include <Eigen/SparseLU>
 #include <Eigen/SparseQR>
@@ -40,27 +41,72 @@ enum
     SRC_PLANE_Z,
     SRC_CBOX,
     SOLVE_LU,
-    SOLVE_BiCGSTAB
+    SOLVE_BiCGSTAB,
+    SOLVE_MATRIX_FREE,
+    SOLVE_SAM
 };
 
 class Slice
 {
+    // One z-slice of the block-tridiagonal system A.x[k-1] + B.x[k] + C.x[k+1] = f[k]
+    // restricted to the tangential fields x=[Ex,Ey;Hx,Hy], Ez and Hz being local
+    // to the slice. A only couples the E rows to the H of the previous slice and C
+    // the H rows to the E of the next one, so both are stored as their Nt x Nt
+    // non-zero block, Nt being half the size of x.
+    // Slices with identical materials and stretching share a single instance
     public:
-        bool absorbed,solved;
+        bool has_A,has_C;
         
-        int ID,btm_ID,top_ID;
-        Slice *btm,*top;
-        
-        Eigen::SparseMatrix<Imdouble> A_mat,B_mat,C_mat;
+        Eigen::MatrixXcd A_mat,B_mat,C_mat;
+        Eigen::MatrixXcd BA_mat,BC_mat; // B^-1.[A;0] and B^-1.[0;C] once eliminated
+        Eigen::PartialPivLU<Eigen::MatrixXcd> B_LU;
         
         Slice();
         
-        void absorb_backward(Slice *slc);
-        void absorb_forward(Slice *slc);
-        void set_bottom(Slice *slc,int slc_ID);
-        void set_ID(int ID_);
-        void set_top(Slice *slc,int slc_ID);
-        void show();
+        void absorb_backward(Slice const &slc);
+        void absorb_forward(Slice const &slc);
+        void eliminate();
+        std::size_t memory_usage() const;
+        void read(std::istream &strm);
+        void release();
+        void write(std::ostream &strm) const;
+};
+
+std::size_t solve_slices(std::vector<Slice> &slc,std::vector<int> const &slc_ID,
+                         std::vector<Eigen::VectorXcd> &x,
+                         std::filesystem::path const &scratch_path="");
+
+class FDFD_CurlCurl
+{
+    // Matrix-free E-field curl-curl operator of the 3D FDFD discretization
+    // A.E = curl_H(curl_E(E)) - k0^2*eps_r*E, applied directly from matsgrid
+    private:
+        int Nx,Ny,Nz,Nxy,Nxyz;
+        bool pml_x,pml_y;
+        double k0;
+        Imdouble udy;
+        Imdouble shift_xp,shift_xm,shift_yp,shift_ym;
+        std::vector<Imdouble> udx_n,udx_h,udz_n,udz_h;
+        std::vector<Imdouble> mat_eps;
+        IndexGrid3 const &matsgrid;
+        
+        mutable Eigen::VectorXcd H_work;
+        
+        Imdouble diagonal(int i,int j,int k,int f) const;
+        
+    public:
+        double shift_beta;
+        int N_sweeps;
+        
+        FDFD_CurlCurl(FD_Base &fd,double w,double kx,double ky);
+        
+        void apply(Eigen::VectorXcd const &E,Eigen::VectorXcd &AE) const;
+        void curl_E(Eigen::VectorXcd const &E,Eigen::VectorXcd &H) const;
+        void curl_H(Eigen::VectorXcd const &H,Eigen::VectorXcd &E) const;
+        int index(int i,int j,int k,int f) const { return f+3*(i+j*Nx+k*Nxy); }
+        std::size_t memory_usage() const;
+        void precondition(Eigen::VectorXcd const &r,Eigen::VectorXcd &z) const;
+        int size() const { return 3*Nxyz; }
 };
 
 class FDFD: public FD_Base
@@ -83,6 +129,7 @@ class FDFD: public FD_Base
         Eigen::SparseMatrix<Imdouble> D_mat,M_mat;
         
         int solver_type;
+        std::filesystem::path slc_scratch;
         
         int slc_Ex(int i,int j);
         int slc_Ey(int i,int j);
@@ -91,8 +138,13 @@ class FDFD: public FD_Base
         int slc_Hy(int i,int j);
         int slc_Hz(int i,int j);
         
+        void set_injection_3D(Eigen::SparseVector<Imdouble> &F_src,
+                              AngleRad theta,AngleRad phi,AngleRad polar);
+        void solve_prop_3D_matrix_free(AngleRad theta,AngleRad phi,AngleRad polar);
         void update_Nxyz();
     public:
+        std::size_t solver_memory; // bytes held by the last 3D solve
+        
         FDFD(double Dx,double Dy,double Dz);
         
         void draw(int vmode,int pos_x,int pos_y,int pos_z,std::string name_mod="");
@@ -126,6 +178,8 @@ class FDFD: public FD_Base
         void set_injection_cbox(int xm,int xp,int ym,int yp,int zm,int zp,
                                Eigen::SparseVector<Imdouble> &F_src);
         void set_injection_plane_z(int k);
+        void set_slice_scratch(std::filesystem::path const &path);
+        void set_solver_type(int solver_type);
         
         void solve_prop_1D(double lambda,AngleRad theta,AngleRad phi,AngleRad polar);
         void solve_prop_2D(double lambda,AngleRad theta,AngleRad phi,AngleRad polar);
@@ -160,15 +214,20 @@ class FDMS: public FD_Base
 };
 
 
-void solve_LU(Eigen::SparseMatrix<Imdouble> const &A,
-              Eigen::VectorXcd &x,
-              Eigen::VectorXcd const &b);
+std::size_t solve_LU(Eigen::SparseMatrix<Imdouble> const &A,
+                     Eigen::VectorXcd &x,
+                     Eigen::VectorXcd const &b);
 
 void solve_BiCGSTAB(Eigen::SparseMatrix<Imdouble> const &A,
                     Eigen::VectorXcd &x,
                     Eigen::VectorXcd const &b,
                     Eigen::VectorXcd const &guess);
 
+int solve_BiCGSTAB_matrix_free(FDFD_CurlCurl const &A,
+                               Eigen::VectorXcd &x,
+                               Eigen::VectorXcd const &b,
+                               double tol=1e-5,int max_it=10000);
+
 Imdouble inverse_power_iteration(Eigen::SparseMatrix<Imdouble> const &A,
                                  Imdouble guess,Eigen::VectorXcd &V,
                                  double conv=1e-5,int max_it=100);
@@ -0,0 +1,414 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdfd.h>
+#include <profiler.h>
+
+
+extern const Imdouble Im;
+
+//###################
+//   FDFD_CurlCurl
+//###################
+
+// The stencils below mirror the triplets of FDFD::solve_prop_3D.
+// Eliminating H from the first-order system
+//
+//     curl_H.H + i*w*e0*eps_r*E = -J_e
+//     curl_E.E - i*w*mu0*H      = -J_m
+//
+// gives the second-order system on E alone, with three unknowns per cell
+// instead of six and no assembled matrix.
+
+FDFD_CurlCurl::FDFD_CurlCurl(FD_Base &fd,double w,double kx,double ky)
+    :Nx(fd.Nx), Ny(fd.Ny), Nz(fd.Nz),
+     Nxy(fd.Nxy), Nxyz(fd.Nxyz),
+     pml_x(fd.pml_x), pml_y(fd.pml_y),
+     k0(w/c_light),
+     udy(1.0/fd.Dy),
+     shift_xp(std::exp( kx*fd.Nx*fd.Dx*Im)),
+     shift_xm(std::exp(-kx*fd.Nx*fd.Dx*Im)),
+     shift_yp(1.0), shift_ym(1.0),
+     udx_n(Nx), udx_h(Nx),
+     udz_n(Nz), udz_h(Nz),
+     mat_eps(3*fd.Nmats),
+     matsgrid(fd.matsgrid),
+     H_work(3*Nxyz),
+     shift_beta(0.5),
+     N_sweeps(2)
+{
+    for(int i=0;i<Nx;i++)
+    {
+        udx_n[i]=1.0/fd.get_Dx(i,w);
+        udx_h[i]=1.0/fd.get_Dx(i+0.5,w);
+    }
+    
+    for(int k=0;k<Nz;k++)
+    {
+        udz_n[k]=1.0/fd.get_Dz(k,w);
+        udz_h[k]=1.0/fd.get_Dz(k+0.5,w);
+    }
+    
+    for(unsigned int m=0;m<fd.Nmats;m++) for(int f=0;f<3;f++)
+        mat_eps[3*m+f]=fd.get_eps(m,f,w);
+}
+
+void FDFD_CurlCurl::apply(Eigen::VectorXcd const &E,Eigen::VectorXcd &AE) const
+{
+    curl_E(E,H_work);
+    curl_H(H_work,AE);
+    
+    double k0_2=k0*k0;
+    
+    for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+    {
+        Imdouble const *eps=&mat_eps[3*matsgrid(i,j,k)];
+        
+        int ind=index(i,j,k,0);
+        
+        AE(ind  )-=k0_2*eps[0]*E(ind  );
+        AE(ind+1)-=k0_2*eps[1]*E(ind+1);
+        AE(ind+2)-=k0_2*eps[2]*E(ind+2);
+    }
+}
+
+void FDFD_CurlCurl::curl_E(Eigen::VectorXcd const &E,Eigen::VectorXcd &H) const
+{
+    for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+    {
+        Imdouble Ex=E(index(i,j,k,0));
+        Imdouble Ey=E(index(i,j,k,1));
+        Imdouble Ez=E(index(i,j,k,2));
+        
+        Imdouble Ex_jp=0,Ex_kp=0;
+        Imdouble Ey_ip=0,Ey_kp=0;
+        Imdouble Ez_ip=0,Ez_jp=0;
+        
+        if(i<Nx-1)
+        {
+            Ey_ip=E(index(i+1,j,k,1));
+            Ez_ip=E(index(i+1,j,k,2));
+        }
+        else if(!pml_x)
+        {
+            Ey_ip=shift_xp*E(index(0,j,k,1));
+            Ez_ip=shift_xp*E(index(0,j,k,2));
+        }
+        
+        if(j<Ny-1)
+        {
+            Ex_jp=E(index(i,j+1,k,0));
+            Ez_jp=E(index(i,j+1,k,2));
+        }
+        else if(!pml_y)
+        {
+            Ex_jp=shift_yp*E(index(i,0,k,0));
+            Ez_jp=shift_yp*E(index(i,0,k,2));
+        }
+        
+        if(k<Nz-1) { Ex_kp=E(index(i,j,k+1,0)); Ey_kp=E(index(i,j,k+1,1)); }
+        
+        H(index(i,j,k,0))=udy*(Ez_jp-Ez)-udz_h[k]*(Ey_kp-Ey);
+        H(index(i,j,k,1))=udz_h[k]*(Ex_kp-Ex)-udx_h[i]*(Ez_ip-Ez);
+        H(index(i,j,k,2))=udx_h[i]*(Ey_ip-Ey)-udy*(Ex_jp-Ex);
+    }
+}
+
+void FDFD_CurlCurl::curl_H(Eigen::VectorXcd const &H,Eigen::VectorXcd &E) const
+{
+    for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+    {
+        Imdouble Hx=H(index(i,j,k,0));
+        Imdouble Hy=H(index(i,j,k,1));
+        Imdouble Hz=H(index(i,j,k,2));
+        
+        Imdouble Hx_jm=0,Hx_km=0;
+        Imdouble Hy_im=0,Hy_km=0;
+        Imdouble Hz_im=0,Hz_jm=0;
+        
+        if(i>0)
+        {
+            Hy_im=H(index(i-1,j,k,1));
+            Hz_im=H(index(i-1,j,k,2));
+        }
+        else if(!pml_x)
+        {
+            Hy_im=shift_xm*H(index(Nx-1,j,k,1));
+            Hz_im=shift_xm*H(index(Nx-1,j,k,2));
+        }
+        
+        if(j>0)
+        {
+            Hx_jm=H(index(i,j-1,k,0));
+            Hz_jm=H(index(i,j-1,k,2));
+        }
+        else if(!pml_y)
+        {
+            Hx_jm=shift_ym*H(index(i,Ny-1,k,0));
+            Hz_jm=shift_ym*H(index(i,Ny-1,k,2));
+        }
+        
+        if(k>0) { Hx_km=H(index(i,j,k-1,0)); Hy_km=H(index(i,j,k-1,1)); }
+        
+        E(index(i,j,k,0))=udy*(Hz-Hz_jm)-udz_n[k]*(Hy-Hy_km);
+        E(index(i,j,k,1))=udz_n[k]*(Hx-Hx_km)-udx_n[i]*(Hz-Hz_im);
+        E(index(i,j,k,2))=udx_n[i]*(Hy-Hy_im)-udy*(Hx-Hx_jm);
+    }
+}
+
+Imdouble FDFD_CurlCurl::diagonal(int i,int j,int k,int f) const
+{
+    Imdouble D=0;
+    
+    bool has_im=(i>0 || !pml_x);
+    bool has_jm=(j>0 || !pml_y);
+    
+    int i_m=(i>0)? i-1 : Nx-1;
+    
+    if(f==0)
+    {
+        D=udy*udy+udz_n[k]*udz_h[k];
+        if(has_jm) D+=udy*udy;
+        if(k>0) D+=udz_n[k]*udz_h[k-1];
+    }
+    else if(f==1)
+    {
+        D=udz_n[k]*udz_h[k]+udx_n[i]*udx_h[i];
+        if(k>0) D+=udz_n[k]*udz_h[k-1];
+        if(has_im) D+=udx_n[i]*udx_h[i_m];
+    }
+    else
+    {
+        D=udx_n[i]*udx_h[i]+udy*udy;
+        if(has_im) D+=udx_n[i]*udx_h[i_m];
+        if(has_jm) D+=udy*udy;
+    }
+    
+    return D-k0*k0*(1.0+shift_beta*Im)*mat_eps[3*matsgrid(i,j,k)+f];
+}
+
+std::size_t FDFD_CurlCurl::memory_usage() const
+{
+    return sizeof(Imdouble)*(H_work.size()+udx_n.size()+udx_h.size()
+                             +udz_n.size()+udz_h.size()+mat_eps.size());
+}
+
+// Approximate inverse of the complex-shifted operator
+// curl_H.curl_E - (1+i*beta)*k0^2*eps_r through damped Jacobi sweeps.
+// The damping shift makes the sweeps contractive where the unshifted
+// Helmholtz operator is indefinite.
+
+void FDFD_CurlCurl::precondition(Eigen::VectorXcd const &r,Eigen::VectorXcd &z) const
+{
+    double omega=0.8;
+    
+    z.setZero(r.size());
+    
+    Eigen::VectorXcd Pz(r.size());
+    
+    for(int s=0;s<N_sweeps;s++)
+    {
+        if(s==0) Pz.setZero();
+        else
+        {
+            apply(z,Pz);
+            
+            // Adding the shift on top of the physical operator
+            
+            for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+            {
+                Imdouble const *eps=&mat_eps[3*matsgrid(i,j,k)];
+                Imdouble shift=-k0*k0*shift_beta*Im;
+                
+                int ind=index(i,j,k,0);
+                
+                Pz(ind  )+=shift*eps[0]*z(ind  );
+                Pz(ind+1)+=shift*eps[1]*z(ind+1);
+                Pz(ind+2)+=shift*eps[2]*z(ind+2);
+            }
+        }
+        
+        for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+        {
+            for(int f=0;f<3;f++)
+            {
+                int ind=index(i,j,k,f);
+                z(ind)+=omega*(r(ind)-Pz(ind))/diagonal(i,j,k,f);
+            }
+        }
+    }
+}
+
+//######################
+//   Krylov iteration
+//######################
+
+// Right-preconditioned BiCGSTAB, only requiring the operator application
+
+int solve_BiCGSTAB_matrix_free(FDFD_CurlCurl const &A,
+                               Eigen::VectorXcd &x,
+                               Eigen::VectorXcd const &b,
+                               double tol,int max_it)
+{
+    int N=A.size();
+    
+    if(x.size()!=N) x.setZero(N);
+    
+    Eigen::VectorXcd r(N),r0(N),p(N),v(N),s(N),t(N),p_h(N),s_h(N);
+    
+    A.apply(x,r);
+    r=b-r;
+    r0=r;
+    
+    p.setZero();
+    v.setZero();
+    
+    Imdouble rho=1.0,alpha=1.0,omega=1.0;
+    
+    double b_norm=b.norm();
+    if(b_norm==0) b_norm=1.0;
+    
+    double res=r.norm()/b_norm;
+    
+    int it=0;
+    
+    for(it=0;it<max_it && res>tol;it++)
+    {
+        Imdouble rho_next=r0.dot(r);
+        
+        if(std::abs(rho_next)==0)
+        {
+            Plog::print(LogType::WARNING, "BiCGSTAB breakdown, restarting\n");
+            
+            r0=r;
+            rho_next=r0.dot(r);
+            p.setZero();
+            v.setZero();
+            rho=alpha=omega=1.0;
+        }
+        
+        Imdouble beta=(rho_next/rho)*(alpha/omega);
+        rho=rho_next;
+        
+        p=r+beta*(p-omega*v);
+        
+        A.precondition(p,p_h);
+        A.apply(p_h,v);
+        
+        alpha=rho/r0.dot(v);
+        s=r-alpha*v;
+        
+        if(s.norm()/b_norm<tol)
+        {
+            x+=alpha*p_h;
+            res=s.norm()/b_norm;
+            it++;
+            break;
+        }
+        
+        A.precondition(s,s_h);
+        A.apply(s_h,t);
+        
+        omega=t.dot(s)/t.squaredNorm();
+        
+        x+=alpha*p_h+omega*s_h;
+        r=s-omega*t;
+        
+        res=r.norm()/b_norm;
+    }
+    
+    chk_msg_sc(it);
+    chk_msg_sc(res);
+    
+    if(res>tol) Plog::print(LogType::WARNING, "Matrix-free BiCGSTAB did not converge: ", res, "\n");
+    
+    return it;
+}
+
+//#######################
+//   FDFD 3D propagation
+//#######################
+
+void FDFD::solve_prop_3D_matrix_free(AngleRad theta,AngleRad phi,AngleRad polar)
+{
+    int i,j,k;
+    
+    double w=2.0*Pi*c_light/lambda;
+    
+    ProfileZone zone_assembly("assembly");
+    
+    FDFD_CurlCurl A(*this,w,kx,ky);
+    
+    Eigen::SparseVector<Imdouble> F_src(6*Nxyz);
+    
+    set_injection_3D(F_src,theta,phi,polar);
+    
+    // Splitting the electric and magnetic currents
+    
+    Eigen::VectorXcd J_e(3*Nxyz),J_m(3*Nxyz);
+    
+    J_e.setZero();
+    J_m.setZero();
+    
+    for(Eigen::SparseVector<Imdouble>::InnerIterator it(F_src);it;++it)
+    {
+        int ind=it.index();
+        int f=ind%6;
+        int cell=ind/6;
+        
+        if(f<3) J_e(3*cell+f)=it.value();
+        else J_m(3*cell+f-3)=it.value();
+    }
+    
+    // b = -i*w*mu0*J_e - curl_H.J_m
+    
+    Eigen::VectorXcd b(3*Nxyz),E(3*Nxyz);
+    
+    A.curl_H(J_m,b);
+    b=-w*mu0*Im*J_e-b;
+    
+    E.setZero();
+    
+    zone_assembly.stop();
+    
+    ProfileZone zone_solve("solve");
+    solve_BiCGSTAB_matrix_free(A,E,b);
+    zone_solve.stop();
+    
+    // Operator buffers plus the BiCGSTAB and field vectors
+    solver_memory=A.memory_usage()+sizeof(Imdouble)*12*3*Nxyz;
+    chk_msg_sc(solver_memory);
+    
+    // Recovering H = (curl_E.E + J_m)/(i*w*mu0)
+    
+    Eigen::VectorXcd H(3*Nxyz);
+    
+    A.curl_E(E,H);
+    H=(H+J_m)/(w*mu0*Im);
+    
+    F.resize(6*Nxyz);
+    
+    for(i=0;i<Nx;i++) for(j=0;j<Ny;j++) for(k=0;k<Nz;k++)
+    {
+        int ind=A.index(i,j,k,0);
+        
+        F(index_Ex(i,j,k))=E(ind  );
+        F(index_Ey(i,j,k))=E(ind+1);
+        F(index_Ez(i,j,k))=E(ind+2);
+        
+        F(index_Hx(i,j,k))=H(ind  );
+        F(index_Hy(i,j,k))=H(ind+1);
+        F(index_Hz(i,j,k))=H(ind+2);
+    }
+}
@@ -36,8 +36,8 @@ void fdfd_single_particle(FDFD_Mode const &fdfd_mode)
     fdfd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdfd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdfd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdfd_mode.discretize(matsgrid,Nx,Ny,Nz);
     
     if(Ny>1)
     {
@@ -56,6 +56,8 @@ void fdfd_single_particle(FDFD_Mode const &fdfd_mode)
     
     if(fdfd_mode.solver=="LU") fdfd.solver_type=SOLVE_LU;
     else if(fdfd_mode.solver=="BiCGSTAB") fdfd.solver_type=SOLVE_BiCGSTAB;
+    else if(fdfd_mode.solver=="matrix_free") fdfd.solver_type=SOLVE_MATRIX_FREE;
+    else if(fdfd_mode.solver=="SAM") fdfd.solver_type=SOLVE_SAM;
     else
     {
         Plog::print(LogType::FATAL, "Unknown solver: ", fdfd_mode.solver, "\n");
@@ -63,6 +65,13 @@ void fdfd_single_particle(FDFD_Mode const &fdfd_mode)
         std::exit(0);
     }
     
+    if(fdfd.solver_type==SOLVE_MATRIX_FREE || fdfd.solver_type==SOLVE_SAM)
+    {
+        Plog::print(LogType::FATAL, "The ", fdfd_mode.solver, " solver is only available in 3D, for periodic structures\n");
+        Plog::print(LogType::FATAL, "Aborting...\n");
+        std::exit(EXIT_FAILURE);
+    }
+    
     fdfd.set_padding(fdfd_mode.pad_xm,fdfd_mode.pad_xp,
                      fdfd_mode.pad_ym,fdfd_mode.pad_yp,
                      fdfd_mode.pad_zm,fdfd_mode.pad_zp);
@@ -122,6 +131,11 @@ void fdfd_single_particle(FDFD_Mode const &fdfd_mode)
         
         fdfd_aux.set_matsgrid(matsgrid_aux);
         
+        // fdfd and fdfd_aux hold their own copies of the grids
+        
+        matsgrid.init(0,0,0,0);
+        matsgrid_aux.init(0,0,0,0);
+        
         #ifdef OLDMAT
         for(unsigned int m=0;m<fdfd_mode.materials_str.size();m++)
         {
@@ -399,14 +413,11 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
     fdfd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdfd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdfd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdfd_mode.discretize(matsgrid,Nx,Ny,Nz);
     
-    if(Ny>1)
-    {
-        Plog::print(LogType::FATAL, "Warning, 3D case not supported yet.\nAborting.\n");
-        std::exit(EXIT_FAILURE);
-    }
+    std::vector<Subpixel_Mix> mixes;
+    fdfd_mode.subpixel_smoothing(matsgrid,mixes,Dx,Dy,Dz,false);
     
     AngleRad pol(0);
     std::string polar_mode=fdfd_mode.polarization;
@@ -419,6 +430,8 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
     
     if(fdfd_mode.solver=="LU") fdfd.solver_type=SOLVE_LU;
     else if(fdfd_mode.solver=="BiCGSTAB") fdfd.solver_type=SOLVE_BiCGSTAB;
+    else if(fdfd_mode.solver=="matrix_free") fdfd.solver_type=SOLVE_MATRIX_FREE;
+    else if(fdfd_mode.solver=="SAM") fdfd.solver_type=SOLVE_SAM;
     else
     {
         Plog::print(LogType::FATAL, "Unknown solver: ", fdfd_mode.solver, "\n");
@@ -426,6 +439,10 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
         std::exit(0);
     }
     
+    // The 2D solver only handles the assembled systems, the others go through the 3D one
+    
+    bool solve_3D=(Ny>1 || fdfd.solver_type==SOLVE_MATRIX_FREE || fdfd.solver_type==SOLVE_SAM);
+    
     fdfd.set_padding(fdfd_mode.pad_xm,fdfd_mode.pad_xp,
                      fdfd_mode.pad_ym,fdfd_mode.pad_yp,
                      fdfd_mode.pad_zm,fdfd_mode.pad_zp);
@@ -451,6 +468,9 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
                     fdfd_mode.alpha_zp);
     
     fdfd.set_matsgrid(matsgrid);
+    fdfd.set_subpixel_mixes(mixes);
+    
+    matsgrid.init(0,0,0,0);
     
     Nx=fdfd.Nx;
     Ny=fdfd.Ny;
@@ -530,7 +550,8 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
                 if(fdfd_mode.Nl>1)
                     lambda=interpolate_linear(fdfd_mode.lambda_min,fdfd_mode.lambda_max,l/(fdfd_mode.Nl-1.0));
                 
-                fdfd.solve_prop_2D(lambda,theta,phi,pol);
+                if(solve_3D) fdfd.solve_prop_3D(lambda,theta,phi,pol);
+                else fdfd.solve_prop_2D(lambda,theta,phi,pol);
                 
                 file<<fdfd.lambda<<" "<<theta.degree()<<" "<<phi.degree()<<" ";
                 
@@ -546,19 +567,19 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
                 // Specular reflection
                 
                 k=fdfd.zs_e+3;
-                for(i=0;i<Nx;i++)
+                for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
                 {
-                    R+=0.5*std::real(fdfd.get_Ex(i,0,k)*0.5*std::conj(fdfd.get_Hy(i,0,k)+fdfd.get_Hy(i,0,k-1))-
-                                     fdfd.get_Ey(i,0,k)*0.5*std::conj(fdfd.get_Hx(i,0,k)+fdfd.get_Hx(i,0,k-1)));
+                    R+=0.5*std::real(fdfd.get_Ex(i,j,k)*0.5*std::conj(fdfd.get_Hy(i,j,k)+fdfd.get_Hy(i,j,k-1))-
+                                     fdfd.get_Ey(i,j,k)*0.5*std::conj(fdfd.get_Hx(i,j,k)+fdfd.get_Hx(i,j,k-1)));
                 }
                 
-                R/=Nx*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index;
+                R/=Nx*Ny*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index;
                 
                 // Diffraction
                 
                 if(fdfd_mode.output_diffraction)
                 {
-                    double norm=Nx*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index*Dx*Dy;
+                    double norm=Nx*Ny*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index*Dx*Dy;
                     
                     for(i=0;i<Nx;i++)
                     for(j=0;j<Ny;j++)
@@ -597,19 +618,19 @@ void fdfd_periodic(FDFD_Mode const &fdfd_mode)
                 tra_index=std::sqrt(tra_index);
                 
                 k=fdfd.zs_s;
-                for(i=0;i<Nx;i++)
+                for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
                 {
-                    T-=0.5*std::real(fdfd.get_Ex(i,0,k)*0.5*std::conj(fdfd.get_Hy(i,0,k)+fdfd.get_Hy(i,0,k-1))-
-                                     fdfd.get_Ey(i,0,k)*0.5*std::conj(fdfd.get_Hx(i,0,k)+fdfd.get_Hx(i,0,k-1)));
+                    T-=0.5*std::real(fdfd.get_Ex(i,j,k)*0.5*std::conj(fdfd.get_Hy(i,j,k)+fdfd.get_Hy(i,j,k-1))-
+                                     fdfd.get_Ey(i,j,k)*0.5*std::conj(fdfd.get_Hx(i,j,k)+fdfd.get_Hx(i,j,k-1)));
                 }
                 
-                T/=Nx*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index;
+                T/=Nx*Ny*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index;
                 
                 // Diffraction
                 
                 if(fdfd_mode.output_diffraction)
                 {
-                    double norm=Nx*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index*Dx*Dy;
+                    double norm=Nx*Ny*0.5*std::sqrt(e0/mu0)*std::cos(fdfd.inc_theta)*inj_index*Dx*Dy;
                     
                     for(i=0;i<Nx;i++)
                     for(j=0;j<Ny;j++)
@@ -755,8 +776,8 @@ void mode_3D(FDFD_Mode const &fdfd_mode)
     fdfd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdfd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdfd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdfd_mode.discretize(matsgrid,Nx,Ny,Nz);
     
     AngleRad pol(0);
     std::string polar_mode=fdfd_mode.polarization;
@@ -782,6 +803,7 @@ void mode_3D(FDFD_Mode const &fdfd_mode)
                     fdfd_mode.alpha_zp);
     
     fdfd.set_matsgrid(matsgrid);
+    matsgrid.init(0,0,0,0);
         
     Nx=fdfd.Nx;
     Ny=fdfd.Ny;
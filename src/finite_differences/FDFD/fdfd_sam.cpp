@@ -14,6 +14,15 @@ limitations under the License.*/
 
 #include <fdfd.h>
 #include <logger.h>
+#include <profiler.h>
+#include <thread_utils.h>
+
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <random>
+#include <thread>
 
 extern const Imdouble Im;
 extern std::ofstream plog;
@@ -23,59 +32,409 @@ extern std::ofstream plog;
 //####################
 
 Slice::Slice()
-    :absorbed(false),solved(false),
-     ID(-1), btm_ID(-1), top_ID(-1),
-     btm(nullptr), top(nullptr)
+    :has_A(false), has_C(false)
+{
+}
+
+// Only the H rows of the previous slice's solution reach the E rows of this
+// one through A, and only the E rows of the next slice reach the H rows through C
+
+void Slice::absorb_backward(Slice const &slc)
+{
+    Eigen::Index Nt=A_mat.rows();
+    
+    B_mat.topLeftCorner(Nt,Nt).noalias()-=A_mat*slc.BC_mat.bottomRows(Nt);
+    
+    if(slc.has_A)
+    {
+        Eigen::MatrixXcd tmp=-A_mat*slc.BA_mat.bottomRows(Nt);
+        A_mat=std::move(tmp);
+    }
+    else A_mat.resize(0,0);
+    
+    has_A=slc.has_A;
+}
+
+void Slice::absorb_forward(Slice const &slc)
+{
+    Eigen::Index Nt=C_mat.rows();
+    
+    B_mat.bottomRightCorner(Nt,Nt).noalias()-=C_mat*slc.BA_mat.topRows(Nt);
+    
+    if(slc.has_C)
+    {
+        Eigen::MatrixXcd tmp=-C_mat*slc.BC_mat.topRows(Nt);
+        C_mat=std::move(tmp);
+    }
+    else C_mat.resize(0,0);
+    
+    has_C=slc.has_C;
+}
+
+void Slice::eliminate()
+{
+    Eigen::Index Nt=B_mat.rows()/2;
+    
+    B_LU.compute(B_mat);
+    
+    if(has_A)
+    {
+        Eigen::MatrixXcd tmp=Eigen::MatrixXcd::Zero(2*Nt,Nt);
+        tmp.topRows(Nt)=A_mat;
+        BA_mat=B_LU.solve(tmp);
+    }
+    
+    if(has_C)
+    {
+        Eigen::MatrixXcd tmp=Eigen::MatrixXcd::Zero(2*Nt,Nt);
+        tmp.bottomRows(Nt)=C_mat;
+        BC_mat=B_LU.solve(tmp);
+    }
+}
+
+std::size_t Slice::memory_usage() const
 {
+    std::size_t N=A_mat.size()+B_mat.size()+C_mat.size()
+                 +BA_mat.size()+BC_mat.size()
+                 +B_LU.rows()*B_LU.cols();
+    
+    return N*sizeof(Imdouble);
+}
+
+template<typename T>
+void slice_read(std::istream &strm,T &var)
+{
+    strm.read(reinterpret_cast<char*>(&var),sizeof(T));
+}
+
+void slice_read(std::istream &strm,Eigen::MatrixXcd &M)
+{
+    Eigen::Index rows=0,cols=0;
+    
+    slice_read(strm,rows);
+    slice_read(strm,cols);
+    
+    M.resize(rows,cols);
+    strm.read(reinterpret_cast<char*>(M.data()),rows*cols*sizeof(Imdouble));
+}
+
+template<typename T>
+void slice_write(std::ostream &strm,T const &var)
+{
+    strm.write(reinterpret_cast<char const*>(&var),sizeof(T));
 }
 
-void Slice::absorb_backward(Slice *slc)
+void slice_write(std::ostream &strm,Eigen::MatrixXcd const &M)
 {
-    btm_ID=slc->btm_ID;
-    btm=slc->btm;
+    Eigen::Index rows=M.rows(),cols=M.cols();
+    
+    slice_write(strm,rows);
+    slice_write(strm,cols);
+    
+    strm.write(reinterpret_cast<char const*>(M.data()),rows*cols*sizeof(Imdouble));
 }
 
-void Slice::absorb_forward(Slice *slc)
+void Slice::read(std::istream &strm)
 {
-    top_ID=slc->top_ID;
-    top=slc->top;
-        
-    Eigen::BiCGSTAB<Eigen::SparseMatrix<Imdouble>,Eigen::IncompleteLUT<Imdouble>> solver;
-    solver.setMaxIterations(5);
-    solver.setTolerance(1e-5);
-    
-    Eigen::SparseMatrix<Imdouble> x_mat(B_mat.rows(),B_mat.cols());
-    Plog::print(slc->A_mat.nonZeros(), "\n");
-    Plog::print(slc->B_mat.nonZeros(), "\n");
-    Plog::print(slc->C_mat.nonZeros(), "\n");
-    Plog::print("Absorb\n");
-    solver.compute(slc->B_mat);
-    Plog::print("Compute done\n");
-    
-    x_mat=solver.solve(slc->A_mat);
-    Plog::print("Solve 1\n");
-    B_mat=B_mat-C_mat*x_mat;
-    Plog::print("Solve 1 done\n");
-    
-    x_mat=solver.solve(slc->C_mat);
-    Plog::print("Solve 2\n");
-    C_mat=-C_mat*x_mat;
-    Plog::print("Solve 2 done\n");
+    slice_read(strm,has_A);
+    slice_read(strm,has_C);
+    slice_read(strm,BA_mat);
+    slice_read(strm,BC_mat);
 }
 
-void Slice::set_bottom(Slice *slc,int slc_ID) { btm=slc; btm_ID=slc_ID; }
-void Slice::set_ID(int ID_) { ID=ID_; }
-void Slice::set_top(Slice *slc,int slc_ID) { top=slc; top_ID=slc_ID; }
-void Slice::show()
+void Slice::release()
 {
-    Plog::print(ID, " ", btm_ID, " ", top_ID, " ",
-                this, " ", btm, " ", top, "\n");
+    A_mat.resize(0,0);
+    B_mat.resize(0,0);
+    C_mat.resize(0,0);
+    
+    B_LU=Eigen::PartialPivLU<Eigen::MatrixXcd>();
+}
+
+void Slice::write(std::ostream &strm) const
+{
+    slice_write(strm,has_A);
+    slice_write(strm,has_C);
+    slice_write(strm,BA_mat);
+    slice_write(strm,BC_mat);
 }
 
 //####################
-//       FDFD
+//   Slices solver
 //####################
+
+class Slices_Level
+{
+    public:
+        std::vector<int> odd_ID;
+        std::vector<Slice> odd_slc;
+        std::vector<Eigen::VectorXcd> g;
+        
+        void read(std::filesystem::path const &fname)
+        {
+            std::ifstream file(fname,std::ios::in|std::ios::binary);
+            
+            std::size_t N_slc=0,N_g=0;
+            
+            slice_read(file,N_slc);
+            odd_slc.resize(N_slc);
+            for(std::size_t n=0;n<N_slc;n++) odd_slc[n].read(file);
+            
+            slice_read(file,N_g);
+            odd_ID.resize(N_g);
+            g.resize(N_g);
+            
+            for(std::size_t n=0;n<N_g;n++)
+            {
+                Eigen::MatrixXcd tmp;
+                
+                slice_read(file,odd_ID[n]);
+                slice_read(file,tmp);
+                
+                g[n]=tmp.col(0);
+            }
+        }
+        
+        void write(std::filesystem::path const &fname)
+        {
+            std::ofstream file(fname,std::ios::out|std::ios::binary|std::ios::trunc);
+            
+            if(!file.is_open())
+            {
+                Plog::print(LogType::FATAL, "Could not open the slices scratch file ", fname.generic_string(), "\n");
+                std::exit(EXIT_FAILURE);
+            }
+            
+            std::size_t N_slc=odd_slc.size(),N_g=g.size();
+            
+            slice_write(file,N_slc);
+            for(std::size_t n=0;n<N_slc;n++) odd_slc[n].write(file);
+            
+            slice_write(file,N_g);
+            
+            for(std::size_t n=0;n<N_g;n++)
+            {
+                slice_write(file,odd_ID[n]);
+                slice_write(file,Eigen::MatrixXcd(g[n]));
+            }
+            
+            odd_ID.clear();
+            odd_slc.clear();
+            g.clear();
+        }
+};
+
+std::size_t slices_memory(std::vector<Slice> const &slc)
+{
+    std::size_t mem=0;
+    
+    for(Slice const &s:slc) mem+=s.memory_usage();
+    
+    return mem;
+}
+
+// Scratch files are tagged per process and per call so that concurrent solves
+// sharing a scratch directory do not overwrite each other's levels
+
+std::string slices_scratch_tag()
+{
+    static unsigned int process_tag=std::random_device()();
+    static std::atomic<unsigned int> call_count(0);
+    
+    return "sam_"+std::to_string(process_tag)+"_"+std::to_string(call_count++);
+}
+
+/*
+ * Solves the block-tridiagonal system A_k.x[k-1] + B_k.x[k] + C_k.x[k+1] = f[k]
+ * by cyclic reduction. slc holds one instance per class of identical slices,
+ * slc_ID maps every slice to its class and x holds f on input, the solution on output.
+ * Odd slices are eliminated at each level, classes being shared between slices
+ * with identical neighbourhoods so that layered stacks only factorize a handful
+ * of blocks. If scratch_path is set, the eliminated levels are kept on disk
+ * until the back-substitution.
+ * Returns the peak memory held by the slice blocks, in bytes.
+ */
+
+std::size_t solve_slices(std::vector<Slice> &slc,std::vector<int> const &slc_ID,
+                         std::vector<Eigen::VectorXcd> &x,
+                         std::filesystem::path const &scratch_path)
+{
+    std::vector<Slice> lvl_slc=slc;
+    std::vector<int> lvl_ID=slc_ID;
+    std::vector<Eigen::VectorXcd> f=x;
+    
+    Eigen::Index Nt=x[0].size()/2;
+    
+    std::vector<Slices_Level> levels;
+    
+    std::string scratch_tag;
+    if(!scratch_path.empty()) scratch_tag=slices_scratch_tag();
+    
+    auto level_fname=[&](int l)
+    {
+        return scratch_path/(scratch_tag+"_level_"+std::to_string(l)+".bin");
+    };
+    
+    std::size_t mem_levels=0,mem_peak=slices_memory(lvl_slc);
+    
+    while(lvl_ID.size()>1)
+    {
+        int N=lvl_ID.size();
+        int N_next=(N+1)/2;
+        
+        // Factorization of the classes of odd slices
+        
+        std::vector<int> odd_cls_ID(lvl_slc.size(),-1);
+        std::vector<int> odd_cls;
+        
+        for(int m=1;m<N;m+=2) if(odd_cls_ID[lvl_ID[m]]<0)
+        {
+            odd_cls_ID[lvl_ID[m]]=odd_cls.size();
+            odd_cls.push_back(lvl_ID[m]);
+        }
+        
+        ProfileZone zone_factorization("factorization");
+        parallel_for(odd_cls.size(),[&](int n){ lvl_slc[odd_cls[n]].eliminate(); });
+        zone_factorization.stop();
+        
+        Slices_Level level;
+        
+        level.odd_ID.resize(N/2);
+        level.g.resize(N/2);
+        
+        parallel_for(N/2,[&](int n)
+        {
+            int m=2*n+1;
+            
+            level.odd_ID[n]=odd_cls_ID[lvl_ID[m]];
+            level.g[n]=lvl_slc[lvl_ID[m]].B_LU.solve(f[m]);
+        });
+        
+        // Reduced system on even slices
+        
+        std::map<std::array<int,3>,int> cls_map;
+        std::vector<std::array<int,3>> cls_src;
+        std::vector<int> next_ID(N_next);
+        
+        for(int p=0;p<N_next;p++)
+        {
+            int m=2*p;
+            std::array<int,3> key={m>0 ? lvl_ID[m-1] : -1,
+                                   lvl_ID[m],
+                                   m<N-1 ? lvl_ID[m+1] : -1};
+            
+            auto it=cls_map.find(key);
+            
+            if(it==cls_map.end())
+            {
+                next_ID[p]=cls_src.size();
+                cls_map[key]=cls_src.size();
+                cls_src.push_back(key);
+            }
+            else next_ID[p]=it->second;
+        }
+        
+        std::vector<Slice> next_slc(cls_src.size());
+        
+        parallel_for(cls_src.size(),[&](int n)
+        {
+            std::array<int,3> const &key=cls_src[n];
+            
+            next_slc[n]=lvl_slc[key[1]];
+            
+            if(key[0]>=0) next_slc[n].absorb_backward(lvl_slc[key[0]]);
+            if(key[2]>=0) next_slc[n].absorb_forward(lvl_slc[key[2]]);
+        });
+        
+        std::vector<Eigen::VectorXcd> f_next(N_next);
         
+        parallel_for(N_next,[&](int p)
+        {
+            int m=2*p;
+            Slice const &cur=lvl_slc[lvl_ID[m]];
+            
+            f_next[p]=f[m];
+            
+            if(m>0) f_next[p].head(Nt).noalias()-=cur.A_mat*level.g[p-1].tail(Nt);
+            if(m<N-1) f_next[p].tail(Nt).noalias()-=cur.C_mat*level.g[p].head(Nt);
+        });
+        
+        mem_peak=std::max(mem_peak,mem_levels+slices_memory(lvl_slc)+slices_memory(next_slc));
+        
+        // Level storage
+        
+        level.odd_slc.resize(odd_cls.size());
+        
+        for(std::size_t n=0;n<odd_cls.size();n++)
+        {
+            Slice &tmp=lvl_slc[odd_cls[n]];
+            
+            tmp.release();
+            level.odd_slc[n]=std::move(tmp);
+        }
+        
+        if(!scratch_path.empty()) level.write(level_fname(levels.size()));
+        else mem_levels+=slices_memory(level.odd_slc);
+        
+        levels.push_back(std::move(level));
+        
+        lvl_slc=std::move(next_slc);
+        lvl_ID=std::move(next_ID);
+        f=std::move(f_next);
+    }
+    
+    // Back-substitution
+    
+    std::vector<Eigen::VectorXcd> x_lvl(1);
+    
+    x_lvl[0]=lvl_slc[lvl_ID[0]].B_mat.partialPivLu().solve(f[0]);
+    
+    for(int l=levels.size()-1;l>=0;l--)
+    {
+        Slices_Level &level=levels[l];
+        
+        if(!scratch_path.empty())
+        {
+            std::filesystem::path fname=level_fname(l);
+            
+            level.read(fname);
+            std::filesystem::remove(fname);
+        }
+        
+        int N_odd=level.g.size();
+        int N=x_lvl.size()+N_odd;
+        
+        std::vector<Eigen::VectorXcd> x_prev(N);
+        
+        for(std::size_t p=0;p<x_lvl.size();p++) x_prev[2*p]=std::move(x_lvl[p]);
+        
+        parallel_for(N_odd,[&](int n)
+        {
+            int m=2*n+1;
+            Slice const &odd=level.odd_slc[level.odd_ID[n]];
+            
+            x_prev[m]=level.g[n];
+            
+            if(odd.has_A) x_prev[m].noalias()-=odd.BA_mat*x_prev[m-1].tail(Nt);
+            if(odd.has_C) x_prev[m].noalias()-=odd.BC_mat*x_prev[m+1].head(Nt);
+        });
+        
+        x_lvl=std::move(x_prev);
+        
+        level.odd_ID.clear();
+        level.odd_slc.clear();
+        level.g.clear();
+    }
+    
+    x=std::move(x_lvl);
+    
+    return mem_peak;
+}
+
+//####################
+//       FDFD
+//####################
+
 void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad polar)
 {
     int i,j,k;
@@ -90,66 +449,115 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
     kx=kn*std::sin(theta)*std::cos(phi);
     ky=kn*std::sin(theta)*std::sin(phi);
     
-    D_mat.setZero();
-    M_mat.setZero();
+    // Slices classification
     
-    int eq=0;
-    Imdouble udx=1.0/Dx;
-    Imdouble udy=1.0/Dy;
-    Imdouble udz=1.0/Dz;
+    std::vector<int> slc_ID(Nz);
+    std::vector<int> slc_k;
+    
+    {
+        std::vector<std::vector<unsigned int>> slc_mats;
+        std::vector<Imdouble> slc_Dz,slc_Dz_h;
+        std::vector<bool> slc_btm,slc_top;
+        
+        for(k=0;k<Nz;k++)
+        {
+            std::vector<unsigned int> mats_k(Nxy);
+            
+            for(i=0;i<Nx;i++) for(j=0;j<Ny;j++) mats_k[i+j*Nx]=matsgrid(i,j,k);
+            
+            Imdouble Dz_k=get_Dz(k,w);
+            Imdouble Dz_h=get_Dz(k+0.5,w);
+            
+            slc_ID[k]=-1;
+            
+            for(std::size_t n=0;n<slc_k.size();n++)
+            {
+                if(slc_btm[n]==(k>0) && slc_top[n]==(k<Nz-1) &&
+                   slc_Dz[n]==Dz_k && slc_Dz_h[n]==Dz_h && slc_mats[n]==mats_k)
+                {
+                    slc_ID[k]=n;
+                    break;
+                }
+            }
+            
+            if(slc_ID[k]<0)
+            {
+                slc_ID[k]=slc_k.size();
+                
+                slc_k.push_back(k);
+                slc_mats.push_back(mats_k);
+                slc_Dz.push_back(Dz_k);
+                slc_Dz_h.push_back(Dz_h);
+                slc_btm.push_back(k>0);
+                slc_top.push_back(k<Nz-1);
+            }
+        }
+    }
     
-    // Slices initialization
+    // Local unknowns reordering: tangential E and H first, Ez and Hz last.
+    // Ez and Hz only couple within their slice through a diagonal block,
+    // so they are eliminated before the cyclic reduction, which then works
+    // on 4Nxy instead of 6Nxy unknowns per slice
     
-    std::vector<Slice> slc(Nz);
+    int Nt=2*Nxy;
+    std::vector<int> perm(6*Nxy);
     
-    for(k=0;k<Nz;k++)
+    for(int c=0;c<Nxy;c++)
     {
-        slc[k].set_ID(k);
-        if(k>0) slc[k].set_bottom(&slc[k-1],k-1);
-        if(k<Nz-1) slc[k].set_top(&slc[k+1],k+1);
-        
-        slc[k].show();
-        
-        slc[k].A_mat.resize(6*Nxy,6*Nxy);
-        slc[k].B_mat.resize(6*Nxy,6*Nxy);
-        slc[k].C_mat.resize(6*Nxy,6*Nxy);
-        
-        slc[k].A_mat.setZero();
-        slc[k].B_mat.setZero();
-        slc[k].C_mat.setZero();
+        perm[6*c+0]=2*c;
+        perm[6*c+1]=2*c+1;
+        perm[6*c+2]=2*Nt+2*c;
+        perm[6*c+3]=Nt+2*c;
+        perm[6*c+4]=Nt+2*c+1;
+        perm[6*c+5]=2*Nt+2*c+1;
     }
     
-    typedef Eigen::Triplet<Imdouble> T;
-    std::vector<T> Trp,Trp_m;
+    // Blocks of the current level, those of the next level and the eliminated
+    // levels, roughly
+    
+    std::size_t mem_estimate=sizeof(Imdouble)*slc_k.size()*14*Nt*Nt;
+    
+    Plog::print("SAM: ", Nz, " slices, ", slc_k.size(), " distinct, about ",
+                mem_estimate/(1024*1024), " MB of dense blocks\n");
     
-    Trp.reserve(24*Nxyz);
-    Trp_m.reserve(6*Nxyz);
+    // Slices assembly
     
-    int Ex,Ey,Ez,Hx,Hy,Hz;
+    ProfileZone zone_assembly("assembly");
     
-    // curl H = e dE/dt
+    std::vector<Slice> slc(slc_k.size());
+    
+    std::vector<Eigen::SparseMatrix<Imdouble>> slc_TI(slc_k.size()),slc_IT(slc_k.size());
+    std::vector<Eigen::VectorXcd> slc_D_inv(slc_k.size());
     
     Imdouble shift_xp=std::exp( kx*Nx*Dx*Im);
     Imdouble shift_xm=std::exp(-kx*Nx*Dx*Im);
     
-    Imdouble shift_yp=std::exp( ky*Ny*Dy*Im);
-    Imdouble shift_ym=std::exp(-ky*Ny*Dy*Im);
+    Imdouble shift_yp=1.0;
+    Imdouble shift_ym=1.0;
     
-    for(k=0;k<Nz;k++)
+    parallel_for(slc_k.size(),[&](int n)
     {
+        typedef Eigen::Triplet<Imdouble> T;
         std::vector<T> Trp_A,Trp_B,Trp_C;
         
-        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++) 
+        int i,j,eq;
+        int k=slc_k[n];
+        int Ex,Ey,Ez,Hx,Hy,Hz;
+        
+        Imdouble udx,udz;
+        Imdouble udy=1.0/Dy;
+        Imdouble er=1.0;
+        
+        // curl H = e dE/dt
+        
+        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
         {
             // Ex
             
             udx=1.0/get_Dx(i+0.5,w);
-            udy=1.0/get_Dy(j,w);
             udz=1.0/get_Dz(k,w);
             
-            Imdouble er=1.0;
-            
-            er=mats[matsgrid(i,j,k)].get_eps(w);
+            er=get_eps(matsgrid(i,j,k),0,w);
             
             eq=slc_Ex(i,j);
             Trp_B.push_back(T(eq,eq,w*e0*er*Im));
@@ -166,10 +574,9 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
             // Ey
             
             udx=1.0/get_Dx(i,w);
-            udy=1.0/get_Dy(j+0.5,w);
             udz=1.0/get_Dz(k,w);
             
-            er=mats[matsgrid(i,j,k)].get_eps(w);
+            er=get_eps(matsgrid(i,j,k),1,w);
             
             eq=slc_Ey(i,j);
             Trp_B.push_back(T(eq,eq,w*e0*er*Im));
@@ -186,10 +593,9 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
             // Ez
             
             udx=1.0/get_Dx(i,w);
-            udy=1.0/get_Dy(j,w);
             udz=1.0/get_Dz(k+0.5,w);
             
-            er=mats[matsgrid(i,j,k)].get_eps(w);
+            er=get_eps(matsgrid(i,j,k),2,w);
             
             eq=slc_Ez(i,j);
             Trp_B.push_back(T(eq,eq,w*e0*er*Im));
@@ -215,7 +621,6 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
             // Hx
             
             udx=1.0/get_Dx(i,w);
-            udy=1.0/get_Dy(j+0.5,w);
             udz=1.0/get_Dz(k+0.5,w);
             
             eq=slc_Hx(i,j);
@@ -233,7 +638,6 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
             // Hy
             
             udx=1.0/get_Dx(i+0.5,w);
-            udy=1.0/get_Dy(j,w);
             udz=1.0/get_Dz(k+0.5,w);
             
             eq=slc_Hy(i,j);
@@ -251,7 +655,6 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
             // Hz
             
             udx=1.0/get_Dx(i+0.5,w);
-            udy=1.0/get_Dy(j+0.5,w);
             udz=1.0/get_Dz(k,w);
             
             eq=slc_Hz(i,j);
@@ -271,96 +674,97 @@ void FDFD::solve_prop_3D_SAM(double lambda_,AngleRad theta,AngleRad phi,AngleRad
                         Ex=slc_Ex(i,j); Trp_B.push_back(T(eq,Ex,+udy));
         }
         
-        slc[k].A_mat.setFromTriplets(Trp_A.begin(),Trp_A.end());
-        slc[k].B_mat.setFromTriplets(Trp_B.begin(),Trp_B.end());
-        slc[k].C_mat.setFromTriplets(Trp_C.begin(),Trp_C.end());
-    }
-    
-//    Eigen::SparseVector<Imdouble> F_src(6*Nxyz);
-//    Eigen::VectorXcd b(6*Nxyz);
-//    
-//    if(inj_type==SRC_PLANE_Z)
-//    {
-//        ImVector3 E_in,H_in;
-//        
-//        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
-//        {
-//            k=inj_zp;
-//            
-//            plane_wave(lambda,1.0,Pi-theta,phi,polar,(i+0.5)*Dx,j*Dy,Dz/2.0,0,E_in,H_in);
-//            F_src.coeffRef(index_Ex(i,j,k))=-H_in.y/Dz;
-//            
-//            plane_wave(lambda,1.0,Pi-theta,phi,polar,i*Dx,(j+0.5)*Dy,Dz/2.0,0,E_in,H_in);
-//            F_src.coeffRef(index_Ey(i,j,k))=+H_in.x/Dz;
-//            
-//            plane_wave(lambda,1.0,Pi-theta,phi,polar,i*Dx,(j+0.5)*Dy,0,0,E_in,H_in);
-//            F_src.coeffRef(index_Hx(i,j,k))=-E_in.y/Dz;
-//            
-//            plane_wave(lambda,1.0,Pi-theta,phi,polar,(i+0.5)*Dx,j*Dy,0,0,E_in,H_in);
-//            F_src.coeffRef(index_Hy(i,j,k))=+E_in.x/Dz;
-//        }
-//    }
-//    else if(inj_type==SRC_CBOX)
-//    {
-//        F_src=inj_F_src;
-//    }
-//    
-//    b=-F_src;
-    
-    std::vector<Slice*> slc_p,slc_q;
-    
-    for(int k=0;k<Nz;k++) slc_p.push_back(&slc[k]);
-    
-    bool run=true;
-    
-    while(run)
-    {
-        if(slc_p.size()%2==0)
+        // Splitting into tangential (T) and interior (I) blocks
+        
+        std::vector<T> Trp_TT,Trp_TI,Trp_IT;
+        Eigen::VectorXcd D=Eigen::VectorXcd::Zero(Nt);
+        
+        for(T const &t:Trp_B)
         {
-            k=slc_p.size()/2;
+            int r=perm[t.row()];
+            int c=perm[t.col()];
             
-            slc_p[k-1]->absorb_forward(slc_p[k]);
-            slc_p[k+1]->absorb_backward(slc_p[k]);
-            slc_p[k]->absorbed=true;
-            
-            for(unsigned int k=0;k<slc_p.size();k++)
-            {
-                if(!slc_p[k]->absorbed) slc_q.push_back(slc_p[k]);
-            }
-            
-            slc_p=slc_q;
-            slc_q.clear();
-            Plog::print("\n");
-            for(unsigned int k=0;k<slc_p.size();k++)
-            {
-                slc_p[k]->show();
-            }
+                 if(r<2*Nt && c<2*Nt) Trp_TT.push_back(T(r,c,t.value()));
+            else if(r<2*Nt) Trp_TI.push_back(T(r,c-2*Nt,t.value()));
+            else if(c<2*Nt) Trp_IT.push_back(T(r-2*Nt,c,t.value()));
+            else D(r-2*Nt)+=t.value(); // Ez and Hz rows only hold their diagonal
         }
-        else
+        
+        Eigen::SparseMatrix<Imdouble> B_TT(2*Nt,2*Nt);
+        Eigen::SparseMatrix<Imdouble> &B_TI=slc_TI[n];
+        Eigen::SparseMatrix<Imdouble> &B_IT=slc_IT[n];
+        
+        B_TT.setFromTriplets(Trp_TT.begin(),Trp_TT.end());
+        B_TI.resize(2*Nt,Nt);
+        B_TI.setFromTriplets(Trp_TI.begin(),Trp_TI.end());
+        B_IT.resize(Nt,2*Nt);
+        B_IT.setFromTriplets(Trp_IT.begin(),Trp_IT.end());
+        
+        slc_D_inv[n]=D.cwiseInverse();
+        
+        Eigen::SparseMatrix<Imdouble> B_red=B_TT-B_TI*slc_D_inv[n].asDiagonal()*B_IT;
+        
+        slc[n].B_mat=Eigen::MatrixXcd(B_red);
+        
+        slc[n].has_A=(k>0);
+        slc[n].has_C=(k<Nz-1);
+        
+        // A: E rows against the H of the previous slice, C: H rows against the E of the next one
+        
+        if(slc[n].has_A)
         {
-            for(unsigned int k=0;k<slc_p.size();k++)
-            {
-                Plog::print(k, "\n");
-                if(k%2==1)
-                {
-                    slc_p[k-1]->absorb_forward(slc_p[k]);
-                    slc_p[k+1]->absorb_backward(slc_p[k]);
-                    slc_p[k]->absorbed=true;
-                }
-                
-                if(!slc_p[k]->absorbed) slc_q.push_back(slc_p[k]);
-            }
-            
-            slc_p=slc_q;
-            slc_q.clear();
-            Plog::print("\n");
-            for(unsigned int k=0;k<slc_p.size();k++)
-            {
-                slc_p[k]->show();
-            }
+            slc[n].A_mat=Eigen::MatrixXcd::Zero(Nt,Nt);
+            for(T const &t:Trp_A) slc[n].A_mat(perm[t.row()],perm[t.col()]-Nt)+=t.value();
         }
         
-        run=false;
-        if(slc_p.size()>2) run=true;
+        if(slc[n].has_C)
+        {
+            slc[n].C_mat=Eigen::MatrixXcd::Zero(Nt,Nt);
+            for(T const &t:Trp_C) slc[n].C_mat(perm[t.row()]-Nt,perm[t.col()])+=t.value();
+        }
+    });
+    
+    zone_assembly.stop();
+    
+    // Source, with Ez and Hz eliminated
+    
+    Eigen::SparseVector<Imdouble> F_src(6*Nxyz);
+    
+    set_injection_3D(F_src,theta,phi,polar);
+    
+    std::vector<Eigen::VectorXcd> f_I(Nz,Eigen::VectorXcd::Zero(Nt));
+    std::vector<Eigen::VectorXcd> x(Nz,Eigen::VectorXcd::Zero(2*Nt));
+    
+    for(Eigen::SparseVector<Imdouble>::InnerIterator it(F_src);it;++it)
+    {
+        k=it.index()/(6*Nxy);
+        int r=perm[it.index()-6*Nxy*k];
+        
+        if(r<2*Nt) x[k](r)=-it.value();
+        else f_I[k](r-2*Nt)=-it.value();
+    }
+    
+    for(k=0;k<Nz;k++)
+    {
+        int n=slc_ID[k];
+        x[k]-=slc_TI[n]*slc_D_inv[n].cwiseProduct(f_I[k]);
+    }
+    
+    ProfileZone zone_solve("solve");
+    solver_memory=solve_slices(slc,slc_ID,x,slc_scratch);
+    zone_solve.stop();
+    
+    // Recovery of Ez and Hz, then back to the global ordering
+    
+    for(k=0;k<Nz;k++)
+    {
+        int n=slc_ID[k];
+        Eigen::VectorXcd x_I=slc_D_inv[n].cwiseProduct(f_I[k]-slc_IT[n]*x[k]);
+        
+        for(int l=0;l<6*Nxy;l++)
+        {
+            int r=perm[l];
+            F(6*Nxy*k+l)=(r<2*Nt) ? x[k](r) : x_I(r-2*Nt);
+        }
     }
 }
@@ -13,6 +13,7 @@ See the License for the specific language governing permissions and
 limitations under the License.*/
 
 #include <fdfd.h>
+#include <profiler.h>
 
 
 extern const Imdouble Im;
@@ -20,6 +21,8 @@ extern std::ofstream plog;
 
 void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad polar)
 {
+    ProfileZone zone("fdfd_1D");
+    
     int k;
     
     lambda=lambda_;
@@ -32,6 +35,8 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     kx=kn*std::sin(theta)*std::cos(phi);
     ky=kn*std::sin(theta)*std::sin(phi);
     
+    ProfileZone zone_assembly("assembly");
+    
     D_mat.setZero();
     M_mat.setZero();
     
@@ -58,7 +63,7 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         
         Imdouble er=1.0;
         
-        er=mats[matsgrid(0,0,k)].get_eps(w);
+        er=get_eps(matsgrid(0,0,k),0,w);
         
         eq=index_Ex(k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -71,7 +76,7 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         
         udz=1.0/get_Dz(k,w);
         
-        er=mats[matsgrid(0,0,k)].get_eps(w);
+        er=get_eps(matsgrid(0,0,k),1,w);
         
         eq=index_Ey(k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -84,7 +89,7 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         
         udz=1.0/get_Dz(k+0.5,w);
         
-        er=mats[matsgrid(0,0,k)].get_eps(w);
+        er=get_eps(matsgrid(0,0,k),2,w);
         
         eq=index_Ez(k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -143,6 +148,8 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     
     W_mat=D_mat-M_mat;
     
+    zone_assembly.stop();
+    
     Eigen::SparseVector<Imdouble> F_src(6*Nxyz);
     Eigen::VectorXcd b(6*Nxyz);
     
@@ -161,10 +168,17 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     
     b=-F_src;
     
+    ProfileZone zone_factorization("factorization");
+    
     Eigen::SparseLU<Eigen::SparseMatrix<Imdouble>> solver;
     solver.analyzePattern(W_mat);
     solver.factorize(W_mat);
+    
+    zone_factorization.stop();
+    
+    ProfileZone zone_solve("solve");
     F=solver.solve(b);
+    zone_solve.stop();
     
 //    double eta=std::sqrt(mu0/e0);
 //    
@@ -190,15 +204,22 @@ void FDFD::solve_prop_1D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
 //    }
 }
 
-void solve_LU(Eigen::SparseMatrix<Imdouble> const &A,
-              Eigen::VectorXcd &x,
-              Eigen::VectorXcd const &b)
+// Returns the size in bytes of the L and U factors
+
+std::size_t solve_LU(Eigen::SparseMatrix<Imdouble> const &A,
+                     Eigen::VectorXcd &x,
+                     Eigen::VectorXcd const &b)
 {
     Eigen::SparseLU<Eigen::SparseMatrix<Imdouble>> solver;
     
+    ProfileZone zone_factorization("factorization");
     solver.compute(A);
+    zone_factorization.stop();
     
+    ProfileZone zone_solve("solve");
     x=solver.solve(b);
+    
+    return (solver.nnzL()+solver.nnzU())*(sizeof(Imdouble)+sizeof(int));
 }
 
 
@@ -343,9 +364,14 @@ void solve_BiCGSTAB(Eigen::SparseMatrix<Imdouble> const &A,
     
     solver.setMaxIterations(10000);
     solver.setTolerance(1e-5);
+    
+    ProfileZone zone_factorization("factorization");
     solver.compute(A);
+    zone_factorization.stop();
     
+    ProfileZone zone_solve("solve");
     x=solver.solveWithGuess(b,guess);
+    zone_solve.stop();
     
     chk_msg_sc(solver.iterations());
     chk_msg_sc(solver.error());
@@ -353,6 +379,8 @@ void solve_BiCGSTAB(Eigen::SparseMatrix<Imdouble> const &A,
 
 void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad polar)
 {
+    ProfileZone zone("fdfd_2D");
+    
     int i,k;
     
     lambda=lambda_;
@@ -361,7 +389,7 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     
     double w=2.0*Pi*c_light/lambda;
     
-    double up_index=mats[matsgrid(0,0,zs_e)].get_eps(w).real();
+    double up_index=get_eps(matsgrid(0,0,zs_e),0,w).real();
     up_index=std::sqrt(up_index);
     
     double kn=2.0*Pi/lambda*up_index;
@@ -369,6 +397,8 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     kx=kn*std::sin(theta)*std::cos(phi);
     ky=kn*std::sin(theta)*std::sin(phi);
     
+    ProfileZone zone_assembly("assembly");
+    
     D_mat.setZero();
     M_mat.setZero();
     
@@ -398,7 +428,7 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         
         Imdouble er=1.0;
         
-        er=mats[matsgrid(i,0,k)].get_eps(w);
+        er=get_eps(matsgrid(i,0,k),0,w);
         
         eq=index_Ex(i,0,k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -412,7 +442,7 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         udz=1.0/get_Dz(k,w);
         udx=1.0/get_Dx(i,w);
         
-        er=mats[matsgrid(i,0,k)].get_eps(w);
+        er=get_eps(matsgrid(i,0,k),1,w);
         
         eq=index_Ey(i,0,k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -431,7 +461,7 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         udz=1.0/get_Dz(k+0.5,w);
         udx=1.0/get_Dx(i,w);
         
-        er=mats[matsgrid(i,0,k)].get_eps(w);
+        er=get_eps(matsgrid(i,0,k),2,w);
         
         eq=index_Ez(i,0,k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -504,6 +534,8 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     
     W_mat=D_mat-M_mat;
     
+    zone_assembly.stop();
+    
     Eigen::SparseVector<Imdouble> F_src(6*Nxyz);
     Eigen::VectorXcd b(6*Nxyz);
     
@@ -512,7 +544,7 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         ImVector3 E_in,H_in;
         
         k=inj_zp;
-        double inj_index=mats[matsgrid(0,0,k)].get_eps(w).real();
+        double inj_index=get_eps(matsgrid(0,0,k),0,w).real();
         inj_index=std::sqrt(inj_index);
         
         for(i=0;i<Nx;i++)
@@ -538,7 +570,9 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     
     b=-F_src;
     
-    if(solver_type==SOLVE_LU) solve_LU(W_mat,F,b);
+    solver_memory=W_mat.nonZeros()*(sizeof(Imdouble)+sizeof(int));
+    
+    if(solver_type==SOLVE_LU) solver_memory+=solve_LU(W_mat,F,b);
     else if(solver_type==SOLVE_BiCGSTAB)
     {
         Eigen::VectorXcd F_guess(6*Nxyz);
@@ -570,8 +604,42 @@ void FDFD::solve_prop_2D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     }
 }
 
+void FDFD::set_injection_3D(Eigen::SparseVector<Imdouble> &F_src,
+                            AngleRad theta,AngleRad phi,AngleRad polar)
+{
+    int i,j,k;
+    
+    if(inj_type==SRC_PLANE_Z)
+    {
+        ImVector3 E_in,H_in;
+        
+        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
+        {
+            k=inj_zp;
+            
+            plane_wave(lambda,1.0,Pi-theta,phi,polar,(i+0.5)*Dx,j*Dy,Dz/2.0,0,E_in,H_in);
+            F_src.coeffRef(index_Ex(i,j,k))=-H_in.y/Dz;
+            
+            plane_wave(lambda,1.0,Pi-theta,phi,polar,i*Dx,(j+0.5)*Dy,Dz/2.0,0,E_in,H_in);
+            F_src.coeffRef(index_Ey(i,j,k))=+H_in.x/Dz;
+            
+            plane_wave(lambda,1.0,Pi-theta,phi,polar,i*Dx,(j+0.5)*Dy,0,0,E_in,H_in);
+            F_src.coeffRef(index_Hx(i,j,k))=-E_in.y/Dz;
+            
+            plane_wave(lambda,1.0,Pi-theta,phi,polar,(i+0.5)*Dx,j*Dy,0,0,E_in,H_in);
+            F_src.coeffRef(index_Hy(i,j,k))=+E_in.x/Dz;
+        }
+    }
+    else if(inj_type==SRC_CBOX)
+    {
+        F_src=inj_F_src;
+    }
+}
+
 void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad polar)
 {
+    ProfileZone zone("fdfd_3D");
+    
     int i,j,k;
     
     lambda=lambda_;
@@ -584,6 +652,19 @@ void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     kx=kn*std::sin(theta)*std::cos(phi);
     ky=kn*std::sin(theta)*std::sin(phi);
     
+    if(solver_type==SOLVE_MATRIX_FREE)
+    {
+        solve_prop_3D_matrix_free(theta,phi,polar);
+        return;
+    }
+    else if(solver_type==SOLVE_SAM)
+    {
+        solve_prop_3D_SAM(lambda,theta,phi,polar);
+        return;
+    }
+    
+    ProfileZone zone_assembly("assembly");
+    
     D_mat.setZero();
     M_mat.setZero();
     
@@ -620,7 +701,7 @@ void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
         
         Imdouble er=1.0;
         
-        er=mats[matsgrid(i,j,k)].get_eps(w);
+        er=get_eps(matsgrid(i,j,k),0,w);
         
         eq=index_Ex(i,j,k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -640,7 +721,7 @@ void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
 //        udy=1.0/get_Dy(j+0.5,w);
         udz=1.0/get_Dz(k,w);
         
-        er=mats[matsgrid(i,j,k)].get_eps(w);
+        er=get_eps(matsgrid(i,j,k),1,w);
         
         eq=index_Ey(i,j,k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -660,7 +741,7 @@ void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
 //        udy=1.0/get_Dy(j,w);
         udz=1.0/get_Dz(k+0.5,w);
         
-        er=mats[matsgrid(i,j,k)].get_eps(w);
+        er=get_eps(matsgrid(i,j,k),2,w);
         
         eq=index_Ez(i,j,k);
         Trp_m.push_back(T(eq,eq,-w*e0*er*Im));
@@ -751,6 +832,8 @@ void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     
     W_mat=D_mat-M_mat;
     
+    zone_assembly.stop();
+    
 //    plog<<W_mat<<std::endl;
     
     chk_msg_sc(W_mat.nonZeros());
@@ -758,35 +841,13 @@ void FDFD::solve_prop_3D(double lambda_,AngleRad theta,AngleRad phi,AngleRad pol
     Eigen::SparseVector<Imdouble> F_src(6*Nxyz);
     Eigen::VectorXcd b(6*Nxyz);
     
-    if(inj_type==SRC_PLANE_Z)
-    {
-        ImVector3 E_in,H_in;
-        
-        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
-        {
-            k=inj_zp;
-            
-            plane_wave(lambda,1.0,Pi-theta,phi,polar,(i+0.5)*Dx,j*Dy,Dz/2.0,0,E_in,H_in);
-            F_src.coeffRef(index_Ex(i,j,k))=-H_in.y/Dz;
-            
-            plane_wave(lambda,1.0,Pi-theta,phi,polar,i*Dx,(j+0.5)*Dy,Dz/2.0,0,E_in,H_in);
-            F_src.coeffRef(index_Ey(i,j,k))=+H_in.x/Dz;
-            
-            plane_wave(lambda,1.0,Pi-theta,phi,polar,i*Dx,(j+0.5)*Dy,0,0,E_in,H_in);
-            F_src.coeffRef(index_Hx(i,j,k))=-E_in.y/Dz;
-            
-            plane_wave(lambda,1.0,Pi-theta,phi,polar,(i+0.5)*Dx,j*Dy,0,0,E_in,H_in);
-            F_src.coeffRef(index_Hy(i,j,k))=+E_in.x/Dz;
-        }
-    }
-    else if(inj_type==SRC_CBOX)
-    {
-        F_src=inj_F_src;
-    }
+    set_injection_3D(F_src,theta,phi,polar);
     
     b=-F_src;
     
-    if(solver_type==SOLVE_LU) solve_LU(W_mat,F,b);
+    solver_memory=W_mat.nonZeros()*(sizeof(Imdouble)+sizeof(int));
+    
+    if(solver_type==SOLVE_LU) solver_memory+=solve_LU(W_mat,F,b);
     else if(solver_type==SOLVE_BiCGSTAB)
     {
         Eigen::VectorXcd F_guess(6*Nxyz);
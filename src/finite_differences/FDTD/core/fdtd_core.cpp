@@ -14,6 +14,7 @@ limitations under the License.*/
 
 #include <fdtd_core.h>
 #include <logger.h>
+#include <profiler.h>
 
 extern const Imdouble Im;
 
@@ -360,7 +361,8 @@ FDTD::~FDTD()
 //    }
 //}
 
-void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
+template<typename T>
+void FDTD::advEx_kernel(T const *mats_index,int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
     int i,j,k;
     int j1,k1;
@@ -403,11 +405,7 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
             
             for(i=i1_;i<i2_;i++) //0 - Nx
             {
-                #ifndef SEP_MATS
-                M=matsgrid(i,j,k);
-                #else
-                M=matsgrid_x(i,j,k);
-                #endif
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].coeffsX(C1,C2y,C2z);
                 
@@ -418,6 +416,18 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
     }
 }
 
+void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
+{
+    #ifndef SEP_MATS
+    IndexGrid3 const &grid=matsgrid;
+    #else
+    IndexGrid3 const &grid=matsgrid_x;
+    #endif
+    
+    grid.visit([&](auto const *mats_index)
+        { advEx_kernel(mats_index,i1_,i2_,j1_,j2_,k1_,k2_); });
+}
+
 //void FDTD::advEy(int j1,int j2)
 //{
 //    int i,j,k;
@@ -475,7 +485,8 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 //    }
 //}
 
-void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
+template<typename T>
+void FDTD::advEy_kernel(T const *mats_index,int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
     int i,j,k;
     int i1,i2,k1,k2;
@@ -517,11 +528,7 @@ void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
                 
                 inv_kappa_x=1.0/kappa_x;
                 
-                #ifndef SEP_MATS
-                M=matsgrid(i,j,k);
-                #else
-                M=matsgrid_y(i,j,k);
-                #endif
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].coeffsY(C1,C2x,C2z);
                 
@@ -532,6 +539,18 @@ void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
     }
 }
 
+void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
+{
+    #ifndef SEP_MATS
+    IndexGrid3 const &grid=matsgrid;
+    #else
+    IndexGrid3 const &grid=matsgrid_y;
+    #endif
+    
+    grid.visit([&](auto const *mats_index)
+        { advEy_kernel(mats_index,i1_,i2_,j1_,j2_,k1_,k2_); });
+}
+
 //void FDTD::advEz(int k1,int k2)
 //{
 //    int i,j,k;
@@ -597,7 +616,8 @@ void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 //    }
 //}
 
-void FDTD::advEz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
+template<typename T>
+void FDTD::advEz_kernel(T const *mats_index,int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
     int i,j,k;
     int i1,i2;
@@ -647,11 +667,7 @@ void FDTD::advEz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
                 
                 inv_kappa_x=1.0/kappa_x;
             
-                #ifndef SEP_MATS
-                M=matsgrid(i,j,k);
-                #else
-                M=matsgrid_z(i,j,k);
-                #endif
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].coeffsZ(C1,C2x,C2y);
                                 
@@ -662,6 +678,18 @@ void FDTD::advEz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
     }
 }
 
+void FDTD::advEz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
+{
+    #ifndef SEP_MATS
+    IndexGrid3 const &grid=matsgrid;
+    #else
+    IndexGrid3 const &grid=matsgrid_z;
+    #endif
+    
+    grid.visit([&](auto const *mats_index)
+        { advEz_kernel(mats_index,i1_,i2_,j1_,j2_,k1_,k2_); });
+}
+
 //void FDTD::advHx(int i1,int i2)
 //{
 //    int i,j,k;
@@ -968,7 +996,8 @@ void FDTD::advHz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
     }
 }
 
-void FDTD::advMats_ante(int i1,int i2)
+template<typename T>
+void FDTD::advMats_ante_kernel(T const *mats_index,int i1,int i2)
 {
     int i,j,k;
     int M;
@@ -979,7 +1008,7 @@ void FDTD::advMats_ante(int i1,int i2)
         {
             for(i=i1;i<i2;i++) //0 - Nx
             {
-                M=matsgrid(i,j,k);
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].ante_compute(i,j,k,Ex,Ey,Ez);
             }
@@ -994,7 +1023,7 @@ void FDTD::advMats_ante(int i1,int i2)
             {
                 for(i=i1;i<i2;i++) //0 - Nx
                 {
-                    M=matsgrid(i,j,k);
+                    M=mats_index[i+(j+k*Ny)*Nx];
                     
                     if(mats[M].m_type==MAT_NAGRA_2LVL)
                     {
@@ -1011,7 +1040,14 @@ void FDTD::advMats_ante(int i1,int i2)
     }
 }
 
-void FDTD::advMats_simp(int i1,int i2)
+void FDTD::advMats_ante(int i1,int i2)
+{
+    matsgrid.visit([&](auto const *mats_index)
+        { advMats_ante_kernel(mats_index,i1,i2); });
+}
+
+template<typename T>
+void FDTD::advMats_simp_kernel(T const *mats_index,int i1,int i2)
 {
     int i,j,k;
     int M;
@@ -1022,7 +1058,7 @@ void FDTD::advMats_simp(int i1,int i2)
         {
             for(i=i1;i<i2;i++) //0 - Nx
             {
-                M=matsgrid(i,j,k);
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].apply_E(i,j,k,Ex,0);
                 mats[M].apply_E(i,j,k,Ey,1);
@@ -1032,7 +1068,14 @@ void FDTD::advMats_simp(int i1,int i2)
     }
 }
 
-void FDTD::advMats_post(int i1,int i2)
+void FDTD::advMats_simp(int i1,int i2)
+{
+    matsgrid.visit([&](auto const *mats_index)
+        { advMats_simp_kernel(mats_index,i1,i2); });
+}
+
+template<typename T>
+void FDTD::advMats_post_kernel(T const *mats_index,int i1,int i2)
 {
     int i,j,k;
     int M;
@@ -1043,7 +1086,7 @@ void FDTD::advMats_post(int i1,int i2)
         {
             for(i=i1;i<i2;i++) //0 - Nx
             {
-                M=matsgrid(i,j,k);
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].post_compute(i,j,k,Ex,Ey,Ez);
             }
@@ -1051,7 +1094,14 @@ void FDTD::advMats_post(int i1,int i2)
     }
 }
 
-void FDTD::advMats_self(int i1,int i2)
+void FDTD::advMats_post(int i1,int i2)
+{
+    matsgrid.visit([&](auto const *mats_index)
+        { advMats_post_kernel(mats_index,i1,i2); });
+}
+
+template<typename T>
+void FDTD::advMats_self_kernel(T const *mats_index,int i1,int i2)
 {
     int i,j,k;
     int M;
@@ -1062,7 +1112,7 @@ void FDTD::advMats_self(int i1,int i2)
         {
             for(i=i1;i<i2;i++) //0 - Nx
             {
-                M=matsgrid(i,j,k);
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].self_compute(i,j,k,Ex,Ey,Ez);
             }
@@ -1070,6 +1120,12 @@ void FDTD::advMats_self(int i1,int i2)
     }
 }
 
+void FDTD::advMats_self(int i1,int i2)
+{
+    matsgrid.visit([&](auto const *mats_index)
+        { advMats_self_kernel(mats_index,i1,i2); });
+}
+
 void FDTD::alloc_DEBH()
 {
     int aNx=Nx;
@@ -1162,40 +1218,58 @@ void FDTD::disable_fields(std::vector<int> const &fields)
 
 void FDTD::update_E()
 {
+    ProfileZone zone("fdtd_E");
+    
     if(tstep==0) pml_coeff_calc();
     
     std::unique_lock<std::mutex> lock(alternator_E.get_main_mutex());
     
     allow_run_E=true;
     
+    // The zones of the phases span the slowest thread, the workers time
+    // their own share
+    
     // Materials Ante
     
+    ProfileZone zone_ante("materials_ante");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_ante.stop();
     
     // E Field
     
+    ProfileZone zone_E("E");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_E.stop();
+    
     // Materials Simp
     
+    ProfileZone zone_simp("materials_simp");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_simp.stop();
     
     // Materials Post
     
+    ProfileZone zone_post("materials_post");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_post.stop();
     
     // Materials Self
     
+    ProfileZone zone_self("materials_self");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_self.stop();
     
     // PMLS
     
+    ProfileZone zone_pml("pml_E");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_pml.stop();
     
     allow_run_E=false;
     
@@ -1227,6 +1301,7 @@ void FDTD::update_E_ante()
     
     // Materials Ante
     
+    ProfileZone zone("materials_ante");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
 }
@@ -1237,6 +1312,7 @@ void FDTD::update_E_self()
     
     // E Field
     
+    ProfileZone zone("E");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
 }
@@ -1247,23 +1323,31 @@ void FDTD::update_E_post()
     
     // Materials Simp
     
+    ProfileZone zone_simp("materials_simp");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_simp.stop();
     
     // Materials Post
     
+    ProfileZone zone_post("materials_post");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_post.stop();
     
     // Materials Self
     
+    ProfileZone zone_self("materials_self");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_self.stop();
     
     // PMLS
     
+    ProfileZone zone_pml("pml_E");
     alternator_E.signal_threads();
     alternator_E.main_wait_threads(lock);
+    zone_pml.stop();
     
     allow_run_E=false;
 }
@@ -1315,19 +1399,25 @@ void FDTD::update_E_ext()
 
 void FDTD::update_H()
 {
+    ProfileZone zone("fdtd_H");
+    
     std::unique_lock<std::mutex> lock(alternator_H.get_main_mutex());
     
     allow_run_H=true;
         
     // H Field
     
+    ProfileZone zone_H("H");
     alternator_H.signal_threads();
     alternator_H.main_wait_threads(lock);
+    zone_H.stop();
     
     // PMLS
     
+    ProfileZone zone_pml("pml_H");
     alternator_H.signal_threads();
     alternator_H.main_wait_threads(lock);
+    zone_pml.stop();
     
     allow_run_H=false;
     
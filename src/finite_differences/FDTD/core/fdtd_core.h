@@ -53,11 +53,11 @@ class FDTD
         //ChpIn chp;
         Grid1<FDTD_Material> mats;
         #ifndef SEP_MATS
-        Grid3<unsigned int> matsgrid;
+        IndexGrid3 matsgrid;
         #else
-        Grid3<unsigned int> matsgrid_x;
-        Grid3<unsigned int> matsgrid_y;
-        Grid3<unsigned int> matsgrid_z;
+        IndexGrid3 matsgrid_x;
+        IndexGrid3 matsgrid_y;
+        IndexGrid3 matsgrid_z;
         #endif
         Grid3<double> Ex,Ey,Ez,Hx,Hy,Hz;
 
@@ -118,6 +118,7 @@ class FDTD
         void set_matsgrid(Grid3<unsigned int> &mat_x,Grid3<unsigned int> &mat_y,Grid3<unsigned int> &mat_z);
         #endif
         void set_material(unsigned int index,Material const &material);
+        void set_material_diag(unsigned int index,double eps_x,double eps_y,double eps_z);
         //void set_spectrum_dens(int);
         void set_tapering(int Ntap);
         
@@ -145,6 +146,18 @@ class FDTD
         void advMats_post(int,int);
         void advMats_self(int,int);
         
+        // Kernels instantiated per material index width, see IndexGrid3::visit
+        
+        template<typename T> void advEx_kernel(T const *mats_index,int i1,int i2,int j1,int j2,int k1,int k2);
+        template<typename T> void advEy_kernel(T const *mats_index,int i1,int i2,int j1,int j2,int k1,int k2);
+        template<typename T> void advEz_kernel(T const *mats_index,int i1,int i2,int j1,int j2,int k1,int k2);
+        
+        template<typename T> void advMats_ante_kernel(T const *mats_index,int,int);
+        template<typename T> void advMats_simp_kernel(T const *mats_index,int,int);
+        template<typename T> void advMats_ext_kernel(T const *mats_index,int,int);
+        template<typename T> void advMats_post_kernel(T const *mats_index,int,int);
+        template<typename T> void advMats_self_kernel(T const *mats_index,int,int);
+        
         void update_E();
         void update_H();
         
@@ -290,7 +290,8 @@ void FDTD::adv_dt_Bz(int k1,int k2)
 //####################
 //####################
 
-void FDTD::advMats_ext(int i1,int i2)
+template<typename T>
+void FDTD::advMats_ext_kernel(T const *mats_index,int i1,int i2)
 {
     int i,j,k;
     int M;
@@ -301,7 +302,7 @@ void FDTD::advMats_ext(int i1,int i2)
         {
             for(i=i1;i<i2;i++) //0 - Nx
             {
-                M=matsgrid(i,j,k);
+                M=mats_index[i+(j+k*Ny)*Nx];
                 
                 mats[M].apply_D2E(i,j,k,Ex,0,dt_Dx,dt_Dy,dt_Dz);
                 mats[M].apply_D2E(i,j,k,Ey,1,dt_Dx,dt_Dy,dt_Dz);
@@ -310,3 +311,9 @@ void FDTD::advMats_ext(int i1,int i2)
         }
     }
 }
+
+void FDTD::advMats_ext(int i1,int i2)
+{
+    matsgrid.visit([&](auto const *mats_index)
+        { advMats_ext_kernel(mats_index,i1,i2); });
+}
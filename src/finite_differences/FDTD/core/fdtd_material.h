@@ -44,6 +44,7 @@ class FDTD_Material
         int Np,Np_r,Np_c;
         double Dx,Dy,Dz,Dt;
         double C1,C2,C2x,C2y,C2z,C3,C4;
+        double ani_fx,ani_fy,ani_fz; // per component factors of the curl coefficients
         double ei,sig;
         
         bool comp_simp;
@@ -108,7 +109,7 @@ class FDTD_Material
         
         bool needs_D_field();
         void link_fdtd(double Dx,double Dy,double Dz,double Dt);
-        void link_grid(Grid3<unsigned int> const &mat_grid,unsigned int ID);
+        void link_grid(IndexGrid3 const &mat_grid,unsigned int ID);
         
         void operator = (double);
         void operator = (FDTD_Material const&);
@@ -147,6 +148,7 @@ class FDTD_Material
         //###############
         
         void set_const(double);
+        void set_const_diag(double eps_x,double eps_y,double eps_z);
         //void set_const_i(Imdouble,double);
         void const_D2E(int i,int j,int k,Grid3<double> &E,int dir,
                        Grid3<double> const &Dx,
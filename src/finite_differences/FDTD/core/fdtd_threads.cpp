@@ -13,6 +13,7 @@ See the License for the specific language governing permissions and
 limitations under the License.*/
 
 #include <fdtd_core.h>
+#include <profiler.h>
 
 std::mutex cout_mutex;
 
@@ -41,18 +42,23 @@ void FDTD::threaded_process_E(int ID)
     {
         // Materials Ante
         
+        ProfileZone zone_ante("materials_ante");
+        
         if(Nx>Nthreads)
         {
             advMats_ante((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
         }
         else if(ID==0) advMats_ante(0,Nx);
         
+        zone_ante.stop();
         alternator_E.signal_main(ID);
         
         // E Field
         
         alternator_E.thread_wait_ok(ID,lock);
         
+        ProfileZone zone_E("E");
+        
         int x1=(ID*Nx)/Nthreads; int x2=((ID+1)*Nx)/Nthreads;
         int y1=(ID*Ny)/Nthreads; int y2=((ID+1)*Ny)/Nthreads;
         int z1=(ID*Nz)/Nthreads; int z2=((ID+1)*Nz)/Nthreads;
@@ -81,48 +87,60 @@ void FDTD::threaded_process_E(int ID)
             else if(ID==0) advEz(0,Nx,0,Ny,0,Nz);
         }
         
+        zone_E.stop();
         alternator_E.signal_main(ID);
         
         // Materials Simp
         
         alternator_E.thread_wait_ok(ID,lock);
         
+        ProfileZone zone_simp("materials_simp");
+        
         if(Nx>Nthreads)
         {
             advMats_simp((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
         }
         else if(ID==0) advMats_simp(0,Nx);
         
+        zone_simp.stop();
         alternator_E.signal_main(ID);
         
         // Materials Post
         
         alternator_E.thread_wait_ok(ID,lock);
         
+        ProfileZone zone_post("materials_post");
+        
         if(Nx>Nthreads)
         {
             advMats_post((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
         }
         else if(ID==0) advMats_post(0,Nx);
         
+        zone_post.stop();
         alternator_E.signal_main(ID);
         
-        // Materials Post
+        // Materials Self
         
         alternator_E.thread_wait_ok(ID,lock);
         
+        ProfileZone zone_self("materials_self");
+        
         if(Nx>Nthreads)
         {
             advMats_self((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
         }
         else if(ID==0) advMats_self(0,Nx);
         
+        zone_self.stop();
         alternator_E.signal_main(ID);
         
         // PMLs E
         
         alternator_E.thread_wait_ok(ID,lock);
         
+        ProfileZone zone_pml("pml_E");
+        
         if(enable_Ex)
         {
             if(Nx>Nthreads) app_pml_Ex((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
@@ -141,6 +159,7 @@ void FDTD::threaded_process_E(int ID)
             else if(ID==0) app_pml_Ez(0,Nz);
         }
         
+        zone_pml.stop();
         alternator_E.signal_main(ID);
         
         // Next Loop - Materials Ante
@@ -174,6 +193,8 @@ void FDTD::threaded_process_H(int ID)
     {
         // H Field
         
+        ProfileZone zone_H("H");
+        
         int x1=(ID*Nx)/Nthreads; int x2=((ID+1)*Nx)/Nthreads;
         int y1=(ID*Ny)/Nthreads; int y2=((ID+1)*Ny)/Nthreads;
         int z1=(ID*Nz)/Nthreads; int z2=((ID+1)*Nz)/Nthreads;
@@ -202,12 +223,15 @@ void FDTD::threaded_process_H(int ID)
             else if(ID==0) advHz(0,Nx,0,Ny,0,Nz);
         }
         
+        zone_H.stop();
         alternator_H.signal_main(ID);
         
         // PMLs H
         
         alternator_H.thread_wait_ok(ID,lock);
         
+        ProfileZone zone_pml("pml_H");
+        
         if(enable_Hx)
         {
             if(Nx>Nthreads) app_pml_Hx((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
@@ -226,6 +250,7 @@ void FDTD::threaded_process_H(int ID)
             else if(ID==0) app_pml_Hz(0,Nz);
         }
         
+        zone_pml.stop();
         alternator_H.signal_main(ID);
         
         // Next Loop - H Field
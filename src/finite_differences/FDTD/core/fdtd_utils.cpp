@@ -773,8 +773,8 @@ void FDTD::set_matsgrid(Grid3<unsigned int> &GMi_x,Grid3<unsigned int> &GMi_y,Gr
     
     for(i=0;i<Nx;i++){ for(j=0;j<Ny;j++){ for(k=0;k<Nz;k++)
     {
-        imin=std::min(matsgrid(i,j,k),imin);
-        imax=std::max(matsgrid(i,j,k),imax);
+        imin=std::min<unsigned int>(matsgrid(i,j,k),imin);
+        imax=std::max<unsigned int>(matsgrid(i,j,k),imax);
     }}}
     
     Bitmap tbmp(Nx,Ny);
@@ -819,6 +819,17 @@ void FDTD::set_material(unsigned int ind,Material const &material_)
     }
 }
 
+// Constant diagonal material of the smoothed interfaces, only ever in a thin
+// shell of voxels, so not linked to the grid
+
+void FDTD::set_material_diag(unsigned int ind,double eps_x,double eps_y,double eps_z)
+{
+    if(ind>=static_cast<unsigned int>(mats.L1())) return;
+    
+    mats[ind].link_fdtd(Dx,Dy,Dz,Dt);
+    mats[ind].set_const_diag(eps_x,eps_y,eps_z);
+}
+
 void FDTD::report_size()
 {
     double F_size=0,P_size=0,M_size=0;
@@ -35,6 +35,7 @@ FDTD_Material::FDTD_Material()
         C2(0), C2x(0), C2y(0), C2z(0),
         C3(0),
         C4(0),
+        ani_fx(1), ani_fy(1), ani_fz(1),
         ei(1),
         sig(0),
         comp_simp(1),
@@ -116,22 +117,22 @@ void FDTD_Material::clean_fields()
 void FDTD_Material::coeffsX(double &C1o,double &C2yo,double &C2zo)
 {
     C1o=C1;
-    C2yo=C2y;
-    C2zo=C2z;
+    C2yo=ani_fx*C2y;
+    C2zo=ani_fx*C2z;
 }
 
 void FDTD_Material::coeffsY(double &C1o,double &C2xo,double &C2zo)
 {
     C1o=C1;
-    C2xo=C2x;
-    C2zo=C2z;
+    C2xo=ani_fy*C2x;
+    C2zo=ani_fy*C2z;
 }
 
 void FDTD_Material::coeffsZ(double &C1o,double &C2xo,double &C2yo)
 {
     C1o=C1;
-    C2xo=C2x;
-    C2yo=C2y;
+    C2xo=ani_fz*C2x;
+    C2yo=ani_fz*C2y;
 }
 
 Imdouble FDTD_Material::get_n(double w)
@@ -391,7 +392,7 @@ void FDTD_Material::link_fdtd(double Dx_i,double Dy_i,double Dz_i,double Dt_i)
     Dt=Dt_i;
 }
 
-void FDTD_Material::link_grid(Grid3<unsigned int> const &mat_grid,unsigned int ID)
+void FDTD_Material::link_grid(IndexGrid3 const &mat_grid,unsigned int ID)
 {
     int i,j,k;
     
@@ -446,6 +447,8 @@ void FDTD_Material::set_base_mat(Material const &material_)
 {
     base_mat=material_;
     
+    ani_fx=ani_fy=ani_fz=1.0;
+    
     if(base_mat.is_const()) set_const(base_mat.eps_inf);
     else if(base_mat.fdtd_compatible())
     {
@@ -755,6 +758,7 @@ void FDTD_Material::operator = (double a)
     C2x=C2y=C2z=0;
     C3=0;
     C4=0;
+    ani_fx=ani_fy=ani_fz=1;
     ei=1;
     sig=0;
     
@@ -778,6 +782,10 @@ void FDTD_Material::operator = (FDTD_Material const & Mi)
     C3=Mi.C3;
     C4=Mi.C4;
     
+    ani_fx=Mi.ani_fx;
+    ani_fy=Mi.ani_fy;
+    ani_fz=Mi.ani_fz;
+    
     ei=Mi.ei;
     sig=Mi.sig;
     
@@ -28,6 +28,8 @@ void FDTD_Material::set_const(double eps)
     ei=eps;
     sig=0;
     
+    ani_fx=ani_fy=ani_fz=1.0;
+    
     const_recalc();
     
     comp_simp=1;
@@ -35,6 +37,18 @@ void FDTD_Material::set_const(double eps)
     comp_D=0;
 }
 
+// Diagonal constant permittivity, in the simple update through the
+// coefficients of each component
+
+void FDTD_Material::set_const_diag(double eps_x,double eps_y,double eps_z)
+{
+    set_const((eps_x+eps_y+eps_z)/3.0);
+    
+    ani_fx=ei/eps_x;
+    ani_fy=ei/eps_y;
+    ani_fz=ei/eps_z;
+}
+
 void FDTD_Material::const_D2E(int i,int j,int k,Grid3<double> &E,int dir,
                               Grid3<double> const &Dx,
                               Grid3<double> const &Dy,
@@ -127,7 +127,7 @@ class AFP_TFSF: public Source
         void deep_inject_H(FDTD &fdtd);
         void deep_link(FDTD const &fdtd);
         void initialize();
-        void set_matsgrid(Grid3<unsigned int> const &G);
+        void set_matsgrid(IndexGrid3 const &G);
 };
 
 class Bloch_Monochromatic: public Source
@@ -16,6 +16,7 @@ limitations under the License.*/
 #include <data_hdl.h>
 #include <fdtd_core.h>
 #include <lua_fdtd.h>
+#include <profiler.h>
 
 extern const Imdouble Im;
 
@@ -39,8 +40,11 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdtd_mode.discretize(matsgrid,Nx,Ny,Nz);
+    
+    std::vector<Subpixel_Mix> mixes;
+    fdtd_mode.subpixel_smoothing(matsgrid,mixes,Dx,Dy,Dz,true);
     
     double Dt=std::min(std::min(Dx,Dy),Dz)/(std::sqrt(3.0)*c_light)*0.99*fdtd_mode.time_mod;
     
@@ -67,6 +71,10 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     
     fdtd.set_matsgrid(matsgrid);
     
+    // The solver keeps the grid with its narrowest index type
+    
+    matsgrid.init(0,0,0,0);
+    
     Nx=fdtd.Nx;
     Ny=fdtd.Ny;
     Nz=fdtd.Nz;
@@ -78,6 +86,8 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     for(unsigned int m=0;m<fdtd_mode.materials.size();m++)
         fdtd.set_material(m,fdtd_mode.materials[m]);
     
+    fdtd_mode.set_subpixel_materials(fdtd,mixes);
+    
     // Disabling fields
     
     fdtd.disable_fields(fdtd_mode.disable_fields);
@@ -153,6 +163,13 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     
     // Main Loop
     
+    std::vector<std::string> sensors_zones(sensors.size());
+    
+    for(unsigned int i=0;i<sensors.size();i++)
+        sensors_zones[i]="sensor_"+(sensors[i]->name.empty() ? std::to_string(i) : sensors[i]->name);
+    
+    ProfileZone zone_run("fdtd_run");
+    
     for(t=0;t<Nt;t++)
     {
         // E-field
@@ -160,22 +177,35 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
         
         // E-field injection
         
+        ProfileZone zone_inject_E("sources_E");
+        
         for(unsigned int i=0;i<sources.size();i++)
             sources[i]->inject_E(fdtd);
         
+        zone_inject_E.stop();
+        
         // H-field
         fdtd.update_H();
         
         for(unsigned int i=0;i<sensors.size();i++)
+        {
+            ProfileZone zone_sensor(sensors_zones[i]);
             sensors[i]->feed(fdtd);
+        }
         
         // H-field injection
         
+        ProfileZone zone_inject_H("sources_H");
+        
         for(unsigned int i=0;i<sources.size();i++)
             sources[i]->inject_H(fdtd);
         
+        zone_inject_H.stop();
+        
         if(t%N_disp==0)
         {
+            ProfileZone zone_display("display");
+            
             int vmode=0;
             fdtd.draw(t,vmode,Nx/2,Ny/2,Nz/2,bitmap);
             
@@ -203,8 +233,14 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
         ++(*dspt);
     }
     
+    zone_run.stop();
+    
+    ProfileZone zone_treat("sensors_treat");
+    
     for(unsigned int i=0;i<sensors.size();i++) sensors[i]->treat();
     
+    zone_treat.stop();
+    
     for(unsigned int i=0;i<sensors.size();i++) delete sensors[i];
     for(unsigned int i=0;i<sources.size();i++) delete sources[i];
 }
@@ -339,6 +339,22 @@ void FDTD_Mode::set_spectrum(double lambda_min_,double lambda_max_,int Nl_)
     Nl=Nl_;
 }
 
+// Effective permittivities of the voxels mixed by subpixel_smoothing()
+
+void FDTD_Mode::set_subpixel_materials(FDTD &fdtd,std::vector<Subpixel_Mix> const &mixes) const
+{
+    for(Subpixel_Mix const &mix : mixes)
+    {
+        double eps_1=materials[mix.mat_1].eps_inf;
+        double eps_2=materials[mix.mat_2].eps_inf;
+        
+        fdtd.set_material_diag(mix.index,
+                               mix.effective_eps(eps_1,eps_2,0).real(),
+                               mix.effective_eps(eps_1,eps_2,1).real(),
+                               mix.effective_eps(eps_1,eps_2,2).real());
+    }
+}
+
 void FDTD_Mode::set_time_mod(double md) { time_mod=md; }
 
 void FDTD_Mode::show() const
@@ -390,6 +406,7 @@ void FDTD_Mode_create_metatable(lua_State *L)
     metatable_add_func(L,"polarization",FD_mode_set_polarization);
     metatable_add_func(L,"prefix",FD_mode_set_prefix);
     metatable_add_func(L,"structure",FD_mode_set_structure);
+    lua_wrapper<13,FDTD_Mode,int>::bind(L,"subpixel",&FDTD_Mode::set_subpixel);
     metatable_add_func(L,"tapering",FDTD_mode_set_tapering);
     metatable_add_func(L,"time_mod",FDTD_mode_set_time_mod);
     
@@ -80,6 +80,7 @@ class FDTD_Mode: public FD_Mode
         void set_spectrum(double lambda_min,double lambda_max,int Nl=481);
         void set_structure(std::string s_name);
         void set_structure_aux(std::string s_name);
+        void set_subpixel_materials(FDTD &fdtd,std::vector<Subpixel_Mix> const &mixes) const;
         void set_time_mod(double md);
         void show() const;
         
@@ -176,8 +176,11 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
     fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdtd_mode.discretize(matsgrid,Nx,Ny,Nz);
+    
+    std::vector<Subpixel_Mix> mixes;
+    fdtd_mode.subpixel_smoothing(matsgrid,mixes,Dx,Dy,Dz,true);
     
     std::string polar_mode=fdtd_mode.polarization;
     
@@ -204,6 +207,7 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
     // Grid and materials
     
     fdtd.set_matsgrid(matsgrid);
+    matsgrid.init(0,0,0,0);
     
     Nx=fdtd.Nx;
     Ny=fdtd.Ny;
@@ -219,6 +223,8 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
     for(unsigned int m=0;m<fdtd_mode.materials.size();m++)
         fdtd.set_material(m,fdtd_mode.materials[m]);
     
+    fdtd_mode.set_subpixel_materials(fdtd,mixes);
+    
     // Disabling fields
     
     fdtd.disable_fields(fdtd_mode.disable_fields);
@@ -44,8 +44,11 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
     fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdtd_mode.discretize(matsgrid,Nx,Ny,Nz);
+    
+    std::vector<Subpixel_Mix> mixes;
+    fdtd_mode.subpixel_smoothing(matsgrid,mixes,Dx,Dy,Dz,true);
     
     std::string polar_mode=fdtd_mode.polarization;
     
@@ -75,6 +78,8 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
     fdtd_r.set_matsgrid(matsgrid);
     fdtd_i.set_matsgrid(matsgrid);
     
+    matsgrid.init(0,0,0,0);
+    
     #ifdef OLDMAT
     for(unsigned int m=0;m<fdtd_mode.materials_str.size();m++)
     {
@@ -88,6 +93,9 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
         fdtd_i.set_material(m,fdtd_mode.materials[m]);
     }
     
+    fdtd_mode.set_subpixel_materials(fdtd_r,mixes);
+    fdtd_mode.set_subpixel_materials(fdtd_i,mixes);
+    
     /////////////////////////
     
     fdtd_r.disable_fields(fdtd_mode.disable_fields);
@@ -50,8 +50,8 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
     fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    Grid3<unsigned int> matsgrid;
+    fdtd_mode.discretize(matsgrid,Nx,Ny,Nz);
     
     Grid3<unsigned int> aux_grid;
     
@@ -65,6 +65,11 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
     for(k=0;k<Nz_aux;k++)
         aux_grid(0,0,k)=matsgrid(0,0,k);
     
+    // Smoothed after the copy, the auxiliary grid only holds the layers
+    
+    std::vector<Subpixel_Mix> mixes;
+    fdtd_mode.subpixel_smoothing(matsgrid,mixes,Dx,Dy,Dz,true);
+    
     std::string polar_mode=fdtd_mode.polarization;
     
     int pml_x=std::max(fdtd_mode.pml_xm,fdtd_mode.pml_xp);
@@ -125,6 +130,8 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
     fdtd.set_matsgrid(matsgrid);
     fdtd_aux.set_matsgrid(aux_grid);
     
+    matsgrid.init(0,0,0,0);
+    
     Nx=fdtd.Nx;
     Ny=fdtd.Ny;
     Nz=fdtd.Nz;
@@ -160,6 +167,8 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
         fdtd_aux.set_material(m,fdtd_mode.materials[m]);
     }
     
+    fdtd_mode.set_subpixel_materials(fdtd,mixes);
+    
     // Disabling fields
     
     fdtd.disable_fields(fdtd_mode.disable_fields);
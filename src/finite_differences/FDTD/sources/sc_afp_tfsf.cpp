@@ -285,7 +285,7 @@ void AFP_TFSF::initialize()
     }
 }
 
-void AFP_TFSF::set_matsgrid(Grid3<unsigned int> const &G)
+void AFP_TFSF::set_matsgrid(IndexGrid3 const &G)
 {
     int k;
     
@@ -44,9 +44,9 @@ FD_Base::FD_Base()
      pml_sigma_zm(0), pml_sigma_zp(0),
      pml_alpha_xm(0), pml_alpha_xp(0),
      pml_alpha_ym(0), pml_alpha_yp(0),
-     pml_alpha_zm(0), pml_alpha_zp(0),
-     matsgrid(Nx,Ny,Nz,0)
+     pml_alpha_zm(0), pml_alpha_zp(0)
 {
+    matsgrid.init(Nx,Ny,Nz,0);
 }
 
 void FD_Base::extend_grid()
@@ -54,7 +54,7 @@ void FD_Base::extend_grid()
     extend_grid_sub(matsgrid);
 }
 
-void FD_Base::extend_grid_sub(Grid3<unsigned int> &matsgrid)
+void FD_Base::extend_grid_sub(IndexGrid3 &matsgrid)
 {
     int i,j,k;
     
@@ -258,6 +258,22 @@ void FD_Base::init_pml()
     pml_sigma_zp*=pml_opti_z;
 }
 
+// Permittivity seen by the E component along dir at a node of material M,
+// smoothed when M is one of the subpixel mixes
+
+Imdouble FD_Base::get_eps(unsigned int M,int dir,double w)
+{
+    if(!mixes.empty() && M>=mixes[0].index)
+    {
+        Subpixel_Mix const &mix=mixes[M-mixes[0].index];
+        
+        return mix.effective_eps(mats[mix.mat_1].get_eps(w),
+                                 mats[mix.mat_2].get_eps(w),dir);
+    }
+    
+    return mats[M].get_eps(w);
+}
+
 void FD_Base::set_materials(Grid1<Material> const &M)
 {
     int Nmats=M.L1();
@@ -306,6 +322,14 @@ void FD_Base::set_matsgrid(Grid3<unsigned int> const &G)
     chk_var(Nmats);
 }
 
+// Mixes of Structure::subpixel_smoothing, to be given along with the grid
+// holding their indices
+
+void FD_Base::set_subpixel_mixes(std::vector<Subpixel_Mix> const &mixes_)
+{
+    mixes=mixes_;
+}
+
 //void FD_Base::set_matsgrid_full(Grid3<unsigned int> const &G) { matsgrid=G; }
 
 void FD_Base::set_padding(int xm,int xp,int ym,int yp,int zm,int zp)
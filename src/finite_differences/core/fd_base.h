@@ -17,6 +17,7 @@ limitations under the License.*/
 
 #include <grid.h>
 #include <material.h>
+#include <structure.h>
 
 class FD_Base
 {
@@ -56,16 +57,18 @@ class FD_Base
         // Materials
         
         Grid1<Material> mats;
-        Grid3<unsigned int> matsgrid;
+        IndexGrid3 matsgrid;
+        std::vector<Subpixel_Mix> mixes;
         
         FD_Base();
         
         void extend_grid();
-        void extend_grid_sub(Grid3<unsigned int> &matsgrid);
+        void extend_grid_sub(IndexGrid3 &matsgrid);
         
         Imdouble get_Dx(double ind,double w);
         Imdouble get_Dy(double ind,double w);
         Imdouble get_Dz(double ind,double w);
+        Imdouble get_eps(unsigned int M,int dir,double w);
         
         int index(int i,int j,int k);
         
@@ -95,6 +98,7 @@ class FD_Base
         void set_material(unsigned int m_ID,Material const &material);
         void set_material(unsigned int m_ID,std::string fname);
         void set_matsgrid(Grid3<unsigned int> const &G);
+        void set_subpixel_mixes(std::vector<Subpixel_Mix> const &mixes);
 //        void set_matsgrid_full(Grid3<unsigned int> const &G);
         void set_padding(int xm,int xp,int ym,int yp,int zm,int zp);
         
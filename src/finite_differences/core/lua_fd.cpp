@@ -51,6 +51,7 @@ FD_Mode::FD_Mode()
      periodic_x(false),
      periodic_y(false),
      periodic_z(false),
+     subpixel(0),
      pml_xm(0), pml_xp(0),
      pml_ym(0), pml_yp(0),
      pml_zm(0), pml_zp(0),
@@ -81,6 +82,23 @@ void FD_Mode::compute_discretization(int &Nx,int &Ny,int &Nz,
     chk_var(Nz);
 }
 
+// Only repaints what changed since the previous computation of a parametric
+// sweep, see Structure::update_discretization. Structures without parameters
+// are discretized from scratch, so that they don't keep copies of the grid.
+
+void FD_Mode::discretize(Grid3<unsigned int> &matsgrid,int Nx,int Ny,int Nz) const
+{
+    if(structure->parameter_name.empty())
+    {
+        structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+        return;
+    }
+    
+    std::vector<int> changed;
+    
+    structure->update_discretization(matsgrid,changed,Nx,Ny,Nz,Dx,Dy,Dz);
+}
+
 
 std::filesystem::path const& FD_Mode::directory() const
 {
@@ -313,6 +331,7 @@ void FD_Mode::reset()
     periodic_x=true;
     periodic_y=true;
     periodic_z=true;
+    subpixel=0;
     pml_xm=0; pml_xp=0;
     pml_ym=0; pml_yp=0;
     pml_zm=0; pml_zp=0;
@@ -415,6 +434,8 @@ void FD_Mode::show() const
     chk_msg_sc(pad_zm);
     chk_msg_sc(pad_zp);
     
+    chk_msg_sc(subpixel);
+    
     chk_msg_sc(pml_xm);
     chk_msg_sc(pml_xp);
     chk_msg_sc(pml_ym);
@@ -468,6 +489,26 @@ void FD_Mode::set_structure(Structure *structure_)
     structure->finalize();
 }
 
+void FD_Mode::set_subpixel(int Nsub) { subpixel=Nsub; }
+
+// The time domain solvers only smooth the constant materials, the frequency
+// domain ones mix any permittivity
+
+void FD_Mode::subpixel_smoothing(Grid3<unsigned int> &matsgrid,std::vector<Subpixel_Mix> &mixes,
+                                 double Dx,double Dy,double Dz,bool const_only) const
+{
+    mixes.clear();
+    
+    if(subpixel<2) return;
+    
+    std::vector<bool> smoothable(materials.size());
+    
+    for(std::size_t m=0;m<materials.size();m++)
+        smoothable[m]=!const_only || materials[m].is_const();
+    
+    structure->subpixel_smoothing(matsgrid,mixes,smoothable,Dx,Dy,Dz,subpixel);
+}
+
 void FD_Mode::process()
 {
 }
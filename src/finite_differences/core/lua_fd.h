@@ -69,6 +69,8 @@ class FD_Mode: public base_mode
         bool periodic_y;
         bool periodic_z;
         
+        int subpixel;
+        
         //PML
         int pml_xm,pml_xp;
         int pml_ym,pml_yp;
@@ -114,6 +116,7 @@ class FD_Mode: public base_mode
         
         void compute_discretization(int &Nx,int &Ny,int &Nz,
                                     double lx,double ly,double lz) const;
+        void discretize(Grid3<unsigned int> &matsgrid,int Nx,int Ny,int Nz) const;
         
         void set_discretization(double D);
         void set_discretization_x(double Dx);
@@ -140,6 +143,9 @@ class FD_Mode: public base_mode
         void set_directory(std::filesystem::path const &directory);
         [[deprecated]] void set_output_directory(std::string dir);
         void set_structure(Structure *structure);
+        void set_subpixel(int Nsub);
+        void subpixel_smoothing(Grid3<unsigned int> &matsgrid,std::vector<Subpixel_Mix> &mixes,
+                                double Dx,double Dy,double Dz,bool const_only) const;
         
         //##########
         
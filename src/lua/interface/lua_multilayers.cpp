@@ -394,9 +394,9 @@ int multilayer_mode_set_sup_index(lua_State *L)
 
 Multilayer_TMM_mode::Multilayer_TMM_mode()
     :mode(MODE_NONE),
-     Nl(481),
+     Nl(481), Na(91),
      lambda_min(370e-9), lambda_max(850e-9),
-     angle(0),
+     angle(0), angle_min(0), angle_max(Degree(90)),
      output("multilayer_out"), polar("TE")
 {
 }
@@ -427,6 +427,14 @@ void Multilayer_TMM_mode::compute_guided(std::string polar_,
     mode=MODE_GUIDED;
 }
 
+void Multilayer_TMM_mode::compute_map(double angle_min_,double angle_max_,int Na_)
+{
+    angle_min=Degree(angle_min_);
+    angle_max=Degree(angle_max_);
+    Na=Na_;
+    mode=MODE_MAP;
+}
+
 void Multilayer_TMM_mode::set_output(std::string output_)
 {
     output=output_;
@@ -470,30 +478,46 @@ void Multilayer_TMM_mode::process()
     
     Multilayer_TMM mlt(N_layers);
         
-    if(mode==MODE_ANGLE)
+    if(mode==MODE_ANGLE || mode==MODE_MAP)
     {
-        std::ofstream file(output,std::ios::out|std::ios::trunc);
+        std::vector<double> lambda_b;
+        std::vector<AngleRad> angle_b;
         
-        mlt.set_angle(angle);
+        int Na_b=(mode==MODE_MAP) ? Na : 1;
         
-        for(i=0;i<Nl;i++)
+        for(i=0;i<Nl;i++) for(j=0;j<Na_b;j++)
         {
-            double lambda=lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0);
-            double w=2.0*Pi*c_light/lambda;
-            
-            mlt.set_lambda(lambda);
-            
-            mlt.set_environment(mat_sup.get_n(w),mat_sub.get_n(w));
-            
-            double index_sup=mat_sup.get_n(w).real();
-            double index_sub=mat_sub.get_n(w).real();
-            
-            for(j=0;j<N_layers;j++)
-                mlt.set_layer(j,layer_h[j],mats[j].get_n(w));
+            lambda_b.push_back(lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0));
             
-            Imdouble r_TE,t_TE,r_TM,t_TM;
+            if(mode==MODE_MAP) angle_b.push_back(angle_min+(angle_max-angle_min)*j/std::max(Na-1.0,1.0));
+            else angle_b.push_back(angle);
+        }
+        
+        mlt.set_environment(mat_sup,mat_sub);
+        
+        for(j=0;j<N_layers;j++)
+            mlt.set_layer(j,layer_h[j],mats[j]);
+        
+        std::vector<Imdouble> r_TE,r_TM,t_TE,t_TM;
+        
+        mlt.compute_batch(lambda_b,angle_b,r_TE,r_TM,t_TE,t_TM,true);
+        
+        std::ofstream file(output,std::ios::out|std::ios::trunc);
+        
+        double index_sup=0,index_sub=0;
+        
+        for(std::size_t n=0;n<lambda_b.size();n++)
+        {
+            double lambda=lambda_b[n];
+            AngleRad angle_n=angle_b[n];
             
-            mlt.compute(r_TE,r_TM,t_TE,t_TM);
+            if(n==0 || lambda!=lambda_b[n-1])
+            {
+                double w=2.0*Pi*c_light/lambda;
+                
+                index_sup=mat_sup.get_n(w).real();
+                index_sub=mat_sub.get_n(w).real();
+            }
             
             using std::abs;
             using std::arg;
@@ -501,24 +525,24 @@ void Multilayer_TMM_mode::process()
             using std::norm;
             
             double ang_ref=Pi/2.0;
-            double ang_ref_arg=index_sup/index_sub*std::sin(angle);
+            double ang_ref_arg=index_sup/index_sub*std::sin(angle_n);
             
             if(ang_ref_arg<=1.0) ang_ref=std::asin(ang_ref_arg);
             
-            double transm_coeff_TE=cos(ang_ref)/cos(angle)*index_sub/index_sup;
-            double transm_coeff_TM=cos(ang_ref)/cos(angle)*index_sup/index_sub;
+            double transm_coeff_TE=cos(ang_ref)/cos(angle_n)*index_sub/index_sup;
+            double transm_coeff_TM=cos(ang_ref)/cos(angle_n)*index_sup/index_sub;
             
-            file<<lambda<<" "<<angle.radian()<<" ";
+            file<<lambda<<" "<<angle_n.radian()<<" ";
             
-            file<<abs(r_TE)<<" "<<arg(r_TE)<<" "<<norm(r_TE)<<" "
-                <<abs(r_TM)<<" "<<arg(r_TM)<<" "<<norm(r_TM)<<" "
-                <<abs(t_TE)<<" "<<arg(t_TE)<<" "<<transm_coeff_TE*norm(t_TE)<<" "
-                <<abs(t_TM)<<" "<<arg(t_TM)<<" "<<transm_coeff_TM*norm(t_TM)<<std::endl;
+            file<<abs(r_TE[n])<<" "<<arg(r_TE[n])<<" "<<norm(r_TE[n])<<" "
+                <<abs(r_TM[n])<<" "<<arg(r_TM[n])<<" "<<norm(r_TM[n])<<" "
+                <<abs(t_TE[n])<<" "<<arg(t_TE[n])<<" "<<transm_coeff_TE*norm(t_TE[n])<<" "
+                <<abs(t_TM[n])<<" "<<arg(t_TM[n])<<" "<<transm_coeff_TM*norm(t_TM[n])<<std::endl;
         }
         
         file.close();
         
-        script_multilayer(output);
+        if(mode==MODE_ANGLE) script_multilayer(output);
     }
     else if(mode==MODE_GUIDED)
     {
@@ -632,4 +656,5 @@ void create_metatables_multilayers(lua_State *L)
     lua_wrapper<4,Multilayer_TMM_mode,double,double,int>::bind(L,"spectrum",&Multilayer_TMM_mode::set_spectrum);
     lua_wrapper<5,Multilayer_TMM_mode,std::string>::bind(L,"substrate",&Multilayer_TMM_mode::set_substrate);
     lua_wrapper<6,Multilayer_TMM_mode,std::string>::bind(L,"superstrate",&Multilayer_TMM_mode::set_superstrate);
+    lua_wrapper<7,Multilayer_TMM_mode,double,double,int>::bind(L,"compute_map",&Multilayer_TMM_mode::compute_map);
 }
@@ -79,12 +79,12 @@ int multilayer_mode_set_sup_index(lua_State *L);
 class Multilayer_TMM_mode: public base_mode
 {
     public:
-        enum{MODE_NONE,MODE_ANGLE,MODE_GUIDED};
+        enum{MODE_NONE,MODE_ANGLE,MODE_GUIDED,MODE_MAP};
         
-        int mode,Nl;
+        int mode,Nl,Na;
         double lambda_min,lambda_max;
         double lambda_guess,nr_guess,ni_guess;
-        AngleRad angle;
+        AngleRad angle,angle_min,angle_max;
         std::string mat_sup_str,
                     mat_sub_str,
                     output,
@@ -100,6 +100,7 @@ class Multilayer_TMM_mode: public base_mode
                             double lambda_guess,
                             double nr_guess,
                             double ni_guess);
+        void compute_map(double angle_min,double angle_max,int Na);
         void set_output(std::string output);
         void set_spectrum(double lambda_min,double lambda_max,int Nl);
         void set_substrate(std::string mat);
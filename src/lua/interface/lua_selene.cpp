@@ -110,9 +110,12 @@ void Selene_Mode::optimize(OptimEngine *engine)
 }
 
 void Selene_Mode::render() { selene.render(); rendered=true; }
+void Selene_Mode::render_progressive(double target_error,int Nr_max) { selene.render_progressive(target_error,Nr_max); rendered=true; }
+void Selene_Mode::render_resume(int Nr_add) { selene.render_resume(Nr_add); rendered=true; }
 void Selene_Mode::set_max_ray_bounces(int max_ray_bounces) { selene.set_max_ray_bounces(max_ray_bounces); }
 void Selene_Mode::set_N_rays_disp(int Nr_disp) { selene.set_N_rays_disp(Nr_disp); }
 void Selene_Mode::set_N_rays_total(int Nr_tot) { selene.set_N_rays_total(Nr_tot); }
+void Selene_Mode::set_N_threads(int N_threads) { selene.set_N_threads(N_threads); }
 void Selene_Mode::set_output_directory(std::string const &output_directory) { selene.set_output_directory(output_directory); }
 
 // Lua mode wrappers
@@ -518,12 +521,18 @@ namespace LuaUI
         
         metatable_add_func(L,"add_object",&LuaUI::selene_mode_add_object);
         metatable_add_func(L,"add_light",&LuaUI::selene_mode_add_light);
+        metatable_add_func(L,"dispersion_tolerance",&LuaUI::selene_mode_set_dispersion_tolerance);
         metatable_add_func(L,"max_ray_bounces",&LuaUI::selene_mode_set_max_ray_bounces);
         metatable_add_func(L,"N_rays_disp",&LuaUI::selene_mode_set_N_rays_disp);
         metatable_add_func(L,"N_rays_total",&LuaUI::selene_mode_set_N_rays_total);
+        metatable_add_func(L,"N_threads",&LuaUI::selene_mode_set_N_threads);
+        metatable_add_func(L,"noise_sensor",&LuaUI::selene_mode_add_noise_sensor);
+        metatable_add_func(L,"noise_threshold",&LuaUI::selene_mode_set_noise_threshold);
         metatable_add_func(L,"optimize",&LuaUI::selene_mode_optimize);
         metatable_add_func(L,"output_directory",&LuaUI::selene_mode_output_directory);
         metatable_add_func(L,"render",&LuaUI::selene_mode_render);
+        metatable_add_func(L,"render_progressive",&LuaUI::selene_mode_render_progressive);
+        metatable_add_func(L,"resume",&LuaUI::selene_mode_render_resume);
     }
     
     void Selene_create_light_metatable(lua_State *L)
@@ -532,6 +541,7 @@ namespace LuaUI
         
         lua_wrapper<0,Sel::Light,double>::bind(L,"power",&Sel::Light::set_power);
         
+        metatable_add_func(L,"aperture",&LuaUI::selene_light_set_aperture);
         metatable_add_func(L,"discrete_spectrum",&LuaUI::selene_light_set_discrete_spectrum);
         metatable_add_func(L,"extent",&LuaUI::selene_light_set_extent);
         metatable_add_func(L,"full_angle",&LuaUI::selene_light_set_angle);
@@ -548,6 +558,7 @@ namespace LuaUI
         metatable_add_func(L,"relative_origin",&LuaUI::selene_frame_set_relative_origin);
         metatable_add_func(L,"rotation",&LuaUI::selene_frame_set_rotation);
         metatable_add_func(L,"rotation_frame",&LuaUI::selene_frame_set_rotation_frame);
+        metatable_add_func(L,"sampling",&LuaUI::selene_light_set_sampling);
         metatable_add_func(L,"spectrum",&LuaUI::selene_light_set_spectrum);
         metatable_add_func(L,"translation_frame",&LuaUI::selene_frame_set_translation_frame);
         metatable_add_func(L,"waist_distance",&LuaUI::selene_light_set_waist_distance);
@@ -648,6 +659,7 @@ namespace LuaUI
         create_obj_metatable(L,"metatable_selene_irf");
         
         metatable_add_func(L,"add_layer",&LuaUI::selene_irf_add_layer);
+        lua_wrapper<0,Sel::IRF,double>::bind(L,"bake_tolerance",&Sel::IRF::set_bake_tolerance);
         metatable_add_func(L,"name",&LuaUI::selene_irf_set_name);
         metatable_add_func(L,"splitting_factor",&LuaUI::selene_irf_set_splitting_factor);
         metatable_add_func(L,"type",&LuaUI::selene_irf_set_type);
@@ -664,6 +676,37 @@ namespace LuaUI
         return 0;
     }
     
+    int selene_mode_add_noise_sensor(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        Sel::Object *p_elem=lua_get_metapointer<Sel::Object>(L,2);
+        
+        int N_uv=0;
+        if(lua_gettop(L)>=3) N_uv=lua_tointeger(L,3);
+        
+        p_mode->selene.add_noise_sensor(p_elem,N_uv);
+        
+        return 0;
+    }
+    
+    int selene_mode_set_dispersion_tolerance(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        
+        p_mode->selene.set_dispersion_tolerance(lua_tonumber(L,2));
+        
+        return 0;
+    }
+    
+    int selene_mode_set_noise_threshold(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        
+        p_mode->selene.set_noise_threshold(lua_tonumber(L,2));
+        
+        return 0;
+    }
+    
     int selene_mode_add_light(lua_State *L)
     {
         Selene_Mode *p_mode=*(reinterpret_cast<Selene_Mode**>(lua_touserdata(L,1)));
@@ -723,6 +766,27 @@ namespace LuaUI
         return 0;
     }
     
+    int selene_mode_render_progressive(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        
+        int Nr_max=0;
+        if(lua_gettop(L)>=3) Nr_max=lua_tointeger(L,3);
+        
+        p_mode->render_progressive(lua_tonumber(L,2),Nr_max);
+        
+        return 0;
+    }
+    
+    int selene_mode_render_resume(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        
+        p_mode->render_resume(lua_tointeger(L,2));
+        
+        return 0;
+    }
+    
     int selene_mode_set_N_rays_total(lua_State *L)
     {
         Selene_Mode *p_mode=*(reinterpret_cast<Selene_Mode**>(lua_touserdata(L,1)));
@@ -731,4 +795,13 @@ namespace LuaUI
         
         return 0;
     }
+    
+    int selene_mode_set_N_threads(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        
+        p_mode->set_N_threads(lua_tointeger(L,2));
+        
+        return 0;
+    }
 }
@@ -34,9 +34,12 @@ class Selene_Mode: public base_mode
         void optimize(OptimEngine *engine);
         void process() override;
         void render();
+        void render_progressive(double target_error,int Nr_max);
+        void render_resume(int Nr_add);
         void set_max_ray_bounces(int max_ray_bounces);
         void set_N_rays_disp(int Nr_disp);
         void set_N_rays_total(int Nr_tot);
+        void set_N_threads(int N_threads);
         void set_output_directory(std::string const &output_directory);
 };
 
@@ -114,6 +117,7 @@ namespace LuaUI
     void create_selene_light_type(lua_State *L,Sel::Light *light);
     
     int selene_light_set_angle(lua_State *L);
+    int selene_light_set_aperture(lua_State *L);
     int selene_light_set_discrete_spectrum(lua_State *L);
     int selene_light_set_extent(lua_State *L);
     int selene_light_set_material(lua_State *L);
@@ -123,6 +127,7 @@ namespace LuaUI
     int selene_light_set_polar_unset(lua_State *L);
     int selene_light_set_power(lua_State *L);
     int selene_light_set_rays_file(lua_State *L);
+    int selene_light_set_sampling(lua_State *L);
     int selene_light_set_spectrum(lua_State *L);
     int selene_light_set_wavelength(lua_State *L);
     int selene_light_set_waist_distance(lua_State *L);
@@ -144,12 +149,18 @@ namespace LuaUI
     void Selene_create_base_metatable(lua_State *L);
     int selene_mode_add_object(lua_State *L);
     int selene_mode_add_light(lua_State *L);
+    int selene_mode_add_noise_sensor(lua_State *L);
     int selene_mode_optimize(lua_State *L);
     int selene_mode_output_directory(lua_State *L);
     int selene_mode_render(lua_State *L);
+    int selene_mode_render_progressive(lua_State *L);
+    int selene_mode_render_resume(lua_State *L);
+    int selene_mode_set_dispersion_tolerance(lua_State *L);
+    int selene_mode_set_noise_threshold(lua_State *L);
     int selene_mode_set_max_ray_bounces(lua_State *L);
     int selene_mode_set_N_rays_disp(lua_State *L);
     int selene_mode_set_N_rays_total(lua_State *L);
+    int selene_mode_set_N_threads(lua_State *L);
 
     // Analysis
 
@@ -588,6 +588,8 @@ namespace LuaUI
             else if(str=="obj_intersection") p_object->sens_ray_obj_intersection=true;
             else if(str=="obj_direction") p_object->sens_ray_obj_direction=true;
             else if(str=="obj_face") p_object->sens_ray_obj_face=true;
+            else if(str=="ascii") p_object->sens_ascii=true;
+            else if(str=="reduce") p_object->sens_reduce=true;
         }
         
         return 0;
@@ -39,6 +39,16 @@ namespace LuaUI
         else if(type=="user_defined") p_light->set_type(Sel::SRC_USER_DEFINED);
     }
     
+    int selene_light_set_aperture(lua_State *L)
+    {
+        Sel::Frame *frame=lua_get_metapointer<Sel::Frame>(L,1);
+        Sel::Light *light=dynamic_cast<Sel::Light*>(frame);
+        
+        light->set_aperture(Vector3(lua_tonumber(L,2),lua_tonumber(L,3),lua_tonumber(L,4)),lua_tonumber(L,5));
+        
+        return 0;
+    }
+    
     int selene_light_set_angle(lua_State *L)
     {
         Sel::Frame *frame=lua_get_metapointer<Sel::Frame>(L,1);
@@ -182,6 +192,19 @@ namespace LuaUI
         return 0;
     }
     
+    int selene_light_set_sampling(lua_State *L)
+    {
+        Sel::Frame *frame=lua_get_metapointer<Sel::Frame>(L,1);
+        Sel::Light *light=dynamic_cast<Sel::Light*>(frame);
+        
+        std::string mode=lua_tostring(L,2);
+        
+             if(mode=="qmc") light->set_sampling_qmc(true);
+        else if(mode=="random") light->set_sampling_qmc(false);
+        
+        return 0;
+    }
+    
     int selene_light_set_spectrum(lua_State *L)
     {
         Sel::Frame *frame=lua_get_metapointer<Sel::Frame>(L,1);
@@ -17,15 +17,20 @@ limitations under the License.*/
 #include <material.h>
 #include <phys_tools.h>
 
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
 extern std::ofstream plog;
 
 extern const Imdouble Im;
 
-int spec_mat_ID=0;
+std::atomic<int> spec_mat_ID(0); // shared by the jobs run side by side
 
 int gen_const_material(lua_State *L)
 {
-    std::filesystem::path fname=PathManager::to_temporary_path("const_mat_"+std::to_string(spec_mat_ID)+".lua");
+    std::filesystem::path fname=PathManager::to_temporary_path("const_mat_"+std::to_string(spec_mat_ID++)+".lua");
     
     std::ofstream file(fname,std::ios::out|std::ios::trunc);
     
@@ -34,14 +39,12 @@ int gen_const_material(lua_State *L)
     file.close();
     lua_pushstring(L,fname.generic_string().c_str());
     
-    spec_mat_ID++;
-    
     return 1;
 }
 
 int gen_complex_material(lua_State *L)
 {
-    std::filesystem::path fname=PathManager::to_temporary_path("complex_mat_"+std::to_string(spec_mat_ID)+".lua");
+    std::filesystem::path fname=PathManager::to_temporary_path("complex_mat_"+std::to_string(spec_mat_ID++)+".lua");
     
     std::ofstream file(fname,std::ios::out|std::ios::trunc);
     
@@ -66,8 +69,6 @@ int gen_complex_material(lua_State *L)
     file.close();
     lua_pushstring(L,fname.generic_string().c_str());
     
-    spec_mat_ID++;
-    
     return 1;
 }
 
@@ -77,6 +78,122 @@ int gen_complex_material(lua_State *L)
 
 namespace lua_material
 {
+    namespace
+    {
+        // Material scripts opened by Loader::load on this thread, to tell
+        // the ones that depend on other files
+        
+        thread_local int N_loads=0;
+        
+        // Files opened from Lua by the material scripts run on this thread,
+        // through dofile, loadfile, require and the io functions
+        
+        thread_local int N_reads=0;
+        
+        char const cache_file_magic[8]={'A','E','M','A','T','C','H','2'};
+        
+        // Registered in place of the script functions, to record which ones
+        // a script calls
+        
+        int call_script_function(lua_State *L)
+        {
+            Loader *loader=static_cast<Loader*>(lua_touserdata(L,lua_upvalueindex(1)));
+            std::size_t i=lua_tointeger(L,lua_upvalueindex(2));
+            
+            if(!vector_contains(loader->called_functions,loader->function_names[i]))
+                loader->called_functions.push_back(loader->function_names[i]);
+            
+            return loader->functions_script[i](L);
+        }
+        
+        // Wraps the Lua function in the upvalue, to count the file reads
+        
+        int count_file_access(lua_State *L)
+        {
+            N_reads++;
+            
+            lua_pushvalue(L,lua_upvalueindex(1));
+            lua_insert(L,1);
+            lua_call(L,lua_gettop(L)-1,LUA_MULTRET);
+            
+            return lua_gettop(L);
+        }
+        
+        std::uint64_t fnv1a(std::string const &str,std::uint64_t hash=14695981039346656037ULL)
+        {
+            for(unsigned char c : str)
+            {
+                hash^=c;
+                hash*=1099511628211ULL;
+            }
+            
+            return hash;
+        }
+        
+        template<typename T>
+        void cache_read(std::istream &strm,T &var)
+        {
+            strm.read(reinterpret_cast<char*>(&var),sizeof(T));
+        }
+        
+        void cache_read(std::istream &strm,std::vector<double> &V)
+        {
+            std::uint64_t N=0;
+            cache_read(strm,N);
+            
+            if(!strm || N>(1ULL<<32)) { strm.setstate(std::ios::failbit); return; }
+            
+            V.resize(N);
+            strm.read(reinterpret_cast<char*>(V.data()),N*sizeof(double));
+        }
+        
+        void cache_read(std::istream &strm,std::string &str)
+        {
+            std::uint64_t N=0;
+            cache_read(strm,N);
+            
+            if(!strm || N>(1ULL<<32)) { strm.setstate(std::ios::failbit); return; }
+            
+            str.resize(N);
+            strm.read(str.data(),N);
+        }
+        
+        void cache_read(std::istream &strm,std::vector<std::string> &V)
+        {
+            std::uint64_t N=0;
+            cache_read(strm,N);
+            
+            if(!strm || N>(1ULL<<16)) { strm.setstate(std::ios::failbit); return; }
+            
+            V.resize(N);
+            for(std::uint64_t i=0;i<N && strm;i++) cache_read(strm,V[i]);
+        }
+        
+        template<typename T>
+        void cache_write(std::ostream &strm,T const &var)
+        {
+            strm.write(reinterpret_cast<char const*>(&var),sizeof(T));
+        }
+        
+        void cache_write(std::ostream &strm,std::vector<double> const &V)
+        {
+            cache_write(strm,static_cast<std::uint64_t>(V.size()));
+            strm.write(reinterpret_cast<char const*>(V.data()),V.size()*sizeof(double));
+        }
+        
+        void cache_write(std::ostream &strm,std::string const &str)
+        {
+            cache_write(strm,static_cast<std::uint64_t>(str.size()));
+            strm.write(str.data(),str.size());
+        }
+        
+        void cache_write(std::ostream &strm,std::vector<std::string> const &V)
+        {
+            cache_write(strm,static_cast<std::uint64_t>(V.size()));
+            for(std::string const &str : V) cache_write(strm,str);
+        }
+    }
+    
     int allocate(lua_State *L)
     {
         Material *p_material=lua_allocate_metapointer<Material>(L,"metatable_material");
@@ -373,6 +490,279 @@ namespace lua_material
         return 0;
     }
     
+    //###########
+    //   Cache
+    //###########
+    
+    std::mutex Cache::cache_mutex;
+    std::map<std::uint64_t,Cache::Entry> Cache::materials;
+    
+    void Cache::clear()
+    {
+        std::unique_lock lock(cache_mutex);
+        
+        materials.clear();
+    }
+    
+    /*
+     * Material of the script, keyed by the hash of its location and content.
+     * On a miss the binary copy is tried first, then the script is run
+     * without holding the lock, since it may load other materials. Scripts
+     * that load other materials, or that open files from Lua (dofile,
+     * loadfile, require, io.input, io.lines, io.open and io.popen), are only
+     * kept in memory.
+     */
+    
+    Cache::Entry Cache::get(std::filesystem::path const &script_path)
+    {
+        std::ifstream file(script_path,std::ios::in|std::ios::binary);
+        
+        std::stringstream strm;
+        strm<<file.rdbuf();
+        
+        std::error_code ec;
+        std::filesystem::path location=std::filesystem::weakly_canonical(script_path,ec);
+        if(ec) location=std::filesystem::absolute(script_path);
+        
+        std::uint64_t hash=fnv1a(strm.str(),fnv1a(location.generic_string()));
+        
+        {
+            std::unique_lock lock(cache_mutex);
+            
+            auto it=materials.find(hash);
+            if(it!=materials.end()) return it->second;
+        }
+        
+        std::filesystem::path fname;
+        
+        if(!PathManager::user_profile_path.empty())
+        {
+            std::stringstream hash_strm;
+            hash_strm<<std::hex<<hash;
+            
+            fname=PathManager::to_userprofile_path("materials_cache")/(hash_strm.str()+".bin");
+        }
+        
+        Entry entry;
+        std::shared_ptr<Material> material=std::make_shared<Material>();
+        
+        if(fname.empty() || !read(fname,hash,*material,entry.functions))
+        {
+            int N_loads_start=N_loads;
+            int N_reads_start=N_reads;
+            
+            Loader loader;
+            loader.run_script(material.get(),script_path);
+            
+            entry.functions=loader.called_functions;
+            
+            if(   N_loads==N_loads_start && N_reads==N_reads_start
+               && !material->is_effective_material && !fname.empty())
+                write(fname,hash,*material,entry.functions);
+        }
+        
+        material->script_path=script_path;
+        entry.material=material;
+        
+        std::unique_lock lock(cache_mutex);
+        
+        return materials.try_emplace(hash,entry).first->second;
+    }
+    
+    bool Cache::read(std::filesystem::path const &fname,std::uint64_t hash,
+                     Material &material,std::vector<std::string> &functions)
+    {
+        std::ifstream file(fname,std::ios::in|std::ios::binary);
+        if(!file.is_open()) return false;
+        
+        char magic[8];
+        std::uint64_t file_hash=0;
+        
+        file.read(magic,8);
+        cache_read(file,file_hash);
+        
+        if(!file || std::memcmp(magic,cache_file_magic,8)!=0 || file_hash!=hash) return false;
+        
+        Material tmp;
+        std::uint64_t N_debye=0,N_drude=0,N_lorentz=0,N_critpoint=0,N_cauchy=0,N_spd=0;
+        
+        cache_read(file,tmp.eps_inf);
+        cache_read(file,tmp.lambda_valid_min);
+        cache_read(file,tmp.lambda_valid_max);
+        
+        cache_read(file,N_debye);
+        for(std::uint64_t i=0;i<N_debye && file;i++)
+        {
+            double ds=0,t0=0;
+            cache_read(file,ds); cache_read(file,t0);
+            
+            tmp.debye.emplace_back();
+            tmp.debye.back().set(ds,t0);
+        }
+        
+        cache_read(file,N_drude);
+        for(std::uint64_t i=0;i<N_drude && file;i++)
+        {
+            double wd=0,g=0;
+            cache_read(file,wd); cache_read(file,g);
+            
+            tmp.drude.emplace_back();
+            tmp.drude.back().set(wd,g);
+        }
+        
+        cache_read(file,N_lorentz);
+        for(std::uint64_t i=0;i<N_lorentz && file;i++)
+        {
+            double A=0,O=0,G=0;
+            cache_read(file,A); cache_read(file,O); cache_read(file,G);
+            
+            tmp.lorentz.emplace_back();
+            tmp.lorentz.back().set(A,O,G);
+        }
+        
+        cache_read(file,N_critpoint);
+        for(std::uint64_t i=0;i<N_critpoint && file;i++)
+        {
+            double A=0,O=0,P=0,G=0;
+            cache_read(file,A); cache_read(file,O); cache_read(file,P); cache_read(file,G);
+            
+            tmp.critpoint.emplace_back();
+            tmp.critpoint.back().set(A,O,P,G);
+        }
+        
+        cache_read(file,N_cauchy);
+        for(std::uint64_t i=0;i<N_cauchy && file;i++)
+        {
+            tmp.cauchy_coeffs.emplace_back();
+            cache_read(file,tmp.cauchy_coeffs.back());
+        }
+        
+        cache_read(file,tmp.sellmeier_B);
+        cache_read(file,tmp.sellmeier_C);
+        
+        // The splines are rebuilt from the tables, in linear time
+        
+        cache_read(file,N_spd);
+        for(std::uint64_t i=0;i<N_spd && file;i++)
+        {
+            std::vector<double> lambda,data_r,data_i;
+            char type_index=0;
+            
+            cache_read(file,lambda);
+            cache_read(file,data_r);
+            cache_read(file,data_i);
+            cache_read(file,type_index);
+            
+            if(!file || lambda.size()<2 || data_r.size()!=lambda.size() || data_i.size()!=lambda.size())
+                return false;
+            
+            tmp.add_spline_data(lambda,data_r,data_i,type_index);
+        }
+        
+        cache_read(file,tmp.name);
+        cache_read(file,tmp.description);
+        
+        std::vector<std::string> tmp_functions;
+        cache_read(file,tmp_functions);
+        
+        if(!file) return false;
+        
+        material=tmp;
+        functions=tmp_functions;
+        
+        return true;
+    }
+    
+    std::size_t Cache::size()
+    {
+        std::unique_lock lock(cache_mutex);
+        
+        return materials.size();
+    }
+    
+    /*
+     * Written next to its final location and then renamed, so that another
+     * session never reads a partial file.
+     */
+    
+    bool Cache::write(std::filesystem::path const &fname,std::uint64_t hash,
+                      Material const &material,std::vector<std::string> const &functions)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(fname.parent_path(),ec);
+        
+        std::filesystem::path fname_tmp=fname;
+        fname_tmp+="."+std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        
+        {
+            std::ofstream file(fname_tmp,std::ios::out|std::ios::trunc|std::ios::binary);
+            if(!file.is_open()) return false;
+            
+            file.write(cache_file_magic,8);
+            cache_write(file,hash);
+            
+            cache_write(file,material.eps_inf);
+            cache_write(file,material.lambda_valid_min);
+            cache_write(file,material.lambda_valid_max);
+            
+            cache_write(file,static_cast<std::uint64_t>(material.debye.size()));
+            for(DebyeModel const &D : material.debye)
+            {
+                cache_write(file,D.ds); cache_write(file,D.t0);
+            }
+            
+            cache_write(file,static_cast<std::uint64_t>(material.drude.size()));
+            for(DrudeModel const &D : material.drude)
+            {
+                cache_write(file,D.wd); cache_write(file,D.g);
+            }
+            
+            cache_write(file,static_cast<std::uint64_t>(material.lorentz.size()));
+            for(LorentzModel const &D : material.lorentz)
+            {
+                cache_write(file,D.A); cache_write(file,D.O); cache_write(file,D.G);
+            }
+            
+            cache_write(file,static_cast<std::uint64_t>(material.critpoint.size()));
+            for(CritpointModel const &D : material.critpoint)
+            {
+                cache_write(file,D.A); cache_write(file,D.O); cache_write(file,D.P); cache_write(file,D.G);
+            }
+            
+            cache_write(file,static_cast<std::uint64_t>(material.cauchy_coeffs.size()));
+            for(std::vector<double> const &coeffs : material.cauchy_coeffs) cache_write(file,coeffs);
+            
+            cache_write(file,material.sellmeier_B);
+            cache_write(file,material.sellmeier_C);
+            
+            cache_write(file,static_cast<std::uint64_t>(material.spd_lambda.size()));
+            for(std::size_t i=0;i<material.spd_lambda.size();i++)
+            {
+                cache_write(file,material.spd_lambda[i]);
+                cache_write(file,material.spd_r[i]);
+                cache_write(file,material.spd_i[i]);
+                cache_write(file,material.spd_type_index[i]);
+            }
+            
+            cache_write(file,material.name);
+            cache_write(file,material.description);
+            
+            cache_write(file,functions);
+            
+            if(!file) return false;
+        }
+        
+        std::filesystem::rename(fname_tmp,fname,ec);
+        
+        if(ec)
+        {
+            std::filesystem::remove(fname_tmp,ec);
+            return false;
+        }
+        
+        return true;
+    }
+    
     //############
     //   Loader
     //############
@@ -440,13 +830,18 @@ namespace lua_material
         
         add_functions("validity_range",set_validity_range<Mode::LIVE>,
                                        set_validity_range<Mode::SCRIPT>);
+        
+        use_cache=true;
     }
     
     void Loader::add_functions(std::string const &name,int (*live_function)(lua_State*),int (*script_function)(lua_State*))
     {
+        use_cache=false;
+        
         function_names.push_back(name);
         functions_live.push_back(live_function);
         functions_script.push_back(script_function);
+        replaced.push_back(false);
     }
     
     void Loader::create_metatable(lua_State *L)
@@ -472,25 +867,30 @@ namespace lua_material
             return;
         }
         
-        material->script_path=script_path_;
+        N_loads++;
         
-        lua_State *L=luaL_newstate();
-        luaL_openlibs(L);
+        // Loaders with their own functions may fill more than the Material
+        // part, they run the script when it calls one of them
         
-        lua_pushlightuserdata(L,static_cast<void*>(material));
-        lua_setglobal(L,"bound_material");
+        if(!use_cache)
+        {
+            run_script(material,script_path_);
+            return;
+        }
         
-        std::filesystem::path caller_path=script_path_.parent_path();
-        lua_pushlightuserdata(L,static_cast<void*>(&caller_path));
-        lua_setglobal(L,"lua_caller_path");
+        Cache::Entry entry=Cache::get(script_path_);
         
         for(std::size_t i=0;i<function_names.size();i++)
-            lua_register(L,function_names[i].c_str(),functions_script[i]);
-        
-        luaL_loadfile(L,script_path_.generic_string().c_str());
-        lua_pcall(L,0,0,0);
+        {
+            if(replaced[i] && vector_contains(entry.functions,function_names[i]))
+            {
+                run_script(material,script_path_);
+                return;
+            }
+        }
         
-        lua_close(L);
+        *material=*entry.material;
+        material->script_path=script_path_;
     }
     
     void Loader::replace_functions(std::string const &name,int (*live_function)(lua_State*),int (*script_function)(lua_State*))
@@ -501,11 +901,58 @@ namespace lua_material
             {
                 functions_live[i]=live_function;
                 functions_script[i]=script_function;
+                replaced[i]=true;
                 return;
             }
         }
     }
     
+    void Loader::run_script(Material *material,std::filesystem::path const &script_path_)
+    {
+        material->script_path=script_path_;
+        
+        lua_State *L=luaL_newstate();
+        luaL_openlibs(L);
+        
+        lua_pushlightuserdata(L,static_cast<void*>(material));
+        lua_setglobal(L,"bound_material");
+        
+        std::filesystem::path caller_path=script_path_.parent_path();
+        lua_pushlightuserdata(L,static_cast<void*>(&caller_path));
+        lua_setglobal(L,"lua_caller_path");
+        
+        for(std::size_t i=0;i<function_names.size();i++)
+        {
+            lua_pushlightuserdata(L,static_cast<void*>(this));
+            lua_pushinteger(L,i);
+            lua_pushcclosure(L,call_script_function,2);
+            lua_setglobal(L,function_names[i].c_str());
+        }
+        
+        for(char const *name : {"dofile","loadfile","require"})
+        {
+            lua_getglobal(L,name);
+            lua_pushcclosure(L,count_file_access,1);
+            lua_setglobal(L,name);
+        }
+        
+        lua_getglobal(L,"io");
+        
+        for(char const *name : {"input","lines","open","popen"})
+        {
+            lua_getfield(L,-1,name);
+            lua_pushcclosure(L,count_file_access,1);
+            lua_setfield(L,-2,name);
+        }
+        
+        lua_pop(L,1);
+        
+        luaL_loadfile(L,script_path_.generic_string().c_str());
+        lua_pcall(L,0,0,0);
+        
+        lua_close(L);
+    }
+    
     void Loader::set_allocation_function(int (*allocation_function_)(lua_State*))
     {
         allocation_function=allocation_function_;
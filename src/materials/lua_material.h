@@ -18,6 +18,9 @@ limitations under the License.*/
 #include <lua_base.h>
 #include <material.h>
 
+#include <cstdint>
+#include <map>
+
 namespace lua_material
 {
     enum class Mode
@@ -42,14 +45,45 @@ namespace lua_material
     
     int get_shift(Mode mode);
     
+    // Materials run with the default Loader functions, once per script
+    // content and shared between threads. The ones that do not depend on
+    // other files also get a binary copy in the user profile, so that their
+    // script is only run once across sessions.
+    
+    class Cache
+    {
+        public:
+            struct Entry
+            {
+                std::shared_ptr<Material const> material;
+                std::vector<std::string> functions; // Loader functions called by the script
+            };
+            
+            static void clear();
+            static Entry get(std::filesystem::path const &script_path);
+            static bool read(std::filesystem::path const &fname,std::uint64_t hash,
+                             Material &material,std::vector<std::string> &functions);
+            static std::size_t size();
+            static bool write(std::filesystem::path const &fname,std::uint64_t hash,
+                              Material const &material,std::vector<std::string> const &functions);
+            
+        private:
+            static std::mutex cache_mutex;
+            static std::map<std::uint64_t,Entry> materials;
+    };
+    
     class Loader
     {
         public:
+            bool use_cache; // false with functions unknown to the default Loader
             int (*allocation_function)(lua_State*);
             
             std::vector<std::string> function_names;
             std::vector<int (*)(lua_State*)> functions_live;
             std::vector<int (*)(lua_State*)> functions_script;
+            std::vector<bool> replaced; // differ from the default ones, see load()
+            
+            std::vector<std::string> called_functions; // by the scripts run so far
             
             Loader();
             virtual ~Loader()=default;
@@ -62,6 +96,7 @@ namespace lua_material
             void replace_functions(std::string const &name,
                                    int (*live_function)(lua_State*),
                                    int (*script_function)(lua_State*));
+            void run_script(Material *material,std::filesystem::path const &script_path);
             void set_allocation_function(int (*alloc)(lua_State*));
     };
 }
@@ -20,6 +20,142 @@ extern std::ofstream plog;
 
 extern const Imdouble Im;
 
+//######################
+//   DispersionCache
+//######################
+
+DispersionCache::DispersionCache(double lambda_min_,double lambda_max_,double tolerance_)
+    :lambda_min(std::min(lambda_min_,lambda_max_)),
+     lambda_max(std::max(lambda_min_,lambda_max_)),
+     tolerance(tolerance_),
+     ready(false),
+     w_min(m_to_rad_Hz(lambda_max)),
+     w_max(m_to_rad_Hz(lambda_min)),
+     inv_dw(0)
+{
+}
+
+DispersionCache::~DispersionCache()
+{
+}
+
+void DispersionCache::build(Material &mat)
+{
+    std::size_t i,N=16;
+    std::size_t N_max=1<<16;
+    
+    model=std::make_unique<Material>(mat);
+    model->disp_cache.reset();
+    
+    if(w_max<=w_min)
+    {
+        eps.resize(1);
+        eps[0]=mat.get_eps_model(w_min);
+        
+        return;
+    }
+    
+    double dw=(w_max-w_min)/N;
+    
+    eps.resize(N+1);
+    for(i=0;i<=N;i++) eps[i]=mat.get_eps_model(w_min+i*dw);
+    
+    std::vector<Imdouble> eps_mid;
+    
+    while(true)
+    {
+        eps_mid.resize(N);
+        
+        bool converged=true;
+        
+        for(i=0;i<N;i++)
+        {
+            eps_mid[i]=mat.get_eps_model(w_min+(i+0.5)*dw);
+            
+            if(std::abs(0.5*(eps[i]+eps[i+1])-eps_mid[i])>tolerance*(1.0+std::abs(eps_mid[i])))
+                converged=false;
+        }
+        
+        if(converged) break;
+        
+        if(2*N>N_max)
+        {
+            Plog::print(LogType::WARNING, "Dispersion cache of ", mat.name, " did not reach the ", tolerance,
+                        " tolerance over [", lambda_min, ",", lambda_max, "]\n");
+            break;
+        }
+        
+        // Refinement, the midpoints become nodes
+        
+        std::vector<Imdouble> eps_tmp(2*N+1);
+        
+        for(i=0;i<N;i++)
+        {
+            eps_tmp[2*i]=eps[i];
+            eps_tmp[2*i+1]=eps_mid[i];
+        }
+        eps_tmp[2*N]=eps[N];
+        
+        eps=std::move(eps_tmp);
+        
+        N*=2;
+        dw=(w_max-w_min)/N;
+    }
+    
+    inv_dw=1.0/dw;
+}
+
+bool DispersionCache::covers(double w) const
+{
+    return w>=w_min && w<=w_max;
+}
+
+Imdouble DispersionCache::get_eps(Material &mat,double w)
+{
+    if(!ready.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(build_mutex);
+        
+        if(!ready.load(std::memory_order_relaxed))
+        {
+            build(mat);
+            ready.store(true,std::memory_order_release);
+        }
+    }
+    
+    std::size_t N=eps.size()-1;
+    
+    if(N==0) return eps[0];
+    
+    double u=(w-w_min)*inv_dw;
+    std::size_t i=std::min(static_cast<std::size_t>(u),N-1);
+    
+    u-=i;
+    
+    return eps[i]+(eps[i+1]-eps[i])*u;
+}
+
+// Whether the table, if already built, still describes the model of mat.
+// Only meant to be called between renders, as it compares every parameter
+
+bool DispersionCache::matches(Material const &mat) const
+{
+    if(!ready.load(std::memory_order_acquire)) return true;
+    
+    return *model==mat && model->maxwell_garnett_host==mat.maxwell_garnett_host;
+}
+
+std::size_t DispersionCache::size() const
+{
+    if(!ready.load(std::memory_order_acquire)) return 0;
+    
+    return eps.size();
+}
+
+//######################
+//      Material
+//######################
+
 Material::Material()
     :eps_inf(1.0),
      lambda_valid_min(400e-9),
@@ -54,7 +190,8 @@ Material::Material(Material const &mat)
      maxwell_garnett_host(mat.maxwell_garnett_host),
      name(mat.name), // String descriptions
      description(mat.description),
-     script_path(mat.script_path)
+     script_path(mat.script_path),
+     disp_cache(mat.disp_cache)
 {
     if(is_effective_material)
     {
@@ -127,6 +264,8 @@ void Material::add_spline_data(std::vector<double> const &lambda,
     
     er_spline.push_back(sp_er);
     ei_spline.push_back(sp_ei);
+    
+    invalidate_dispersion_cache();
 }
 
 void Material::allocate_effective_materials(std::size_t Nm)
@@ -142,6 +281,13 @@ void Material::allocate_effective_materials(std::size_t Nm)
     {
         eff_mats[i]=new Material;
     }
+    
+    invalidate_dispersion_cache();
+}
+
+void Material::clear_dispersion_cache()
+{
+    disp_cache.reset();
 }
 
 bool Material::fdtd_compatible()
@@ -159,6 +305,14 @@ bool Material::fdtd_compatible()
 }
 
 Imdouble Material::get_eps(double w)
+{
+    if(disp_cache!=nullptr && disp_cache->covers(w))
+        return disp_cache->get_eps(*this,w);
+    
+    return get_eps_model(w);
+}
+
+Imdouble Material::get_eps_model(double w)
 {
     if(!is_effective_material)
     {
@@ -209,7 +363,8 @@ Imdouble Material::get_eps(double w)
     }
     else
     {
-        eff_eps.resize(eff_mats.size());
+        // Local storage, the cache may evaluate the model from several threads
+        std::vector<Imdouble> eff_eps(eff_mats.size());
         
         for(std::size_t i=0;i<eff_mats.size();i++)
         {
@@ -458,6 +613,14 @@ Imdouble Material::get_n(double w)
     return std::sqrt(get_eps(w));
 }
 
+void Material::invalidate_dispersion_cache()
+{
+    if(disp_cache!=nullptr)
+        disp_cache=std::make_shared<DispersionCache>(disp_cache->lambda_min,
+                                                     disp_cache->lambda_max,
+                                                     disp_cache->tolerance);
+}
+
 bool Material::is_const() const
 {
     if(is_effective_material)
@@ -529,6 +692,8 @@ void Material::operator = (Material const &mat)
             *(eff_mats[i])=*(mat.eff_mats[i]);
         }
     }
+    
+    disp_cache=mat.disp_cache;
 }
 
 bool Material::operator == (Material const &mat) const
@@ -605,6 +770,15 @@ bool Material::operator!=(Material const &mat) const
     return !(*this==mat);
 }
 
+// Catches edits made through the public members, which cannot invalidate
+// the table by themselves
+
+void Material::refresh_dispersion_cache()
+{
+    if(disp_cache!=nullptr && !disp_cache->matches(*this))
+        invalidate_dispersion_cache();
+}
+
 void Material::reset()
 {
     eps_inf=1.0;
@@ -650,16 +824,27 @@ void Material::reset()
     name="";
     description="";
     script_path="";
+    
+    invalidate_dispersion_cache();
 }
 
 void Material::set_const_eps(double eps_)
 {
     eps_inf=eps_;
+    
+    invalidate_dispersion_cache();
 }
 
 void Material::set_const_n(double n)
 {
     eps_inf=n*n;
+    
+    invalidate_dispersion_cache();
+}
+
+void Material::set_dispersion_cache(double lambda_min,double lambda_max,double tolerance)
+{
+    disp_cache=std::make_shared<DispersionCache>(lambda_min,lambda_max,tolerance);
 }
 
 //######################
@@ -19,7 +19,10 @@ limitations under the License.*/
 //#include <lua_base.h>
 #include <math_approx.h>
 
+#include <atomic>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 
 enum class EffectiveModel
 {
@@ -30,6 +33,34 @@ enum class EffectiveModel
     SUM_INV
 };
 
+class Material;
+
+class DispersionCache
+{
+    // Tabulated permittivity over a wavelength band, uniform in frequency
+    // The table is refined until the linear interpolation error on eps is below
+    // tolerance*(1+|eps|) at every interval midpoint
+    public:
+        double lambda_min,lambda_max,tolerance;
+        
+        DispersionCache(double lambda_min,double lambda_max,double tolerance);
+        ~DispersionCache();
+        
+        bool covers(double w) const;
+        Imdouble get_eps(Material &mat,double w);
+        bool matches(Material const &mat) const;
+        std::size_t size() const;
+        
+    private:
+        std::atomic<bool> ready;
+        std::mutex build_mutex;
+        double w_min,w_max,inv_dw;
+        std::vector<Imdouble> eps;
+        std::unique_ptr<Material> model; // Copy of the model the table was built from
+        
+        void build(Material &mat);
+};
+
 class Material
 {
     public:
@@ -70,6 +101,10 @@ class Material
         std::string name,description; 
         std::filesystem::path script_path;
         
+        // Dispersion cache, shared between copies
+        
+        std::shared_ptr<DispersionCache> disp_cache;
+        
         Material();
         Material(Material const &mat);
         virtual ~Material();
@@ -79,17 +114,24 @@ class Material
                              std::vector<double> const &data_i,
                              bool type_index);
         virtual void allocate_effective_materials(std::size_t Nm);
+        void clear_dispersion_cache();
         bool fdtd_compatible();
         Imdouble get_eps(double w);
+        Imdouble get_eps_model(double w);
         std::string get_matlab(std::string const &fname) const;
         Imdouble get_n(double w);
         bool is_const() const;
         void operator = (Material const &mat);
         bool operator == (Material const &mat) const;
         bool operator != (Material const &mat) const;
+        void refresh_dispersion_cache();
         void reset();
         void set_const_eps(double eps);
         void set_const_n(double n);
+        void set_dispersion_cache(double lambda_min,double lambda_max,double tolerance=1e-6);
+    
+    private:
+        void invalidate_dispersion_cache();
 };
 
 Imdouble effmodel_bruggeman(Imdouble eps_1,Imdouble eps_2,
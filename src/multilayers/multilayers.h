@@ -326,6 +326,17 @@ class Multilayer_TMM
                      Imdouble &t_TE,Imdouble &t_TM);
         void compute_abs(double &r_TE,double &r_TM,
                          double &t_TE,double &t_TM);
+        void compute_batch(std::vector<double> const &lambda,
+                           std::vector<AngleRad> const &angle,
+                           std::vector<Imdouble> &r_TE,std::vector<Imdouble> &r_TM,
+                           std::vector<Imdouble> &t_TE,std::vector<Imdouble> &t_TM,
+                           bool use_materials=false);
+        void compute_batch_block(std::size_t n_start,std::size_t n_end,
+                                 std::vector<double> const &lambda,
+                                 std::vector<AngleRad> const &angle,
+                                 std::vector<Imdouble> &r_TE,std::vector<Imdouble> &r_TM,
+                                 std::vector<Imdouble> &t_TE,std::vector<Imdouble> &t_TM,
+                                 bool use_materials);
         Imdouble compute_chara_TE(Imdouble const &n_eff);
         Imdouble compute_chara_TM(Imdouble const &n_eff);
         void compute_mode_TE(Imdouble const &n_eff,MLFieldHolder &holder,bool auto_z=true);
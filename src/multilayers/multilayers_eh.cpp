@@ -14,6 +14,7 @@ limitations under the License.*/
 
 #include <multilayers.h>
 #include <phys_tools.h>
+#include <thread_utils.h>
 
 
 extern const Imdouble Im;
@@ -126,6 +127,199 @@ void Multilayer_TMM::compute(Imdouble &r_TE,Imdouble &r_TM,
     t_TM=M(0,0)+M(0,1)*r_TM;
 }
 
+/*
+ * Computes r and t for the (lambda[n],angle[n]) pairs. Points are processed in
+ * blocks whose transfer matrices are kept as separate real and imaginary arrays,
+ * so that the layer products vectorize across points, and blocks are spread
+ * over threads. Results are bit-identical to compute().
+ * If use_materials is set, the indices are evaluated from the layer materials
+ * as in set_lambda_full().
+ */
+
+void Multilayer_TMM::compute_batch(std::vector<double> const &lambda_b,
+                                   std::vector<AngleRad> const &angle_b,
+                                   std::vector<Imdouble> &r_TE,std::vector<Imdouble> &r_TM,
+                                   std::vector<Imdouble> &t_TE,std::vector<Imdouble> &t_TM,
+                                   bool use_materials)
+{
+    if(lambda_b.size()!=angle_b.size())
+    {
+        Plog::print(LogType::FATAL, "Multilayer_TMM batch size mismatch: ", lambda_b.size(), " wavelengths for ", angle_b.size(), " angles\n");
+        std::exit(EXIT_FAILURE);
+    }
+    
+    std::size_t N=lambda_b.size();
+    std::size_t N_block=64;
+    
+    r_TE.resize(N); r_TM.resize(N);
+    t_TE.resize(N); t_TM.resize(N);
+    
+    if(N==0) return;
+    
+    int N_tasks=(N+N_block-1)/N_block;
+    
+    parallel_for(N_tasks,[&](int m)
+    {
+        compute_batch_block(m*N_block,std::min(N,(m+1)*N_block),
+                            lambda_b,angle_b,r_TE,r_TM,t_TE,t_TM,use_materials);
+    });
+}
+
+void Multilayer_TMM::compute_batch_block(std::size_t n_start,std::size_t n_end,
+                                         std::vector<double> const &lambda_b,
+                                         std::vector<AngleRad> const &angle_b,
+                                         std::vector<Imdouble> &r_TE,std::vector<Imdouble> &r_TM,
+                                         std::vector<Imdouble> &t_TE,std::vector<Imdouble> &t_TM,
+                                         bool use_materials)
+{
+    int l,p;
+    int Np=n_end-n_start;
+    
+    // Indices per point: superstrate, layers, substrate
+    
+    std::vector<Imdouble> ind((N_layers+2)*Np);
+    std::vector<double> k0_p(Np);
+    std::vector<Imdouble> kp_p(Np);
+    
+    for(p=0;p<Np;p++)
+    {
+        std::size_t n=n_start+p;
+        Imdouble *ind_p=ind.data()+(N_layers+2)*p;
+        
+        if(!use_materials)
+        {
+            ind_p[0]=sup_ind;
+            for(l=0;l<N_layers;l++) ind_p[l+1]=index_layer[l];
+            ind_p[N_layers+1]=sub_ind;
+        }
+        else if(p>0 && lambda_b[n]==lambda_b[n-1])
+        {
+            for(l=0;l<N_layers+2;l++) ind_p[l]=ind_p[l-N_layers-2];
+        }
+        else
+        {
+            double w=m_to_rad_Hz(lambda_b[n]);
+            
+            ind_p[0]=sup_mat.get_n(w);
+            for(l=0;l<N_layers;l++) ind_p[l+1]=material_layer[l].get_n(w);
+            ind_p[N_layers+1]=sub_mat.get_n(w);
+        }
+        
+        k0_p[p]=2.0*Pi/lambda_b[n];
+        kp_p[p]=ind_p[0]*k0_p[p]*std::sin(angle_b[n]);
+    }
+    
+    // Normal wavevectors, shared by the two interfaces of each layer
+    
+    std::vector<Imdouble> b_p((N_layers+2)*Np),g_p((N_layers+2)*Np);
+    
+    for(p=0;p<Np;p++) for(l=0;l<N_layers+2;l++)
+    {
+        double k0=k0_p[p];
+        Imdouble kp=kp_p[p];
+        
+        Imdouble n1=ind[(N_layers+2)*p+l];
+        Imdouble eps1=n1*n1;
+        Imdouble kn1=k0*n1;
+        
+        b_p[(N_layers+2)*p+l]=std::sqrt(kn1*kn1-kp*kp);
+        g_p[(N_layers+2)*p+l]=b_p[(N_layers+2)*p+l]/(k0*eps1);
+    }
+    
+    // Structure of arrays: [polarization][coefficient][point]
+    
+    std::vector<double> M_r(8*Np),M_i(8*Np);
+    std::vector<double> L_r(8*Np),L_i(8*Np);
+    
+    auto set_coeffs=[&](std::vector<double> &A_r,std::vector<double> &A_i,
+                        int p,int pol,Imdouble const &a00,Imdouble const &a01,
+                                      Imdouble const &a10,Imdouble const &a11)
+    {
+        int off=4*pol*Np+p;
+        
+        A_r[off]=a00.real();      A_i[off]=a00.imag();
+        A_r[off+Np]=a01.real();   A_i[off+Np]=a01.imag();
+        A_r[off+2*Np]=a10.real(); A_i[off+2*Np]=a10.imag();
+        A_r[off+3*Np]=a11.real(); A_i[off+3*Np]=a11.imag();
+    };
+    
+    for(p=0;p<Np;p++)
+    {
+        Imdouble b1=b_p[(N_layers+2)*p],b2=b_p[(N_layers+2)*p+1];
+        Imdouble g1=g_p[(N_layers+2)*p],g2=g_p[(N_layers+2)*p+1];
+        
+        set_coeffs(M_r,M_i,p,0,0.5*(1.0+b1/b2),0.5*(1.0-b1/b2),
+                               0.5*(1.0-b1/b2),0.5*(1.0+b1/b2));
+        set_coeffs(M_r,M_i,p,1,0.5*(1.0+g1/g2),0.5*(1.0-g1/g2),
+                               0.5*(1.0-g1/g2),0.5*(1.0+g1/g2));
+    }
+    
+    for(l=0;l<N_layers;l++)
+    {
+        for(p=0;p<Np;p++)
+        {
+            Imdouble b1=b_p[(N_layers+2)*p+l+1],b2=b_p[(N_layers+2)*p+l+2];
+            Imdouble g1=g_p[(N_layers+2)*p+l+1],g2=g_p[(N_layers+2)*p+l+2];
+            
+            Imdouble exp_p=std::exp(+h_layer[l]*b1*Im);
+            Imdouble exp_m=std::exp(-h_layer[l]*b1*Im);
+            
+            set_coeffs(L_r,L_i,p,0,0.5*(1.0+b1/b2)*exp_p,0.5*(1.0-b1/b2)*exp_m,
+                                   0.5*(1.0-b1/b2)*exp_p,0.5*(1.0+b1/b2)*exp_m);
+            set_coeffs(L_r,L_i,p,1,0.5*(1.0+g1/g2)*exp_p,0.5*(1.0-g1/g2)*exp_m,
+                                   0.5*(1.0-g1/g2)*exp_p,0.5*(1.0+g1/g2)*exp_m);
+        }
+        
+        // M=L*M, same operations order as the 2x2 Eigen product
+        
+        for(int pol=0;pol<2;pol++)
+        {
+            double *Lr[4],*Li[4],*Mr[4],*Mi[4];
+            
+            for(int c=0;c<4;c++)
+            {
+                Lr[c]=L_r.data()+(4*pol+c)*Np; Li[c]=L_i.data()+(4*pol+c)*Np;
+                Mr[c]=M_r.data()+(4*pol+c)*Np; Mi[c]=M_i.data()+(4*pol+c)*Np;
+            }
+            
+            for(p=0;p<Np;p++)
+            {
+                double m00_r=Mr[0][p],m00_i=Mi[0][p],m01_r=Mr[1][p],m01_i=Mi[1][p];
+                double m10_r=Mr[2][p],m10_i=Mi[2][p],m11_r=Mr[3][p],m11_i=Mi[3][p];
+                
+                for(int i=0;i<2;i++)
+                {
+                    double la_r=Lr[2*i][p],la_i=Li[2*i][p];
+                    double lb_r=Lr[2*i+1][p],lb_i=Li[2*i+1][p];
+                    
+                    Mr[2*i][p]=(la_r*m00_r-la_i*m00_i)+(lb_r*m10_r-lb_i*m10_i);
+                    Mi[2*i][p]=(la_r*m00_i+la_i*m00_r)+(lb_r*m10_i+lb_i*m10_r);
+                    
+                    Mr[2*i+1][p]=(la_r*m01_r-la_i*m01_i)+(lb_r*m11_r-lb_i*m11_i);
+                    Mi[2*i+1][p]=(la_r*m01_i+la_i*m01_r)+(lb_r*m11_i+lb_i*m11_r);
+                }
+            }
+        }
+    }
+    
+    for(p=0;p<Np;p++)
+    {
+        std::size_t n=n_start+p;
+        
+        Imdouble M00(M_r[p],M_i[p]),M01(M_r[Np+p],M_i[Np+p]);
+        Imdouble M10(M_r[2*Np+p],M_i[2*Np+p]),M11(M_r[3*Np+p],M_i[3*Np+p]);
+        
+        r_TE[n]=-M10/M11;
+        t_TE[n]=M00+M01*r_TE[n];
+        
+        M00=Imdouble(M_r[4*Np+p],M_i[4*Np+p]); M01=Imdouble(M_r[5*Np+p],M_i[5*Np+p]);
+        M10=Imdouble(M_r[6*Np+p],M_i[6*Np+p]); M11=Imdouble(M_r[7*Np+p],M_i[7*Np+p]);
+        
+        r_TM[n]=-M10/M11;
+        t_TM[n]=M00+M01*r_TM[n];
+    }
+}
+
 Imdouble Multilayer_TMM::compute_chara_TE(Imdouble const &n_eff)
 {
     if(n_eff.real()<0 || n_eff.imag()<0) return 1.0;
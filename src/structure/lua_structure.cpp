@@ -19,6 +19,7 @@ limitations under the License.*/
 #include <string_tools.h>
 #include <structure.h>
 
+#include <atomic>
 #include <fstream>
 #include <sstream>
 
@@ -26,15 +27,17 @@ limitations under the License.*/
 
 namespace LuaUI
 {
-    int spec_struct=0;
+    std::atomic<int> spec_struct(0); // shared by the jobs run side by side
 
 [[deprecated]]
 int gen_empty_structure(lua_State *L)
 {
+    int ID=spec_struct++;
+    
     std::stringstream fname;
     
     fname<<"empty_structure_";
-    fname<<spec_struct;
+    fname<<ID;
     fname<<".lua";
     
     std::ofstream file(PathManager::to_temporary_path(fname.str()),std::ios::out|std::ios::trunc);
@@ -60,8 +63,6 @@ int gen_empty_structure(lua_State *L)
     
     lua_pushstring(L,fname.str().c_str());
     
-    spec_struct++;
-    
     return 1;
 }
 
@@ -70,10 +71,12 @@ int gen_multilayer(lua_State *L)
 {
     int i;
     
+    int ID=spec_struct++;
+    
     std::stringstream fname;
     
     fname<<"multilayer_";
-    fname<<spec_struct;
+    fname<<ID;
     fname<<".lua";
     
     std::ofstream file(PathManager::to_temporary_path(fname.str()),std::ios::out|std::ios::trunc);
@@ -117,18 +120,18 @@ int gen_multilayer(lua_State *L)
     
     lua_pushstring(L,fname.str().c_str());
     
-    spec_struct++;
-    
     return 1;
 }
 
 [[deprecated]]
 int gen_simple_substrate(lua_State *L)
 {
+    int ID=spec_struct++;
+    
     std::stringstream fname;
     
     fname<<"simple_substrate_";
-    fname<<spec_struct;
+    fname<<ID;
     fname<<".lua";
     
     std::ofstream file(PathManager::to_temporary_path(fname.str()),std::ios::out|std::ios::trunc);
@@ -155,18 +158,18 @@ int gen_simple_substrate(lua_State *L)
     
     lua_pushstring(L,fname.str().c_str());
     
-    spec_struct++;
-    
     return 1;
 }
 
 [[deprecated]]
 int gen_slab(lua_State *L)
 {
+    int ID=spec_struct++;
+    
     std::stringstream fname;
     
     fname<<"slab_";
-    fname<<spec_struct;
+    fname<<ID;
     fname<<".lua";
     
     std::ofstream file(PathManager::to_temporary_path(fname.str()),std::ios::out|std::ios::trunc);
@@ -196,8 +199,6 @@ int gen_slab(lua_State *L)
     
     lua_pushstring(L,fname.str().c_str());
     
-    spec_struct++;
-    
     return 1;
 }
 
@@ -440,7 +441,9 @@ int structure_add_layer(lua_State *L)
     return 0;
 }
 
-int structure_add_lua_def(lua_State *L)
+// The batch functions get a table of x and return a table of 0 or 1
+
+int add_lua_def(lua_State *L,bool batch)
 {
     int i;
     
@@ -467,11 +470,21 @@ int structure_add_lua_def(lua_State *L)
     lua_getglobal(L,"lua_mother_state");
     mom_state=reinterpret_cast<lua_State*>(lua_touserdata(L,-1));
     
-    p_struct->add_operation(new Add_Lua_Def(mom_state,fname,parameters,mat_index));
+    p_struct->add_operation(new Add_Lua_Def(mom_state,fname,parameters,mat_index,batch));
     
     return 0;
 }
 
+int structure_add_lua_batch_def(lua_State *L)
+{
+    return add_lua_def(L,true);
+}
+
+int structure_add_lua_def(lua_State *L)
+{
+    return add_lua_def(L,false);
+}
+
 int structure_add_mesh(lua_State *L)
 {
     Structure *p_struct=get_structure_pointer(L);
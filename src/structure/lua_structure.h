@@ -34,6 +34,7 @@ int structure_add_conf_coating(lua_State *L);
 int structure_add_cylinder(lua_State *L);
 int structure_add_ellipsoid(lua_State *L);
 int structure_add_layer(lua_State *L);
+int structure_add_lua_batch_def(lua_State *L);
 int structure_add_lua_def(lua_State *L);
 int structure_add_mesh(lua_State *L);
 int structure_add_sin_layer(lua_State *L);
@@ -15,6 +15,162 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <lua_structure.h>
 #include <structure.h>
+#include <thread_utils.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace
+{
+    // Lua state of the discretization worker running on this thread
+    
+    thread_local lua_State *thread_lua_state=nullptr;
+    
+    int lua_ignore_operation(lua_State *L)
+    {
+        return 0;
+    }
+    
+    int lua_chunk_writer(lua_State *L,void const *p,std::size_t size,void *chunk)
+    {
+        static_cast<std::string*>(chunk)->append(static_cast<char const*>(p),size);
+        
+        return 0;
+    }
+    
+    /*
+     * Pushes on W a copy of the value at index i of L. Tables are copied
+     * deeply, Lua functions through their bytecode and C functions by pointer,
+     * both with a copy of their upvalues. copies is the index in W of the table
+     * of the tables and functions of L already copied, keyed by their address.
+     * upvalues maps the upvalues of the Lua functions already copied to their
+     * first function and index, so that the copies of closures that shared an
+     * upvalue share it too.
+     * Other values, as userdata and threads, are copied as nil and false is
+     * returned.
+     */
+    
+    bool copy_lua_value(lua_State *L,int i,lua_State *W,int copies,
+                        std::map<void*,std::pair<void*,int>> &upvalues)
+    {
+        i=lua_absindex(L,i);
+        int type=lua_type(L,i);
+        
+        switch(type)
+        {
+            case LUA_TNIL: lua_pushnil(W); return true;
+            case LUA_TBOOLEAN: lua_pushboolean(W,lua_toboolean(L,i)); return true;
+            case LUA_TNUMBER:
+                if(lua_isinteger(L,i)) lua_pushinteger(W,lua_tointeger(L,i));
+                else lua_pushnumber(W,lua_tonumber(L,i));
+                return true;
+            case LUA_TSTRING:
+            {
+                std::size_t size;
+                char const *str=lua_tolstring(L,i,&size);
+                lua_pushlstring(W,str,size);
+            }
+                return true;
+            case LUA_TLIGHTUSERDATA: lua_pushlightuserdata(W,lua_touserdata(L,i)); return true;
+            case LUA_TTABLE:
+            case LUA_TFUNCTION: break;
+            default: lua_pushnil(W); return false;
+        }
+        
+        void *address=const_cast<void*>(lua_topointer(L,i));
+        
+        lua_pushlightuserdata(W,address);
+        if(lua_rawget(W,copies)!=LUA_TNIL) return true;
+        lua_pop(W,1);
+        
+        bool copyable=true;
+        
+        auto record=[&]()
+        {
+            lua_pushlightuserdata(W,address);
+            lua_pushvalue(W,-2);
+            lua_rawset(W,copies);
+        };
+        
+        if(type==LUA_TTABLE)
+        {
+            lua_newtable(W);
+            record();
+            
+            lua_pushnil(L);
+            
+            while(lua_next(L,i)!=0)
+            {
+                copyable&=copy_lua_value(L,-2,W,copies,upvalues);
+                copyable&=copy_lua_value(L,-1,W,copies,upvalues);
+                
+                if(lua_isnil(W,-2)) lua_pop(W,2);
+                else lua_rawset(W,-3);
+                
+                lua_pop(L,1);
+            }
+        }
+        else if(lua_iscfunction(L,i))
+        {
+            int N_up=0;
+            
+            while(lua_getupvalue(L,i,N_up+1)!=nullptr)
+            {
+                copyable&=copy_lua_value(L,-1,W,copies,upvalues);
+                lua_pop(L,1);
+                N_up++;
+            }
+            
+            lua_pushcclosure(W,lua_tocfunction(L,i),N_up);
+            record();
+        }
+        else
+        {
+            std::string chunk;
+            
+            lua_pushvalue(L,i);
+            lua_dump(L,lua_chunk_writer,&chunk,0);
+            lua_pop(L,1);
+            
+            if(luaL_loadbuffer(W,chunk.data(),chunk.size(),"worker")!=LUA_OK)
+            {
+                lua_pop(W,1);
+                lua_pushnil(W);
+                return false;
+            }
+            
+            record();
+            
+            for(int n=1;lua_getupvalue(L,i,n)!=nullptr;n++)
+            {
+                copyable&=copy_lua_value(L,-1,W,copies,upvalues);
+                lua_setupvalue(W,-2,n);
+                lua_pop(L,1);
+                
+                // The value may have reached another closure with this upvalue
+                
+                void *id=lua_upvalueid(L,i,n);
+                auto shared=upvalues.find(id);
+                
+                if(shared==upvalues.end()) upvalues[id]={address,n};
+                else
+                {
+                    lua_pushlightuserdata(W,shared->second.first);
+                    lua_rawget(W,copies);
+                    lua_upvaluejoin(W,-2,n,-1,shared->second.second);
+                    lua_pop(W,1);
+                }
+            }
+        }
+        
+        return copyable;
+    }
+}
 
 //##################
 //   Structure_OP
@@ -42,10 +198,97 @@ int Structure_OP::index(double x,double y,double z)
 }
 
 
+void Structure_OP::index_batch(std::vector<double> const &x,double y,double z,std::vector<int> &indices)
+{
+    indices.resize(x.size());
+    
+    for(std::size_t i=0;i<x.size();i++)
+        indices[i]=index(x[i],y,z);
+}
+
+
+bool Structure_OP::on_grid() const
+{
+    return false;
+}
+
+
+/*
+ * For the operations that need the discretized stack below them, such as
+ * the conformal coatings: matgrid holds the materials of the lower levels,
+ * with node (i,j,k) at (i*Dx,j*Dy,k*Dz).
+ */
+
+void Structure_OP::paint_grid(Grid3<unsigned int> &matgrid,double Dx,double Dy,double Dz)
+{
+}
+
+
+/*
+ * Distance around a node over which paint_grid() reads the grid, for
+ * Structure::update_discretization. False when it also evaluates the stack
+ * away from the nodes, or reads the whole grid.
+ */
+
+bool Structure_OP::grid_reach(double Dx,double Dy,double Dz,double &reach) const
+{
+    return false;
+}
+
+
 void Structure_OP::precompute()
 {
 }
 
+
+bool Structure_OP::thread_safe() const
+{
+    return true;
+}
+
+/*
+ * Range [xa,xb] of the line (y,z) where index() can hit. With SPAN_INTERVAL
+ * the hits have to form a single interval within it, as for convex shapes.
+ * With SPAN_CROSSINGS, x is inside when an odd number of the x_crossings()
+ * are below or at x.
+ */
+
+int Structure_OP::x_span(double y,double z,double &xa,double &xb)
+{
+    xa=-std::numeric_limits<double>::max();
+    xb=std::numeric_limits<double>::max();
+    
+    return SPAN_VOXELS;
+}
+
+
+void Structure_OP::x_crossings(double y,double z,std::vector<double> &crossings)
+{
+    crossings.clear();
+}
+
+//##################
+//   Subpixel_Mix
+//##################
+
+/*
+ * Diagonal term of the smoothed permittivity seen by the field along dir, in
+ * its own cell: the part of the field along the interface normal sees the
+ * harmonic mean of the permittivities and the tangential part the arithmetic
+ * one. The off-diagonal terms are dropped. Complex permittivities are mixed
+ * the same way, for the frequency domain solvers.
+ */
+
+Imdouble Subpixel_Mix::effective_eps(Imdouble eps_1,Imdouble eps_2,int dir) const
+{
+    double f=fill[dir];
+    
+    Imdouble eps_mean=f*eps_1+(1.0-f)*eps_2;
+    Imdouble inv_mean=f/eps_1+(1.0-f)/eps_2;
+    
+    return 1.0/(n2[dir]*inv_mean+(1.0-n2[dir])/eps_mean);
+}
+
 //###############
 //   Structure
 //###############
@@ -61,7 +304,9 @@ Structure::Structure()
      periodic_x(false),
      periodic_y(false),
      periodic_z(false),
-     L(nullptr)
+     L(nullptr),
+     lua_workers_copyable(true),
+     discretized_current(false)
 {
 }
 
@@ -76,7 +321,10 @@ Structure::Structure(std::filesystem::path const &script_path_)
      periodic_x(false),
      periodic_y(false),
      periodic_z(false),
-     L(nullptr), script_path(script_path_)
+     L(nullptr),
+     lua_workers_copyable(true),
+     script_path(script_path_),
+     discretized_current(false)
 {
     set_script(script_path_);
 }
@@ -84,35 +332,670 @@ Structure::Structure(std::filesystem::path const &script_path_)
 Structure::~Structure()
 {
     if(L!=nullptr) lua_close(L);
+    
+    for(lua_State *W : worker_states) lua_close(W);
+    
+    for(Structure_OP *op : operations) delete op;
+    for(Structure_OP *op : discretized_operations) delete op;
 }
 
 void Structure::add_operation(Structure_OP *operation)
 {
+    if(operation->signature.empty()) operation->signature=pending_signature;
+    
+    operation->parent=this;
+    operation->stack_ID=operations.size();
+    
     operations.push_back(operation);
 }
 
 void Structure::discretize(Grid3<unsigned int> &matgrid,
                            int Nx,int Ny,int Nz,double Dx,double Dy,double Dz)
+{
+    discretize_stack(matgrid,Nx,Ny,Nz,Dx,Dy,Dz,nullptr);
+    
+    // Nothing is kept for update_discretization(), which starts again from
+    // a full discretization
+    
+    discretized_grid.init(0,0,0);
+    discretized_stages.clear();
+    discretized_stages.shrink_to_fit();
+    discretized_current=false;
+}
+
+/*
+ * Same result as index() at every node, computed line by line along x. The
+ * operations are painted on each line from the top of the stack, each node
+ * keeping the first one that covers it, and each one only visits the part of
+ * the line given by its x_span(). The xz planes are shared between threads.
+ * The grid before each whole grid operation is appended to stages, if any.
+ */
+
+void Structure::discretize_stack(Grid3<unsigned int> &matgrid,
+                                 int Nx,int Ny,int Nz,double Dx,double Dy,double Dz,
+                                 std::vector<Grid3<unsigned int>> *stages)
 {
     matgrid.init(Nx,Ny,Nz,0);
     
-    ProgTimeDisp dsp(Nx*Ny*Nz, 100, "Structure Discretization");
+    if(stages!=nullptr) stages->clear();
     
-    for(int i=0;i<Nx;i++)
-    for(int j=0;j<Ny;j++)
-    for(int k=0;k<Nz;k++)
+    std::vector<double> xs,ys,zs;
+    std::vector<int> x_runs;
+    
+    grid_coordinates(Nx,Ny,Nz,Dx,Dy,Dz,xs,ys,zs,x_runs);
+    
+    bool parallel=true;
+    bool lua_ops=false;
+    
+    for(Structure_OP *op : operations)
+    {
+        if(!op->thread_safe()) parallel=false;
+        if(dynamic_cast<Add_Lua_Def*>(op)!=nullptr) lua_ops=true;
+    }
+    
+    int Nthr=parallel ? std::min(max_threads_number(),Nz) : 1;
+    
+    // The Lua defined operations get one state per extra worker
+    
+    if(lua_ops)
     {
-        double x=i*Dx;
-        double y=j*Dy;
-        double z=k*Dz;
+        while(static_cast<int>(worker_states.size())<Nthr-1)
+            worker_states.push_back(create_worker_state());
+    }
+    
+    // Operations painted row by row, up to the next one that works on the
+    // whole grid
+    
+    auto paint_rows=[&](std::size_t l1,std::size_t l2)
+    {
+        ProgTimeDisp dsp(Nz, 1, "Structure Discretization");
+        std::mutex dsp_mutex;
         
-        matgrid(i,j,k)=index(x,y,z);
+        std::atomic<int> next_k(0);
         
-        ++dsp;
+        auto worker=[&](int t)
+        {
+            int k;
+            std::vector<int> row(Nx);
+            
+            if(lua_ops && t>0) thread_lua_state=worker_states[t-1];
+            
+            while((k=next_k++)<Nz)
+            {
+                for(int j=0;j<Ny;j++)
+                {
+                    if(l1==0) std::fill(row.begin(),row.end(),default_material);
+                    else for(int i=0;i<Nx;i++) row[i]=matgrid(i,j,k);
+                    
+                    discretize_row(row,l1,l2,xs,x_runs,ys[j],zs[k]);
+                    
+                    for(int i=0;i<Nx;i++) matgrid(i,j,k)=row[i];
+                }
+                
+                std::unique_lock lock(dsp_mutex);
+                ++dsp;
+            }
+            
+            thread_lua_state=nullptr;
+        };
+        
+        run_threads(Nthr,worker);
+    };
+    
+    std::size_t l1=0;
+    
+    while(true)
+    {
+        std::size_t l2=l1;
+        
+        while(l2<operations.size() && !operations[l2]->on_grid()) l2++;
+        
+        paint_rows(l1,l2);
+        
+        if(l2==operations.size()) break;
+        
+        if(stages!=nullptr) stages->push_back(matgrid);
+        
+        operations[l2]->paint_grid(matgrid,Dx,Dy,Dz);
+        
+        l1=l2+1;
+    }
+    
+    for(Structure_OP *op : discretized_operations) delete op;
+    discretized_operations.clear();
+    
+    discretized_key=discretization_key(Nx,Ny,Nz,Dx,Dy,Dz);
+    discretized_current=true;
+}
+
+std::vector<double> Structure::discretization_key(int Nx,int Ny,int Nz,double Dx,double Dy,double Dz) const
+{
+    std::vector<double> key={Dx,Dy,Dz,lx,ly,lz};
+    
+    for(int v : {Nx,Ny,Nz,default_material})
+        key.push_back(v);
+    
+    for(bool v : {flip_x,flip_y,flip_z,periodic_x,periodic_y,periodic_z})
+        key.push_back(v);
+    
+    return key;
+}
+
+/*
+ * Discretization of the current operations on top of the last one, whose
+ * grid the structure keeps without the subpixel smoothing of the callers,
+ * and copies to matgrid. The operations are matched to the ones of the last
+ * discretization by their signature, and only the rows crossed by the ones
+ * that were added or removed are painted again, which gives the same grid
+ * as discretize() as long as the matched operations kept their order. The
+ * whole grid operations split the stack in segments: the grid before each
+ * one is kept, and the rows it may change are the ones within its
+ * grid_reach() of a row painted again below it, on top of the ones its own
+ * segment crosses. Operations that evaluate the stack away from the nodes,
+ * as the directional coatings and the Lua defined ones, added or removed
+ * whole grid operations, or a different grid or set of modifiers fall back
+ * to the full discretization. The linear indices of the nodes that changed
+ * since the last call are written to changed, and the function returns
+ * false when it had to fall back.
+ */
+
+bool Structure::update_discretization(Grid3<unsigned int> &matgrid,std::vector<int> &changed,
+                                      int Nx,int Ny,int Nz,double Dx,double Dy,double Dz)
+{
+    changed.clear();
+    
+    std::vector<double> key=discretization_key(Nx,Ny,Nz,Dx,Dy,Dz);
+    bool same_grid=   key==discretized_key
+                   && discretized_grid.L1()==Nx && discretized_grid.L2()==Ny && discretized_grid.L3()==Nz;
+    
+    if(discretized_current && same_grid)
+    {
+        matgrid=discretized_grid;
+        return true;
+    }
+    
+    std::vector<Structure_OP*> const &old_ops=discretized_operations;
+    
+    auto node_local=[&](Structure_OP *op)
+    {
+        double reach;
+        
+        if(op->on_grid()) return op->grid_reach(Dx,Dy,Dz,reach);
+        
+        return    dynamic_cast<Add_Coating*>(op)==nullptr
+               && dynamic_cast<Add_Lua_Def*>(op)==nullptr;
+    };
+    
+    // Segment of each operation, the number of whole grid operations below it
+    
+    auto segments=[](std::vector<Structure_OP*> const &ops,std::vector<int> &segment)
+    {
+        int s=0;
+        segment.resize(ops.size());
+        
+        for(std::size_t l=0;l<ops.size();l++)
+        {
+            segment[l]=s;
+            if(ops[l]->on_grid()) s++;
+        }
+        
+        return s+1;
+    };
+    
+    std::vector<int> old_segment,new_segment;
+    
+    int N_seg=segments(operations,new_segment);
+    
+    bool incremental=   same_grid
+                     && std::all_of(old_ops.begin(),old_ops.end(),node_local)
+                     && std::all_of(operations.begin(),operations.end(),node_local)
+                     && segments(old_ops,old_segment)==N_seg
+                     && static_cast<int>(discretized_stages.size())==N_seg-1;
+    
+    // Matching, the n-th operation of a given signature to the n-th one of
+    // the previous stack
+    
+    std::vector<bool> old_kept(old_ops.size(),false),new_kept(operations.size(),false);
+    
+    if(incremental)
+    {
+        std::map<std::string,std::vector<int>> old_positions;
+        std::map<std::string,std::size_t> N_matched;
+        
+        for(std::size_t l=0;l<old_ops.size();l++)
+            if(!old_ops[l]->signature.empty()) old_positions[old_ops[l]->signature].push_back(l);
+        
+        int last=-1;
+        
+        for(std::size_t l=0;l<operations.size() && incremental;l++)
+        {
+            auto it=old_positions.find(operations[l]->signature);
+            if(operations[l]->signature.empty() || it==old_positions.end()) continue;
+            
+            std::size_t &n=N_matched[operations[l]->signature];
+            if(n>=it->second.size()) continue;
+            
+            int m=it->second[n++];
+            
+            if(m<last) incremental=false;
+            last=m;
+            
+            old_kept[m]=true;
+            new_kept[l]=true;
+        }
+        
+        // The whole grid operations have to be kept for the segments to match
+        
+        for(std::size_t l=0;l<old_ops.size();l++) if(old_ops[l]->on_grid() && !old_kept[l]) incremental=false;
+        for(std::size_t l=0;l<operations.size();l++) if(operations[l]->on_grid() && !new_kept[l]) incremental=false;
+    }
+    
+    if(!incremental)
+    {
+        bool comparable=discretized_grid.L1()==Nx && discretized_grid.L2()==Ny && discretized_grid.L3()==Nz;
+        
+        Grid3<unsigned int> previous;
+        if(comparable) previous=discretized_grid;
+        
+        discretize_stack(discretized_grid,Nx,Ny,Nz,Dx,Dy,Dz,&discretized_stages);
+        
+        for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+            if(!comparable || previous(i,j,k)!=discretized_grid(i,j,k)) changed.push_back(i+Nx*(j+Ny*k));
+        
+        matgrid=discretized_grid;
+        
+        return false;
+    }
+    
+    std::vector<std::vector<Structure_OP*>> dirty_ops(N_seg);
+    
+    for(std::size_t l=0;l<old_ops.size();l++) if(!old_kept[l]) dirty_ops[old_segment[l]].push_back(old_ops[l]);
+    for(std::size_t l=0;l<operations.size();l++) if(!new_kept[l]) dirty_ops[new_segment[l]].push_back(operations[l]);
+    
+    std::vector<std::size_t> grid_ops;
+    
+    for(std::size_t l=0;l<operations.size();l++) if(operations[l]->on_grid()) grid_ops.push_back(l);
+    
+    std::vector<double> xs,ys,zs;
+    std::vector<int> x_runs;
+    
+    grid_coordinates(Nx,Ny,Nz,Dx,Dy,Dz,xs,ys,zs,x_runs);
+    
+    bool parallel=std::all_of(old_ops.begin(),old_ops.end(),[](Structure_OP *op) { return op->thread_safe(); })
+                  && std::all_of(operations.begin(),operations.end(),[](Structure_OP *op) { return op->thread_safe(); });
+    
+    int Nthr=parallel ? max_threads_number() : 1;
+    
+    auto crosses=[&](Structure_OP *op,double y,double z,std::vector<double> &crossings)
+    {
+        for(int j=-periodic_y;j<=periodic_y;j++)
+        for(int k=-periodic_z;k<=periodic_z;k++)
+        {
+            double xa,xb;
+            int span=op->x_span(y+j*ly,z+k*lz,xa,xb);
+            
+            if(span==SPAN_CROSSINGS)
+            {
+                op->x_crossings(y+j*ly,z+k*lz,crossings);
+                if(!crossings.empty()) return true;
+            }
+            else if(span!=SPAN_NONE) return true;
+        }
+        
+        return false;
+    };
+    
+    // Rows crossed by the dirty operations of segment s. Below a whole grid
+    // operation, the lines of its padding out of the non periodic sides are
+    // counted with the closest row.
+    
+    auto mark_segment=[&](int s,std::vector<char> &dirty)
+    {
+        std::vector<Structure_OP*> const &ops=dirty_ops[s];
+        
+        if(ops.empty()) return;
+        
+        bool padding=s<N_seg-1;
+        
+        auto coordinate=[](int n,double D,bool flip,double l) { return flip ? l-n*D : n*D; };
+        
+        parallel_for(Nz,[&](int k)
+        {
+            std::vector<double> crossings;
+            
+            int k1=k,k2=k;
+            
+            if(padding && !periodic_z && k==0) k1=-1;
+            if(padding && !periodic_z && k==Nz-1) k2=Nz;
+            
+            for(int j=0;j<Ny;j++)
+            {
+                int j1=j,j2=j;
+                
+                if(padding && !periodic_y && j==0) j1=-1;
+                if(padding && !periodic_y && j==Ny-1) j2=Ny;
+                
+                for(int k3=k1;k3<=k2 && !dirty[j+Ny*k];k3++)
+                for(int j3=j1;j3<=j2 && !dirty[j+Ny*k];j3++)
+                {
+                    double y=(j3==j) ? ys[j] : coordinate(j3,Dy,flip_y,ly);
+                    double z=(k3==k) ? zs[k] : coordinate(k3,Dz,flip_z,lz);
+                    
+                    for(std::size_t l=0;l<ops.size() && !dirty[j+Ny*k];l++)
+                        if(crosses(ops[l],y,z,crossings)) dirty[j+Ny*k]=1;
+                }
+            }
+        },Nthr);
+    };
+    
+    // Rows within reach of a dirty row, the distances of the whole grid
+    // operations wrapping around the periodic sides
+    
+    auto dilate=[&](std::vector<char> &dirty,double reach)
+    {
+        int rj=std::ceil(reach/Dy);
+        int rk=std::ceil(reach/Dz);
+        
+        std::vector<char> tmp(Ny*Nz,0);
+        
+        for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++)
+        {
+            if(!dirty[j+Ny*k]) continue;
+            
+            for(int d=-rj;d<=rj;d++)
+            {
+                int j2=j+d;
+                
+                if(periodic_y) j2=(j2%Ny+Ny)%Ny;
+                else if(j2<0 || j2>=Ny) continue;
+                
+                tmp[j2+Ny*k]=1;
+            }
+        }
+        
+        std::fill(dirty.begin(),dirty.end(),0);
+        
+        for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++)
+        {
+            if(!tmp[j+Ny*k]) continue;
+            
+            for(int d=-rk;d<=rk;d++)
+            {
+                int k2=k+d;
+                
+                if(periodic_z) k2=(k2%Nz+Nz)%Nz;
+                else if(k2<0 || k2>=Nz) continue;
+                
+                dirty[j+Ny*k2]=1;
+            }
+        }
+    };
+    
+    std::vector<char> dirty(Ny*Nz,0);
+    std::vector<std::vector<int>> changed_k(Nz);
+    std::atomic<int> N_rows(0);
+    
+    Grid3<unsigned int> base;
+    
+    for(int s=0;s<N_seg;s++)
+    {
+        Structure_OP *grid_op=(s>0) ? operations[grid_ops[s-1]] : nullptr;
+        
+        if(grid_op!=nullptr)
+        {
+            double reach;
+            grid_op->grid_reach(Dx,Dy,Dz,reach);
+            
+            dilate(dirty,reach);
+        }
+        
+        mark_segment(s,dirty);
+        
+        if(std::find(dirty.begin(),dirty.end(),1)==dirty.end()) continue;
+        
+        // The rows start from the grid below, once painted by the whole grid
+        // operation, and end up in the grid before the next one
+        
+        if(grid_op!=nullptr)
+        {
+            base=discretized_stages[s-1];
+            grid_op->paint_grid(base,Dx,Dy,Dz);
+        }
+        
+        std::size_t l1=(s>0) ? grid_ops[s-1]+1 : 0;
+        std::size_t l2=(s<N_seg-1) ? grid_ops[s] : operations.size();
+        
+        bool last=s==N_seg-1;
+        Grid3<unsigned int> &target=last ? discretized_grid : discretized_stages[s];
+        
+        parallel_for(Nz,[&](int k)
+        {
+            std::vector<int> row(Nx);
+            
+            for(int j=0;j<Ny;j++)
+            {
+                if(!dirty[j+Ny*k]) continue;
+                
+                N_rows++;
+                
+                if(grid_op==nullptr) std::fill(row.begin(),row.end(),default_material);
+                else for(int i=0;i<Nx;i++) row[i]=base(i,j,k);
+                
+                discretize_row(row,l1,l2,xs,x_runs,ys[j],zs[k]);
+                
+                for(int i=0;i<Nx;i++)
+                {
+                    if(target(i,j,k)!=static_cast<unsigned int>(row[i]))
+                    {
+                        target(i,j,k)=row[i];
+                        if(last) changed_k[k].push_back(i+Nx*(j+Ny*k));
+                    }
+                }
+            }
+        },Nthr);
+    }
+    
+    for(int k=0;k<Nz;k++) changed.insert(changed.end(),changed_k[k].begin(),changed_k[k].end());
+    
+    std::size_t N_dirty=0;
+    for(std::vector<Structure_OP*> const &ops : dirty_ops) N_dirty+=ops.size();
+    
+    Plog::print("Structure update: ", N_dirty, " operations changed, ",
+                N_rows.load(), "/", N_seg*Ny*Nz, " rows repainted, ", changed.size(), " nodes changed\n");
+    
+    for(Structure_OP *op : discretized_operations) delete op;
+    discretized_operations.clear();
+    
+    discretized_current=true;
+    
+    matgrid=discretized_grid;
+    
+    return true;
+}
+
+void Structure::discretize_row(std::vector<int> &row,std::size_t l1,std::size_t l2,
+                               std::vector<double> const &xs,
+                               std::vector<int> const &x_runs,
+                               double y,double z)
+{
+    std::vector<double> crossings,x_batch;
+    std::vector<int> indices,n_batch;
+    
+    // Top-down as in index(): a node keeps the first operation, and image,
+    // that covers it, and the lower operations are not evaluated on it
+    
+    std::vector<bool> painted(row.size(),false);
+    std::size_t N_left=row.size();
+    
+    auto paint=[&](int n,int mat)
+    {
+        if(painted[n]) return;
+        
+        row[n]=mat;
+        painted[n]=true;
+        N_left--;
+    };
+    
+    for(std::size_t l=l2;l>l1 && N_left>0;l--)
+    {
+        Structure_OP *op=operations[l-1];
+        
+        for(int i=-periodic_x;i<=periodic_x;i++)
+        for(int j=-periodic_y;j<=periodic_y;j++)
+        for(int k=-periodic_z;k<=periodic_z;k++)
+        {
+            double y2=y+j*ly;
+            double z2=z+k*lz;
+            
+            double xa,xb;
+            int span=op->x_span(y2,z2,xa,xb);
+            
+            if(span==SPAN_NONE) continue;
+            
+            if(span==SPAN_CROSSINGS)
+            {
+                op->x_crossings(y2,z2,crossings);
+                if(crossings.empty()) continue;
+                
+                xa=crossings.front();
+                xb=crossings.back();
+            }
+            
+            // Margin for the rounding of the analytic bounds, the interval
+            // ends are then set by index() itself, starting one node out
+            
+            double margin=1e-9*(std::abs(xa)+std::abs(xb));
+            
+            xa-=margin;
+            xb+=margin;
+            
+            double shift=i*lx;
+            
+            auto hit=[&](int n) { return op->index(xs[n]+shift,y2,z2); };
+            
+            for(std::size_t r=0;r+1<x_runs.size();r++)
+            {
+                int r0=x_runs[r];
+                int r1=x_runs[r+1];
+                
+                // Nodes of the run within [xa,xb]
+                
+                int n0,n1;
+                
+                if(r1-r0<2 || xs[r0+1]>=xs[r0])
+                {
+                    n0=std::lower_bound(xs.begin()+r0,xs.begin()+r1,xa-shift)-xs.begin();
+                    n1=std::upper_bound(xs.begin()+r0,xs.begin()+r1,xb-shift)-xs.begin()-1;
+                }
+                else
+                {
+                    n0=std::lower_bound(xs.begin()+r0,xs.begin()+r1,xb-shift,std::greater<double>())-xs.begin();
+                    n1=std::upper_bound(xs.begin()+r0,xs.begin()+r1,xa-shift,std::greater<double>())-xs.begin()-1;
+                }
+                
+                if(span==SPAN_CROSSINGS)
+                {
+                    // Same comparisons as index(), in increasing x
+                    
+                    bool increasing=r1-r0<2 || xs[r0+1]>=xs[r0];
+                    std::size_t c=0;
+                    
+                    for(int m=0;m<=n1-n0;m++)
+                    {
+                        int n=increasing ? n0+m : n1-m;
+                        
+                        while(c<crossings.size() && crossings[c]<=xs[n]+shift) c++;
+                        
+                        if(c%2!=0) paint(n,op->mat_index);
+                    }
+                }
+                else if(span==SPAN_INTERVAL)
+                {
+                    n0=std::max(n0-1,r0);
+                    n1=std::min(n1+1,r1-1);
+                    
+                    while(n0<=n1 && hit(n0)==-1) n0++;
+                    while(n1>=n0 && hit(n1)==-1) n1--;
+                    
+                    if(n0>n1) continue;
+                    
+                    while(n0>r0 && hit(n0-1)!=-1) n0--;
+                    while(n1<r1-1 && hit(n1+1)!=-1) n1++;
+                    
+                    for(int n=n0;n<=n1;n++) paint(n,op->mat_index);
+                }
+                else if(n0<=n1)
+                {
+                    x_batch.clear();
+                    n_batch.clear();
+                    
+                    for(int n=n0;n<=n1;n++)
+                    {
+                        if(painted[n]) continue;
+                        
+                        x_batch.push_back(xs[n]+shift);
+                        n_batch.push_back(n);
+                    }
+                    
+                    if(x_batch.empty()) continue;
+                    
+                    op->index_batch(x_batch,y2,z2,indices);
+                    
+                    for(std::size_t m=0;m<n_batch.size();m++)
+                        if(indices[m]!=-1) paint(n_batch[m],indices[m]);
+                }
+            }
+        }
     }
 }
 
 
+void Structure::get_loop(bool &x,bool &y,bool &z) const
+{
+    x=periodic_x;
+    y=periodic_y;
+    z=periodic_z;
+}
+
+
+/*
+ * Node coordinates once flipped and wrapped, as in index(), and the
+ * monotonic runs of xs, split where the wrapping jumps back.
+ */
+
+void Structure::grid_coordinates(int Nx,int Ny,int Nz,double Dx,double Dy,double Dz,
+                                 std::vector<double> &xs,std::vector<double> &ys,std::vector<double> &zs,
+                                 std::vector<int> &x_runs) const
+{
+    auto transform=[](double x,bool flip,bool periodic,double l)
+    {
+        if(flip) x=l-x;
+        if(periodic) x=modulus(x,l);
+        
+        return x;
+    };
+    
+    xs.resize(Nx);
+    ys.resize(Ny);
+    zs.resize(Nz);
+    
+    for(int i=0;i<Nx;i++) xs[i]=transform(i*Dx,flip_x,periodic_x,lx);
+    for(int j=0;j<Ny;j++) ys[j]=transform(j*Dy,flip_y,periodic_y,ly);
+    for(int k=0;k<Nz;k++) zs[k]=transform(k*Dz,flip_z,periodic_z,lz);
+    
+    x_runs.assign(1,0);
+    
+    for(int i=1;i<Nx;i++)
+    {
+        int r0=x_runs.back();
+        
+        if(i-1>r0 && (xs[i]-xs[i-1])*(xs[r0+1]-xs[r0])<0) x_runs.push_back(i);
+    }
+    
+    x_runs.push_back(Nx);
+}
+
+
 double Structure::get_lx() const
 {
     return lx;
@@ -131,6 +1014,31 @@ double Structure::get_lz() const
 }
 
 
+/*
+ * State in which the Lua defined operations have to be evaluated: the one of
+ * the calling discretization worker, if any, else the main script state.
+ */
+
+lua_State* Structure::get_lua_state()
+{
+    if(thread_lua_state!=nullptr) return thread_lua_state;
+    
+    return L;
+}
+
+/*
+ * Whether the Lua defined operations can be evaluated on the copies of the
+ * script state, the first copy is made here if needed.
+ */
+
+bool Structure::lua_workers_available()
+{
+    if(worker_states.empty()) worker_states.push_back(create_worker_state());
+    
+    return lua_workers_copyable;
+}
+
+
 std::filesystem::path const& Structure::get_script_path() const
 {
     return script_path;
@@ -140,9 +1048,22 @@ std::filesystem::path const& Structure::get_script_path() const
 void Structure::finalize()
 {
     if(L!=nullptr) lua_close(L);
+    L=nullptr;
+    
+    for(lua_State *W : worker_states) lua_close(W);
+    worker_states.clear();
     
-    for(std::size_t i=0;i<operations.size();i++)
-        delete operations[i];
+    // The operations of the last discretization are kept for
+    // update_discretization()
+    
+    if(discretized_current)
+    {
+        for(Structure_OP *op : discretized_operations) delete op;
+        
+        discretized_operations=std::move(operations);
+        discretized_current=false;
+    }
+    else for(Structure_OP *op : operations) delete op;
     
     operations.clear();
     
@@ -163,21 +1084,33 @@ void Structure::finalize()
     lua_pushlightuserdata(L,reinterpret_cast<void*>(L));
     lua_setglobal(L,"lua_mother_state");
     
-    lua_register(L,"add_block",LuaUI::structure_add_block);
+    // Operations registered through record_operation() for their signature
+    
+    auto register_op=[&](char const *name,lua_CFunction function)
+    {
+        lua_pushcfunction(L,function);
+        lua_pushlightuserdata(L,reinterpret_cast<void*>(this));
+        lua_pushstring(L,name);
+        lua_pushcclosure(L,record_operation,3);
+        lua_setglobal(L,name);
+    };
+    
+    register_op("add_block",LuaUI::structure_add_block);
     lua_register(L,"default_material",LuaUI::structure_default_material);
-    lua_register(L,"add_coating",LuaUI::structure_add_coating);
-    lua_register(L,"add_cone",LuaUI::structure_add_cone);
-    lua_register(L,"add_conformal_coating",LuaUI::structure_add_conf_coating);
-    lua_register(L,"add_cylinder",LuaUI::structure_add_cylinder);
-    lua_register(L,"add_ellipsoid",LuaUI::structure_add_ellipsoid);
+    register_op("add_coating",LuaUI::structure_add_coating);
+    register_op("add_cone",LuaUI::structure_add_cone);
+    register_op("add_conformal_coating",LuaUI::structure_add_conf_coating);
+    register_op("add_cylinder",LuaUI::structure_add_cylinder);
+    register_op("add_ellipsoid",LuaUI::structure_add_ellipsoid);
 //    lua_register(L,"add_height_map",lop_add_height_map);
-    lua_register(L,"add_layer",LuaUI::structure_add_layer);
-    lua_register(L,"add_lua_def",LuaUI::structure_add_lua_def);
-    lua_register(L,"add_mesh",LuaUI::structure_add_mesh);
-    lua_register(L,"add_sin_layer",LuaUI::structure_add_sin_layer);
-    lua_register(L,"add_sphere",LuaUI::structure_add_sphere);
-    lua_register(L,"add_vect_block",LuaUI::structure_add_vect_block);
-    lua_register(L,"add_vect_tri",LuaUI::structure_add_vect_tri);
+    register_op("add_layer",LuaUI::structure_add_layer);
+    register_op("add_lua_batch_def",LuaUI::structure_add_lua_batch_def);
+    register_op("add_lua_def",LuaUI::structure_add_lua_def);
+    register_op("add_mesh",LuaUI::structure_add_mesh);
+    register_op("add_sin_layer",LuaUI::structure_add_sin_layer);
+    register_op("add_sphere",LuaUI::structure_add_sphere);
+    register_op("add_vect_block",LuaUI::structure_add_vect_block);
+    register_op("add_vect_tri",LuaUI::structure_add_vect_tri);
     lua_register(L,"declare_parameter",LuaUI::structure_declare_parameter);
     lua_register(L,"flip",LuaUI::structure_set_flip);
     lua_register(L,"loop",LuaUI::structure_set_loop);
@@ -220,6 +1153,129 @@ void Structure::finalize()
     }
 }
 
+
+/*
+ * Copy of the script state for a discretization worker. The script is not
+ * run again: the globals it left in the main state, that a fresh state does
+ * not have, are copied with the functions and their upvalues. Values drawn
+ * by the script, as with math.random or random_packing, are then the same on
+ * every worker. The operations are ignored.
+ * The Lua defined operations look their globals up by name, so that all the
+ * copied values are reachable from them: if one cannot be copied, as a file
+ * handle or a coroutine, lua_workers_copyable is cleared.
+ */
+
+lua_State* Structure::create_worker_state()
+{
+    lua_State *W=luaL_newstate();
+    luaL_openlibs(W);
+    
+    lua_pushlightuserdata(W,reinterpret_cast<void*>(this));
+    lua_setglobal(W,"lua_calling_class");
+    
+    lua_pushlightuserdata(W,reinterpret_cast<void*>(W));
+    lua_setglobal(W,"lua_mother_state");
+    
+    for(char const *name : {"add_block","default_material","add_coating","add_cone","add_conformal_coating",
+                            "add_cylinder","add_ellipsoid","add_layer","add_lua_batch_def","add_lua_def",
+                            "add_mesh","add_sin_layer","add_sphere","add_vect_block","add_vect_tri",
+                            "declare_parameter","flip","loop"})
+        lua_register(W,name,lua_ignore_operation);
+    
+    lua_workers_copyable=true;
+    
+    if(L==nullptr) return W;
+    
+    // Copies table, the main globals standing for the worker ones
+    
+    lua_newtable(W);
+    int copies=lua_gettop(W);
+    
+    lua_rawgeti(L,LUA_REGISTRYINDEX,LUA_RIDX_GLOBALS);
+    int globals=lua_gettop(L);
+    
+    lua_pushlightuserdata(W,const_cast<void*>(lua_topointer(L,globals)));
+    lua_rawgeti(W,LUA_REGISTRYINDEX,LUA_RIDX_GLOBALS);
+    lua_rawset(W,copies);
+    
+    lua_rawgeti(W,LUA_REGISTRYINDEX,LUA_RIDX_GLOBALS);
+    int worker_globals=lua_gettop(W);
+    
+    std::map<void*,std::pair<void*,int>> upvalues;
+    
+    lua_pushnil(L);
+    
+    while(lua_next(L,globals)!=0)
+    {
+        if(lua_type(L,-2)==LUA_TSTRING)
+        {
+            char const *name=lua_tostring(L,-2);
+            
+            if(lua_getfield(W,worker_globals,name)==LUA_TNIL)
+            {
+                lua_pop(W,1);
+                
+                if(!copy_lua_value(L,-1,W,copies,upvalues) && lua_workers_copyable)
+                {
+                    Plog::print(LogType::WARNING, "The global ", name, " cannot be copied to the discretization workers,",
+                                " the Lua defined operations will be evaluated on one thread\n");
+                    lua_workers_copyable=false;
+                }
+                
+                lua_setfield(W,worker_globals,name);
+            }
+            else lua_pop(W,1);
+        }
+        
+        lua_pop(L,1);
+    }
+    
+    lua_pop(L,1);
+    lua_settop(W,0);
+    
+    return W;
+}
+
+/*
+ * Wrapper of the Lua operations, the arguments of the call are written down
+ * as the signature of the operations it adds. Calls with arguments that
+ * cannot be written down, as functions or tables, get none and are always
+ * considered as new.
+ */
+
+int Structure::record_operation(lua_State *L)
+{
+    Structure *structure=reinterpret_cast<Structure*>(lua_touserdata(L,lua_upvalueindex(2)));
+    
+    std::stringstream strm;
+    strm<<std::setprecision(17)<<lua_tostring(L,lua_upvalueindex(3))<<"(";
+    
+    bool valid=true;
+    
+    for(int i=1;i<=lua_gettop(L);i++)
+    {
+        if(i>1) strm<<",";
+        
+        int type=lua_type(L,i);
+        
+             if(type==LUA_TNUMBER) strm<<lua_tonumber(L,i);
+        else if(type==LUA_TSTRING) strm<<"\""<<lua_tostring(L,i)<<"\"";
+        else if(type==LUA_TBOOLEAN) strm<<(lua_toboolean(L,i) ? "true" : "false");
+        else if(type==LUA_TNIL) strm<<"nil";
+        else valid=false;
+    }
+    
+    strm<<")";
+    
+    structure->pending_signature=valid ? strm.str() : "";
+    
+    int N_ret=lua_tocfunction(L,lua_upvalueindex(1))(L);
+    
+    structure->pending_signature.clear();
+    
+    return N_ret;
+}
+
 int Structure::index(double x,double y,double z)
 {
     return index(x,y,z,operations.size());
@@ -373,6 +1429,209 @@ void Structure::retrieve_nominal_size(double &lx_,double &ly_,double &lz_) const
     lz_=lz;
 }
 
+/*
+ * Smooths the staircase of the material interfaces. For the voxels with a
+ * different neighbour, the Yee cells of Ex, Ey and Ez, shifted by half a step
+ * along their component from the node, are each sampled Nsub^3 times with
+ * index(). The voxels whose three cells hold exactly two smoothable materials
+ * get the index of a Subpixel_Mix, numbered past the materials and the grid.
+ * The fill fractions are exact to 1/Nsub^3, and in each cell the normal points
+ * to the centroid of the mat_1 samples, with the squared component along the
+ * field rounded to eighths so that the voxels can share their mixes.
+ */
+
+void Structure::subpixel_smoothing(Grid3<unsigned int> &matgrid,std::vector<Subpixel_Mix> &mixes,
+                                   std::vector<bool> const &smoothable,
+                                   double Dx,double Dy,double Dz,int Nsub)
+{
+    mixes.clear();
+    
+    int Nx=matgrid.L1();
+    int Ny=matgrid.L2();
+    int Nz=matgrid.L3();
+    
+    if(Nsub<2 || Nx*Ny*Nz==0) return;
+    
+    unsigned int first_index=std::max<unsigned int>(smoothable.size(),matgrid.max()+1);
+    
+    bool parallel=true;
+    bool lua_ops=false;
+    bool grid_ops=false;
+    
+    for(Structure_OP *op : operations)
+    {
+        if(!op->thread_safe()) parallel=false;
+        if(op->on_grid()) grid_ops=true;
+        if(dynamic_cast<Add_Lua_Def*>(op)!=nullptr) lua_ops=true;
+    }
+    
+    int Nthr=parallel ? std::min(max_threads_number(),Nz) : 1;
+    
+    if(lua_ops)
+    {
+        while(static_cast<int>(worker_states.size())<Nthr-1)
+            worker_states.push_back(create_worker_state());
+    }
+    
+    auto is_smoothable=[&](int M)
+    {
+        return M>=0 && M<static_cast<int>(smoothable.size()) && smoothable[M];
+    };
+    
+    auto neighbour=[](int i,int N,bool periodic)
+    {
+        if(periodic) return (i+N)%N;
+        else return std::clamp(i,0,N-1);
+    };
+    
+    int Nq=8;
+    int Ns3=Nsub*Nsub*Nsub;
+    
+    // Materials, then fill count of the first one and rounded normal
+    // component of the Ex, Ey and Ez cells, per xy plane
+    
+    typedef std::array<int,8> Mix_Key;
+    
+    std::vector<std::vector<std::pair<int,Mix_Key>>> plane_mixes(Nz);
+    
+    std::atomic<int> next_k(0);
+    
+    auto worker=[&](int t)
+    {
+        int k;
+        
+        if(lua_ops && t>0) thread_lua_state=worker_states[t-1];
+        
+        while((k=next_k++)<Nz)
+        {
+            for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+            {
+                int M=matgrid(i,j,k);
+                
+                bool interface=false;
+                
+                for(int d=-1;d<=1;d+=2)
+                {
+                    if(   static_cast<int>(matgrid(neighbour(i+d,Nx,periodic_x),j,k))!=M
+                       || static_cast<int>(matgrid(i,neighbour(j+d,Ny,periodic_y),k))!=M
+                       || static_cast<int>(matgrid(i,j,neighbour(k+d,Nz,periodic_z)))!=M) interface=true;
+                }
+                
+                if(!interface || !is_smoothable(M)) continue;
+                
+                // The solvers extend the outer voxels into their padding, but
+                // a single voxel along an axis means no variation along it
+                
+                if(   (!periodic_x && Nx>1 && (i==0 || i==Nx-1))
+                   || (!periodic_y && Ny>1 && (j==0 || j==Ny-1))
+                   || (!periodic_z && Nz>1 && (k==0 || k==Nz-1))) continue;
+                
+                // Painted by an operation on the grid, unknown to index()
+                
+                if(grid_ops && index(i*Dx,j*Dy,k*Dz)!=M) continue;
+                
+                int M2=-1;
+                int N_M[3]={0,0,0};
+                double n2[3]={0,0,0};
+                bool two_materials=true;
+                
+                for(int dir=0;dir<3 && two_materials;dir++)
+                {
+                    // Yee cell of the E component along dir
+                    
+                    double x0=(i+0.5*(dir==0))*Dx;
+                    double y0=(j+0.5*(dir==1))*Dy;
+                    double z0=(k+0.5*(dir==2))*Dz;
+                    
+                    double g[3]={0,0,0};
+                    
+                    for(int c=0;c<Nsub;c++)
+                    for(int b=0;b<Nsub;b++)
+                    for(int a=0;a<Nsub;a++)
+                    {
+                        double u=((a+0.5)/Nsub-0.5)*Dx;
+                        double v=((b+0.5)/Nsub-0.5)*Dy;
+                        double w=((c+0.5)/Nsub-0.5)*Dz;
+                        
+                        int S=index(x0+u,y0+v,z0+w);
+                        
+                        if(S==M)
+                        {
+                            N_M[dir]++;
+                            g[0]+=u; g[1]+=v; g[2]+=w;
+                        }
+                        else if(M2==-1 || S==M2) M2=S;
+                        else two_materials=false;
+                    }
+                    
+                    double g2=g[0]*g[0]+g[1]*g[1]+g[2]*g[2];
+                    
+                    // Interface through the middle of the cell, no preferred
+                    // direction
+                    
+                    if(g2>0) n2[dir]=g[dir]*g[dir]/g2;
+                    else if(N_M[dir]>0 && N_M[dir]<Ns3) n2[dir]=1.0/3.0;
+                }
+                
+                if(!two_materials || M2==-1 || !is_smoothable(M2)) continue;
+                
+                Mix_Key key;
+                
+                key[0]=std::min(M,M2);
+                key[1]=std::max(M,M2);
+                
+                for(int dir=0;dir<3;dir++)
+                {
+                    key[2+2*dir]=M<M2 ? N_M[dir] : Ns3-N_M[dir];
+                    key[3+2*dir]=nearest_integer(Nq*n2[dir]);
+                }
+                
+                plane_mixes[k].push_back(std::make_pair(i+j*Nx,key));
+            }
+        }
+        
+        thread_lua_state=nullptr;
+    };
+    
+    run_threads(Nthr,worker);
+    
+    // Numbered in grid order, whatever the threads
+    
+    std::map<Mix_Key,unsigned int> mix_index;
+    std::size_t N_voxels=0;
+    
+    for(int k=0;k<Nz;k++)
+    {
+        for(auto const &[n,key] : plane_mixes[k])
+        {
+            auto it=mix_index.find(key);
+            
+            if(it==mix_index.end())
+            {
+                Subpixel_Mix mix;
+                
+                mix.index=first_index+mixes.size();
+                mix.mat_1=key[0];
+                mix.mat_2=key[1];
+                
+                for(int dir=0;dir<3;dir++)
+                {
+                    mix.fill[dir]=key[2+2*dir]/static_cast<double>(Ns3);
+                    mix.n2[dir]=key[3+2*dir]/static_cast<double>(Nq);
+                }
+                
+                it=mix_index.emplace(key,mix.index).first;
+                mixes.push_back(mix);
+            }
+            
+            matgrid(n%Nx,n/Nx,k)=it->second;
+            N_voxels++;
+        }
+    }
+    
+    Plog::print("Subpixel smoothing: ", N_voxels, " voxels, ", mixes.size(), " mixes\n");
+}
+
 void Structure::voxelize(double Dx,double Dy,double Dz)
 {
     finalize();
@@ -22,16 +22,28 @@ limitations under the License.*/
 #include <Eigen/Eigen>
 
 #include <filesystem>
+#include <mutex>
 #include <vector>
 
 class Structure;
 
+// Spans of an operation along an x line, see Structure_OP::x_span
+
+enum
+{
+    SPAN_NONE,      // the line misses the operation
+    SPAN_INTERVAL,  // the operation covers a single interval of the line
+    SPAN_VOXELS,    // to be evaluated voxel by voxel within the interval
+    SPAN_CROSSINGS  // inside between pairs of crossings, see x_crossings
+};
+
 class Structure_OP
 {
     public:
         double x1,x2,y1,y2,z1,z2,r;
         int mat_index,stack_ID;
         Structure *parent;
+        std::string signature; // call that created it, see Structure::update_discretization
         
         Structure_OP(double x1,double x2,
                      double y1,double y2,
@@ -39,7 +51,14 @@ class Structure_OP
         virtual ~Structure_OP();
         
         virtual int index(double x,double y,double z);
+        virtual void index_batch(std::vector<double> const &x,double y,double z,std::vector<int> &indices);
+        virtual bool on_grid() const;
+        virtual void paint_grid(Grid3<unsigned int> &matgrid,double Dx,double Dy,double Dz);
+        virtual bool grid_reach(double Dx,double Dy,double Dz,double &reach) const;
         virtual void precompute();
+        virtual bool thread_safe() const;
+        virtual int x_span(double y,double z,double &xa,double &xb);
+        virtual void x_crossings(double y,double z,std::vector<double> &crossings);
 };
 
 class Add_Block: public Structure_OP
@@ -50,6 +69,7 @@ class Add_Block: public Structure_OP
                   double z1,double z2,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
 };
 
 class Add_Coating: public Structure_OP
@@ -76,6 +96,7 @@ class Add_Cone: public Structure_OP
                  double r,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
 };
 
 
@@ -88,7 +109,9 @@ class Add_Conf_Coating: public Structure_OP
                          int index);
 
         int index(double x, double y, double z) override;
-        void precompute() override;
+        bool on_grid() const override;
+        void paint_grid(Grid3<unsigned int> &matgrid,double Dx,double Dy,double Dz) override;
+        bool grid_reach(double Dx,double Dy,double Dz,double &reach) const override;
 
     private:
         struct Seed
@@ -126,8 +149,9 @@ class Add_Conf_Coating: public Structure_OP
 
         std::vector<Seed> seeds;
         Octree octree;
+        std::once_flag seeds_flag;
 
-        std::vector<int> buffer;
+        void generate_seeds();
 };
 
 
@@ -142,6 +166,7 @@ class Add_Cylinder: public Structure_OP
                      double r,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
 };
 
 class Add_Ellipsoid: public Structure_OP
@@ -152,6 +177,7 @@ class Add_Ellipsoid: public Structure_OP
                       double rx,double ry,double rz,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
 };
 
 class Add_Layer: public Structure_OP
@@ -162,6 +188,7 @@ class Add_Layer: public Structure_OP
         Add_Layer(int type,double z1,double z2,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
 };
 
 class Add_Lua_Def: public Structure_OP
@@ -170,13 +197,16 @@ class Add_Lua_Def: public Structure_OP
         lua_State *L;
         std::string fname;
         std::vector<lua_tools::lua_type*> parameters;
+        bool batch;
         
         Add_Lua_Def(lua_State *L,
                     std::string const &fname,
                     std::vector<lua_tools::lua_type*> const &parameters,
-                    int mat_index);
+                    int mat_index,bool batch=false);
         
         int index(double x,double y,double z);
+        void index_batch(std::vector<double> const &x,double y,double z,std::vector<int> &indices);
+        bool thread_safe() const;
 };
 
 class Add_Mesh: public Structure_OP
@@ -196,6 +226,15 @@ class Add_Mesh: public Structure_OP
                  std::filesystem::path fname,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
+        void x_crossings(double y,double z,std::vector<double> &crossings);
+        
+    private:
+        int Nbin_y,Nbin_z;
+        std::vector<std::vector<int>> face_bins;
+        
+        void bin_faces();
+        double edge_function(int Va,int Vb,double y,double z);
 };
 
 class Add_Sin_Layer: public Structure_OP
@@ -218,6 +257,7 @@ class Add_Sphere: public Structure_OP
         Add_Sphere(double x1,double y1,double z1,double r,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
 };
 
 class Add_Vect_Block: public Structure_OP
@@ -242,6 +282,7 @@ class Add_Vect_Block: public Structure_OP
         void get_abc(double &a,double &b,double &c,
                      double x,double y,double z);
         virtual int index(double x,double y,double z);
+        virtual int x_span(double y,double z,double &xa,double &xb);
 };
 
 class Add_Vect_Tri: public Add_Vect_Block
@@ -256,6 +297,20 @@ class Add_Vect_Tri: public Add_Vect_Block
                      double alp,int mat_index);
         
         int index(double x,double y,double z);
+        int x_span(double y,double z,double &xa,double &xb);
+};
+
+// Voxel shared by two materials, see Structure::subpixel_smoothing
+
+class Subpixel_Mix
+{
+    public:
+        unsigned int index;         // material index given to the voxels
+        unsigned int mat_1,mat_2;
+        double fill[3];             // volume fraction of mat_1 in the cell of Ex, Ey and Ez
+        double n2[3];               // squared normal component along each field, in its cell
+        
+        Imdouble effective_eps(Imdouble eps_1,Imdouble eps_2,int dir) const;
 };
 
 class Structure
@@ -266,8 +321,11 @@ class Structure
         
         Structure();
         Structure(std::filesystem::path const &script_path);
+        Structure(Structure const&)=delete;
         ~Structure();
         
+        void operator = (Structure const&)=delete;
+        
         void add_operation(Structure_OP *operation);
         void discretize(Grid3<unsigned int> &matgrid,
                         int Nx,int Ny,int Nz,double Dx,double Dy,double Dz);
@@ -275,28 +333,61 @@ class Structure
         double get_lx() const;
         double get_ly() const;
         double get_lz() const;
+        lua_State* get_lua_state();
+        bool lua_workers_available();
         std::filesystem::path const& get_script_path() const;
         int index(double x,double y,double z);
         int index(double x,double y,double z,int restrict_level);
         void print(std::filesystem::path const &path_,double Dx,double Dy,double Dz);
         void set_default_material(int mat);
         void set_flip(int x,int y,int z);
+        void get_loop(bool &x,bool &y,bool &z) const;
         void set_loop(int x,int y,int z);
         void set_script(std::filesystem::path const &script_path);
         void retrieve_nominal_size(double &lx,double &ly,double &lz) const;
+        void subpixel_smoothing(Grid3<unsigned int> &matgrid,std::vector<Subpixel_Mix> &mixes,
+                                std::vector<bool> const &smoothable,
+                                double Dx,double Dy,double Dz,int Nsub=4);
+        bool update_discretization(Grid3<unsigned int> &matgrid,std::vector<int> &changed,
+                                   int Nx,int Ny,int Nz,double Dx,double Dy,double Dz);
         void voxelize(double Dx,double Dy,double Dz);
 
     private:
+        lua_State* create_worker_state();
+        void discretize_stack(Grid3<unsigned int> &matgrid,
+                              int Nx,int Ny,int Nz,double Dx,double Dy,double Dz,
+                              std::vector<Grid3<unsigned int>> *stages);
+        std::vector<double> discretization_key(int Nx,int Ny,int Nz,double Dx,double Dy,double Dz) const;
+        void discretize_row(std::vector<int> &row,std::size_t l1,std::size_t l2,
+                            std::vector<double> const &xs,
+                            std::vector<int> const &x_runs,
+                            double y,double z);
+        void grid_coordinates(int Nx,int Ny,int Nz,double Dx,double Dy,double Dz,
+                              std::vector<double> &xs,std::vector<double> &ys,std::vector<double> &zs,
+                              std::vector<int> &x_runs) const;
+        static int record_operation(lua_State *L);
+
         int default_material;
         double lx,ly,lz;
         bool flip_x,flip_y,flip_z;
         bool periodic_x,periodic_y,periodic_z;
 
         lua_State *L;
+        std::vector<lua_State*> worker_states;
+        bool lua_workers_copyable;
         std::string script_content;
         std::filesystem::path script_path;
         
         std::vector<Structure_OP*> operations;
+        
+        // Last discretization, for update_discretization()
+        
+        std::string pending_signature;
+        std::vector<double> discretized_key;
+        std::vector<Structure_OP*> discretized_operations;
+        Grid3<unsigned int> discretized_grid;
+        std::vector<Grid3<unsigned int>> discretized_stages; // grid before each whole grid operation
+        bool discretized_current;
 };
 
 #endif // STRUCTURE_H_INCLUDED
@@ -14,8 +14,178 @@ limitations under the License.*/
 
 #include <mesh_tools.h>
 #include <structure.h>
+#include <thread_utils.h>
 
+#include <array>
+#include <set>
 
+namespace
+{
+    /*
+     * Felzenszwalb-Huttenlocher lower envelope: d[p]=min_q h2*(p-q)^2+f[q],
+     * in linear time. Infinite f are not features. With periodic, the line
+     * is seen through its two neighbouring images.
+     */
+    
+    void distance_transform(std::vector<double> const &f,std::vector<double> &d,double h2,bool periodic)
+    {
+        double const inf=std::numeric_limits<double>::infinity();
+        
+        int N=f.size();
+        int N_ext=periodic ? 3*N : N;
+        int offset=periodic ? N : 0;
+        
+        auto f_ext=[&](int q) { return f[q%N]; };
+        
+        thread_local std::vector<int> v;
+        thread_local std::vector<double> zb;
+        
+        v.resize(N_ext);
+        zb.resize(N_ext+1);
+        
+        int k=-1;
+        
+        for(int q=0;q<N_ext;q++)
+        {
+            if(f_ext(q)==inf) continue;
+            
+            double s=-inf;
+            
+            while(k>=0)
+            {
+                int r=v[k];
+                
+                s=((f_ext(q)+h2*q*q)-(f_ext(r)+h2*r*r))/(2.0*h2*(q-r));
+                
+                if(s>zb[k]) break;
+                
+                k--;
+            }
+            
+            if(k<0) s=-inf;
+            
+            k++;
+            v[k]=q;
+            zb[k]=s;
+            zb[k+1]=inf;
+        }
+        
+        d.resize(N);
+        
+        if(k<0)
+        {
+            std::fill(d.begin(),d.end(),inf);
+            return;
+        }
+        
+        k=0;
+        
+        for(int p=0;p<N;p++)
+        {
+            int q=p+offset;
+            
+            while(zb[k+1]<q) k++;
+            
+            d[p]=h2*(q-v[k])*(q-v[k])+f_ext(v[k]);
+        }
+    }
+
+    // Restricts [xa,xb] to the x where lo <= g*x+h <= hi
+    
+    bool linear_span(double g,double h,double lo,double hi,double &xa,double &xb)
+    {
+        if(g==0) return h>=lo && h<=hi && xa<=xb;
+        
+        double u=(lo-h)/g;
+        double v=(hi-h)/g;
+        
+        if(u>v) std::swap(u,v);
+        
+        xa=std::max(xa,u);
+        xb=std::min(xb,v);
+        
+        return xa<=xb;
+    }
+    
+    // Restricts [xa,xb] to the hull of the x where A*x^2+B*x+C <= 0
+    
+    bool quadratic_span(double A,double B,double C,double &xa,double &xb)
+    {
+        if(A==0) return linear_span(B,C,-std::numeric_limits<double>::max(),0,xa,xb);
+        
+        double D=B*B-4.0*A*C;
+        
+        if(D<0)
+        {
+            if(A<0) return xa<=xb;
+            
+            // Near tangency, left to the caller's check of the nodes
+            
+            D=0;
+        }
+        
+        double q=-0.5*(B+std::copysign(std::sqrt(D),B));
+        double u=q/A;
+        double v=q!=0 ? C/q : u;
+        
+        if(u>v) std::swap(u,v);
+        
+        if(A>0)
+        {
+            if(u>xb || v<xa) return false;
+            
+            xa=std::max(xa,u);
+            xb=std::min(xb,v);
+        }
+        else
+        {
+            // Outside of the roots, the hull is only reduced by the side
+            // that misses [xa,xb]
+            
+                 if(xa>u && xb<v) xa=xb=(v-xb<xa-u) ? v : u;
+            else if(xa>u) xa=std::max(xa,v);
+            else if(xb<v) xb=std::min(xb,u);
+        }
+        
+        return xa<=xb;
+    }
+    
+    // Span of the revolution shape of axis (x1,y1,z1)+t*base_vec, 0<=t<=length,
+    // and of radius r+slope*t
+    
+    bool axis_span(double x1,double y1,double z1,Vector3 const &base_vec,double length,
+                   double r,double slope,double y,double z,double &xa,double &xb)
+    {
+        double dy=y-y1;
+        double dz=z-z1;
+        
+        // Projection on the axis: px*x'+p0, with x'=x-x1
+        
+        double px=base_vec.x;
+        double p0=base_vec.y*dy+base_vec.z*dz;
+        
+        xa-=x1;
+        xb-=x1;
+        
+        if(!linear_span(px,p0,0,length,xa,xb)) return false;
+        
+        // Squared radius against the squared distance to the axis
+        
+        double a=r;
+        double b=slope;
+        
+        double A=1.0-px*px-b*b*px*px;
+        double B=-2.0*px*p0-2.0*(a+b*p0)*b*px;
+        double C=dy*dy+dz*dz-p0*p0-(a+b*p0)*(a+b*p0);
+        
+        if(!quadratic_span(A,B,C,xa,xb)) return false;
+        
+        xa+=x1;
+        xb+=x1;
+        
+        return true;
+    }
+}
 
 //###############
 //   Add_Block
@@ -38,6 +208,16 @@ int Add_Block::index(double x,double y,double z)
     return mat_index;
 }
 
+int Add_Block::x_span(double y,double z,double &xa,double &xb)
+{
+    if(y<y1 || y>=y2 || z<z1 || z>=z2) return SPAN_NONE;
+    
+    xa=x1;
+    xb=x2;
+    
+    return SPAN_INTERVAL;
+}
+
 //#################
 //   Add_Coating
 //#################
@@ -133,6 +313,19 @@ int Add_Cone::index(double x,double y,double z)
     return -1;
 }
 
+int Add_Cone::x_span(double y,double z,double &xa,double &xb)
+{
+    if(y<std::min(y1,y2)-r || y>std::max(y1,y2)+r ||
+       z<std::min(z1,z2)-r || z>std::max(z1,z2)+r) return SPAN_NONE;
+    
+    xa=std::min(x1,x2)-r;
+    xb=std::max(x1,x2)+r;
+    
+    if(!axis_span(x1,y1,z1,base_vec,length,r,-r/length,y,z,xa,xb)) return SPAN_NONE;
+    
+    return SPAN_INTERVAL;
+}
+
 //######################
 //   Add_Conf_Coating
 //######################
@@ -157,6 +350,10 @@ int Add_Conf_Coating::index(double x, double y, double z)
 {
     if(parent->index(x,y,z,stack_ID) != origin_mat) return -1;
 
+    std::call_once(seeds_flag, &Add_Conf_Coating::generate_seeds, this);
+
+    thread_local std::vector<int> buffer;
+
     octree.point_check(buffer, x, y, z);
 
     for(int i : buffer)
@@ -179,7 +376,10 @@ int Add_Conf_Coating::index(double x, double y, double z)
 }
 
 
-void Add_Conf_Coating::precompute()
+// Seeds for the point by point evaluation, only built when index() is
+// called outside of the discretization
+
+void Add_Conf_Coating::generate_seeds()
 {
     double lx = parent->get_lx();
     double ly = parent->get_ly();
@@ -190,55 +390,33 @@ void Add_Conf_Coating::precompute()
     int Nz = static_cast<int>(lz/delta);
 
     seeds.clear();
-    seeds.reserve(Nx*Ny);
+
+    // Lattice nodes already seeded
+
+    std::set<std::array<int,3>> seeded;
 
     for(int i=0; i<Nx; i++)
     for(int j=0; j<Ny; j++)
     for(int k=0; k<Nz; k++)
     {
-        double x = i*delta;
-        double y = j*delta;
-        double z = k*delta;
-
-        if(parent->index(x, y, z, stack_ID) != origin_mat)
+        if(parent->index(i*delta, j*delta, k*delta, stack_ID) != origin_mat)
         {
             continue;
         }
-        
-        if(   parent->index(x-delta, y, z, stack_ID) != origin_mat
-           && !vector_contains(seeds, {x-delta, y, z}))
-        {
-            seeds.push_back({x-delta, y, z});
-        }
-
-        if(   parent->index(x+delta, y, z, stack_ID) != origin_mat
-           && !vector_contains(seeds, {x+delta, y, z}))
-        {
-            seeds.push_back({x+delta, y, z});
-        }
-
-        if(   parent->index(x, y-delta, z, stack_ID) != origin_mat
-           && !vector_contains(seeds, {x, y-delta, z}))
-        {
-            seeds.push_back({x, y-delta, z});
-        }
-
-        if(   parent->index(x, y+delta, z, stack_ID) != origin_mat
-           && !vector_contains(seeds, {x, y+delta, z}))
-        {
-            seeds.push_back({x, y+delta, z});
-        }
 
-        if(   parent->index(x, y, z-delta, stack_ID) != origin_mat
-           && !vector_contains(seeds, {x, y, z-delta}))
+        for(std::array<int,3> const &n : {std::array<int,3>{i-1, j, k}, std::array<int,3>{i+1, j, k},
+                                         std::array<int,3>{i, j-1, k}, std::array<int,3>{i, j+1, k},
+                                         std::array<int,3>{i, j, k-1}, std::array<int,3>{i, j, k+1}})
         {
-            seeds.push_back({x, y, z-delta});
-        }
-
-        if(   parent->index(x, y, z+delta, stack_ID) != origin_mat
-           && !vector_contains(seeds, {x, y, z+delta}))
-        {
-            seeds.push_back({x, y, z+delta});
+            double x = n[0]*delta;
+            double y = n[1]*delta;
+            double z = n[2]*delta;
+
+            if(   parent->index(x, y, z, stack_ID) != origin_mat
+               && seeded.insert(n).second)
+            {
+                seeds.push_back({x, y, z});
+            }
         }
     }
 
@@ -248,6 +426,124 @@ void Add_Conf_Coating::precompute()
     octree.generate_tree(seeds, rule);
 }
 
+
+bool Add_Conf_Coating::on_grid() const
+{
+    return true;
+}
+
+
+// paint_grid() only reads the grid within thickness of a node, the seeds
+// being nodes of the grid
+
+bool Add_Conf_Coating::grid_reach(double Dx, double Dy, double Dz, double &reach) const
+{
+    reach = thickness;
+
+    return true;
+}
+
+
+/*
+ * The nodes of origin_mat closer than thickness to a seed, a node of another
+ * material next to a node of origin_mat, the distances coming from an exact
+ * Euclidean distance transform of the grid, whatever its steps. Out of the
+ * non periodic sides, the grid is extended by one node of the stack below.
+ * The seeds are the nodes of the grid and not of the delta lattice of
+ * index(), both only match when the steps are delta.
+ */
+
+void Add_Conf_Coating::paint_grid(Grid3<unsigned int> &matgrid, double Dx, double Dy, double Dz)
+{
+    int Nx = matgrid.L1();
+    int Ny = matgrid.L2();
+    int Nz = matgrid.L3();
+
+    unsigned int const origin = origin_mat;
+
+    bool periodic_x, periodic_y, periodic_z;
+    parent->get_loop(periodic_x, periodic_y, periodic_z);
+
+    // Padded grid, shifted by one node on the non periodic axes
+
+    int ox = !periodic_x;
+    int oy = !periodic_y;
+    int oz = !periodic_z;
+
+    int Px = Nx+2*ox;
+    int Py = Ny+2*oy;
+    int Pz = Nz+2*oz;
+
+    double const inf = std::numeric_limits<double>::infinity();
+
+    auto feature = [&](int i, int j, int k)
+    {
+        int N_out = (i < 0 || i >= Nx) + (j < 0 || j >= Ny) + (k < 0 || k >= Nz);
+
+        if(N_out == 0) return matgrid(i,j,k) != origin;
+
+        // Only the faces of the padding are next to the grid
+
+        return    N_out == 1
+               && parent->index(i*Dx, j*Dy, k*Dz, stack_ID) != static_cast<int>(origin);
+    };
+
+    Grid3<double> d2(Px, Py, Pz, 0);
+
+    // Squared distances along x, then y, then z
+
+    parallel_for(Py*Pz, [&](int n)
+    {
+        int j = n%Py;
+        int k = n/Py;
+
+        thread_local std::vector<double> f, d;
+        f.resize(Px);
+
+        for(int i=0; i<Px; i++) f[i] = feature(i-ox, j-oy, k-oz) ? 0 : inf;
+
+        distance_transform(f, d, Dx*Dx, periodic_x);
+
+        for(int i=0; i<Px; i++) d2(i,j,k) = d[i];
+    });
+
+    parallel_for(Px*Pz, [&](int n)
+    {
+        int i = n%Px;
+        int k = n/Px;
+
+        thread_local std::vector<double> f, d;
+        f.resize(Py);
+
+        for(int j=0; j<Py; j++) f[j] = d2(i,j,k);
+
+        distance_transform(f, d, Dy*Dy, periodic_y);
+
+        for(int j=0; j<Py; j++) d2(i,j,k) = d[j];
+    });
+
+    parallel_for(Nx*Ny, [&](int n)
+    {
+        int i = n%Nx;
+        int j = n/Nx;
+
+        thread_local std::vector<double> f, d;
+        f.resize(Pz);
+
+        for(int k=0; k<Pz; k++) f[k] = d2(i+ox,j+oy,k);
+
+        distance_transform(f, d, Dz*Dz, periodic_z);
+
+        for(int k=0; k<Nz; k++)
+        {
+            if(matgrid(i,j,k) == origin && d[k+oz] < thickness*thickness)
+            {
+                matgrid(i,j,k) = mat_index;
+            }
+        }
+    });
+}
+
 //##################
 //   Add_Cylinder
 //##################
@@ -284,6 +580,19 @@ int Add_Cylinder::index(double x,double y,double z)
     return -1;
 }
 
+int Add_Cylinder::x_span(double y,double z,double &xa,double &xb)
+{
+    if(y<std::min(y1,y2)-r || y>std::max(y1,y2)+r ||
+       z<std::min(z1,z2)-r || z>std::max(z1,z2)+r) return SPAN_NONE;
+    
+    xa=std::min(x1,x2)-r;
+    xb=std::max(x1,x2)+r;
+    
+    if(!axis_span(x1,y1,z1,base_vec,length,r,0,y,z,xa,xb)) return SPAN_NONE;
+    
+    return SPAN_INTERVAL;
+}
+
 //###################
 //   Add_Ellipsoid
 //###################
@@ -310,6 +619,24 @@ int Add_Ellipsoid::index(double x,double y,double z)
     return -1;
 }
 
+int Add_Ellipsoid::x_span(double y,double z,double &xa,double &xb)
+{
+    if(y<y1-ry || y>y1+ry ||
+       z<z1-rz || z>z1+rz) return SPAN_NONE;
+    
+    y=(y-y1)/ry;
+    z=(z-z1)/rz;
+    
+    double t=1.0-y*y-z*z;
+    
+    if(t<0) return SPAN_NONE;
+    
+    xa=x1-rx*std::sqrt(t);
+    xb=x1+rx*std::sqrt(t);
+    
+    return SPAN_INTERVAL;
+}
+
 //###############
 //   Add_Layer
 //###############
@@ -338,6 +665,28 @@ int Add_Layer::index(double x,double y,double z)
     return -1;
 }
 
+int Add_Layer::x_span(double y,double z,double &xa,double &xb)
+{
+    xa=-std::numeric_limits<double>::max();
+    xb=std::numeric_limits<double>::max();
+    
+    switch(type)
+    {
+        case 0:
+            xa=z1;
+            xb=z2;
+            break;
+        case 1:
+            if(y<z1 || y>=z2) return SPAN_NONE;
+            break;
+        case 2:
+            if(z<z1 || z>=z2) return SPAN_NONE;
+            break;
+    }
+    
+    return SPAN_INTERVAL;
+}
+
 //####################
 //   Add_Lua_Def
 //####################
@@ -345,50 +694,107 @@ int Add_Layer::index(double x,double y,double z)
 Add_Lua_Def::Add_Lua_Def(lua_State *L_,
                          std::string const &fname_,
                          std::vector<lua_tools::lua_type*> const &parameters_,
-                         int mat_index_)
+                         int mat_index_,bool batch_)
     :Structure_OP(0,0,0,0,0,0,mat_index_),
      L(L_),
      fname(fname_),
-     parameters(parameters_)
+     parameters(parameters_),
+     batch(batch_)
 {
 }
 
 int Add_Lua_Def::index(double x,double y,double z)
 {
+    thread_local std::vector<double> x_arr(1);
+    thread_local std::vector<int> indices;
+    
+    x_arr[0]=x;
+    index_batch(x_arr,y,z,indices);
+    
+    return indices[0];
+}
+
+void Add_Lua_Def::index_batch(std::vector<double> const &x,double y,double z,std::vector<int> &indices)
+{
+    lua_State *L_local=(parent!=nullptr) ? parent->get_lua_state() : L;
+    
     int Narg=parameters.size();
+    std::size_t N=x.size();
+    
+    indices.assign(N,-1);
     
-    lua_getglobal(L,fname.c_str());
+    lua_getglobal(L_local,fname.c_str());
     
-    if(lua_isnil(L,-1))
+    if(lua_isnil(L_local,-1))
     {
         Plog::print("Error, unknown function: ", fname, "\n");
         Plog::print("Ignoring operation", "\n");
         
-        return -1;
+        lua_pop(L_local,1);
+        return;
     }
     
-    lua_pushvalue(L,-1);
-    lua_pushnumber(L,x);
-    lua_pushnumber(L,y);
-    lua_pushnumber(L,z);
-    
-    for(int l=0;l<Narg;l++)
-        parameters[l]->push_value(L);
-    
-    lua_call(L,3+Narg,1);
-    
-    if(lua_tointeger(L,-1))
+    if(batch)
     {
-        lua_pop(L,2);
-        return mat_index;
+        lua_pushvalue(L_local,-1);
+        
+        lua_createtable(L_local,N,0);
+        
+        for(std::size_t i=0;i<N;i++)
+        {
+            lua_pushnumber(L_local,x[i]);
+            lua_rawseti(L_local,-2,i+1);
+        }
+        
+        lua_pushnumber(L_local,y);
+        lua_pushnumber(L_local,z);
+        
+        for(int l=0;l<Narg;l++)
+            parameters[l]->push_value(L_local);
+        
+        lua_call(L_local,3+Narg,1);
+        
+        for(std::size_t i=0;i<N;i++)
+        {
+            lua_rawgeti(L_local,-1,i+1);
+            if(lua_tointeger(L_local,-1)) indices[i]=mat_index;
+            lua_pop(L_local,1);
+        }
+        
+        lua_pop(L_local,2);
     }
     else
     {
-        lua_pop(L,2);
-        return -1;
+        // The function is looked up once for the whole batch
+        
+        for(std::size_t i=0;i<N;i++)
+        {
+            lua_pushvalue(L_local,-1);
+            lua_pushnumber(L_local,x[i]);
+            lua_pushnumber(L_local,y);
+            lua_pushnumber(L_local,z);
+            
+            for(int l=0;l<Narg;l++)
+                parameters[l]->push_value(L_local);
+            
+            lua_call(L_local,3+Narg,1);
+            
+            if(lua_tointeger(L_local,-1)) indices[i]=mat_index;
+            lua_pop(L_local,1);
+        }
+        
+        lua_pop(L_local,1);
     }
 }
 
+// The discretization workers have their own copy of the script state, if
+// everything it holds can be copied
+
+bool Add_Lua_Def::thread_safe() const
+{
+    return parent!=nullptr && parent->lua_workers_available();
+}
+
 //##############
 //   Add_Mesh
 //##############
@@ -406,14 +812,15 @@ Add_Mesh::Add_Mesh(double x1_,double y1_,double z1_,
         std::exit(EXIT_FAILURE);
     }
     
+    for(unsigned int i=0;i<V_arr.size();i++)
+        V_arr[i].loc*=scale;
+    
     x_min=x_max=V_arr[0].loc.x;
     y_min=y_max=V_arr[0].loc.y;
     z_min=z_max=V_arr[0].loc.z;
     
     for(unsigned int i=0;i<V_arr.size();i++)
     {
-        V_arr[i].loc*=scale;
-    
         x_min=std::min(x_min,V_arr[i].loc.x);
         x_max=std::max(x_max,V_arr[i].loc.x);
         
@@ -423,6 +830,55 @@ Add_Mesh::Add_Mesh(double x1_,double y1_,double z1_,
         z_min=std::min(z_min,V_arr[i].loc.z);
         z_max=std::max(z_max,V_arr[i].loc.z);
     }
+    
+    bin_faces();
+}
+
+// Faces sorted on a (y,z) grid by bounding box, so that a line along x
+// only visits the faces of its cell
+
+void Add_Mesh::bin_faces()
+{
+    int Nbins=std::max(1,static_cast<int>(std::sqrt(F_arr.size())));
+    
+    Nbin_y=Nbin_z=Nbins;
+    face_bins.assign(Nbin_y*Nbin_z,std::vector<int>());
+    
+    auto bin=[](double u,double u_min,double u_max,int N)
+    {
+        if(u_max<=u_min) return 0;
+        
+        return std::clamp(static_cast<int>((u-u_min)/(u_max-u_min)*N),0,N-1);
+    };
+    
+    for(std::size_t f=0;f<F_arr.size();f++)
+    {
+        Vector3 const &A=V_arr[F_arr[f].V1].loc;
+        Vector3 const &B=V_arr[F_arr[f].V2].loc;
+        Vector3 const &C=V_arr[F_arr[f].V3].loc;
+        
+        int j1=bin(std::min({A.y,B.y,C.y}),y_min,y_max,Nbin_y);
+        int j2=bin(std::max({A.y,B.y,C.y}),y_min,y_max,Nbin_y);
+        int k1=bin(std::min({A.z,B.z,C.z}),z_min,z_max,Nbin_z);
+        int k2=bin(std::max({A.z,B.z,C.z}),z_min,z_max,Nbin_z);
+        
+        for(int j=j1;j<=j2;j++) for(int k=k1;k<=k2;k++)
+            face_bins[j+k*Nbin_y].push_back(f);
+    }
+}
+
+// Orientation of (y,z) with respect to the edge Va->Vb in the (y,z) plane,
+// always evaluated from the lowest vertex index so that the faces sharing
+// an edge see exactly opposite values
+
+double Add_Mesh::edge_function(int Va,int Vb,double y,double z)
+{
+    if(Va>Vb) return -edge_function(Vb,Va,y,z);
+    
+    Vector3 const &A=V_arr[Va].loc;
+    Vector3 const &B=V_arr[Vb].loc;
+    
+    return (B.y-A.y)*(z-A.z)-(B.z-A.z)*(y-A.y);
 }
 
 int Add_Mesh::index(double x,double y,double z)
@@ -431,17 +887,92 @@ int Add_Mesh::index(double x,double y,double z)
         || y<y_min || y>y_max
         || z<z_min || z>z_max) return -1;
     
-    Vector3 O(x,y,z);
-    Vector3 D;
+    thread_local std::vector<double> crossings;
     
-    D.rand_sph();
+    x_crossings(y,z,crossings);
     
-    int N_inter=ray_N_inter(V_arr,F_arr,-1,O,D);
+    int N_inter=std::upper_bound(crossings.begin(),crossings.end(),x)-crossings.begin();
     if(N_inter%2!=0) return mat_index;
     
     return -1;
 }
 
+int Add_Mesh::x_span(double y,double z,double &xa,double &xb)
+{
+    if(    y<y_min || y>y_max
+        || z<z_min || z>z_max) return SPAN_NONE;
+    
+    xa=x_min;
+    xb=x_max;
+    
+    return SPAN_CROSSINGS;
+}
+
+/*
+ * Sorted x of the faces crossed by the line (y,z). A line through an edge
+ * or a vertex is given to one face only with a top-left rule, as in
+ * triangle rasterization, so the parity does not depend on the rounding.
+ */
+
+void Add_Mesh::x_crossings(double y,double z,std::vector<double> &crossings)
+{
+    crossings.clear();
+    
+    if(    y<y_min || y>y_max
+        || z<z_min || z>z_max) return;
+    
+    int j=0,k=0;
+    
+    if(y_max>y_min) j=std::clamp(static_cast<int>((y-y_min)/(y_max-y_min)*Nbin_y),0,Nbin_y-1);
+    if(z_max>z_min) k=std::clamp(static_cast<int>((z-z_min)/(z_max-z_min)*Nbin_z),0,Nbin_z-1);
+    
+    for(int f : face_bins[j+k*Nbin_y])
+    {
+        int const V[3]={F_arr[f].V1,F_arr[f].V2,F_arr[f].V3};
+        double w[3];
+        
+        int sgn=0;
+        bool mixed=false;
+        
+        for(int l=0;l<3;l++)
+        {
+            w[l]=edge_function(V[(l+1)%3],V[(l+2)%3],y,z);
+            
+            int s=(w[l]>0)-(w[l]<0);
+            
+                 if(sgn==0) sgn=s;
+            else if(s!=0 && s!=sgn) mixed=true;
+        }
+        
+        if(mixed || sgn==0) continue;
+        
+        bool inside=true;
+        
+        for(int l=0;l<3 && inside;l++)
+        {
+            if(w[l]!=0) continue;
+            
+            Vector3 const &A=V_arr[V[(l+1)%3]].loc;
+            Vector3 const &B=V_arr[V[(l+2)%3]].loc;
+            
+            double dy=sgn*(B.y-A.y);
+            double dz=sgn*(B.z-A.z);
+            
+            inside=dz<0 || (dz==0 && dy>0);
+        }
+        
+        if(!inside) continue;
+        
+        Vector3 const &A=V_arr[V[0]].loc;
+        Vector3 const &B=V_arr[V[1]].loc;
+        Vector3 const &C=V_arr[V[2]].loc;
+        
+        crossings.push_back((w[0]*A.x+w[1]*B.x+w[2]*C.x)/(w[0]+w[1]+w[2]));
+    }
+    
+    std::sort(crossings.begin(),crossings.end());
+}
+
 //###################
 //   Add_Sin_Layer
 //###################
@@ -498,6 +1029,21 @@ int Add_Sphere::index(double x,double y,double z)
     return -1;
 }
 
+int Add_Sphere::x_span(double y,double z,double &xa,double &xb)
+{
+    y=y-y1;
+    z=z-z1;
+    
+    double t=r*r-y*y-z*z;
+    
+    if(t<0) return SPAN_NONE;
+    
+    xa=x1-std::sqrt(t);
+    xb=x1+std::sqrt(t);
+    
+    return SPAN_INTERVAL;
+}
+
 //####################
 //   Add_Vect_Block
 //####################
@@ -565,6 +1111,25 @@ int Add_Vect_Block::index(double x,double y,double z)
     return -1;
 }
 
+// The coordinates in the (A,B,C) basis are linear in x along the line
+
+int Add_Vect_Block::x_span(double y,double z,double &xa,double &xb)
+{
+    if(    y<y_min || y>y_max
+        || z<z_min || z>z_max) return SPAN_NONE;
+    
+    Eigen::Matrix3d inv=vectmat.inverse();
+    Eigen::Vector3d h=inv*Eigen::Vector3d(-xO,y-yO,z-zO);
+    
+    xa=x_min;
+    xb=x_max;
+    
+    for(int m=0;m<3;m++)
+        if(!linear_span(inv(m,0),h(m),0,1.0,xa,xb)) return SPAN_NONE;
+    
+    return SPAN_INTERVAL;
+}
+
 //####################
 //   Add_Vect_Tri
 //####################
@@ -599,3 +1164,24 @@ int Add_Vect_Tri::index(double x,double y,double z)
     
     return -1;
 }
+
+int Add_Vect_Tri::x_span(double y,double z,double &xa,double &xb)
+{
+    if(    y<y_min || y>y_max
+        || z<z_min || z>z_max) return SPAN_NONE;
+    
+    Eigen::Matrix3d inv=vectmat.inverse();
+    Eigen::Vector3d h=inv*Eigen::Vector3d(-xO,y-yO,z-zO);
+    
+    xa=x_min;
+    xb=x_max;
+    
+    double const max=std::numeric_limits<double>::max();
+    
+    if(   !linear_span(inv(1,0),h(1),0,1.0,xa,xb)
+       || !linear_span(inv(2,0),h(2),0,1.0,xa,xb)
+       || !linear_span(inv(0,0)-alp*inv(2,0),h(0)-alp*h(2),0,max,xa,xb)
+       || !linear_span(inv(0,0)+(1.0-alp)*inv(2,0),h(0)+(1.0-alp)*h(2),-max,1.0,xa,xb)) return SPAN_NONE;
+    
+    return SPAN_INTERVAL;
+}
@@ -0,0 +1,82 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <math_approx.h>
+#include <mathUT.h>
+
+// Evaluates splines on uniform and non-uniform samplings of sin(x), point by
+// point and batched, on sorted and unsorted queries, in and out of range
+
+bool cspline_segments(bool uniform)
+{
+    int Np=200;
+    
+    std::vector<double> x(Np),y(Np);
+    
+    for(int i=0;i<Np;i++)
+    {
+        double u=i/(Np-1.0);
+        
+        if(uniform) x[i]=4.0*u;
+        else x[i]=4.0*u*u;
+        
+        y[i]=std::sin(x[i]);
+    }
+    
+    Cspline spline(x,y,CSPLINE_NAK);
+    
+    // Nodes
+    
+    for(int i=0;i<Np;i++)
+        if(std::abs(spline.eval(x[i])-y[i])>1e-9) return false;
+    
+    // Sorted queries, slightly out of range on both ends
+    
+    int Nq=5001;
+    std::vector<double> xq(Nq),yq;
+    
+    for(int i=0;i<Nq;i++) xq[i]=-0.01+4.02*i/(Nq-1.0);
+    
+    spline.eval(xq,yq);
+    
+    double err_max=0;
+    
+    for(int i=0;i<Nq;i++)
+    {
+        if(yq[i]!=spline.eval(xq[i])) return false;
+        if(xq[i]>=0.1 && xq[i]<=3.9) err_max=std::max(err_max,std::abs(yq[i]-std::sin(xq[i])));
+    }
+    
+    if(err_max>1e-5)
+    {
+        std::cout<<"Spline error "<<err_max<<" uniform="<<uniform<<"\n";
+        return false;
+    }
+    
+    // Unsorted queries
+    
+    for(int i=0;i<Nq;i++) xq[i]=4.0*randp();
+    
+    spline.eval(xq,yq);
+    
+    for(int i=0;i<Nq;i++)
+        if(yq[i]!=spline.eval(xq[i])) return false;
+    
+    return true;
+}
+
+int cspline_lookup(int argc,char *argv[])
+{
+    return !(cspline_segments(true) && cspline_segments(false));
+}
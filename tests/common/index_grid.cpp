@@ -0,0 +1,112 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <grid.h>
+
+// Fills an index grid with growing material indices, and checks that the
+// storage widens without losing the indices already written
+
+int index_grid(int argc,char *argv[])
+{
+    int Nx=40,Ny=30,Nz=20;
+    
+    IndexGrid3 G;
+    G.init(Nx,Ny,Nz,0);
+    
+    Grid3<unsigned int> ref(Nx,Ny,Nz,0);
+    
+    if(G.bytes_per_index()!=1 || G.mem_size()!=Nx*Ny*Nz)
+    {
+        std::cout<<"Wrong initial storage\n";
+        return 1;
+    }
+    
+    unsigned int steps[3]={7,300,70000};
+    int widths[3]={1,2,4};
+    
+    for(int s=0;s<3;s++)
+    {
+        for(int k=s;k<Nz;k+=3){ for(int j=0;j<Ny;j++){ for(int i=0;i<Nx;i++)
+        {
+            unsigned int value=steps[s]+(i+j+k)%5;
+            
+            G(i,j,k)=value;
+            ref(i,j,k)=value;
+        }}}
+        
+        if(G.bytes_per_index()!=widths[s])
+        {
+            std::cout<<"Wrong width after step "<<s<<": "<<G.bytes_per_index()<<"\n";
+            return 1;
+        }
+    }
+    
+    // Copy between cells goes through the values
+    
+    for(int j=0;j<Ny;j++){ for(int i=0;i<Nx;i++)
+    {
+        G(i,j,0)=G(i,j,Nz-1);
+        ref(i,j,0)=ref(i,j,Nz-1);
+    }}
+    
+    IndexGrid3 const &G_const=G;
+    
+    for(int k=0;k<Nz;k++){ for(int j=0;j<Ny;j++){ for(int i=0;i<Nx;i++)
+    {
+        if(G_const(i,j,k)!=ref(i,j,k) || G(i,j,k)!=ref(i,j,k))
+        {
+            std::cout<<"Mismatch at "<<i<<" "<<j<<" "<<k<<": "<<G_const(i,j,k)<<" "<<ref(i,j,k)<<"\n";
+            return 1;
+        }
+    }}}
+    
+    if(G.max()!=ref.max())
+    {
+        std::cout<<"Wrong maximum: "<<G.max()<<" "<<ref.max()<<"\n";
+        return 1;
+    }
+    
+    // Typed access sees the same indices, with the storage width
+    
+    int typed_mismatches=0;
+    std::size_t typed_size=0;
+    
+    G.visit([&](auto const *data)
+    {
+        typed_size=sizeof(*data);
+        
+        for(int k=0;k<Nz;k++){ for(int j=0;j<Ny;j++){ for(int i=0;i<Nx;i++)
+        {
+            if(data[i+(j+k*Ny)*Nx]!=ref(i,j,k)) typed_mismatches++;
+        }}}
+    });
+    
+    if(typed_mismatches>0 || typed_size!=4)
+    {
+        std::cout<<"Wrong typed access: "<<typed_mismatches<<" mismatches, "<<typed_size<<" bytes\n";
+        return 1;
+    }
+    
+    // Reinitialization goes back to the narrowest storage
+    
+    G.init(Nx,Ny,Nz,3);
+    
+    if(G.bytes_per_index()!=1 || G(Nx-1,Ny-1,Nz-1)!=3)
+    {
+        std::cout<<"Wrong reinitialization\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <mathUT.h>
+
+// Checks the Philox blocks against the reference answers of the Random123
+// distribution, and that the streams are reproducible and independent
+
+bool philox_known_answers()
+{
+    std::uint32_t out[4];
+    
+    std::uint32_t ctr_0[4]={0,0,0,0};
+    std::uint32_t key_0[2]={0,0};
+    std::uint32_t ref_0[4]={0x6627e8d5,0xe169c58d,0xbc57ac4c,0x9b00dbd8};
+    
+    Philox::block(ctr_0,key_0,out);
+    
+    for(int i=0;i<4;i++) if(out[i]!=ref_0[i]) return false;
+    
+    std::uint32_t ctr_1[4]={0xffffffff,0xffffffff,0xffffffff,0xffffffff};
+    std::uint32_t key_1[2]={0xffffffff,0xffffffff};
+    std::uint32_t ref_1[4]={0x408f276d,0x41c83b0e,0xa20bc7c6,0x6d5451fd};
+    
+    Philox::block(ctr_1,key_1,out);
+    
+    for(int i=0;i<4;i++) if(out[i]!=ref_1[i]) return false;
+    
+    std::uint32_t ctr_2[4]={0x243f6a88,0x85a308d3,0x13198a2e,0x03707344};
+    std::uint32_t key_2[2]={0xa4093822,0x299f31d0};
+    std::uint32_t ref_2[4]={0xd16cfe09,0x94fdcceb,0x5001e420,0x24126ea1};
+    
+    Philox::block(ctr_2,key_2,out);
+    
+    for(int i=0;i<4;i++) if(out[i]!=ref_2[i]) return false;
+    
+    return true;
+}
+
+bool philox_streams()
+{
+    std::vector<double> A(10),B(10),C(10);
+    
+    seedp_stream(1986,0,42,3);
+    for(double &v : A) v=randp();
+    
+    seedp_stream(1986,0,43,3);
+    for(double &v : C) v=randp();
+    
+    seedp_stream(1986,0,42,3);
+    for(double &v : B) v=randp();
+    
+    if(A!=B || A==C) return false;
+    
+    for(double v : A) if(v<0 || v>1.0) return false;
+    
+    return true;
+}
+
+int philox_rng(int argc,char *argv[])
+{
+    if(!philox_known_answers())
+    {
+        std::cout<<"Philox known answer mismatch\n";
+        return 1;
+    }
+    
+    if(!philox_streams())
+    {
+        std::cout<<"Philox streams are not reproducible\n";
+        return 1;
+    }
+    
+    return 0;
+}
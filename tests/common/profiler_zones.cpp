@@ -0,0 +1,100 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <profiler.h>
+
+#include <iostream>
+#include <thread>
+
+// Nests zones and counters on the main thread and on workers started one
+// after the other, which have to share a single tree, and checks that nothing
+// is recorded while the profiler is off
+
+int count_occurrences(std::string const &str,std::string const &pattern)
+{
+    int N=0;
+    
+    for(std::size_t p=str.find(pattern);p!=std::string::npos;p=str.find(pattern,p+1)) N++;
+    
+    return N;
+}
+
+int profiler_zones(int argc,char *argv[])
+{
+    Profiler::enable();
+    
+    {
+        ProfileZone zone("outer");
+        
+        for(int i=0;i<3;i++)
+        {
+            ProfileZone zone_inner("inner");
+        }
+        
+        ProfileZone zone_stopped("stopped");
+        zone_stopped.stop();
+        
+        ProfileCounter counter("counted");
+        
+        for(int i=0;i<5;i++)
+        {
+            counter.start();
+            counter.stop();
+        }
+    }
+    
+    for(int t=0;t<4;t++)
+    {
+        std::thread worker([]()
+        {
+            ProfileZone zone("worker");
+        });
+        
+        worker.join();
+    }
+    
+    Profiler::disable();
+    
+    {
+        ProfileZone zone("outer");
+        ProfileZone zone_disabled("disabled");
+        
+        ProfileCounter counter_disabled("disabled_counter");
+        counter_disabled.start();
+        counter_disabled.stop();
+    }
+    
+    std::string summary=Profiler::summary_json();
+    
+    std::cout<<summary;
+    
+    if(   count_occurrences(summary,"\"name\": \"outer\", \"calls\": 1,")!=1
+       || count_occurrences(summary,"\"name\": \"inner\", \"calls\": 3,")!=1
+       || count_occurrences(summary,"\"name\": \"stopped\", \"calls\": 1,")!=1
+       || count_occurrences(summary,"\"name\": \"worker\", \"calls\": 4,")!=1
+       || count_occurrences(summary,"\"name\": \"counted\", \"calls\": 5,")!=1
+       || count_occurrences(summary,"\"disabled")!=0)
+    {
+        std::cout<<"Zones mismatch\n";
+        return 1;
+    }
+    
+    if(count_occurrences(summary,"\"thread\":")!=2)
+    {
+        std::cout<<"The workers trees were not reused\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,58 @@
+-- Queues small jobs, the last one failing, and checks their outputs
+
+function write_job_output(index,value,fail)
+	if job_index~=index or not string.find(job_directory,"jobs/job_" .. index .. "/",1,true) then
+		print("Wrong globals for job " .. index)
+		print("job_index " .. tostring(job_index))
+		print("job_directory " .. tostring(job_directory))
+		fail_test()
+	end
+	
+	local file=io.open(job_directory .. "output.txt","w")
+	file:write(job_index .. " " .. value)
+	file:close()
+	
+	if fail then
+		error("expected failure")
+	end
+end
+
+values={0.5,1.5,2.5}
+
+for i=1,#values do
+	add_job(write_job_output,i,values[i],i==#values)
+end
+
+N_failed=run_jobs(2)
+
+if N_failed~=1 then
+	print("Failed jobs count " .. N_failed)
+	fail_test()
+end
+
+script_directory=debug.getinfo(1,"S").source:match("^@(.*[/\\])") or ""
+
+for i=1,#values do
+	local directory=script_directory .. "jobs/job_" .. i .. "/"
+	local file=io.open(directory .. "output.txt","r")
+	
+	if file==nil then
+		print("Missing output of job " .. i)
+		fail_test()
+	else
+		local index=file:read("n")
+		local value=file:read("n")
+		file:close()
+		
+		if index~=i or value~=values[i] then
+			print("Wrong output of job " .. i)
+			fail_test()
+		end
+		
+		os.remove(directory .. "output.txt")
+	end
+	
+	os.remove(directory)
+end
+
+os.remove(script_directory .. "jobs")
@@ -0,0 +1,55 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include "fdfd_slab.h"
+
+// Solves a 3D slab problem with both the direct and the matrix-free paths,
+// checks that they agree and reports the time and the memory each solver
+// held, LU fill-in included
+
+bool matrix_free_agreement()
+{
+    int Nxy=10;
+    int Nz=40;
+    
+    double t_LU,t_MF;
+    std::size_t mem_LU,mem_MF;
+    
+    std::vector<Imdouble> E_LU=run_fdfd_slab(SOLVE_LU,Nxy,Nz,t_LU,mem_LU);
+    std::vector<Imdouble> E_MF=run_fdfd_slab(SOLVE_MATRIX_FREE,Nxy,Nz,t_MF,mem_MF);
+    
+    std::cout<<"Direct:      "<<t_LU<<" s, "<<mem_LU/1024<<" kB\n";
+    std::cout<<"Matrix-free: "<<t_MF<<" s, "<<mem_MF/1024<<" kB\n";
+    
+    double err=fdfd_slab_deviation(E_LU,E_MF);
+    
+    if(err>1e-3)
+    {
+        std::cout<<"Matrix-free FDFD disagreement: "<<err<<"\n";
+        return false;
+    }
+    
+    if(mem_MF>=mem_LU)
+    {
+        std::cout<<"Matrix-free FDFD does not save memory\n";
+        return false;
+    }
+    
+    return true;
+}
+
+int fdfd_matrix_free(int argc,char *argv[])
+{
+    return !matrix_free_agreement();
+}
@@ -0,0 +1,75 @@
+-- Runs a periodic grating through the FDFD mode with the different solvers and compares R and T
+
+script_directory=debug.getinfo(1,"S").source:match("^@(.*[/\\])") or ""
+
+structure_fname=script_directory .. "fdfd_periodic_grating.lua"
+
+file=io.open(structure_fname,"w")
+file:write("lx=80e-9\n")
+file:write("ly=10e-9\n")
+file:write("lz=400e-9\n")
+file:write("default_material(0)\n")
+file:write("add_block(0,40e-9,0,10e-9,150e-9,250e-9,1)\n")
+file:close()
+
+structure=Structure(structure_fname)
+
+glass=Material()
+glass:refractive_index(1.5)
+
+function compute_RT(solver)
+	local prefix=script_directory .. "fdfd_" .. solver .. "_"
+
+	local fdfd=MODE("fdfd")
+	fdfd:prefix(prefix)
+	fdfd:polarization("TE")
+	fdfd:structure(structure)
+	fdfd:Dxyz(10e-9)
+	fdfd:spectrum(600e-9,600e-9,1)
+	fdfd:padding(0,0,0,0,20,20)
+	fdfd:pml_zm(10,1,1,0)
+	fdfd:pml_zp(10,1,1,0)
+	fdfd:material(1,glass)
+	fdfd:solver(solver)
+	fdfd:compute()
+
+	local file=io.open(prefix .. "fdfd_spectral_data","r")
+
+	if file==nil then
+		print("Missing output of the " .. solver .. " solver")
+		fail_test()
+	end
+
+	local lambda=file:read("n")
+	local theta=file:read("n")
+	local phi=file:read("n")
+	local R=file:read("n")
+	local T=file:read("n")
+	file:close()
+
+	os.remove(prefix .. "fdfd_spectral_data")
+
+	return R,T
+end
+
+R_LU,T_LU=compute_RT("LU")
+
+if R_LU==nil or T_LU==nil or R_LU<=0 or T_LU<=0 or R_LU+T_LU>1.01 then
+	print("Invalid LU result")
+	print("R " .. tostring(R_LU))
+	print("T " .. tostring(T_LU))
+	fail_test()
+end
+
+for _,solver in ipairs({"matrix_free","SAM"}) do
+	R,T=compute_RT(solver)
+
+	if R==nil or T==nil or math.abs(R-R_LU)>1e-3 or math.abs(T-T_LU)>1e-3 then
+		print("Mismatch of the " .. solver .. " solver")
+		print("R " .. tostring(R) .. " " .. R_LU)
+		print("T " .. tostring(T) .. " " .. T_LU)
+		fail_test()
+	end
+end
+
+os.remove(structure_fname)
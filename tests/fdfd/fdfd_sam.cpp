@@ -0,0 +1,84 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include "fdfd_slab.h"
+
+#include <thread>
+
+// Solves a layered 3D problem with both the direct and the slices paths,
+// in memory and through scratch files, and checks that they agree. Two
+// scratch solves also run side by side in the same directory
+
+bool sam_agreement()
+{
+    int Nxy=4;
+    int Nz=40;
+    
+    double t_LU,t_SAM,t_disk;
+    std::size_t mem_LU,mem_SAM,mem_disk;
+    
+    std::filesystem::path scratch=std::filesystem::temp_directory_path();
+    
+    std::vector<Imdouble> E_LU=run_fdfd_slab(SOLVE_LU,Nxy,Nz,t_LU,mem_LU);
+    std::vector<Imdouble> E_SAM=run_fdfd_slab(SOLVE_SAM,Nxy,Nz,t_SAM,mem_SAM);
+    std::vector<Imdouble> E_disk=run_fdfd_slab(SOLVE_SAM,Nxy,Nz,t_disk,mem_disk,scratch);
+    
+    std::cout<<"Direct:          "<<t_LU<<" s, "<<mem_LU/1024<<" kB\n";
+    std::cout<<"Slices:          "<<t_SAM<<" s, "<<mem_SAM/1024<<" kB\n";
+    std::cout<<"Slices, scratch: "<<t_disk<<" s, "<<mem_disk/1024<<" kB\n";
+    
+    // Concurrent scratch solves
+    
+    std::vector<Imdouble> E_conc[2];
+    std::vector<std::thread*> tsk(2);
+    
+    for(int t=0;t<2;t++)
+        tsk[t]=new std::thread([&,t]()
+                               {
+                                   double time_s;
+                                   std::size_t memory;
+                                   
+                                   E_conc[t]=run_fdfd_slab(SOLVE_SAM,Nxy,Nz,time_s,memory,scratch);
+                               });
+    
+    for(int t=0;t<2;t++)
+    {
+        tsk[t]->join();
+        delete tsk[t];
+    }
+    
+    double err=std::max({fdfd_slab_deviation(E_LU,E_SAM),
+                         fdfd_slab_deviation(E_LU,E_disk),
+                         fdfd_slab_deviation(E_LU,E_conc[0]),
+                         fdfd_slab_deviation(E_LU,E_conc[1])});
+    
+    if(err>1e-3)
+    {
+        std::cout<<"SAM FDFD disagreement: "<<err<<"\n";
+        return false;
+    }
+    
+    if(mem_disk>mem_SAM)
+    {
+        std::cout<<"SAM scratch files do not save memory\n";
+        return false;
+    }
+    
+    return true;
+}
+
+int fdfd_sam(int argc,char *argv[])
+{
+    return !sam_agreement();
+}
@@ -0,0 +1,91 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDFD_SLAB_H_INCLUDED
+#define FDFD_SLAB_H_INCLUDED
+
+#include <fdfd.h>
+
+#include <chrono>
+
+// Shared fixture of the 3D FDFD solver tests: slab of index 1.5 filling the
+// middle third of an Nxy x Nxy x Nz grid, lit at normal incidence.
+// Returns E along the (0,0) column, the solve time and the memory the solver
+// reported holding
+
+inline std::vector<Imdouble> run_fdfd_slab(int solver_type,int Nxy,int Nz,
+                                           double &time_s,std::size_t &memory,
+                                           std::filesystem::path const &scratch="")
+{
+    double Dx=20e-9;
+    
+    Grid3<unsigned int> matsgrid(Nxy,Nxy,Nz,0);
+    
+    for(int i=0;i<Nxy;i++) for(int j=0;j<Nxy;j++) for(int k=Nz/3;k<2*Nz/3;k++)
+        matsgrid(i,j,k)=1;
+    
+    FDFD fdfd(Dx,Dx,Dx);
+    
+    fdfd.set_solver_type(solver_type);
+    fdfd.set_slice_scratch(scratch);
+    fdfd.set_pml_zm(10,1.0,1.0,0.0);
+    fdfd.set_pml_zp(10,1.0,1.0,0.0);
+    fdfd.set_matsgrid(matsgrid);
+    
+    Material mat_1;
+    mat_1.set_const_n(1.5);
+    
+    fdfd.set_material(1,mat_1);
+    fdfd.set_injection_plane_z(fdfd.zs_e-2);
+    
+    auto t_start=std::chrono::high_resolution_clock::now();
+    
+    fdfd.solve_prop_3D(600e-9,0,0,0);
+    
+    auto t_end=std::chrono::high_resolution_clock::now();
+    
+    time_s=std::chrono::duration<double>(t_end-t_start).count();
+    memory=fdfd.solver_memory;
+    
+    std::vector<Imdouble> E;
+    
+    for(int k=0;k<fdfd.Nz;k++)
+    {
+        E.push_back(fdfd.get_Ex(0,0,k));
+        E.push_back(fdfd.get_Ey(0,0,k));
+        E.push_back(fdfd.get_Ez(0,0,k));
+    }
+    
+    return E;
+}
+
+// Largest deviation of E_b from E_a, relative to the largest field of E_a
+
+inline double fdfd_slab_deviation(std::vector<Imdouble> const &E_a,
+                                  std::vector<Imdouble> const &E_b)
+{
+    double E_max=0,err_max=0;
+    
+    for(std::size_t i=0;i<E_a.size();i++)
+    {
+        E_max=std::max(E_max,std::abs(E_a[i]));
+        err_max=std::max(err_max,std::abs(E_a[i]-E_b[i]));
+    }
+    
+    if(E_max==0) return 1.0;
+    
+    return err_max/E_max;
+}
+
+#endif // FDFD_SLAB_H_INCLUDED
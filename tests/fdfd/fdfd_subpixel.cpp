@@ -0,0 +1,124 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdfd.h>
+
+extern const Imdouble Im;
+
+// Transmission of a slab of index 2 with the 1D FDFD solver, against the Airy
+// formula. The slab is shifted over one cell to sample every position of the
+// interfaces relative to the grid, and the worst error is kept. The subpixel
+// smoothing has to beat the staircase at every resolution, and converge at
+// second order where the staircase only converges at first order
+
+namespace
+{
+    double slab_d=133.6e-9;
+    double slab_n=2.0;
+    double lambda=600e-9;
+    
+    // Field below the slab, relative to the same run without it
+    
+    Imdouble fdfd_slab_transmission(double z1,double D,bool smoothing)
+    {
+        int Nz=nearest_integer(340e-9/D);
+        int N_pml=nearest_integer(300e-9/D);
+        
+        Structure structure;
+        structure.add_operation(new Add_Layer(2,z1,z1+slab_d,1));
+        
+        Imdouble E[2];
+        
+        for(int run=0;run<2;run++)
+        {
+            Grid3<unsigned int> matsgrid;
+            structure.discretize(matsgrid,1,1,Nz,D,D,D);
+            
+            if(run==1) matsgrid=0;
+            
+            std::vector<Subpixel_Mix> mixes;
+            if(smoothing) structure.subpixel_smoothing(matsgrid,mixes,{true,true},D,D,D,64);
+            
+            FDFD fdfd(D,D,D);
+            
+            fdfd.set_pml_zm(N_pml,1.0,1.0,0.0);
+            fdfd.set_pml_zp(N_pml,1.0,1.0,0.0);
+            fdfd.set_matsgrid(matsgrid);
+            fdfd.set_subpixel_mixes(mixes);
+            
+            Material slab;
+            slab.set_const_n(slab_n);
+            
+            fdfd.set_material(1,slab);
+            
+            fdfd.solve_prop_1D(lambda,0,0,0);
+            
+            E[run]=fdfd.get_Ey(0,0,fdfd.zs_s-2);
+        }
+        
+        return E[0]/E[1];
+    }
+}
+
+int fdfd_subpixel(int argc,char *argv[])
+{
+    // Airy transmission, with the phase of the empty run removed
+    
+    double k0=2.0*Pi/lambda;
+    double r=(1.0-slab_n)/(1.0+slab_n);
+    
+    Imdouble phase=std::exp(slab_n*k0*slab_d*Im);
+    Imdouble t_exact=(1.0-r*r)*phase/(1.0-r*r*phase*phase)*std::exp(-k0*slab_d*Im);
+    
+    int N_pos=8;
+    double D[3]={10e-9,5e-9,2.5e-9};
+    double err_stair[3],err_smooth[3];
+    
+    for(int n=0;n<3;n++)
+    {
+        err_stair[n]=err_smooth[n]=0;
+        
+        for(int p=0;p<N_pos;p++)
+        {
+            double z1=100e-9+(p+0.5)/N_pos*D[n];
+            
+            err_stair[n]=std::max(err_stair[n],std::abs(fdfd_slab_transmission(z1,D[n],false)-t_exact));
+            err_smooth[n]=std::max(err_smooth[n],std::abs(fdfd_slab_transmission(z1,D[n],true)-t_exact));
+        }
+        
+        std::cout<<"D="<<D[n]<<" staircase error: "<<err_stair[n]<<" smoothed error: "<<err_smooth[n]<<"\n";
+    }
+    
+    for(int n=0;n<3;n++)
+    {
+        if(!(err_smooth[n]<err_stair[n]/2.0))
+        {
+            std::cout<<"Smoothing does not improve the staircase at D="<<D[n]<<"\n";
+            return 1;
+        }
+    }
+    
+    double order_stair=std::log2(err_stair[0]/err_stair[2])/2.0;
+    double order_smooth=std::log2(err_smooth[0]/err_smooth[2])/2.0;
+    
+    std::cout<<"Convergence order, staircase: "<<order_stair<<" smoothed: "<<order_smooth<<"\n";
+    
+    if(!(order_smooth>1.7))
+    {
+        std::cout<<"Smoothed convergence below second order\n";
+        return 1;
+    }
+    
+    return 0;
+}
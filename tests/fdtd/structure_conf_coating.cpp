@@ -0,0 +1,212 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <structure.h>
+
+#include <chrono>
+#include <iostream>
+
+// Conformal coating of a textured substrate: the distance transform on the
+// grid is checked against a direct search of the nearest seed, a node of
+// another material next to one of the substrate, and against
+// Structure::index(). A grid with other steps than the seed lattice, and
+// different ones along each axis, is checked against the direct search alone
+
+int structure_conf_coating(int argc,char *argv[])
+{
+    int N=60;
+    double D=5e-9;
+    double thickness=17e-9;
+    
+    int R=static_cast<int>(thickness/D)+1;
+    
+    int N_mismatch=0;
+    
+    for(int config=0;config<2;config++)
+    {
+        Structure structure;
+        
+        if(config==1) structure.set_loop(1,1,0);
+        
+        structure.add_operation(new Add_Layer(2,-1e-6,100e-9,1));
+        structure.add_operation(new Add_Sphere(90e-9,110e-9,100e-9,60e-9,1));
+        structure.add_operation(new Add_Ellipsoid(210e-9,180e-9,110e-9,50e-9,70e-9,45e-9,1));
+        structure.add_operation(new Add_Cylinder(150e-9,40e-9,80e-9,150e-9,40e-9,160e-9,20e-9,1));
+        structure.add_operation(new Add_Block(0,300e-9,250e-9,300e-9,0,50e-9,3));
+        
+        Add_Conf_Coating *coating=new Add_Conf_Coating(thickness,D,1,2);
+        
+        structure.add_operation(coating);
+        structure.add_operation(new Add_Sphere(150e-9,150e-9,140e-9,20e-9,4));
+        
+        coating->parent=&structure;
+        coating->stack_ID=5;
+        
+        Grid3<unsigned int> matgrid;
+        
+        auto t_start=std::chrono::high_resolution_clock::now();
+        
+        structure.discretize(matgrid,N,N,N,D,D,D);
+        
+        double time_grid=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        // Stack below the coating, seeds out of the domain included
+        
+        auto below=[&](int i,int j,int k) { return structure.index(i*D,j*D,k*D,5); };
+        
+        auto inside=[&](int i,int j,int k)
+        {
+            return (config==1 || (i>=0 && i<N && j>=0 && j<N)) && k>=0 && k<N;
+        };
+        
+        auto seed=[&](int i,int j,int k)
+        {
+            if(below(i,j,k)==1) return false;
+            
+            for(int d=-1;d<=1;d+=2)
+            {
+                if(   (inside(i+d,j,k) && below(i+d,j,k)==1)
+                   || (inside(i,j+d,k) && below(i,j+d,k)==1)
+                   || (inside(i,j,k+d) && below(i,j,k+d)==1)) return true;
+            }
+            
+            return false;
+        };
+        
+        for(int i=0;i<N;i++)
+        for(int j=0;j<N;j++)
+        for(int k=0;k<N;k++)
+        {
+            int expected=below(i,j,k);
+            
+            if(expected==1)
+            {
+                bool coated=false;
+                
+                for(int a=-R;a<=R && !coated;a++)
+                for(int b=-R;b<=R && !coated;b++)
+                for(int c=-R;c<=R && !coated;c++)
+                {
+                    if((a*a+b*b+c*c)*D*D<thickness*thickness && seed(i+a,j+b,k+c))
+                        coated=true;
+                }
+                
+                if(coated) expected=2;
+            }
+            
+            double x=i*D,y=j*D,z=k*D;
+            
+            if((x-150e-9)*(x-150e-9)+(y-150e-9)*(y-150e-9)+(z-140e-9)*(z-140e-9)<=20e-9*20e-9) expected=4;
+            
+            if(matgrid(i,j,k)!=static_cast<unsigned int>(expected)) N_mismatch++;
+        }
+        
+        std::cout<<"Configuration "<<config<<": "<<time_grid<<" s\n";
+        
+        if(config==0)
+        {
+            t_start=std::chrono::high_resolution_clock::now();
+            
+            for(int i=0;i<N;i++)
+            for(int j=0;j<N;j++)
+            for(int k=0;k<N;k++)
+            {
+                if(matgrid(i,j,k)!=static_cast<unsigned int>(structure.index(i*D,j*D,k*D))) N_mismatch++;
+            }
+            
+            double time_index=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+            
+            std::cout<<"    point by point: "<<time_index<<" s\n";
+        }
+        
+        structure.finalize();
+    }
+    
+    // Grid steps differing from the seed lattice and between the axes
+    
+    {
+        double Dx=4e-9,Dy=5e-9,Dz=7e-9;
+        
+        Structure structure;
+        
+        structure.add_operation(new Add_Layer(2,-1e-6,100e-9,1));
+        structure.add_operation(new Add_Sphere(90e-9,110e-9,100e-9,60e-9,1));
+        
+        Add_Conf_Coating *coating=new Add_Conf_Coating(thickness,2*D,1,2);
+        
+        structure.add_operation(coating);
+        
+        coating->parent=&structure;
+        coating->stack_ID=2;
+        
+        Grid3<unsigned int> matgrid;
+        
+        structure.discretize(matgrid,N,N,N,Dx,Dy,Dz);
+        
+        auto below=[&](int i,int j,int k) { return structure.index(i*Dx,j*Dy,k*Dz,2); };
+        
+        auto seed=[&](int i,int j,int k)
+        {
+            if(below(i,j,k)==1) return false;
+            
+            for(int d=-1;d<=1;d+=2)
+            {
+                if(   (i+d>=0 && i+d<N && below(i+d,j,k)==1)
+                   || (j+d>=0 && j+d<N && below(i,j+d,k)==1)
+                   || (k+d>=0 && k+d<N && below(i,j,k+d)==1)) return true;
+            }
+            
+            return false;
+        };
+        
+        int Rx=static_cast<int>(thickness/Dx)+1;
+        int Ry=static_cast<int>(thickness/Dy)+1;
+        int Rz=static_cast<int>(thickness/Dz)+1;
+        
+        for(int i=0;i<N;i++)
+        for(int j=0;j<N;j++)
+        for(int k=0;k<N;k++)
+        {
+            int expected=below(i,j,k);
+            
+            if(expected==1)
+            {
+                bool coated=false;
+                
+                for(int a=-Rx;a<=Rx && !coated;a++)
+                for(int b=-Ry;b<=Ry && !coated;b++)
+                for(int c=-Rz;c<=Rz && !coated;c++)
+                {
+                    double d2=a*a*Dx*Dx+b*b*Dy*Dy+c*c*Dz*Dz;
+                    
+                    if(d2<thickness*thickness && seed(i+a,j+b,k+c)) coated=true;
+                }
+                
+                if(coated) expected=2;
+            }
+            
+            if(matgrid(i,j,k)!=static_cast<unsigned int>(expected)) N_mismatch++;
+        }
+        
+        structure.finalize();
+    }
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Conformal coating mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <structure.h>
+#include <thread_utils.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+// Discretizes the same Lua defined torus through add_lua_def and
+// add_lua_batch_def, both have to give the analytic shape on any number of
+// threads. Spheres placed with math.random by the script have to be the same
+// on every worker as in the main state, closures sharing an upvalue have to
+// keep sharing it, and a script holding a file handle has to stay on one
+// thread
+
+bool torus_inside(double x,double y,double z)
+{
+    double r=std::abs(std::sqrt((x-150e-9)*(x-150e-9)+(y-150e-9)*(y-150e-9))-100e-9);
+    double h=z-150e-9;
+    
+    return r*r+h*h<=40e-9*40e-9;
+}
+
+int structure_lua_def(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"structure_lua_def";
+    std::filesystem::create_directories(base);
+    
+    std::string torus_function=
+        "lx=300e-9\n"
+        "ly=300e-9\n"
+        "lz=300e-9\n"
+        "function torus(x,y,z,x0,y0,z0)\n"
+        "    local r=math.abs(math.sqrt((x-x0)*(x-x0)+(y-y0)*(y-y0))-100e-9)\n"
+        "    local h=z-z0\n"
+        "    if r*r+h*h<=40e-9*40e-9 then return 1 end\n"
+        "    return 0\n"
+        "end\n"
+        "function torus_batch(x,y,z,x0,y0,z0)\n"
+        "    local out={}\n"
+        "    for i=1,#x do out[i]=torus(x[i],y,z,x0,y0,z0) end\n"
+        "    return out\n"
+        "end\n";
+    
+    std::ofstream(base/"torus.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<torus_function<<"add_lua_def(\"torus\",150e-9,150e-9,150e-9,1)\n";
+    
+    std::ofstream(base/"torus_batch.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<torus_function<<"add_lua_batch_def(\"torus_batch\",150e-9,150e-9,150e-9,1)\n";
+    
+    std::ofstream(base/"random_spheres.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<"lx=300e-9\n"
+          "ly=300e-9\n"
+          "lz=300e-9\n"
+          "local R=40e-9\n"
+          "centers={}\n"
+          "for n=1,8 do centers[n]={math.random()*lx,math.random()*ly,math.random()*lz} end\n"
+          "local function inside(x,y,z,c) return (x-c[1])^2+(y-c[2])^2+(z-c[3])^2<=R*R end\n"
+          "function spheres(x,y,z)\n"
+          "    for n=1,#centers do if inside(x,y,z,centers[n]) then return 1 end end\n"
+          "    return 0\n"
+          "end\n"
+          "add_lua_def(\"spheres\",1)\n";
+    
+    std::string shared_upvalue=
+        "lx=300e-9\n"
+        "ly=300e-9\n"
+        "lz=300e-9\n"
+        "local R=0\n"
+        "local function set_radius(r) R=r end\n"
+        "local function inside(x,y,z) return (x-150e-9)^2+(y-150e-9)^2+(z-150e-9)^2<=R*R end\n"
+        "function sphere(x,y,z)\n"
+        "    set_radius(100e-9)\n"
+        "    if inside(x,y,z) then return 1 end\n"
+        "    return 0\n"
+        "end\n"
+        "add_lua_def(\"sphere\",1)\n";
+    
+    std::ofstream(base/"shared_upvalue.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<shared_upvalue;
+    
+    std::ofstream(base/"file_handle.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<"log_file=io.tmpfile()\n"<<shared_upvalue;
+    
+    int N=61;
+    double D=5e-9;
+    
+    int N_mismatch=0;
+    
+    for(std::string const &name : {"torus","torus_batch"})
+    {
+        Structure structure(base/(name+".lua"));
+        structure.finalize();
+        
+        for(int N_threads : {1,0})
+        {
+            Grid3<unsigned int> matgrid;
+            
+            set_thread_budget(N_threads);
+            
+            auto t_start=std::chrono::high_resolution_clock::now();
+            
+            structure.discretize(matgrid,N,N,N,D,D,D);
+            
+            double time_span=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+            
+            std::cout<<name<<", "<<max_threads_number()<<" threads: "<<time_span<<" s\n";
+            
+            for(int i=0;i<N;i++)
+            for(int j=0;j<N;j++)
+            for(int k=0;k<N;k++)
+            {
+                if(matgrid(i,j,k)!=(torus_inside(i*D,j*D,k*D) ? 1u : 0u)) N_mismatch++;
+            }
+        }
+    }
+    
+    {
+        Structure structure(base/"random_spheres.lua");
+        structure.finalize();
+        
+        Grid3<unsigned int> matgrid;
+        structure.discretize(matgrid,N,N,N,D,D,D);
+        
+        int N_inside=0;
+        
+        for(int i=0;i<N;i++)
+        for(int j=0;j<N;j++)
+        for(int k=0;k<N;k++)
+        {
+            if(matgrid(i,j,k)==1) N_inside++;
+            if(matgrid(i,j,k)!=static_cast<unsigned int>(structure.index(i*D,j*D,k*D))) N_mismatch++;
+        }
+        
+        if(N_inside==0) N_mismatch++;
+    }
+    
+    for(std::string const &name : {"shared_upvalue","file_handle"})
+    {
+        Structure structure(base/(name+".lua"));
+        structure.finalize();
+        
+        set_thread_budget(4);
+        
+        Grid3<unsigned int> matgrid;
+        structure.discretize(matgrid,N,N,N,D,D,D);
+        
+        set_thread_budget(0);
+        
+        for(int i=0;i<N;i++)
+        for(int j=0;j<N;j++)
+        for(int k=0;k<N;k++)
+        {
+            double r2=(i*D-150e-9)*(i*D-150e-9)+(j*D-150e-9)*(j*D-150e-9)+(k*D-150e-9)*(k*D-150e-9);
+            
+            if(matgrid(i,j,k)!=(r2<=100e-9*100e-9 ? 1u : 0u)) N_mismatch++;
+        }
+        
+        if(structure.lua_workers_available()!=(name=="shared_upvalue"))
+        {
+            std::cout<<"Wrong Lua workers availability for "<<name<<"\n";
+            N_mismatch++;
+        }
+    }
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Lua defined structure mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <structure.h>
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+// Voxelizes a cube whose faces and diagonals go through the grid nodes and a
+// sphere mesh. Each voxel is checked against Structure::index() and the
+// expected shapes away from their surface.
+
+void write_mesh_cube(std::filesystem::path const &fname,double a,double b)
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    for(int n=0;n<8;n++)
+        file<<"v "<<(n&1 ? b : a)<<" "<<(n&2 ? b : a)<<" "<<(n&4 ? b : a)<<"\n";
+    
+    file<<"f 1 3 4 2\nf 5 6 8 7\nf 1 2 6 5\nf 3 7 8 4\nf 1 5 7 3\nf 2 4 8 6\n";
+}
+
+void write_mesh_sphere(std::filesystem::path const &fname,double x0,double y0,double z0,double r,int Nth,int Nph)
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    file<<"v "<<x0<<" "<<y0<<" "<<z0+r<<"\n";
+    
+    for(int i=1;i<Nth;i++) for(int j=0;j<Nph;j++)
+    {
+        double th=Pi*i/Nth;
+        double ph=2.0*Pi*j/Nph;
+        
+        file<<"v "<<x0+r*std::sin(th)*std::cos(ph)<<" "<<y0+r*std::sin(th)*std::sin(ph)<<" "<<z0+r*std::cos(th)<<"\n";
+    }
+    
+    file<<"v "<<x0<<" "<<y0<<" "<<z0-r<<"\n";
+    
+    auto V=[&](int i,int j) { return 2+(i-1)*Nph+j%Nph; };
+    int south=2+(Nth-1)*Nph;
+    
+    for(int j=0;j<Nph;j++)
+    {
+        file<<"f 1 "<<V(1,j)<<" "<<V(1,j+1)<<"\n";
+        file<<"f "<<south<<" "<<V(Nth-1,j+1)<<" "<<V(Nth-1,j)<<"\n";
+        
+        for(int i=1;i<Nth-1;i++)
+            file<<"f "<<V(i,j)<<" "<<V(i+1,j)<<" "<<V(i+1,j+1)<<" "<<V(i,j+1)<<"\n";
+    }
+}
+
+int check_mesh_structure(Structure &structure,int N,double D,std::function<int(double,double,double)> const &expected)
+{
+    Grid3<unsigned int> matgrid;
+    
+    auto t_start=std::chrono::high_resolution_clock::now();
+    
+    structure.discretize(matgrid,N,N,N,D,D,D);
+    
+    double time_span=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+    
+    std::cout<<"    "<<N*N*N<<" voxels: "<<time_span<<" s\n";
+    
+    int N_mismatch=0;
+    
+    for(int i=0;i<N;i++)
+    for(int j=0;j<N;j++)
+    for(int k=0;k<N;k++)
+    {
+        unsigned int mat=matgrid(i,j,k);
+        
+        if(mat!=static_cast<unsigned int>(structure.index(i*D,j*D,k*D))) N_mismatch++;
+        
+        int mat_expected=expected(i*D,j*D,k*D);
+        
+        if(mat_expected>=0 && mat!=static_cast<unsigned int>(mat_expected)) N_mismatch++;
+    }
+    
+    return N_mismatch;
+}
+
+int structure_mesh(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"structure_mesh";
+    std::filesystem::create_directories(base);
+    
+    int N=61;
+    double D=5e-9;
+    
+    int N_mismatch=0;
+    
+    // Cube
+    
+    write_mesh_cube(base/"cube.obj",40,160);
+    
+    Structure cube;
+    cube.add_operation(new Add_Mesh(0,0,0,1e-9,base/"cube.obj",1));
+    
+    std::cout<<"Cube:\n";
+    
+    N_mismatch+=check_mesh_structure(cube,N,D,[](double x,double y,double z)
+    {
+        double a=40e-9,b=160e-9,eps=1e-12;
+        
+        if(   std::abs(x-a)<eps || std::abs(x-b)<eps
+           || y<a+eps || y>b-eps || z<a+eps || z>b-eps) return -1;
+        
+        if(x<a || x>b) return 0;
+        
+        return 1;
+    });
+    
+    cube.finalize();
+    
+    // Sphere
+    
+    write_mesh_sphere(base/"sphere.obj",150,150,150,100,48,96);
+    
+    Structure sphere;
+    sphere.add_operation(new Add_Mesh(0,0,0,1e-9,base/"sphere.obj",1));
+    
+    std::cout<<"Sphere:\n";
+    
+    N_mismatch+=check_mesh_structure(sphere,N,D,[](double x,double y,double z)
+    {
+        double r2=(x-150e-9)*(x-150e-9)+(y-150e-9)*(y-150e-9)+(z-150e-9)*(z-150e-9);
+        
+        if(r2<=95e-9*95e-9) return 1;
+        if(r2>101e-9*101e-9) return 0;
+        
+        return -1;
+    });
+    
+    sphere.finalize();
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Mesh voxelization mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <structure.h>
+
+#include <chrono>
+#include <iostream>
+
+// Discretizes a stack of overlapping primitives, with and without the
+// periodic and flip modifiers, and checks every voxel against
+// Structure::index()
+
+void fill_rasterizer_structure(Structure &structure)
+{
+    structure.set_default_material(1);
+    
+    structure.add_operation(new Add_Layer(2,0,60e-9,2));
+    structure.add_operation(new Add_Block(20e-9,180e-9,30e-9,250e-9,40e-9,140e-9,3));
+    structure.add_operation(new Add_Sphere(150e-9,150e-9,150e-9,90e-9,4));
+    structure.add_operation(new Add_Ellipsoid(80e-9,220e-9,200e-9,70e-9,40e-9,55e-9,5));
+    structure.add_operation(new Add_Cylinder(10e-9,40e-9,30e-9,260e-9,190e-9,270e-9,35e-9,6));
+    structure.add_operation(new Add_Cone(280e-9,20e-9,120e-9,60e-9,260e-9,280e-9,60e-9,7));
+    structure.add_operation(new Add_Cylinder(0,100e-9,100e-9,300e-9,100e-9,100e-9,25e-9,8));
+    structure.add_operation(new Add_Vect_Block(200e-9,10e-9,20e-9,
+                                               80e-9,30e-9,10e-9,
+                                               -20e-9,90e-9,30e-9,
+                                               15e-9,-10e-9,120e-9,9));
+    structure.add_operation(new Add_Vect_Tri(40e-9,180e-9,220e-9,
+                                             120e-9,-20e-9,20e-9,
+                                             10e-9,70e-9,-30e-9,
+                                             -10e-9,20e-9,60e-9,0.3,10));
+    structure.add_operation(new Add_Layer(0,270e-9,285e-9,11));
+}
+
+int structure_rasterizer(int argc,char *argv[])
+{
+    int Nx=97,Ny=83,Nz=71;
+    double Dx=300e-9/(Nx-1),Dy=300e-9/(Ny-1),Dz=300e-9/(Nz-1);
+    
+    int N_mismatch=0;
+    
+    for(int config=0;config<3;config++)
+    {
+        Structure structure;
+        fill_rasterizer_structure(structure);
+        
+        if(config>=1) structure.set_loop(1,1,0);
+        if(config>=2) structure.set_flip(1,0,1);
+        
+        Grid3<unsigned int> matgrid;
+        
+        auto t_start=std::chrono::high_resolution_clock::now();
+        
+        structure.discretize(matgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+        
+        double time_span=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        t_start=std::chrono::high_resolution_clock::now();
+        
+        for(int i=0;i<Nx;i++)
+        for(int j=0;j<Ny;j++)
+        for(int k=0;k<Nz;k++)
+        {
+            if(matgrid(i,j,k)!=static_cast<unsigned int>(structure.index(i*Dx,j*Dy,k*Dz)))
+                N_mismatch++;
+        }
+        
+        double time_voxel=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        std::cout<<"Configuration "<<config<<":\n";
+        std::cout<<"    spans: "<<time_span<<" s\n";
+        std::cout<<"    voxels: "<<time_voxel<<" s\n";
+        
+        structure.finalize();
+    }
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Rasterizer mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <structure.h>
+
+#include <iostream>
+
+// Subpixel smoothing of a sphere: the fill fractions of the Ex cells have to
+// give back its volume much better than the staircase, and the normals of the
+// mixed cells have to follow the radial direction at the field positions
+
+int structure_subpixel(int argc,char *argv[])
+{
+    int N=40;
+    double D=5e-9;
+    double x0=101e-9,y0=98e-9,z0=103e-9,r=57.3e-9;
+    
+    Structure structure;
+    structure.add_operation(new Add_Sphere(x0,y0,z0,r,1));
+    
+    Grid3<unsigned int> matgrid;
+    structure.discretize(matgrid,N,N,N,D,D,D);
+    
+    double exact=4.0/3.0*Pi*r*r*r/(D*D*D);
+    double staircase=0;
+    
+    for(int i=0;i<N;i++) for(int j=0;j<N;j++) for(int k=0;k<N;k++)
+        if(matgrid(i,j,k)==1) staircase++;
+    
+    std::vector<Subpixel_Mix> mixes;
+    structure.subpixel_smoothing(matgrid,mixes,{true,true},D,D,D,4);
+    
+    if(mixes.empty() || mixes[0].index!=2)
+    {
+        std::cout<<"No mixes\n";
+        return 1;
+    }
+    
+    double smoothed=0;
+    double normal_error=0;
+    int N_mixed=0,N_cells=0;
+    
+    for(int i=0;i<N;i++) for(int j=0;j<N;j++) for(int k=0;k<N;k++)
+    {
+        unsigned int M=matgrid(i,j,k);
+        
+        if(M==1) smoothed++;
+        else if(M>=2)
+        {
+            Subpixel_Mix const &mix=mixes[M-2];
+            
+            if(mix.mat_1!=0 || mix.mat_2!=1)
+            {
+                std::cout<<"Wrong materials in mix "<<M<<"\n";
+                return 1;
+            }
+            
+            smoothed+=1.0-mix.fill[0];
+            N_mixed++;
+            
+            for(int dir=0;dir<3;dir++)
+            {
+                if(mix.fill[dir]==0 || mix.fill[dir]==1) continue;
+                
+                Vector3 u((i+0.5*(dir==0))*D-x0,
+                          (j+0.5*(dir==1))*D-y0,
+                          (k+0.5*(dir==2))*D-z0);
+                u.normalize();
+                
+                double u_dir=dir==0 ? u.x : (dir==1 ? u.y : u.z);
+                
+                normal_error+=std::abs(mix.n2[dir]-u_dir*u_dir);
+                N_cells++;
+            }
+        }
+    }
+    
+    double staircase_error=std::abs(staircase/exact-1.0);
+    double smoothed_error=std::abs(smoothed/exact-1.0);
+    
+    normal_error/=N_cells;
+    
+    std::cout<<"Volume error, staircase: "<<staircase_error<<" smoothed: "<<smoothed_error<<"\n";
+    std::cout<<N_mixed<<" mixed voxels, "<<mixes.size()<<" mixes, mean normal error: "<<normal_error<<"\n";
+    
+    if(smoothed_error>2e-3 || smoothed_error>staircase_error/3.0 || normal_error>0.1)
+    {
+        std::cout<<"Smoothing too far from the sphere\n";
+        return 1;
+    }
+    
+    // Limits of the effective permittivity
+    
+    Subpixel_Mix mix;
+    mix.fill[0]=mix.fill[1]=mix.fill[2]=0.5;
+    mix.n2[0]=1.0;
+    mix.n2[1]=mix.n2[2]=0;
+    
+    double eps_x=mix.effective_eps(1.0,4.0,0).real();
+    double eps_y=mix.effective_eps(1.0,4.0,1).real();
+    double eps_z=mix.effective_eps(1.0,4.0,2).real();
+    
+    if(std::abs(eps_x-1.6)>1e-12 || std::abs(eps_y-2.5)>1e-12 || std::abs(eps_z-2.5)>1e-12)
+    {
+        std::cout<<"Wrong effective permittivity: "<<eps_x<<" "<<eps_y<<" "<<eps_z<<"\n";
+        return 1;
+    }
+    
+    // Nothing to do without a second smoothable material
+    
+    structure.discretize(matgrid,N,N,N,D,D,D);
+    structure.subpixel_smoothing(matgrid,mixes,{true,false},D,D,D,4);
+    
+    if(!mixes.empty() || matgrid.max()!=1)
+    {
+        std::cout<<"Smoothing of a non smoothable material\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <structure.h>
+
+#include <fstream>
+#include <iostream>
+
+// Moves one sphere of a script stack between two discretizations, through a
+// parameter of the script. The incremental update has to give the same grid
+// as a full discretization, including under a conformal coating on the delta
+// lattice, list exactly the nodes that changed whatever the caller did with
+// its copy of the grid, and fall back when the grid changes or with a
+// directional coating
+
+namespace
+{
+    std::string update_script(std::string const &coating)
+    {
+        return "declare_parameter(\"x_sphere\",150e-9)\n"
+               "lx=300e-9\n"
+               "ly=300e-9\n"
+               "lz=300e-9\n"
+               "default_material(1)\n"
+               "add_layer(\"Z\",0,60e-9,2)\n"
+               "add_block(20e-9,180e-9,30e-9,250e-9,40e-9,140e-9,3)\n"
+               "add_sphere(x_sphere,150e-9,150e-9,90e-9,4)\n"
+               +coating+
+               "add_cylinder(10e-9,40e-9,30e-9,260e-9,190e-9,270e-9,35e-9,5)\n"
+               "add_layer(\"Z\",270e-9,285e-9,6)\n"
+               "loop(1,1,0)\n";
+    }
+    
+    void set_update_parameter(Structure &structure,double x_sphere)
+    {
+        structure.parameter_name.assign(1,"x_sphere");
+        structure.parameter_value.assign(1,x_sphere);
+        structure.finalize();
+    }
+    
+    // Mismatches with a full discretization, and nodes that changed from previous
+    // but are not listed in changed
+    
+    int update_mismatch(std::filesystem::path const &script,double x_sphere,
+                        Grid3<unsigned int> const &matgrid,Grid3<unsigned int> const &previous,
+                        std::vector<int> const &changed,double D)
+    {
+        int N=matgrid.L1();
+        
+        Structure full(script);
+        set_update_parameter(full,x_sphere);
+        
+        Grid3<unsigned int> reference;
+        full.discretize(reference,N,N,N,D,D,D);
+        
+        std::vector<int> expected;
+        int N_mismatch=0;
+        
+        for(int k=0;k<N;k++) for(int j=0;j<N;j++) for(int i=0;i<N;i++)
+        {
+            if(matgrid(i,j,k)!=reference(i,j,k)) N_mismatch++;
+            if(previous(i,j,k)!=reference(i,j,k)) expected.push_back(i+N*(j+N*k));
+        }
+        
+        std::cout<<changed.size()<<" nodes changed, "<<N_mismatch<<" mismatches\n";
+        
+        if(changed!=expected || changed.empty()) N_mismatch++;
+        
+        return N_mismatch;
+    }
+}
+
+int structure_update(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"structure_update";
+    std::filesystem::create_directories(base);
+    
+    std::ofstream(base/"plain.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<update_script("");
+    
+    std::ofstream(base/"conformal.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<update_script("add_conformal_coating(15e-9,5e-9,1,7)\n");
+    
+    std::ofstream(base/"directional.lua",std::ios::out|std::ios::trunc|std::ios::binary)
+        <<update_script("add_coating(30,20,20e-9,5e-9,1,7)\n");
+    
+    int N=60;
+    double D=5e-9;
+    
+    for(std::string const &name : {"plain","conformal","directional"})
+    {
+        std::filesystem::path script=base/(name+".lua");
+        
+        Structure structure(script);
+        set_update_parameter(structure,150e-9);
+        
+        Grid3<unsigned int> matgrid;
+        std::vector<int> changed;
+        
+        if(structure.update_discretization(matgrid,changed,N,N,N,D,D,D) || static_cast<int>(changed.size())!=N*N*N)
+        {
+            std::cout<<name<<": first update not a full discretization\n";
+            return 1;
+        }
+        
+        Grid3<unsigned int> previous(matgrid);
+        
+        // The caller smooths its copy, which the next update ignores
+        
+        std::vector<Subpixel_Mix> mixes;
+        structure.subpixel_smoothing(matgrid,mixes,std::vector<bool>(8,true),D,D,D,2);
+        
+        // Sweep step
+        
+        set_update_parameter(structure,200e-9);
+        
+        bool incremental=structure.update_discretization(matgrid,changed,N,N,N,D,D,D);
+        
+        std::cout<<name<<": ";
+        
+        if(update_mismatch(script,200e-9,matgrid,previous,changed,D)>0)
+        {
+            std::cout<<"Update mismatch\n";
+            return 1;
+        }
+        
+        if(incremental!=(name!="directional"))
+        {
+            std::cout<<"Unexpected "<<(incremental ? "incremental update\n" : "fallback\n");
+            return 1;
+        }
+        
+        // Nothing to do without a new stack
+        
+        if(!structure.update_discretization(matgrid,changed,N,N,N,D,D,D) || !changed.empty())
+        {
+            std::cout<<"Spurious update\n";
+            return 1;
+        }
+        
+        // Different grid, full discretization
+        
+        set_update_parameter(structure,200e-9);
+        
+        if(structure.update_discretization(matgrid,changed,N,N,N+1,D,D,D) || matgrid.L3()!=N+1)
+        {
+            std::cout<<"Missing fallback\n";
+            return 1;
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <material.h>
+#include <phys_tools.h>
+
+#include <thread>
+
+// Checks the tabulated permittivity of a dispersive material against its model
+// over the declared band, from several threads, and the cache invalidation,
+// through the interface and after direct edits of the model
+
+bool dispersion_cache_accuracy()
+{
+    double tol=1e-6;
+    double lambda_min=400e-9,lambda_max=1000e-9;
+    
+    Material mat;
+    
+    mat.eps_inf=2.1;
+    mat.drude.resize(1);
+    mat.drude[0].set(1.3e16,1e14);
+    mat.lorentz.resize(1);
+    mat.lorentz[0].set(1.5,m_to_rad_Hz(450e-9),2e14);
+    
+    mat.set_dispersion_cache(lambda_min,lambda_max,tol);
+    
+    int Nthr=4,Nl=2001;
+    std::vector<double> err_max(Nthr,0);
+    std::vector<std::thread> tsk;
+    
+    for(int t=0;t<Nthr;t++) tsk.emplace_back([&,t]()
+    {
+        for(int i=t;i<Nl;i+=Nthr)
+        {
+            double w=m_to_rad_Hz(lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0)+0.37e-9);
+            if(!mat.disp_cache->covers(w)) continue;
+            
+            Imdouble eps_ref=mat.get_eps_model(w);
+            
+            err_max[t]=std::max(err_max[t],std::abs(mat.get_eps(w)-eps_ref)/(1.0+std::abs(eps_ref)));
+        }
+    });
+    
+    for(int t=0;t<Nthr;t++) tsk[t].join();
+    
+    double err=*std::max_element(err_max.begin(),err_max.end());
+    
+    std::cout<<"Table size: "<<mat.disp_cache->size()<<", max error: "<<err<<"\n";
+    
+    // Linear interpolation error peaks at the midpoints, where the table is checked
+    if(err>2.0*tol) return false;
+    
+    // Copies share the table, edits through the interface rebuild it
+    
+    Material mat_copy(mat);
+    if(mat_copy.disp_cache!=mat.disp_cache) return false;
+    
+    mat_copy.reset();
+    mat_copy.set_const_n(1.5);
+    
+    double w=m_to_rad_Hz(600e-9);
+    if(std::abs(mat_copy.get_eps(w)-2.25)>1e-12) return false;
+    if(std::abs(mat.get_eps(w)-mat.get_eps_model(w))>tol*(1.0+std::abs(mat.get_eps(w)))) return false;
+    
+    // Outside of the band, the model is evaluated
+    
+    w=m_to_rad_Hz(1500e-9);
+    if(mat.get_eps(w)!=mat.get_eps_model(w)) return false;
+    
+    // Edits of the public members are caught by a refresh, the other copies
+    // keep the table that still describes them
+    
+    Material mat_edit(mat);
+    
+    mat_edit.eps_inf=3.4;
+    mat_edit.refresh_dispersion_cache();
+    
+    if(mat_edit.disp_cache==mat.disp_cache) return false;
+    
+    w=m_to_rad_Hz(600e-9);
+    Imdouble eps_edit=mat_edit.get_eps_model(w);
+    
+    if(std::abs(mat_edit.get_eps(w)-eps_edit)>tol*(1.0+std::abs(eps_edit))) return false;
+    
+    std::shared_ptr<DispersionCache> cache=mat.disp_cache;
+    
+    mat.refresh_dispersion_cache();
+    if(mat.disp_cache!=cache) return false;
+    
+    return true;
+}
+
+int material_dispersion_cache(int argc,char *argv[])
+{
+    return !dispersion_cache_accuracy();
+}
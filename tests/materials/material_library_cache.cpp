@@ -0,0 +1,220 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <filehdl.h>
+#include <lua_material.h>
+#include <phys_tools.h>
+
+#include <fstream>
+
+// Round trip of a material through the binary cache format, the rejection of
+// stale or damaged files, the sharing of a library material between two
+// loads of the same script, the scripts kept out of the binary cache, and
+// loaders with replaced functions
+
+namespace
+{
+    template<lua_material::Mode mode>
+    int replaced_name(lua_State *L)
+    {
+        lua_material::get_mat_pointer<mode>(L)->name="replaced";
+        
+        return 0;
+    }
+    
+    class ReplacingLoader : public lua_material::Loader
+    {
+        public:
+            ReplacingLoader()
+            {
+                replace_functions("name",replaced_name<lua_material::Mode::LIVE>,
+                                         replaced_name<lua_material::Mode::SCRIPT>);
+            }
+    };
+    
+    void write_script(std::filesystem::path const &fname,std::string const &content)
+    {
+        std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+        file<<content;
+    }
+    
+    int count_cache_files(std::filesystem::path const &dir)
+    {
+        if(!std::filesystem::exists(dir)) return 0;
+        
+        int N=0;
+        for(auto const &entry : std::filesystem::directory_iterator(dir))
+            if(entry.path().extension()==".bin") N++;
+        
+        return N;
+    }
+}
+
+int material_library_cache(int argc,char *argv[])
+{
+    Material mat;
+    
+    mat.eps_inf=2.1;
+    mat.lambda_valid_min=300e-9;
+    mat.lambda_valid_max=1200e-9;
+    
+    mat.debye.resize(1);
+    mat.debye[0].set(0.5,1e-15);
+    mat.drude.resize(1);
+    mat.drude[0].set(1.3e16,1e14);
+    mat.lorentz.resize(1);
+    mat.lorentz[0].set(1.5,m_to_rad_Hz(450e-9),2e14);
+    mat.critpoint.resize(1);
+    mat.critpoint[0].set(-1.4,6.7e15,2.6,3.6e15);
+    
+    mat.cauchy_coeffs.push_back({1.5,4e-15});
+    mat.sellmeier_B={0.69,0.41};
+    mat.sellmeier_C={4.7e-15,1.35e-14};
+    
+    std::vector<double> lambda,data_r,data_i;
+    
+    for(int i=0;i<50;i++)
+    {
+        lambda.push_back(300e-9+i*20e-9);
+        data_r.push_back(1.5+0.1*std::cos(i/5.0));
+        data_i.push_back(0.01*i);
+    }
+    
+    mat.add_spline_data(lambda,data_r,data_i,true);
+    
+    mat.name="Test material";
+    mat.description="Every model at once\nwith a second line";
+    
+    std::vector<std::string> functions={"add_lorentz","name"},functions_read;
+    
+    std::filesystem::path fname=std::filesystem::temp_directory_path()/"material_library_cache.bin";
+    
+    if(!lua_material::Cache::write(fname,1986,mat,functions))
+    {
+        std::cout<<"Could not write the cache file\n";
+        return 1;
+    }
+    
+    Material mat_read;
+    
+    if(   !lua_material::Cache::read(fname,1986,mat_read,functions_read) || mat_read!=mat
+       || functions_read!=functions
+       || mat_read.name!=mat.name || mat_read.description!=mat.description
+       || mat_read.lambda_valid_min!=mat.lambda_valid_min || mat_read.lambda_valid_max!=mat.lambda_valid_max)
+    {
+        std::cout<<"Cache round trip mismatch\n";
+        return 1;
+    }
+    
+    for(double l=350e-9;l<1100e-9;l+=50e-9)
+    {
+        double w=m_to_rad_Hz(l);
+        
+        if(mat_read.get_eps(w)!=mat.get_eps(w))
+        {
+            std::cout<<"Permittivity mismatch at "<<l<<"\n";
+            return 1;
+        }
+    }
+    
+    if(lua_material::Cache::read(fname,1987,mat_read,functions_read))
+    {
+        std::cout<<"Stale cache file accepted\n";
+        return 1;
+    }
+    
+    std::filesystem::resize_file(fname,std::filesystem::file_size(fname)-10);
+    
+    if(lua_material::Cache::read(fname,1986,mat_read,functions_read))
+    {
+        std::cout<<"Truncated cache file accepted\n";
+        return 1;
+    }
+    
+    std::filesystem::remove(fname);
+    
+    // Library material
+    
+    std::filesystem::path script=std::filesystem::path(__FILE__).parent_path()/".."/".."/"mat_lib"/"Ag_Dolling.lua";
+    
+    if(std::filesystem::exists(script))
+    {
+        lua_material::Cache::clear();
+        
+        Material mat_1,mat_2;
+        lua_material::Loader loader;
+        
+        loader.load(&mat_1,script);
+        loader.load(&mat_2,script);
+        
+        if(lua_material::Cache::size()!=1 || mat_1!=mat_2 || mat_2.script_path!=script)
+        {
+            std::cout<<"Library material not shared\n";
+            return 1;
+        }
+    }
+    
+    // Scripts reading files from Lua
+    
+    std::filesystem::path dir=std::filesystem::temp_directory_path()/"material_library_cache";
+    std::filesystem::path user_profile_path=PathManager::user_profile_path;
+    
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    
+    PathManager::user_profile_path=dir/"profile";
+    std::filesystem::path cache_dir=PathManager::to_userprofile_path("materials_cache");
+    
+    write_script(dir/"index.txt","2.5\n");
+    write_script(dir/"plain.lua","refractive_index(1.5)\nname(\"plain\")\n");
+    write_script(dir/"reader.lua","local f=io.open(\""+(dir/"index.txt").generic_string()+"\",\"r\")\n"
+                                  "refractive_index(f:read(\"n\"))\nf:close()\n");
+    
+    lua_material::Cache::clear();
+    
+    Material mat_plain,mat_reader;
+    lua_material::Loader loader;
+    
+    loader.load(&mat_plain,dir/"plain.lua");
+    loader.load(&mat_reader,dir/"reader.lua");
+    
+    int N_files=count_cache_files(cache_dir);
+    
+    if(   std::real(mat_plain.get_n(m_to_rad_Hz(500e-9)))!=1.5
+       || std::real(mat_reader.get_n(m_to_rad_Hz(500e-9)))!=2.5 || N_files!=1)
+    {
+        std::cout<<"Scripts reading files cached on disk: "<<N_files<<" files\n";
+        return 1;
+    }
+    
+    // Loaders with replaced functions only run the scripts calling them
+    
+    Material mat_replaced_plain,mat_replaced_reader;
+    ReplacingLoader replacing_loader;
+    
+    replacing_loader.load(&mat_replaced_plain,dir/"plain.lua");
+    replacing_loader.load(&mat_replaced_reader,dir/"reader.lua");
+    
+    if(   mat_replaced_plain.name!="replaced" || mat_plain.name!="plain"
+       || mat_replaced_reader!=mat_reader || lua_material::Cache::size()!=2)
+    {
+        std::cout<<"Replaced functions ignored\n";
+        return 1;
+    }
+    
+    PathManager::user_profile_path=user_profile_path;
+    std::filesystem::remove_all(dir);
+    
+    return 0;
+}
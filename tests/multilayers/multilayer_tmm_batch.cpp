@@ -0,0 +1,97 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <multilayers.h>
+#include <phys_tools.h>
+
+#include <chrono>
+
+extern const Imdouble Im;
+
+// Computes a wavelength x angle map of an absorbing stack with both the
+// scalar and the batched transfer matrices and checks that they match exactly
+
+bool tmm_batch_agreement(bool use_materials)
+{
+    int l,n;
+    int Nl=5;
+    
+    Multilayer_TMM mlt(Nl);
+    
+    Material mat_sup,mat_sub;
+    mat_sup.set_const_n(1.0);
+    mat_sub.set_const_n(1.52);
+    
+    mlt.set_environment(1.0,1.52);
+    mlt.set_environment(mat_sup,mat_sub);
+    
+    for(l=0;l<Nl;l++)
+    {
+        Imdouble n_l=1.4+0.3*l+0.05*l*Im;
+        
+        Material mat;
+        mat.set_const_n(n_l.real());
+        
+        mlt.set_layer(l,(40+17*l)*1e-9,mat);
+        mlt.set_layer(l,(40+17*l)*1e-9,n_l);
+    }
+    
+    if(use_materials) for(l=0;l<Nl;l++) mlt.index_layer[l]=mlt.index_layer[l].real();
+    
+    std::vector<double> lambda;
+    std::vector<AngleRad> angle;
+    
+    for(int i=0;i<101;i++) for(int j=0;j<37;j++)
+    {
+        lambda.push_back(400e-9+4e-9*i);
+        angle.push_back(Degree(2.5*j));
+    }
+    
+    auto t_start=std::chrono::high_resolution_clock::now();
+    
+    std::vector<Imdouble> r_TE,r_TM,t_TE,t_TM;
+    mlt.compute_batch(lambda,angle,r_TE,r_TM,t_TE,t_TM,use_materials);
+    
+    auto t_batch=std::chrono::high_resolution_clock::now();
+    
+    bool match=true;
+    
+    for(n=0;n<static_cast<int>(lambda.size());n++)
+    {
+        Imdouble r_TE_s,r_TM_s,t_TE_s,t_TM_s;
+        
+        if(use_materials) mlt.set_lambda_full(lambda[n]);
+        else mlt.set_lambda(lambda[n]);
+        
+        mlt.set_angle(angle[n]);
+        mlt.compute(r_TE_s,r_TM_s,t_TE_s,t_TM_s);
+        
+        if(r_TE_s!=r_TE[n] || r_TM_s!=r_TM[n] ||
+           t_TE_s!=t_TE[n] || t_TM_s!=t_TM[n]) match=false;
+    }
+    
+    auto t_scalar=std::chrono::high_resolution_clock::now();
+    
+    std::cout<<"Batched: "<<std::chrono::duration<double>(t_batch-t_start).count()<<" s\n";
+    std::cout<<"Scalar:  "<<std::chrono::duration<double>(t_scalar-t_batch).count()<<" s\n";
+    
+    if(!match) std::cout<<"Batched TMM mismatch, use_materials="<<use_materials<<"\n";
+    
+    return match;
+}
+
+int multilayer_tmm_batch(int argc,char *argv[])
+{
+    return !(tmm_batch_agreement(false) && tmm_batch_agreement(true));
+}
@@ -0,0 +1,119 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+#include <chrono>
+
+// Bakes a multilayer IRF from both sides, including total internal reflection,
+// and checks the table lookups against the exact transfer-matrix solve
+
+int selene_irf_table(int argc,char *argv[])
+{
+    Material air,glass,low,high;
+    air.set_const_n(1.0);
+    glass.set_const_n(1.5);
+    low.set_const_n(1.38);
+    high.set_const_n(2.3);
+    
+    Sel::IRF irf;
+    irf.name="coating";
+    irf.set_type_multilayer();
+    
+    irf.ml_heights={100e-9,60e-9,500e-9};
+    irf.ml_materials={&low,&high,&low};
+    
+    double lambda_min=400e-9,lambda_max=800e-9;
+    double tolerance=1e-4;
+    
+    irf.set_bake_tolerance(tolerance);
+    
+    irf.bake(&air,&glass,false,lambda_min,lambda_max);
+    irf.bake(&glass,&air,true,lambda_min,lambda_max);
+    
+    if(irf.baked.size()!=2)
+    {
+        std::cout<<"Missing tables: "<<irf.baked.size()<<"\n";
+        return 1;
+    }
+    
+    seedp(4096);
+    
+    int N_fail=0;
+    double err_max=0;
+    
+    for(Sel::IRF_Table const &table : irf.baked)
+    {
+        std::cout<<"Table "<<table.th.size()<<" x "<<table.lambda.size()<<"\n";
+        
+        double n1=table.mat_1->get_n(0).real();
+        double n2=table.mat_2->get_n(0).real();
+        
+        int Npts=20000;
+        
+        std::vector<double> thi(Npts),lambda(Npts);
+        
+        for(int n=0;n<Npts;n++)
+        {
+            thi[n]=randp(Pi/2.0);
+            lambda[n]=randp(lambda_min,lambda_max);
+        }
+        
+        std::vector<double> R_exact(Npts),T_exact(Npts);
+        
+        auto t_start=std::chrono::high_resolution_clock::now();
+        
+        for(int n=0;n<Npts;n++)
+        {
+            double R_TE,T_TE,R_TM,T_TM;
+            irf.get_power(thi[n],lambda[n],n1,n2,table.reversed,R_TE,T_TE,R_TM,T_TM);
+            
+            R_exact[n]=(n%2==0) ? R_TE : R_TM;
+            T_exact[n]=(n%2==0) ? T_TE : T_TM;
+        }
+        
+        double time_exact=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        t_start=std::chrono::high_resolution_clock::now();
+        
+        for(int n=0;n<Npts;n++)
+        {
+            double R,T;
+            
+            if(!table.lookup(thi[n],lambda[n],n%2==0,R,T))
+            {
+                N_fail++;
+                continue;
+            }
+            
+            err_max=std::max(err_max,std::abs(R-R_exact[n]));
+            err_max=std::max(err_max,std::abs(T-T_exact[n]));
+        }
+        
+        double time_table=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        std::cout<<"    exact: "<<Npts/time_exact<<" evaluations/s\n";
+        std::cout<<"    table: "<<Npts/time_table<<" evaluations/s\n";
+    }
+    
+    std::cout<<"Maximum error: "<<err_max<<"\n";
+    
+    if(N_fail>0 || err_max>tolerance)
+    {
+        std::cout<<"Table mismatch, "<<N_fail<<" failed lookups\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+#include <fstream>
+
+// Checks the inverted Planck spectrum against the distribution, and
+// estimates the power a light sends through a small disk: the low discrepancy
+// points and the aperture have to be much closer to the exact value than the
+// pseudo-random rays, also when the aperture is not centered on the emission
+
+double disk_power(Sel::Light &light,int Nrays,std::uint64_t seed)
+{
+    seedp(seed);
+    
+    light.set_sampling_seed(seed);
+    light.reset_ray_counter();
+    light.bootstrap();
+    
+    int N_hits=0;
+    
+    for(int n=0;n<Nrays;n++)
+    {
+        Sel::SelRay ray;
+        light.get_ray(ray);
+        
+        if(ray.dir.x<=0) continue;
+        
+        double t=(1.0-ray.start.x)/ray.dir.x;
+        double y=ray.start.y+t*ray.dir.y;
+        double z=ray.start.z+t*ray.dir.z;
+        
+        if(y*y+z*z<0.01) N_hits++;
+    }
+    
+    return light.get_power()*N_hits/static_cast<double>(Nrays);
+}
+
+double rms_error(Sel::Light &light,int Nrays,double exact)
+{
+    int Nrep=16;
+    double sum=0;
+    
+    for(int k=0;k<Nrep;k++)
+    {
+        double err=disk_power(light,Nrays,1986+k)/exact-1.0;
+        sum+=err*err;
+    }
+    
+    return std::sqrt(sum/Nrep);
+}
+
+int selene_light_sampling(int argc,char *argv[])
+{
+    // Spectrum
+    
+    Sel::Light planck;
+    planck.set_spectrum_planck(300e-9,2000e-9,3000);
+    planck.bootstrap();
+    
+    int Nbins=34;
+    int Nlambda=1000000;
+    std::vector<double> histogram(Nbins,0),expected(Nbins,0);
+    
+    seedp(2024);
+    
+    for(int n=0;n<Nlambda;n++)
+    {
+        int k=(planck.compute_wavelength(randp())-300e-9)/50e-9;
+        histogram[std::clamp(k,0,Nbins-1)]++;
+    }
+    
+    double norm=0;
+    
+    for(int k=0;k<Nbins;k++)
+    {
+        for(int j=0;j<100;j++)
+            expected[k]+=planck_distribution_wavelength(300e-9+50e-9*(k+(j+0.5)/100.0),3000);
+        
+        norm+=expected[k];
+    }
+    
+    double spectrum_error=0;
+    
+    for(int k=0;k<Nbins;k++)
+    {
+        expected[k]*=Nlambda/norm;
+        
+        if(expected[k]>1000)
+            spectrum_error=std::max(spectrum_error,std::abs(histogram[k]-expected[k])/std::sqrt(expected[k]));
+    }
+    
+    std::cout<<"Planck spectrum, max deviation: "<<spectrum_error<<" sigma\n";
+    
+    if(spectrum_error>5.0)
+    {
+        std::cout<<"Planck spectrum mismatch\n";
+        return 1;
+    }
+    
+    // Spectrum file with a step, given by a repeated wavelength
+    
+    std::filesystem::path spectrum_fname=std::filesystem::temp_directory_path()/"selene_spectrum_step.txt";
+    
+    {
+        std::ofstream file(spectrum_fname,std::ios::out|std::ios::trunc);
+        file<<"400e-9 0\n500e-9 1\n500e-9 2\n600e-9 2\n600e-9 0\n";
+    }
+    
+    Sel::Light stepped;
+    stepped.set_spectrum_file(spectrum_fname.generic_string());
+    stepped.bootstrap();
+    
+    for(int n=0;n<=1000;n++)
+    {
+        double lambda=stepped.compute_wavelength(n/1000.0);
+        
+        if(!std::isfinite(lambda) || lambda<400e-9 || lambda>600e-9)
+        {
+            std::cout<<"Stepped spectrum out of range: "<<lambda<<"\n";
+            return 1;
+        }
+    }
+    
+    // Power through a disk of radius 0.1 at a distance of 1
+    
+    int Nrays=16384;
+    
+    double exact_point=(1.0-1.0/std::sqrt(1.01))/2.0;
+    double exact_lambertian=0.01/1.01;
+    
+    Sel::Light point,lambertian;
+    point.set_type(Sel::SRC_POINT);
+    lambertian.set_type(Sel::SRC_LAMBERTIAN);
+    
+    bool failed=false;
+    
+    for(Sel::Light *light : {&point,&lambertian})
+    {
+        double exact=light==&point ? exact_point : exact_lambertian;
+        
+        light->set_sampling_qmc(false);
+        light->clear_aperture();
+        double err_random=rms_error(*light,Nrays,exact);
+        
+        light->set_sampling_qmc(true);
+        double err_qmc=rms_error(*light,Nrays,exact);
+        
+        light->set_aperture(Vector3(1.0,0,0),0.1);
+        double err_aperture=rms_error(*light,Nrays,exact);
+        
+        std::cout<<(light==&point ? "Point" : "Lambertian")<<" light, relative errors:\n";
+        std::cout<<"    random: "<<err_random<<"\n";
+        std::cout<<"    qmc: "<<err_qmc<<"\n";
+        std::cout<<"    qmc and aperture: "<<err_aperture<<"\n";
+        
+        if(err_qmc>err_random/3.0 || err_aperture>err_random/10.0) failed=true;
+    }
+    
+    // Aperture around the disk but off the lambertian axis, the candidate
+    // directions are rejected with a varying probability
+    
+    lambertian.set_aperture(Vector3(1.0,0.2,0),0.35);
+    
+    Timer timer;
+    timer.tic();
+    double err_offset=rms_error(lambertian,Nrays,exact_lambertian);
+    timer.toc();
+    
+    std::cout<<"Lambertian light, offset aperture: "<<err_offset<<" in "<<timer()<<" s\n";
+    
+    if(err_offset>0.01) failed=true;
+    
+    if(failed)
+    {
+        std::cout<<"Sampling error too high\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+#include <algorithm>
+
+// Intersects a random triangle soup through the mesh hierarchy and checks
+// the closest and the complete hit lists against the brute force tests
+
+int selene_mesh_bvh(int argc,char *argv[])
+{
+    seedp(1986);
+    
+    int NFc=3000;
+    
+    std::vector<Sel::Vertex> V_arr(3*NFc);
+    std::vector<Sel::SelFace> F_arr(NFc);
+    
+    for(int i=0;i<NFc;i++)
+    {
+        Vector3 C(randp(-1.0,1.0),randp(-1.0,1.0),randp(-1.0,1.0));
+        
+        for(int j=0;j<3;j++)
+        {
+            Vector3 D(randp(-0.1,0.1),randp(-0.1,0.1),randp(-0.1,0.1));
+            V_arr[3*i+j].loc=C+D;
+        }
+        
+        F_arr[i].V1=3*i;
+        F_arr[i].V2=3*i+1;
+        F_arr[i].V3=3*i+2;
+    }
+    
+    Sel::BoundingBox bbox;
+    std::vector<Sel::SelFace> faces;
+    std::vector<std::string> face_names;
+    
+    Sel::Primitives::Mesh mesh(bbox,faces,face_names);
+    mesh.set_mesh(V_arr,F_arr);
+    
+    int N_mismatch=0;
+    
+    for(int n=0;n<5000;n++)
+    {
+        Sel::SelRay ray;
+        Vector3 dir;
+        dir.rand_sph();
+        
+        ray.set_start(Vector3(randp(-1.5,1.5),randp(-1.5,1.5),randp(-1.5,1.5)));
+        ray.set_dir(dir);
+        
+        int face_skip=(n%3==0) ? static_cast<int>(randp(NFc-1)) : -1;
+        
+        // Closest hit
+        
+        int face_ref;
+        double t_ref,u,v;
+        
+        ray_inter(V_arr,F_arr,face_skip,ray.start,ray.dir,face_ref,t_ref,u,v);
+        
+        std::vector<Sel::RayInter> inter;
+        mesh.intersect(inter,ray,0,face_skip,true);
+        
+        if(face_ref<0)
+        {
+            if(!inter.empty()) N_mismatch++;
+        }
+        else if(inter.size()!=1 || inter[0].face!=face_ref || inter[0].t!=t_ref) N_mismatch++;
+        
+        // Every hit
+        
+        std::vector<RayFaceIntersect> all_ref;
+        ray_inter(V_arr,F_arr,face_skip,ray.start,ray.dir,all_ref);
+        
+        inter.clear();
+        mesh.intersect(inter,ray,0,face_skip,false);
+        
+        std::vector<int> faces_ref,faces_bvh;
+        
+        for(RayFaceIntersect const &hit : all_ref) faces_ref.push_back(hit.ftarget);
+        for(Sel::RayInter const &hit : inter) faces_bvh.push_back(hit.face);
+        
+        std::sort(faces_ref.begin(),faces_ref.end());
+        std::sort(faces_bvh.begin(),faces_bvh.end());
+        
+        if(faces_ref!=faces_bvh) N_mismatch++;
+    }
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Mesh BVH mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+#include <selene_primitives.h>
+
+#include <chrono>
+
+// Traces random rays against the sample meshes with the packed intersection
+// kernels, checks them against the one face at a time traversal and reports
+// the throughput of both
+
+int selene_mesh_kernels(int argc,char *argv[])
+{
+    std::filesystem::path samples=std::filesystem::path(__FILE__).parent_path()/".."/".."/"samples"/"Selene";
+    
+    std::vector<std::filesystem::path> fnames;
+    
+    if(std::filesystem::exists(samples))
+    {
+        for(auto const &entry : std::filesystem::directory_iterator(samples))
+            if(entry.path().extension()==".obj") fnames.push_back(entry.path());
+    }
+    
+    if(fnames.empty())
+    {
+        std::cout<<"No sample mesh found in "<<samples<<", skipping the benchmark\n";
+        return 0;
+    }
+    
+    std::cout<<"Packed kernel: "<<Sel::Primitives::face_pack_isa()<<"\n";
+    
+    int N_mismatch=0;
+    
+    for(std::filesystem::path const &fname : fnames)
+    {
+        seedp(2024);
+        
+        std::vector<Sel::Vertex> V_arr;
+        std::vector<Sel::SelFace> F_arr;
+        
+        obj_file_load(fname,V_arr,F_arr);
+        
+        Sel::BoundingBox bbox;
+        std::vector<Sel::SelFace> faces;
+        std::vector<std::string> face_names;
+        
+        Sel::Primitives::Mesh mesh(bbox,faces,face_names);
+        mesh.set_mesh(V_arr,F_arr);
+        
+        Sel::BoundingBox const &box=mesh.bbox;
+        
+        Vector3 center(0.5*(box.xm+box.xp),0.5*(box.ym+box.yp),0.5*(box.zm+box.zp));
+        double radius=std::max({box.span_x(),box.span_y(),box.span_z()});
+        
+        int Nrays=200000;
+        
+        std::vector<Sel::SelRay> rays(Nrays);
+        
+        for(int n=0;n<Nrays;n++)
+        {
+            Vector3 start,target;
+            
+            start.rand_sph(radius);
+            target=Vector3(randp(box.xm,box.xp),randp(box.ym,box.yp),randp(box.zm,box.zp));
+            
+            rays[n].set_start(center+start);
+            rays[n].set_dir(target-center-start);
+        }
+        
+        // One face at a time, over the same hierarchy
+        
+        std::vector<Sel::BoundingBox> face_boxes(F_arr.size());
+        
+        for(std::size_t k=0;k<F_arr.size();k++)
+        {
+            Vector3 const &A=V_arr[F_arr[k].V1].loc;
+            Vector3 const &B=V_arr[F_arr[k].V2].loc;
+            Vector3 const &C=V_arr[F_arr[k].V3].loc;
+            
+            Sel::BoundingBox &fbox=face_boxes[k];
+            
+            fbox.xm=std::min({A.x,B.x,C.x}); fbox.xp=std::max({A.x,B.x,C.x});
+            fbox.ym=std::min({A.y,B.y,C.y}); fbox.yp=std::max({A.y,B.y,C.y});
+            fbox.zm=std::min({A.z,B.z,C.z}); fbox.zp=std::max({A.z,B.z,C.z});
+            
+            double pad=1e-9*std::max({fbox.span_x(),fbox.span_y(),fbox.span_z()});
+            
+            fbox.xm-=pad; fbox.xp+=pad;
+            fbox.ym-=pad; fbox.yp+=pad;
+            fbox.zm-=pad; fbox.zp+=pad;
+        }
+        
+        Sel::BVH face_bvh;
+        face_bvh.build(face_boxes,4);
+        
+        std::vector<int> face_ref(Nrays,-1);
+        std::vector<double> t_ref(Nrays,0);
+        
+        auto t_start=std::chrono::high_resolution_clock::now();
+        
+        for(int n=0;n<Nrays;n++)
+        {
+            Sel::SelRay const &ray=rays[n];
+            
+            double t_max=1e100;
+            int face_hit=-1;
+            
+            face_bvh.traverse(ray,t_max,[&](int k,double &t_max_)
+            {
+                double t,u,v;
+                
+                if(ray_inter_face(V_arr,F_arr[k],ray.start,ray.dir,t,u,v) && t>=0)
+                {
+                    if(t<t_max_ || (t==t_max_ && k<face_hit))
+                    {
+                        face_hit=k;
+                        t_max_=t;
+                    }
+                }
+            });
+            
+            face_ref[n]=face_hit;
+            t_ref[n]=t_max;
+        }
+        
+        double time_scalar=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        // Packed kernels
+        
+        std::vector<Sel::RayInter> inter;
+        int N_hits=0;
+        
+        t_start=std::chrono::high_resolution_clock::now();
+        
+        for(int n=0;n<Nrays;n++)
+        {
+            inter.clear();
+            mesh.intersect(inter,rays[n],0,-1,true);
+            
+            if(face_ref[n]<0)
+            {
+                if(!inter.empty()) N_mismatch++;
+            }
+            else
+            {
+                N_hits++;
+                if(inter.size()!=1 || inter[0].face!=face_ref[n] || inter[0].t!=t_ref[n]) N_mismatch++;
+            }
+        }
+        
+        double time_packed=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t_start).count();
+        
+        std::cout<<fname.filename().generic_string()<<": "<<F_arr.size()<<" faces, "<<N_hits<<"/"<<Nrays<<" hits\n";
+        std::cout<<"    scalar: "<<Nrays/time_scalar<<" rays/s\n";
+        std::cout<<"    packed: "<<Nrays/time_packed<<" rays/s\n";
+    }
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Packed kernel mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
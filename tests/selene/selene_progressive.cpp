@@ -0,0 +1,192 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+// A render resumed with more rays has to match a single render with the same
+// total, and a progressive render has to stop once the sensor noise is below
+// its target. With two lights the passes interleave the lights, so only the
+// set of sensor rows is compared
+
+class ProgressiveScene
+{
+    public:
+        Material air,glass;
+        Sel::IRF fresnel;
+        Sel::Object box;
+        Sel::Light light,light_2;
+        Sel::Selene selene;
+        
+        ProgressiveScene(std::filesystem::path const &directory,bool two_lights=false)
+        {
+            air.set_const_n(1.0);
+            glass.set_const_n(1.5);
+            
+            fresnel.set_type_fresnel();
+            
+            box.name="box";
+            box.set_box(0.1,0.1,0.1);
+            box.set_default_out_mat(&air);
+            box.set_default_in_mat(&glass);
+            box.set_default_irf(&fresnel);
+            box.set_sens_transp();
+            box.sens_wavelength=true;
+            box.sens_ray_obj_intersection=true;
+            box.sens_ray_obj_face=true;
+            
+            light.set_type(Sel::SRC_POINT);
+            light.set_displacement(-0.1,0.065,0);
+            light.amb_mat=&air;
+            light.set_spectrum_flat(400e-9,800e-9);
+            
+            selene.set_N_rays_disp(100);
+            selene.set_output_directory(directory);
+            selene.add_object(&box);
+            selene.add_light(&light);
+            
+            if(two_lights)
+            {
+                light_2.set_type(Sel::SRC_POINT);
+                light_2.set_displacement(0.1,-0.035,0.02);
+                light_2.set_power(0.6);
+                light_2.amb_mat=&air;
+                light_2.set_spectrum_flat(500e-9,600e-9);
+                
+                selene.add_light(&light_2);
+            }
+        }
+};
+
+std::string export_sensor(std::filesystem::path const &directory)
+{
+    Sel::SensorFile sensor_file;
+    
+    if(!sensor_file.open(directory/"box_ray_sensor")) return "";
+    
+    sensor_file.export_ascii(directory/"box_ray_sensor.txt");
+    sensor_file.close();
+    
+    std::ifstream file(directory/"box_ray_sensor.txt",std::ios::in|std::ios::binary);
+    
+    std::stringstream strm;
+    strm<<file.rdbuf();
+    
+    return strm.str();
+}
+
+std::vector<std::string> sorted_rows(std::string const &data)
+{
+    std::vector<std::string> rows;
+    
+    std::stringstream strm(data);
+    std::string row;
+    
+    while(std::getline(strm,row)) rows.push_back(row);
+    
+    std::sort(rows.begin(),rows.end());
+    
+    return rows;
+}
+
+int selene_progressive(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"selene_progressive";
+    
+    // Single render
+    
+    {
+        ProgressiveScene scene(base/"single");
+        
+        seedp(1986);
+        scene.selene.set_N_rays_total(6000);
+        scene.selene.render();
+    }
+    
+    // Same number of rays in three steps
+    
+    {
+        ProgressiveScene scene(base/"resumed");
+        
+        seedp(1986);
+        scene.selene.set_N_rays_total(2000);
+        scene.selene.render();
+        scene.selene.render_resume(1000);
+        scene.selene.render_resume(3000);
+    }
+    
+    std::string single=export_sensor(base/"single");
+    std::string resumed=export_sensor(base/"resumed");
+    
+    if(single.empty() || single!=resumed)
+    {
+        std::cout<<"Resumed render mismatch\n";
+        return 1;
+    }
+    
+    // Two lights
+    
+    {
+        ProgressiveScene scene(base/"single_2",true);
+        
+        seedp(1986);
+        scene.selene.set_N_rays_total(6000);
+        scene.selene.render();
+    }
+    
+    {
+        ProgressiveScene scene(base/"resumed_2",true);
+        
+        seedp(1986);
+        scene.selene.set_N_rays_total(2000);
+        scene.selene.render();
+        scene.selene.render_resume(1000);
+        scene.selene.render_resume(3000);
+    }
+    
+    single=export_sensor(base/"single_2");
+    resumed=export_sensor(base/"resumed_2");
+    
+    if(single.empty() || sorted_rows(single)!=sorted_rows(resumed))
+    {
+        std::cout<<"Resumed two lights render mismatch\n";
+        return 1;
+    }
+    
+    // Progressive
+    
+    ProgressiveScene scene(base/"progressive");
+    
+    double target=0.05;
+    
+    seedp(1986);
+    scene.selene.set_N_rays_total(2000);
+    scene.selene.add_noise_sensor(&scene.box,4);
+    scene.selene.render_progressive(target,1000000);
+    
+    double noise=scene.selene.get_noise();
+    
+    std::cout<<"Progressive noise: "<<noise<<"\n";
+    
+    if(noise>target)
+    {
+        std::cout<<"Progressive render stopped above its target\n";
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+// Traces random rays through a crowd of rotated boxes and spheres, the scene
+// hierarchy has to return the same nearest hit as testing every object
+
+bool nearest_hit(std::vector<Sel::Object*> const &objs,Sel::SelRay const &ray,Sel::RayInter &inter)
+{
+    std::vector<Sel::RayInter> buffer;
+    
+    for(Sel::Object *obj : objs) obj->intersect(ray,buffer);
+    
+    bool hit=false;
+    double t_min=1e100;
+    
+    for(Sel::RayInter const &itmp : buffer)
+    {
+        if(itmp.t<t_min)
+        {
+            t_min=itmp.t;
+            inter=itmp;
+            hit=true;
+        }
+    }
+    
+    return hit;
+}
+
+int selene_scene_bvh(int argc,char *argv[])
+{
+    Material air,glass;
+    air.set_const_n(1.0);
+    glass.set_const_n(1.5);
+    
+    Sel::IRF fresnel;
+    fresnel.set_type_fresnel();
+    
+    std::vector<Sel::Object*> objs;
+    
+    for(int i=0;i<6;i++) for(int j=0;j<6;j++) for(int k=0;k<3;k++)
+    {
+        Sel::Object *obj=new Sel::Object;
+        
+        if((i+j+k)%2==0) obj->set_box(0.01,0.015,0.02);
+        else obj->set_sphere(0.008);
+        
+        obj->set_displacement(0.03*i,0.03*j,0.03*k);
+        obj->set_rotation(17.0*i,11.0*j,23.0*k);
+        obj->set_default_out_mat(&air);
+        obj->set_default_in_mat(&glass);
+        obj->set_default_irf(&fresnel);
+        
+        objs.push_back(obj);
+    }
+    
+    Sel::Light light;
+    light.set_type(Sel::SRC_POINT);
+    light.set_displacement(0.075,0.075,0.03);
+    light.amb_mat=&air;
+    light.lambda_mono=500e-9;
+    
+    std::filesystem::path directory=std::filesystem::temp_directory_path()/"selene_scene_bvh";
+    
+    Sel::Selene selene;
+    selene.set_N_rays_total(10);
+    selene.set_output_directory(directory);
+    selene.add_light(&light);
+    for(Sel::Object *obj : objs) selene.add_object(obj);
+    
+    selene.render();
+    
+    seedp(1986);
+    
+    int N_mismatch=0;
+    
+    for(int n=0;n<20000;n++)
+    {
+        Vector3 start(randp(-0.05,0.2),randp(-0.05,0.2),randp(-0.05,0.12));
+        Vector3 dir;
+        dir.rand_sph();
+        
+        Sel::RayPath path;
+        path.ray.set_start(start);
+        path.ray.set_dir(dir);
+        
+        Sel::RayInter ref;
+        bool ref_hit=nearest_hit(objs,path.ray,ref);
+        
+        selene.request_raytrace(path);
+        
+        if(path.does_intersect!=ref_hit) N_mismatch++;
+        else if(ref_hit && (   path.intersection.object!=ref.object
+                            || path.intersection.face!=ref.face
+                            || path.intersection.t!=ref.t)) N_mismatch++;
+    }
+    
+    for(Sel::Object *obj : objs) delete obj;
+    std::filesystem::remove_all(directory);
+    
+    if(N_mismatch>0)
+    {
+        std::cout<<"Scene BVH mismatches: "<<N_mismatch<<"\n";
+        return 1;
+    }
+    
+    return 0;
+}
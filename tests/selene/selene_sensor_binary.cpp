@@ -0,0 +1,142 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+#include <fstream>
+#include <sstream>
+
+// Renders the same scene with binary and ASCII sensors, the ASCII export of
+// the binary file has to match the direct dump and both have to give the
+// same ray counts, whether the binary file is binned from memory or in place
+
+std::string read_sensor_file(std::filesystem::path const &fname)
+{
+    std::ifstream file(fname,std::ios::in|std::ios::binary);
+    
+    std::stringstream strm;
+    strm<<file.rdbuf();
+    
+    return strm.str();
+}
+
+void render_sensor_scene(std::filesystem::path const &directory,Sel::Object &box,bool ascii)
+{
+    Material air,glass;
+    air.set_const_n(1.0);
+    glass.set_const_n(1.5);
+    
+    Sel::IRF fresnel;
+    fresnel.set_type_fresnel();
+    
+    box.name="box";
+    box.set_box(0.1,0.1,0.1);
+    box.set_default_out_mat(&air);
+    box.set_default_in_mat(&glass);
+    box.set_default_irf(&fresnel);
+    box.set_sens_transp();
+    box.sens_wavelength=true;
+    box.sens_source=true;
+    box.sens_path=true;
+    box.sens_ray_obj_intersection=true;
+    box.sens_ray_obj_direction=true;
+    box.sens_ray_obj_face=true;
+    box.sens_ascii=ascii;
+    
+    Sel::Light light;
+    light.set_type(Sel::SRC_POINT);
+    light.set_displacement(-0.1,0.065,0);
+    light.amb_mat=&air;
+    light.set_spectrum_flat(400e-9,800e-9);
+    
+    Sel::Selene selene;
+    selene.set_N_rays_total(5000);
+    selene.set_N_rays_disp(100);
+    selene.set_output_directory(directory);
+    selene.add_object(&box);
+    selene.add_light(&light);
+    
+    seedp(1986);
+    selene.render();
+}
+
+int selene_sensor_binary(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"selene_sensor_binary";
+    
+    Sel::Object box_bin,box_ascii;
+    
+    render_sensor_scene(base/"binary",box_bin,false);
+    render_sensor_scene(base/"ascii",box_ascii,true);
+    
+    if(!Sel::SensorFile::is_binary(base/"binary"/"box_ray_sensor"))
+    {
+        std::cout<<"Missing binary sensor file\n";
+        return 1;
+    }
+    
+    Sel::SensorFile sensor_file;
+    
+    if(!sensor_file.open(base/"binary"/"box_ray_sensor") || sensor_file.get_N_rows()==0)
+    {
+        std::cout<<"Could not read the binary sensor file\n";
+        return 1;
+    }
+    
+    sensor_file.export_ascii(base/"binary"/"box_ray_sensor.txt");
+    
+    if(   read_sensor_file(base/"binary"/"box_ray_sensor.txt")
+       != read_sensor_file(base/"ascii"/"box_ray_sensor"))
+    {
+        std::cout<<"ASCII export mismatch\n";
+        return 1;
+    }
+    
+    Sel::RayCounter counter_bin,counter_ascii;
+    
+    counter_bin.set_sensor(&box_bin);
+    counter_ascii.set_sensor(&box_ascii);
+    
+    counter_bin.update();
+    counter_ascii.update();
+    
+    if(   counter_bin.compute_hit_count()!=counter_ascii.compute_hit_count()
+       || counter_bin.compute_hit_count()!=sensor_file.get_N_rows())
+    {
+        std::cout<<"Hit count mismatch: "<<counter_bin.compute_hit_count()<<" "<<counter_ascii.compute_hit_count()<<"\n";
+        return 1;
+    }
+    
+    // Binning in place from the mapped blocks matches the loaded columns
+    
+    std::vector<Grid2<double>> bins_loaded=counter_bin.bins;
+    
+    counter_bin.update_from_file();
+    
+    for(std::size_t f=0;f<bins_loaded.size();f++)
+    {
+        Grid2<double> const &bins_file=counter_bin.bins[f];
+        
+        for(int i=0;i<bins_file.L1();i++) for(int j=0;j<bins_file.L2();j++)
+        {
+            if(bins_file(i,j)!=bins_loaded[f](i,j))
+            {
+                std::cout<<"In place binning mismatch on face "<<f<<"\n";
+                return 1;
+            }
+        }
+    }
+    
+    return 0;
+}
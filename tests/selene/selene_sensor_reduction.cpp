@@ -0,0 +1,125 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+// Renders the same scene with a recording sensor and with reduction only
+// sensors on one and several threads, the bins and the spreads have to agree
+
+void render_reduction_scene(std::filesystem::path const &directory,Sel::Object &box,bool reduce,int N_threads)
+{
+    Material air,glass;
+    air.set_const_n(1.0);
+    glass.set_const_n(1.5);
+    
+    Sel::IRF fresnel;
+    fresnel.set_type_fresnel();
+    
+    box.name="box";
+    box.set_box(0.1,0.1,0.1);
+    box.set_default_out_mat(&air);
+    box.set_default_in_mat(&glass);
+    box.set_default_irf(&fresnel);
+    box.set_sens_transp();
+    box.sens_ray_obj_intersection=true;
+    box.sens_ray_obj_direction=true;
+    box.sens_ray_obj_face=true;
+    box.sens_reduce=reduce;
+    
+    Sel::Light light;
+    light.set_type(Sel::SRC_POINT);
+    light.set_displacement(-0.1,0.065,0);
+    light.amb_mat=&air;
+    light.set_spectrum_flat(400e-9,800e-9);
+    
+    Sel::Selene selene;
+    selene.set_N_threads(N_threads);
+    selene.set_N_rays_total(20000);
+    selene.set_N_rays_disp(100);
+    selene.set_output_directory(directory);
+    selene.add_object(&box);
+    selene.add_light(&light);
+    
+    seedp(1986);
+    selene.render();
+}
+
+int selene_sensor_reduction(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"selene_sensor_reduction";
+    
+    Sel::Object box_full,box_serial,box_parallel;
+    
+    render_reduction_scene(base/"full",box_full,false,1);
+    render_reduction_scene(base/"serial",box_serial,true,1);
+    render_reduction_scene(base/"parallel",box_parallel,true,3);
+    
+    Sel::RayCounter counter_full,counter_serial,counter_parallel;
+    
+    counter_full.set_sensor(&box_full);
+    counter_serial.set_sensor(&box_serial);
+    counter_parallel.set_sensor(&box_parallel);
+    
+    counter_full.update();
+    counter_serial.update();
+    counter_parallel.update();
+    
+    double N_hits=counter_full.compute_hit_count();
+    
+    if(   N_hits==0
+       || counter_serial.compute_hit_count()!=N_hits
+       || counter_parallel.compute_hit_count()!=N_hits)
+    {
+        std::cout<<"Hit count mismatch: "<<N_hits<<" "<<counter_serial.compute_hit_count()<<" "<<counter_parallel.compute_hit_count()<<"\n";
+        return 1;
+    }
+    
+    for(int i=0;i<counter_full.N_faces;i++)
+    {
+        if(   !(counter_full.bins[i]==counter_serial.bins[i])
+           || !(counter_full.bins[i]==counter_parallel.bins[i]))
+        {
+            std::cout<<"Bins mismatch on face "<<i<<"\n";
+            return 1;
+        }
+    }
+    
+    // Streaming and two pass moments only differ by rounding
+    
+    double spatial=counter_full.compute_spatial_spread();
+    double angular=counter_full.compute_angular_spread();
+    
+    if(   std::abs(counter_serial.compute_spatial_spread()-spatial)>1e-10*spatial
+       || std::abs(counter_serial.compute_angular_spread()-angular)>1e-10*angular)
+    {
+        std::cout<<"Spread mismatch: "<<spatial<<" "<<counter_serial.compute_spatial_spread()<<" "
+                 <<angular<<" "<<counter_serial.compute_angular_spread()<<"\n";
+        return 1;
+    }
+    
+    if(   counter_parallel.compute_spatial_spread()!=counter_serial.compute_spatial_spread()
+       || counter_parallel.compute_angular_spread()!=counter_serial.compute_angular_spread())
+    {
+        std::cout<<"Reductions depend on the number of threads\n";
+        return 1;
+    }
+    
+    if(!std::filesystem::exists(base/"serial"/"box_sensor_reduction.txt"))
+    {
+        std::cout<<"Missing reduction file\n";
+        return 1;
+    }
+    
+    return 0;
+}
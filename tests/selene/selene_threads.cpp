@@ -0,0 +1,112 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <selene.h>
+
+#include <fstream>
+#include <sstream>
+
+// Renders the same scene with one and several worker threads, the sensor and
+// fetcher outputs have to be identical, and the render must only draw its
+// seed from the generator of the calling thread
+
+std::string read_file(std::filesystem::path const &fname)
+{
+    std::ifstream file(fname,std::ios::in|std::ios::binary);
+    
+    std::stringstream strm;
+    strm<<file.rdbuf();
+    
+    return strm.str();
+}
+
+double render_scene(std::filesystem::path const &directory,int N_threads)
+{
+    Material air,glass;
+    air.set_const_n(1.0);
+    glass.set_const_n(1.5);
+    
+    Sel::IRF fresnel;
+    fresnel.set_type_fresnel();
+    
+    Sel::Object box;
+    box.name="box";
+    box.set_box(0.1,0.1,0.1);
+    box.set_default_out_mat(&air);
+    box.set_default_in_mat(&glass);
+    box.set_default_irf(&fresnel);
+    box.set_sens_transp();
+    box.sens_wavelength=true;
+    box.sens_path=true;
+    box.sens_generation=true;
+    box.sens_ray_world_intersection=true;
+    box.sens_ray_world_direction=true;
+    
+    Sel::Light light;
+    light.set_type(Sel::SRC_POINT);
+    light.set_displacement(-0.1,0.065,0);
+    light.amb_mat=&air;
+    light.set_spectrum_flat(400e-9,800e-9);
+    
+    Sel::Selene selene;
+    selene.set_N_threads(N_threads);
+    selene.set_N_rays_total(5000);
+    selene.set_N_rays_disp(100);
+    selene.set_output_directory(directory);
+    selene.add_object(&box);
+    selene.add_light(&light);
+    
+    seedp(1986);
+    selene.render();
+    
+    return randp();
+}
+
+int selene_threads(int argc,char *argv[])
+{
+    std::filesystem::path base=std::filesystem::temp_directory_path()/"selene_threads";
+    
+    seedp(1986);
+    randi(); randi();
+    double next_randp=randp();
+    
+    bool same=true;
+    
+    for(int N_threads : {1,3})
+    {
+        std::string directory=N_threads==1 ? "serial" : "parallel";
+        
+        if(render_scene(base/directory,N_threads)!=next_randp)
+        {
+            std::cout<<"Generator of the calling thread changed by the render with "<<N_threads<<" threads\n";
+            same=false;
+        }
+    }
+    
+    for(std::string fname : {"box_ray_sensor","selene_fetcher_0.txt"})
+    {
+        std::string serial=read_file(base/"serial"/fname);
+        std::string parallel=read_file(base/"parallel"/fname);
+        
+        if(serial.empty() || serial!=parallel)
+        {
+            std::cout<<"Thread count dependent output: "<<fname<<"\n";
+            same=false;
+        }
+    }
+    
+    std::filesystem::remove_all(base);
+    
+    return !same;
+}